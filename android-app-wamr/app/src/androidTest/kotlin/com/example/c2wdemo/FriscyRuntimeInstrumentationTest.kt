@@ -1,5 +1,6 @@
 package com.example.c2wdemo
 
+import android.util.Log
 import androidx.test.ext.junit.runners.AndroidJUnit4
 import androidx.test.platform.app.InstrumentationRegistry
 import org.junit.Assert.assertFalse
@@ -9,6 +10,7 @@ import org.junit.FixMethodOrder
 import org.junit.Test
 import org.junit.runner.RunWith
 import org.junit.runners.MethodSorters
+import java.io.ByteArrayOutputStream
 import java.util.concurrent.CountDownLatch
 import java.util.concurrent.TimeUnit
 
@@ -23,8 +25,23 @@ import java.util.concurrent.TimeUnit
 class FriscyRuntimeInstrumentationTest {
 
     companion object {
-        private val outputBuffer = StringBuilder()
+        private val outputBuffer = ByteArrayOutputStream()
         private val lock = Any()
+
+        private fun outputText(): String = synchronized(lock) { outputBuffer.toString("UTF-8") }
+
+        /** Polls the raw output for [needle] for up to [timeoutMs]. */
+        private fun awaitOutput(needle: ByteArray, timeoutMs: Long): Boolean {
+            val deadline = System.currentTimeMillis() + timeoutMs
+            while (System.currentTimeMillis() < deadline) {
+                val bytes = synchronized(lock) { outputBuffer.toByteArray() }
+                if ((0..bytes.size - needle.size).any { i ->
+                        needle.indices.all { bytes[i + it] == needle[it] }
+                    }) return true
+                Thread.sleep(200)
+            }
+            return false
+        }
     }
 
     @Test
@@ -56,9 +73,9 @@ class FriscyRuntimeInstrumentationTest {
         val tarBytes = ctx.assets.open("rootfs.tar").use { it.readBytes() }
         assertTrue("rootfs.tar should not be empty", tarBytes.isNotEmpty())
 
-        val result = FriscyRuntime.loadRootfs(tarBytes, "/bin/sh") { text ->
+        val result = FriscyRuntime.loadRootfs(tarBytes, "/bin/sh") { bytes ->
             synchronized(lock) {
-                outputBuffer.append(text)
+                outputBuffer.write(bytes)
             }
         }
         assertTrue("loadRootfs() should return true", result)
@@ -82,7 +99,7 @@ class FriscyRuntimeInstrumentationTest {
             val deadline = System.currentTimeMillis() + 15_000
             while (System.currentTimeMillis() < deadline) {
                 synchronized(lock) {
-                    if (outputBuffer.contains("hello")) {
+                    if (outputBuffer.toString("UTF-8").contains("hello")) {
                         latch.countDown()
                         return@Thread
                     }
@@ -94,15 +111,29 @@ class FriscyRuntimeInstrumentationTest {
 
         // Give the shell a moment to be ready, then send echo command
         Thread.sleep(1_000)
-        FriscyRuntime.sendInput("echo hello\n")
+        FriscyRuntime.sendInput("echo hello\n".toByteArray())
 
         val found = latch.await(16, TimeUnit.SECONDS)
         assertTrue(
-            "Expected 'hello' in output within 15s, buffer: ${synchronized(lock) { outputBuffer.toString().takeLast(200) }}",
+            "Expected 'hello' in output within 15s, buffer: ${outputText().takeLast(200)}",
             found
         )
     }
 
+    @Test
+    fun test_06b_outputKeepsNulAndInvalidUtf8() {
+        assertTrue("VM must be running for binary output test", FriscyRuntime.isRunning)
+
+        // printf writes x NUL 0xFF y; the typed command itself only holds the escapes
+        FriscyRuntime.sendInput("printf 'x\\000\\377y\\n'\n".toByteArray())
+
+        val expected = byteArrayOf('x'.code.toByte(), 0, 0xFF.toByte(), 'y'.code.toByte())
+        assertTrue(
+            "Expected raw bytes x NUL 0xFF y in output, buffer: ${outputText().takeLast(200)}",
+            awaitOutput(expected, 15_000)
+        )
+    }
+
     @Test
     fun test_07_stopDoesNotCrash() {
         FriscyRuntime.stop()
@@ -115,4 +146,14 @@ class FriscyRuntimeInstrumentationTest {
         // If we get here without a crash, the test passes
         assertFalse("isRunning should be false after destroy", FriscyRuntime.isRunning)
     }
+
+    @Test
+    fun test_09_outputThroughputBenchmark() {
+        val totalBytes = 16L shl 20
+        val result = FriscyRuntime.benchmarkOutput(totalBytes)
+        assertNotNull("benchmarkOutput() should run with no guest running", result)
+        Log.i("FriscyBenchmark", "UTF-8 output: $result")
+        assertTrue("benchmark should deliver every byte, got: $result",
+            result!!.contains("\"bytes\":$totalBytes"))
+    }
 }
@@ -0,0 +1,172 @@
+// boot_trace.hpp - Startup critical path, from rootfs load to first stdin read
+//
+// The load timings (session.hpp) stop where the guest starts running, but
+// most of a cold start is spent after that: ld-musl relocating, then the
+// program's own startup until it prints and waits for input. This records
+// the whole path as milestones, in ms since the load began:
+//   tar_ingest      rootfs tar copied in and parsed into the VFS
+//   vfs_setup       virtual /dev, /proc, /etc files added
+//   elf_load        entry binary and interpreter loaded into the arena
+//   boot_setup      heap, syscalls and initial stack ready (first instruction)
+//   entry           the program's entry point reached. For a dynamic binary
+//                   this is ld-musl's jump to AT_ENTRY, observed through the
+//                   exec cache's entry stub, so the step before it is the
+//                   interpreter's mapping and relocation.
+//   first_output    first byte written to the terminal
+//   first_stdin_read  first read of stdin: the guest is at its prompt
+// plus the first MAX_SYSCALLS syscalls the guest makes, with their times.
+//
+// Syscalls are recorded by swapping every installed handler for a wrapper
+// that looks the real one up by number (a7); the originals go back as soon
+// as enough were seen, so only startup pays for it. The trace ends at the
+// first stdin read, which logs the report; report_json() serves it to
+// nativeGetBootTrace() and the headless boot_snapshot tool.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <libriscv/machine.hpp>
+
+namespace boottrace {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+inline constexpr size_t MAX_SYSCALLS = 64;
+
+struct Mark {
+    const char* phase;      // One of the names above (string literal)
+    double at_ms;
+};
+
+struct Syscall {
+    int nr;
+    double at_ms;
+};
+
+inline std::mutex g_mutex;                  // Marks are read from the JNI thread
+inline std::atomic<bool> g_active{false};
+inline std::atomic<bool> g_output_seen{false};
+inline std::chrono::steady_clock::time_point g_started;
+inline std::vector<Mark> g_marks;
+inline std::vector<Syscall> g_syscalls;
+
+// Real handlers while the syscall wrapper is installed
+inline Machine::syscall_t g_saved[std::size(Machine::syscall_handlers)];
+inline bool g_wrapped = false;
+
+inline double elapsed_ms() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - g_started).count();
+}
+
+inline bool running() { return g_active.load(std::memory_order_relaxed); }
+
+// Begin a new trace; the previous one is discarded
+inline void start() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_started = std::chrono::steady_clock::now();
+    g_marks.clear();
+    g_syscalls.clear();
+    g_output_seen.store(false);
+    g_active.store(true);
+}
+
+// Record `phase` as reached now; only its first occurrence counts
+inline void mark(const char* phase) {
+    if (!running()) return;
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (const auto& m : g_marks) {
+        if (std::strcmp(m.phase, phase) == 0) return;
+    }
+    g_marks.push_back({phase, elapsed_ms()});
+}
+
+inline void unwrap_syscalls() {
+    if (!g_wrapped) return;
+    g_wrapped = false;
+    for (size_t i = 0; i < std::size(g_saved); i++) {
+        if (g_saved[i]) Machine::syscall_handlers[i] = g_saved[i];
+        g_saved[i] = nullptr;
+    }
+}
+
+inline void traced_syscall(Machine& m) {
+    int nr = static_cast<int>(m.cpu.reg(17));   // a7
+    auto handler = g_saved[nr];
+    bool done;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_syscalls.push_back({nr, elapsed_ms()});
+        done = g_syscalls.size() >= MAX_SYSCALLS;
+    }
+    if (done) unwrap_syscalls();
+    handler(m);
+}
+
+// Record the guest's first syscalls. Call once every handler is installed.
+inline void wrap_syscalls() {
+    if (!running() || g_wrapped) return;
+    for (size_t i = 0; i < std::size(g_saved); i++) {
+        g_saved[i] = Machine::syscall_handlers[i];
+        if (g_saved[i]) Machine::syscall_handlers[i] = traced_syscall;
+    }
+    g_wrapped = true;
+}
+
+inline void first_output() {
+    if (running() && !g_output_seen.exchange(true)) mark("first_output");
+}
+
+inline std::string report_json() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::string out = running() ? "{\"complete\":false,\"phases\":[" : "{\"complete\":true,\"phases\":[";
+    char buf[128];
+    double prev = 0;
+    for (size_t i = 0; i < g_marks.size(); i++) {
+        // "ms" is the phase's own share: time since the milestone before it
+        snprintf(buf, sizeof(buf), "%s{\"phase\":\"%s\",\"at_ms\":%.2f,\"ms\":%.2f}",
+                 i ? "," : "", g_marks[i].phase, g_marks[i].at_ms, g_marks[i].at_ms - prev);
+        out += buf;
+        prev = g_marks[i].at_ms;
+    }
+    out += "],\"syscalls\":[";
+    for (size_t i = 0; i < g_syscalls.size(); i++) {
+        snprintf(buf, sizeof(buf), "%s{\"nr\":%d,\"at_ms\":%.2f}",
+                 i ? "," : "", g_syscalls[i].nr, g_syscalls[i].at_ms);
+        out += buf;
+    }
+    out += "]}";
+    return out;
+}
+
+// The guest reads stdin for the first time: the trace is complete
+inline void first_stdin_read() {
+    if (!running()) return;
+    mark("first_stdin_read");
+    unwrap_syscalls();
+    g_active.store(false);
+
+    std::string line;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        double prev = 0;
+        char buf[64];
+        for (const auto& m : g_marks) {
+            snprintf(buf, sizeof(buf), " %s %.1f", m.phase, m.at_ms - prev);
+            line += buf;
+            prev = m.at_ms;
+        }
+    }
+    fprintf(stderr, "[boot] at prompt in %.1f ms:%s\n", elapsed_ms(), line.c_str());
+}
+
+}  // namespace boottrace
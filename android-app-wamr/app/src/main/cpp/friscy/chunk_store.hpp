@@ -0,0 +1,321 @@
+// chunk_store.hpp - Content-addressed chunk store for deduplicated snapshots
+//
+// Snapshots saved with Layout::Stored keep no chunk payloads of their own:
+// the file is a manifest (registers, index, hashes, state) and every
+// non-zero chunk lives once in a store shared by all snapshots in the same
+// directory. Ten snapshots of one image share the base pages instead of
+// storing them ten times, and "is this chunk already there?" is a stat().
+//
+// Store layout (<snapshot dir>/chunks/):
+//   <kk>/<key>    one file per unique chunk: [ChunkHeader][payload], named
+//                 by its 128-bit content key in hex (kk = first two digits)
+//   refs          RefEntry[] sorted by key: manifests referencing the chunk
+//
+// Chunk files are written to a temp name and renamed, and an existing key
+// is never rewritten, so readers never see a partial chunk. The payload
+// codec is opaque here (the snapshot codec that produced it); the header
+// carries a CRC32C of the payload that get() checks on every read.
+//
+// Reference counts are one per manifest entry. add_refs() runs once a
+// manifest is on disk; release() runs when one is deleted and removes
+// chunks whose count drops to zero. The refs file is only a cache of what
+// the manifests say: rebuild() recounts from the live manifests and sweeps
+// every unreferenced chunk, which also collects chunks written by a save
+// that failed before its manifest was committed. Callers serialize access
+// (snapshot::g_mutex).
+
+#pragma once
+
+#include "crc32c.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace chunkstore {
+
+inline constexpr uint32_t CHUNK_MAGIC = 0x4B435946;   // "FYCK"
+inline constexpr uint32_t REFS_MAGIC  = 0x46524346;   // "FCRF"
+inline constexpr uint32_t MAX_REFS = 1u << 24;        // Sanity bound on the refs file
+
+// 64-bit content hash of a chunk, four independent lanes so it runs near
+// memory bandwidth. Never returns 0 (reserved for zero chunks). A non-zero
+// seed gives an independent hash (the second half of a store key).
+inline uint64_t chunk_hash(const uint8_t* p, size_t n, uint64_t seed = 0) {
+    constexpr uint64_t K1 = 0x9E3779B97F4A7C15ULL;
+    constexpr uint64_t K2 = 0xC2B2AE3D27D4EB4FULL;
+    auto mix = [](uint64_t h, uint64_t v) {
+        h ^= v * K2;
+        h = (h << 31) | (h >> 33);
+        return h * K1;
+    };
+    uint64_t lane[4] = {K1 ^ seed, K2 ^ seed, K1 ^ n, K2 ^ n};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint64_t v[4];
+        memcpy(v, p + i, 32);
+        for (int l = 0; l < 4; l++) lane[l] = mix(lane[l], v[l]);
+    }
+    uint64_t h = mix(mix(mix(lane[0], lane[1]), lane[2]), lane[3]);
+    for (; i < n; i++) h = mix(h, p[i]);
+    h ^= h >> 29;
+    h *= K2;
+    h ^= h >> 32;
+    return h ? h : 1;
+}
+
+struct Key {
+    uint64_t hi = 0;   // chunk_hash(), as in the snapshot's HASHES section
+    uint64_t lo = 0;   // Independently seeded hash of the same bytes
+
+    bool operator==(const Key& o) const { return hi == o.hi && lo == o.lo; }
+    bool operator<(const Key& o) const { return hi != o.hi ? hi < o.hi : lo < o.lo; }
+};
+
+struct KeyHash {
+    size_t operator()(const Key& k) const { return static_cast<size_t>(k.hi ^ (k.lo * 31)); }
+};
+
+struct ChunkHeader {
+    uint32_t magic;
+    uint32_t codec;
+    uint32_t raw_size;
+    uint32_t stored_size;
+    uint32_t checksum;   // CRC32C of the payload
+    uint32_t reserved;
+};
+static_assert(sizeof(ChunkHeader) == 24, "chunk store header layout");
+
+struct RefEntry {
+    uint64_t hi;
+    uint64_t lo;
+    uint32_t count;
+    uint32_t reserved;
+};
+static_assert(sizeof(RefEntry) == 24, "chunk store ref layout");
+
+inline std::string key_hex(const Key& k) {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx",
+             (unsigned long long)k.hi, (unsigned long long)k.lo);
+    return buf;
+}
+
+inline bool parse_key(const std::string& s, Key& k) {
+    if (s.size() != 32 || s.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return false;
+    }
+    k.hi = strtoull(s.substr(0, 16).c_str(), nullptr, 16);
+    k.lo = strtoull(s.substr(16).c_str(), nullptr, 16);
+    return true;
+}
+
+struct Stats {
+    uint64_t chunks = 0;        // Chunk files on disk
+    uint64_t bytes = 0;         // Their total size
+    uint64_t references = 0;    // Sum of refcounts
+    uint64_t unreferenced = 0;  // Chunks with no reference (collectable)
+};
+
+class Store {
+public:
+    explicit Store(std::string dir) : dir_(std::move(dir)) {}
+
+    const std::string& dir() const { return dir_; }
+
+    std::string path_of(const Key& k) const {
+        std::string hex = key_hex(k);
+        return dir_ + "/" + hex.substr(0, 2) + "/" + hex;
+    }
+
+    bool contains(const Key& k) const {
+        struct stat st{};
+        return ::stat(path_of(k).c_str(), &st) == 0;
+    }
+
+    // Store a chunk under `k` unless it is already present. Sets `added`
+    // when a new file was written.
+    bool put(const Key& k, uint32_t codec, uint32_t raw_size,
+             const void* payload, uint32_t stored_size, bool& added) {
+        added = false;
+        if (contains(k)) return true;
+        std::string path = path_of(k);
+        std::string sub = path.substr(0, path.rfind('/'));
+        ::mkdir(dir_.c_str(), 0755);
+        ::mkdir(sub.c_str(), 0755);
+
+        std::string tmp = path + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if (!f) {
+            fprintf(stderr, "[chunkstore] Cannot create %s: %s\n", tmp.c_str(), strerror(errno));
+            return false;
+        }
+        ChunkHeader hdr{CHUNK_MAGIC, codec, raw_size, stored_size,
+                        crc32c::compute(payload, stored_size), 0};
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+                  (stored_size == 0 || fwrite(payload, stored_size, 1, f) == 1);
+        ok = fclose(f) == 0 && ok;
+        if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        added = true;
+        return true;
+    }
+
+    // Read the chunk stored under `k`. The header and payload checksum are
+    // validated; decoding the payload is up to the caller.
+    bool get(const Key& k, ChunkHeader& hdr, std::vector<uint8_t>& payload) const {
+        std::string path = path_of(k);
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) {
+            fprintf(stderr, "[chunkstore] Missing chunk %s\n", key_hex(k).c_str());
+            return false;
+        }
+        bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.magic == CHUNK_MAGIC;
+        if (ok) {
+            payload.resize(hdr.stored_size);
+            ok = (hdr.stored_size == 0 || fread(payload.data(), hdr.stored_size, 1, f) == 1) &&
+                 crc32c::compute(payload.data(), payload.size()) == hdr.checksum;
+        }
+        fclose(f);
+        if (!ok) fprintf(stderr, "[chunkstore] Corrupt chunk %s\n", key_hex(k).c_str());
+        return ok;
+    }
+
+    // --- Reference counts ---
+
+    // Load the refs file. Returns false when it is missing or corrupt; the
+    // counts are then empty and the caller should rebuild().
+    bool load_refs() {
+        refs_.clear();
+        FILE* f = fopen((dir_ + "/refs").c_str(), "rb");
+        if (!f) return false;
+        uint32_t head[2] = {0, 0};
+        bool ok = fread(head, sizeof(head), 1, f) == 1 && head[0] == REFS_MAGIC &&
+                  head[1] <= MAX_REFS;
+        std::vector<RefEntry> entries(ok ? head[1] : 0);
+        ok = ok && (entries.empty() ||
+                    fread(entries.data(), sizeof(RefEntry), entries.size(), f) == entries.size());
+        fclose(f);
+        if (!ok) return false;
+        for (const auto& e : entries) refs_[Key{e.hi, e.lo}] = e.count;
+        return true;
+    }
+
+    bool save_refs() const {
+        std::vector<RefEntry> entries;
+        entries.reserve(refs_.size());
+        for (const auto& [k, n] : refs_) {
+            if (n > 0) entries.push_back({k.hi, k.lo, n, 0});
+        }
+        std::sort(entries.begin(), entries.end(), [](const RefEntry& a, const RefEntry& b) {
+            return Key{a.hi, a.lo} < Key{b.hi, b.lo};
+        });
+        ::mkdir(dir_.c_str(), 0755);
+        std::string path = dir_ + "/refs";
+        std::string tmp = path + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if (!f) return false;
+        uint32_t head[2] = {REFS_MAGIC, static_cast<uint32_t>(entries.size())};
+        bool ok = fwrite(head, sizeof(head), 1, f) == 1 &&
+                  (entries.empty() ||
+                   fwrite(entries.data(), sizeof(RefEntry), entries.size(), f) == entries.size());
+        ok = fclose(f) == 0 && ok;
+        if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void add_refs(const std::vector<Key>& keys) {
+        for (const auto& k : keys) refs_[k]++;
+    }
+
+    // Drop one reference per key and delete chunks nobody references any
+    // more. Returns the number of chunks deleted.
+    uint32_t release(const std::vector<Key>& keys) {
+        uint32_t removed = 0;
+        for (const auto& k : keys) {
+            auto it = refs_.find(k);
+            if (it == refs_.end()) continue;
+            if (--it->second == 0) {
+                refs_.erase(it);
+                if (::unlink(path_of(k).c_str()) == 0) removed++;
+            }
+        }
+        return removed;
+    }
+
+    // Mark and sweep: replace the counts with those of `live` (the keys of
+    // every manifest still on disk) and delete every other chunk file,
+    // including leftover temp files. Returns the number of files deleted.
+    uint32_t rebuild(const std::vector<Key>& live) {
+        refs_.clear();
+        add_refs(live);
+        uint32_t removed = 0;
+        walk([&](const std::string& path, const std::string& name, uint64_t) {
+            Key k;
+            if (!parse_key(name, k) || refs_.find(k) == refs_.end()) {
+                if (::unlink(path.c_str()) == 0) removed++;
+            }
+        });
+        return removed;
+    }
+
+    Stats stats() const {
+        Stats s;
+        walk([&](const std::string&, const std::string& name, uint64_t size) {
+            s.chunks++;
+            s.bytes += size;
+            Key k;
+            auto it = parse_key(name, k) ? refs_.find(k) : refs_.end();
+            if (it == refs_.end()) s.unreferenced++;
+        });
+        for (const auto& [k, n] : refs_) s.references += n;
+        return s;
+    }
+
+private:
+    // fn(path, file name, size) for every file in the fan-out directories
+    template <typename Fn>
+    void walk(Fn&& fn) const {
+        DIR* top = opendir(dir_.c_str());
+        if (!top) return;
+        while (dirent* d = readdir(top)) {
+            // Only the fan-out directories ("00".."ff"; note ".." is two chars too)
+            std::string sub = d->d_name;
+            if (sub.size() != 2 || sub.find_first_not_of("0123456789abcdef") != std::string::npos) {
+                continue;
+            }
+            std::string sub_path = dir_ + "/" + sub;
+            DIR* inner = opendir(sub_path.c_str());
+            if (!inner) continue;
+            while (dirent* e = readdir(inner)) {
+                std::string name = e->d_name;
+                if (name == "." || name == "..") continue;
+                std::string path = sub_path + "/" + name;
+                struct stat st{};
+                if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+                fn(path, name, static_cast<uint64_t>(st.st_size));
+            }
+            closedir(inner);
+        }
+        closedir(top);
+    }
+
+    std::string dir_;
+    std::unordered_map<Key, uint32_t, KeyHash> refs_;
+};
+
+}  // namespace chunkstore
@@ -0,0 +1,125 @@
+// crc32c.hpp - CRC32C (Castagnoli) checksums for friscy snapshots
+//
+// Snapshot payloads and manifests are checksummed with CRC32C because
+// both Android ABIs we ship have it in hardware: the ARMv8 CRC extension
+// (every arm64 phone in practice, but optional in the ISA, so it is
+// detected through HWCAP) and SSE4.2 on x86_64. The instructions are
+// enabled per function, so the rest of the build keeps its baseline
+// target flags. Anything else falls back to a slicing-by-8 table, about
+// 1-2 GB/s against 8+ GB/s for the instructions.
+//
+// update() continues a running checksum, so a value can be built up over
+// several buffers: crc32c::update(crc32c::update(0, a, n), b, m) equals
+// crc32c::update(0, ab, n + m).
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+namespace crc32c {
+
+inline constexpr uint32_t POLY = 0x82F63B78;   // Reflected Castagnoli polynomial
+
+// table[k][b]: CRC of byte b followed by k zero bytes
+inline constexpr auto TABLES = [] {
+    std::array<std::array<uint32_t, 256>, 8> t{};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for (int i = 0; i < 8; i++) c = (c >> 1) ^ (POLY & (0u - (c & 1)));
+        t[0][b] = c;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+    }
+    return t;
+}();
+
+inline uint32_t update_sw(uint32_t crc, const uint8_t* p, size_t n) {
+    const auto& t = TABLES;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);   // Little-endian on every target we build for
+        v ^= crc;
+        crc = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^
+              t[4][(v >> 24) & 0xFF] ^ t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^
+              t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+    }
+    for (; n > 0; n--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+inline uint32_t update_hw(uint32_t crc, const uint8_t* p, size_t n) {
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    for (; n > 0; n--) c32 = _mm_crc32_u8(c32, *p++);
+    return c32;
+}
+
+inline bool hw_available() {
+    static const bool ok = __builtin_cpu_supports("sse4.2");
+    return ok;
+}
+
+#elif defined(__aarch64__)
+
+// Inline asm rather than the ACLE intrinsics: those need +crc for the whole
+// translation unit with some toolchains.
+inline uint32_t update_hw(uint32_t crc, const uint8_t* p, size_t n) {
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        asm(".arch_extension crc\n\tcrc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(v));
+    }
+    for (; n > 0; n--) {
+        uint32_t b = *p++;
+        asm(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r"(crc) : "r"(b));
+    }
+    return crc;
+}
+
+inline bool hw_available() {
+    constexpr unsigned long HWCAP_CRC32_BIT = 1ul << 7;   // asm/hwcap.h HWCAP_CRC32
+    static const bool ok = (getauxval(AT_HWCAP) & HWCAP_CRC32_BIT) != 0;
+    return ok;
+}
+
+#else
+
+inline uint32_t update_hw(uint32_t crc, const uint8_t* p, size_t n) {
+    return update_sw(crc, p, n);
+}
+
+inline bool hw_available() { return false; }
+
+#endif
+
+// Continue `crc` (0 to start) over n bytes.
+inline uint32_t update(uint32_t crc, const void* data, size_t n) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    crc = hw_available() ? update_hw(crc, p, n) : update_sw(crc, p, n);
+    return ~crc;
+}
+
+inline uint32_t compute(const void* data, size_t n) {
+    return update(0, data, n);
+}
+
+}  // namespace crc32c
@@ -0,0 +1,146 @@
+// elf_cache.hpp - Shared immutable binaries for the exec paths
+//
+// Booting and every execve need the bytes of the program and its
+// interpreter, and their parsed headers. A Blob is a snapshot of one
+// version of a VFS file: it is copied out once per (inode, generation),
+// parsed once (segments, load and writable ranges, interpreter, DT_NEEDED,
+// dynamic symbols) and then shared by reference. Two blobs hold the same
+// file version exactly when their ids are equal, so "is this the binary
+// that is already loaded" is an integer compare rather than a byte compare
+// of tens of MB.
+//
+// The VFS entry stands in for the inode. Its generation is bumped by every
+// write (vfs::VirtualFS::touch), so a rewritten file gets a new blob while
+// processes still running the old one keep theirs. Blobs are kept alive by
+// whoever runs them (g_exec_ctx) plus a small set of recently used ones, so
+// a script that execs the same tools over and over does not copy them again.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vfs.hpp"
+#include "elf_loader.hpp"
+
+namespace elfcache {
+
+inline constexpr size_t MAX_RECENT = 8;
+inline constexpr size_t MAX_RECENT_BYTES = 96ull << 20;
+
+struct Blob {
+    uint64_t id = 0;                // Never reused
+    std::string path;               // Resolved VFS path it was read from
+    std::vector<uint8_t> bytes;
+    bool is_elf = false;            // RISC-V ELF magic
+    std::string error;              // Set when is_elf but the headers are unusable
+    elf::Layout elf;                // Valid when is_elf and error is empty
+};
+
+using BlobRef = std::shared_ptr<const Blob>;
+
+struct Slot {
+    std::weak_ptr<vfs::Entry> inode;
+    uint64_t generation = 0;
+    std::weak_ptr<const Blob> blob;
+};
+
+struct Stats {
+    uint64_t hits = 0;
+    uint64_t copies = 0;
+    uint64_t bytes_copied = 0;
+};
+
+inline std::unordered_map<const vfs::Entry*, Slot> g_slots;
+inline std::vector<BlobRef> g_recent;      // Most recent last
+inline uint64_t g_next_id = 1;
+inline Stats g_stats;
+
+// When set, the distinct paths fetched are appended here, up to
+// MAX_TRACE (session.hpp records a startup profile with it)
+inline constexpr size_t MAX_TRACE = 32;
+inline std::vector<std::string>* g_trace = nullptr;
+
+inline bool has_elf_magic(const std::vector<uint8_t>& b) {
+    if (b.size() < sizeof(elf::Elf64_Ehdr)) return false;
+    const auto* ehdr = reinterpret_cast<const elf::Elf64_Ehdr*>(b.data());
+    return ehdr->e_ident[0] == 0x7f && ehdr->e_ident[1] == 'E' &&
+           ehdr->e_ident[2] == 'L' && ehdr->e_ident[3] == 'F' &&
+           ehdr->e_machine == elf::EM_RISCV;
+}
+
+// Wrap bytes that did not come from the VFS (e.g. a binary stored inline
+// in a snapshot because its file has changed since).
+inline BlobRef adopt(const std::string& path, std::vector<uint8_t> bytes) {
+    auto blob = std::make_shared<Blob>();
+    blob->id = g_next_id++;
+    blob->path = path;
+    blob->bytes = std::move(bytes);
+    blob->is_elf = has_elf_magic(blob->bytes);
+    if (blob->is_elf) {
+        try {
+            blob->elf = elf::parse_layout(blob->bytes);
+        } catch (const std::exception& e) {
+            blob->error = e.what();
+        }
+    }
+    return blob;
+}
+
+inline void keep_recent(const BlobRef& blob) {
+    std::erase(g_recent, blob);
+    g_recent.push_back(blob);
+    size_t bytes = 0;
+    for (const auto& b : g_recent) bytes += b->bytes.size();
+    while (g_recent.size() > MAX_RECENT || (g_recent.size() > 1 && bytes > MAX_RECENT_BYTES)) {
+        bytes -= g_recent.front()->bytes.size();
+        g_recent.erase(g_recent.begin());
+    }
+}
+
+// The current version of the regular file at `path` (symlinks followed),
+// or null when there is none.
+inline BlobRef get(vfs::VirtualFS& fs, const std::string& path) {
+    auto entry = fs.resolve(path);
+    if (!entry || !entry->is_file()) return nullptr;
+    if (g_trace && g_trace->size() < MAX_TRACE &&
+        std::find(g_trace->begin(), g_trace->end(), path) == g_trace->end()) {
+        g_trace->push_back(path);
+    }
+
+    auto& slot = g_slots[entry.get()];
+    if (slot.inode.lock() == entry && slot.generation == entry->generation) {
+        if (auto blob = slot.blob.lock()) {
+            g_stats.hits++;
+            keep_recent(blob);
+            return blob;
+        }
+    }
+    if (g_slots.size() > 256) {
+        std::erase_if(g_slots, [](const auto& kv) { return kv.second.blob.expired(); });
+    }
+
+    auto blob = adopt(path, entry->content);
+    g_stats.copies++;
+    g_stats.bytes_copied += blob->bytes.size();
+    g_slots[entry.get()] = {entry, entry->generation, blob};
+    keep_recent(blob);
+    return blob;
+}
+
+// Is `blob` still what the VFS has at its path?
+inline bool current(vfs::VirtualFS& fs, const BlobRef& blob) {
+    if (!blob || blob->path.empty()) return false;
+    auto entry = fs.resolve(blob->path);
+    if (!entry) return false;
+    auto it = g_slots.find(entry.get());
+    return it != g_slots.end() && it->second.inode.lock() == entry &&
+           it->second.generation == entry->generation && it->second.blob.lock() == blob;
+}
+
+}  // namespace elfcache
@@ -10,13 +10,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <string>
 #include <vector>
 #include <optional>
 #include <stdexcept>
+#include <string_view>
 #include <libriscv/machine.hpp>
+#include "page_attrs.hpp"
 
 namespace elf {
 
@@ -67,6 +70,29 @@ constexpr uint32_t PF_R = 4;
 
 constexpr uint16_t EM_RISCV = 0xF3;
 
+// Dynamic section tags
+constexpr uint64_t DT_NULL     = 0;
+constexpr uint64_t DT_NEEDED   = 1;
+constexpr uint64_t DT_HASH     = 4;
+constexpr uint64_t DT_STRTAB   = 5;
+constexpr uint64_t DT_SYMTAB   = 6;
+constexpr uint64_t DT_STRSZ    = 10;
+constexpr uint64_t DT_GNU_HASH = 0x6ffffef5;
+
+struct Elf64_Dyn {
+    int64_t  d_tag;
+    uint64_t d_val;
+};
+
+struct Elf64_Sym {
+    uint32_t st_name;
+    uint8_t  st_info;
+    uint8_t  st_other;
+    uint16_t st_shndx;
+    uint64_t st_value;
+    uint64_t st_size;
+};
+
 // Auxiliary vector types (for dynamic linker)
 constexpr uint64_t AT_NULL         = 0;
 constexpr uint64_t AT_IGNORE       = 1;
@@ -239,6 +265,141 @@ inline std::pair<uint64_t, uint64_t> get_load_range(const std::vector<uint8_t>&
     return {lo, hi};
 }
 
+// A PT_LOAD segment, at its link-time address
+struct Segment {
+    uint64_t vaddr, filesz, memsz, offset;
+    uint32_t flags;
+};
+
+// A defined dynamic symbol. name points into the ELF bytes, which must
+// outlive it.
+struct DynSym {
+    std::string_view name;
+    uint64_t value;
+    uint64_t size;
+    uint8_t info;
+};
+
+// Everything the loaders need from an ELF, so the program headers are
+// walked once per binary rather than once per question.
+struct Layout {
+    ElfInfo info;
+    std::vector<Segment> loads;
+    std::pair<uint64_t, uint64_t> load_range{UINT64_MAX, 0};      // As get_load_range()
+    std::pair<uint64_t, uint64_t> writable_range{UINT64_MAX, 0};  // As get_writable_range()
+    std::vector<std::string_view> needed;   // DT_NEEDED, into the ELF bytes
+    std::vector<DynSym> dynsyms;
+};
+
+namespace detail {
+
+// File offset of link-time address vaddr, or 0 when no segment holds it
+inline uint64_t file_offset(const std::vector<Segment>& loads, uint64_t vaddr) {
+    for (const auto& seg : loads) {
+        if (vaddr >= seg.vaddr && vaddr < seg.vaddr + seg.filesz) {
+            return seg.offset + (vaddr - seg.vaddr);
+        }
+    }
+    return 0;
+}
+
+// Symbol count from DT_HASH (nchain) or DT_GNU_HASH (highest chain end)
+inline size_t dynsym_count(const std::vector<uint8_t>& data, uint64_t hash_off, uint64_t gnu_off) {
+    auto u32_at = [&](uint64_t off, uint32_t& v) {
+        if (off + 4 > data.size()) return false;
+        memcpy(&v, data.data() + off, 4);
+        return true;
+    };
+    uint32_t v;
+    if (hash_off && u32_at(hash_off + 4, v)) return v;
+    if (!gnu_off) return 0;
+    uint32_t nbuckets, symoffset, bloom_size;
+    if (!u32_at(gnu_off, nbuckets) || !u32_at(gnu_off + 4, symoffset) ||
+        !u32_at(gnu_off + 8, bloom_size)) {
+        return 0;
+    }
+    uint64_t buckets = gnu_off + 16 + uint64_t(bloom_size) * 8;
+    uint64_t chains = buckets + uint64_t(nbuckets) * 4;
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < nbuckets; i++) {
+        if (!u32_at(buckets + uint64_t(i) * 4, v)) return 0;
+        last = std::max(last, v);
+    }
+    if (last < symoffset) return symoffset;
+    for (;; last++) {
+        if (!u32_at(chains + uint64_t(last - symoffset) * 4, v)) return 0;
+        if (v & 1) return last + 1;
+    }
+}
+
+}  // namespace detail
+
+// Parse headers, PT_LOAD segments and (with_dynamic) the DT_NEEDED list and
+// defined dynamic symbols. Throws like parse_elf() on a malformed header;
+// a malformed dynamic section just leaves those lists short.
+inline Layout parse_layout(const std::vector<uint8_t>& data, bool with_dynamic = true) {
+    Layout l;
+    l.info = parse_elf(data);
+
+    const auto* ehdr = reinterpret_cast<const Elf64_Ehdr*>(data.data());
+    uint64_t dyn_off = 0, dyn_size = 0;
+    size_t phoff = ehdr->e_phoff;
+    for (uint16_t i = 0; i < ehdr->e_phnum; i++, phoff += ehdr->e_phentsize) {
+        if (phoff + sizeof(Elf64_Phdr) > data.size()) break;
+        const auto* phdr = reinterpret_cast<const Elf64_Phdr*>(data.data() + phoff);
+        if (phdr->p_type == PT_DYNAMIC) {
+            dyn_off = phdr->p_offset;
+            dyn_size = phdr->p_filesz;
+        }
+        if (phdr->p_type != PT_LOAD) continue;
+        l.loads.push_back({phdr->p_vaddr, phdr->p_filesz, phdr->p_memsz,
+                           phdr->p_offset, phdr->p_flags});
+        uint64_t hi = phdr->p_vaddr + phdr->p_memsz;
+        l.load_range.first = std::min(l.load_range.first, phdr->p_vaddr);
+        l.load_range.second = std::max(l.load_range.second, hi);
+        if (phdr->p_flags & PF_W) {
+            l.writable_range.first = std::min(l.writable_range.first, phdr->p_vaddr);
+            l.writable_range.second = std::max(l.writable_range.second, hi);
+        }
+    }
+    if (!with_dynamic || dyn_off == 0 || dyn_off + dyn_size > data.size()) return l;
+
+    uint64_t strtab = 0, strsz = 0, symtab = 0, hash = 0, gnu_hash = 0;
+    std::vector<uint64_t> needed;
+    for (uint64_t off = dyn_off; off + sizeof(Elf64_Dyn) <= dyn_off + dyn_size;
+         off += sizeof(Elf64_Dyn)) {
+        Elf64_Dyn d;
+        memcpy(&d, data.data() + off, sizeof(d));
+        if (d.d_tag == static_cast<int64_t>(DT_NULL)) break;
+        switch (static_cast<uint64_t>(d.d_tag)) {
+            case DT_NEEDED:   needed.push_back(d.d_val); break;
+            case DT_STRTAB:   strtab = detail::file_offset(l.loads, d.d_val); break;
+            case DT_STRSZ:    strsz = d.d_val; break;
+            case DT_SYMTAB:   symtab = detail::file_offset(l.loads, d.d_val); break;
+            case DT_HASH:     hash = detail::file_offset(l.loads, d.d_val); break;
+            case DT_GNU_HASH: gnu_hash = detail::file_offset(l.loads, d.d_val); break;
+        }
+    }
+    if (strtab == 0 || strtab + strsz > data.size()) return l;
+
+    auto str_at = [&](uint64_t idx) -> std::string_view {
+        if (idx >= strsz) return {};
+        const char* p = reinterpret_cast<const char*>(data.data() + strtab + idx);
+        return {p, strnlen(p, strsz - idx)};
+    };
+    for (uint64_t n : needed) l.needed.push_back(str_at(n));
+
+    size_t count = symtab && symtab < data.size() ? detail::dynsym_count(data, hash, gnu_hash) : 0;
+    count = std::min<size_t>(count, (data.size() - symtab) / sizeof(Elf64_Sym));
+    for (size_t i = 1; i < count; i++) {   // Entry 0 is the null symbol
+        Elf64_Sym sym;
+        memcpy(&sym, data.data() + symtab + i * sizeof(Elf64_Sym), sizeof(sym));
+        if (sym.st_shndx == 0) continue;   // SHN_UNDEF: imported
+        l.dynsyms.push_back({str_at(sym.st_name), sym.st_value, sym.st_size, sym.st_info});
+    }
+    return l;
+}
+
 // Build auxiliary vector for dynamic linker
 // Returns pairs of (type, value) that should be pushed to stack
 inline std::vector<std::pair<uint64_t, uint64_t>> build_auxv(
@@ -355,187 +516,224 @@ using Machine = riscv::Machine<riscv::RISCV64>;
 // └──────────────────────────────┘ ← sp
 // Low addresses
 
+namespace detail {
+
+// Page ranges of a set of segments with their merged permissions.
+// A page touched by several segments gets the OR of their flags, so a data
+// segment (RW) never removes execute permission from a page it shares with
+// a code segment (RX). Adjacent pages with equal flags form one range.
+struct PageRange {
+    uint64_t lo, hi;
+    uint32_t flags;     // PF_R | PF_W | PF_X
+};
+
+inline std::vector<PageRange> merged_page_ranges(const std::vector<elf::Segment>& segments) {
+    constexpr uint64_t RISCV_PAGE = 4096;
+    constexpr uint64_t RISCV_PAGE_MASK = ~(RISCV_PAGE - 1);
+
+    // Every segment start and end (rounded out to pages) is a point where
+    // the merged flags may change; between two such points they are constant.
+    std::vector<uint64_t> edges;
+    edges.reserve(segments.size() * 2);
+    for (const auto& seg : segments) {
+        uint64_t lo = seg.vaddr & RISCV_PAGE_MASK;
+        uint64_t hi = (seg.vaddr + seg.memsz + RISCV_PAGE - 1) & RISCV_PAGE_MASK;
+        if (lo >= hi) continue;
+        edges.push_back(lo);
+        edges.push_back(hi);
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    std::vector<PageRange> ranges;
+    for (size_t i = 0; i + 1 < edges.size(); i++) {
+        uint64_t lo = edges[i], hi = edges[i + 1];
+        bool touched = false;
+        uint32_t flags = 0;
+        for (const auto& seg : segments) {
+            uint64_t seg_lo = seg.vaddr & RISCV_PAGE_MASK;
+            uint64_t seg_hi = (seg.vaddr + seg.memsz + RISCV_PAGE - 1) & RISCV_PAGE_MASK;
+            if (seg_lo < seg_hi && seg_lo < hi && seg_hi > lo) {
+                touched = true;
+                flags |= seg.flags & (elf::PF_R | elf::PF_W | elf::PF_X);
+            }
+        }
+        if (!touched) continue;  // Gap between segments
+        if (!ranges.empty() && ranges.back().hi == lo && ranges.back().flags == flags) {
+            ranges.back().hi = hi;
+        } else {
+            ranges.push_back({lo, hi, flags});
+        }
+    }
+    return ranges;
+}
+
+}  // namespace detail
+
 // Load an ELF file into memory at the specified base.
-// Uses two-pass approach: first copies data, then merges page permissions
-// across all segments. This correctly handles shared pages where a code
-// segment (RX) and data segment (RW) overlap on the same 4KB page —
-// the shared page gets RWX instead of the data segment clobbering the
-// code segment's execute permission.
+// Copies the segment data first and then applies permissions, merged
+// across segments (see detail::merged_page_ranges), with one
+// set_page_attr call per range.
+//
+// With a flat arena that covers every segment, each segment is a single
+// memcpy plus a memset for its BSS straight into the arena, where guest
+// memory actually lives. Otherwise the data goes
+// through the page API, making pages writable as it faults on them (e.g.
+// code pages from a previous binary during execve).
 inline uint64_t load_elf_segments(
     Machine& machine,
     const std::vector<uint8_t>& elf_data,
+    const elf::Layout& layout,
     uint64_t requested_base = 0
 ) {
-    const auto* ehdr = reinterpret_cast<const elf::Elf64_Ehdr*>(elf_data.data());
-
     // For PIE/shared objects, we can load at any address
     // For ET_EXEC, we must load at the specified addresses
     uint64_t base_adjust = 0;
-    if (ehdr->e_type == elf::ET_DYN && requested_base != 0) {
-        // Find lowest vaddr to calculate adjustment
-        auto [lo, hi] = elf::get_load_range(elf_data);
-        base_adjust = requested_base - lo;
+    if (layout.info.type == elf::ET_DYN && requested_base != 0) {
+        base_adjust = requested_base - layout.load_range.first;
     }
 
-    // Collect all PT_LOAD segments
-    struct SegInfo {
-        uint64_t vaddr, filesz, memsz, offset;
-        uint32_t flags;
-    };
-    std::vector<SegInfo> segments;
+    // All PT_LOAD segments, at their load address
+    std::vector<elf::Segment> segments = layout.loads;
+    for (auto& seg : segments) seg.vaddr += base_adjust;
 
-    size_t phoff = ehdr->e_phoff;
-    for (uint16_t i = 0; i < ehdr->e_phnum; i++) {
-        const auto* phdr = reinterpret_cast<const elf::Elf64_Phdr*>(
-            elf_data.data() + phoff);
-
-        if (phdr->p_type == elf::PT_LOAD) {
-            segments.push_back({
-                phdr->p_vaddr + base_adjust,
-                phdr->p_filesz,
-                phdr->p_memsz,
-                phdr->p_offset,
-                phdr->p_flags
-            });
+    bool copied = false;
+    if constexpr (riscv::encompassing_Nbit_arena > 0) {
+        auto* arena = (uint8_t*)machine.memory.memory_arena_ptr();
+        constexpr uint64_t ARENA_MASK = (1ULL << riscv::encompassing_Nbit_arena) - 1;
+        const uint64_t arena_size = machine.memory.memory_arena_size();
+        bool fits = arena != nullptr;
+        for (const auto& seg : segments) {
+            if (!fits) break;
+            uint64_t dst = seg.vaddr & ARENA_MASK;
+            fits = seg.memsz <= arena_size && dst <= arena_size - seg.memsz &&
+                   seg.filesz <= seg.memsz;
+        }
+        if (fits) {
+            for (const auto& seg : segments) {
+                uint8_t* dst = arena + (seg.vaddr & ARENA_MASK);
+                if (seg.filesz > 0) {
+                    std::memcpy(dst, elf_data.data() + seg.offset, seg.filesz);
+                }
+                if (seg.memsz > seg.filesz) {
+                    std::memset(dst + seg.filesz, 0, seg.memsz - seg.filesz);
+                }
+            }
+            copied = true;
         }
-
-        phoff += ehdr->e_phentsize;
     }
 
-    // Pass 1: Copy segment data into guest memory.
-    // Use fault-retry loop: if a page isn't writable (e.g. code pages from
-    // a previous binary during execve), make it RWX and retry.
-    for (const auto& seg : segments) {
-        auto copy_with_retry = [&](uint64_t dst, const void* src, size_t len) {
-            size_t offset = 0;
-            int faults = 0;
-            while (offset < len) {
-                try {
-                    machine.memory.memcpy(dst + offset,
-                        (const uint8_t*)src + offset, len - offset);
-                    if (faults > 0) {
-                        fprintf(stderr, "[load_elf] copy 0x%lx+0x%lx len=0x%lx done after %d faults\n",
-                                (long)dst, (long)offset, (long)len, faults);
-                    }
-                    return;  // success
-                } catch (const riscv::MachineException& e) {
-                    uint64_t fault = e.data();
-                    if (fault == 0) throw;  // not a page fault
-                    faults++;
-                    if (faults <= 10)
-                        fprintf(stderr, "[load_elf] fault #%d at 0x%lx (page 0x%lx) during copy dst=0x%lx+0x%lx len=0x%lx\n",
-                                faults, (long)fault, (long)(fault & ~0xFFFULL),
-                                (long)dst, (long)offset, (long)len);
-                    // Make the faulting page writable and retry
-                    uint64_t page = fault & ~0xFFFULL;
-                    riscv::PageAttributes attr;
-                    attr.read = true; attr.write = true; attr.exec = true;
-                    machine.memory.set_page_attr(page, 4096, attr);
-                    // Advance offset to skip already-copied data
-                    if (fault >= dst + offset) {
-                        offset = (fault & ~0xFFFULL) - dst;
+    if (!copied) {
+        // Slow path: copy through the page API.
+        // Use fault-retry loop: if a page isn't writable (e.g. code pages from
+        // a previous binary during execve), make it RWX and retry.
+        for (const auto& seg : segments) {
+            auto copy_with_retry = [&](uint64_t dst, const void* src, size_t len) {
+                size_t offset = 0;
+                int faults = 0;
+                while (offset < len) {
+                    try {
+                        machine.memory.memcpy(dst + offset,
+                            (const uint8_t*)src + offset, len - offset);
+                        if (faults > 0) {
+                            fprintf(stderr, "[load_elf] copy 0x%lx+0x%lx len=0x%lx done after %d faults\n",
+                                    (long)dst, (long)offset, (long)len, faults);
+                        }
+                        return;  // success
+                    } catch (const riscv::MachineException& e) {
+                        uint64_t fault = e.data();
+                        if (fault == 0) throw;  // not a page fault
+                        faults++;
+                        if (faults <= 10)
+                            fprintf(stderr, "[load_elf] fault #%d at 0x%lx (page 0x%lx) during copy dst=0x%lx+0x%lx len=0x%lx\n",
+                                    faults, (long)fault, (long)(fault & ~0xFFFULL),
+                                    (long)dst, (long)offset, (long)len);
+                        // Make the faulting page writable and retry
+                        uint64_t page = fault & ~0xFFFULL;
+                        riscv::PageAttributes attr;
+                        attr.read = true; attr.write = true; attr.exec = true;
+                        pageattr::set(machine.memory, page, 4096, attr);
+                        // Advance offset to skip already-copied data
+                        if (fault >= dst + offset) {
+                            offset = (fault & ~0xFFFULL) - dst;
+                        }
                     }
                 }
-            }
-        };
-        auto memset_with_retry = [&](uint64_t dst, uint8_t val, size_t len) {
-            size_t offset = 0;
-            while (offset < len) {
-                try {
-                    machine.memory.memset(dst + offset, val, len - offset);
-                    return;
-                } catch (const riscv::MachineException& e) {
-                    uint64_t fault = e.data();
-                    if (fault == 0) throw;
-                    uint64_t page = fault & ~0xFFFULL;
-                    riscv::PageAttributes attr;
-                    attr.read = true; attr.write = true; attr.exec = true;
-                    machine.memory.set_page_attr(page, 4096, attr);
-                    if (fault >= dst + offset) {
-                        offset = (fault & ~0xFFFULL) - dst;
+            };
+            auto memset_with_retry = [&](uint64_t dst, uint8_t val, size_t len) {
+                size_t offset = 0;
+                while (offset < len) {
+                    try {
+                        machine.memory.memset(dst + offset, val, len - offset);
+                        return;
+                    } catch (const riscv::MachineException& e) {
+                        uint64_t fault = e.data();
+                        if (fault == 0) throw;
+                        uint64_t page = fault & ~0xFFFULL;
+                        riscv::PageAttributes attr;
+                        attr.read = true; attr.write = true; attr.exec = true;
+                        pageattr::set(machine.memory, page, 4096, attr);
+                        if (fault >= dst + offset) {
+                            offset = (fault & ~0xFFFULL) - dst;
+                        }
                     }
                 }
-            }
-        };
+            };
 
-        if (seg.filesz > 0) {
-            copy_with_retry(seg.vaddr, elf_data.data() + seg.offset, seg.filesz);
-        }
-        if (seg.memsz > seg.filesz) {
-            memset_with_retry(seg.vaddr + seg.filesz, 0, seg.memsz - seg.filesz);
-        }
+            if (seg.filesz > 0) {
+                copy_with_retry(seg.vaddr, elf_data.data() + seg.offset, seg.filesz);
+            }
+            if (seg.memsz > seg.filesz) {
+                memset_with_retry(seg.vaddr + seg.filesz, 0, seg.memsz - seg.filesz);
+            }
 
-        // In encompassing_Nbit_arena mode, the fast-path read/write bypasses
-        // the page table and accesses the arena buffer directly. But page-based
-        // memcpy above may have written to "owning" page objects that DON'T
-        // point to the arena (e.g. stack pages from before execve). Fix this by
-        // also writing segment data directly to the arena buffer.
-        if constexpr (riscv::encompassing_Nbit_arena > 0) {
-            auto* arena = (uint8_t*)machine.memory.memory_arena_ptr();
-            if (arena) {
-                constexpr uint64_t ARENA_MASK = (1ULL << riscv::encompassing_Nbit_arena) - 1;
-                uint64_t arena_dst = seg.vaddr & ARENA_MASK;
-                size_t arena_size = machine.memory.memory_arena_size();
-                if (seg.filesz > 0 && arena_dst + seg.filesz <= arena_size) {
-                    std::memcpy(arena + arena_dst,
-                                elf_data.data() + seg.offset, seg.filesz);
-                }
-                // Zero BSS in arena too
-                if (seg.memsz > seg.filesz) {
-                    uint64_t bss_dst = (seg.vaddr + seg.filesz) & ARENA_MASK;
-                    size_t bss_len = seg.memsz - seg.filesz;
-                    if (bss_dst + bss_len <= arena_size) {
-                        std::memset(arena + bss_dst, 0, bss_len);
+            // In encompassing_Nbit_arena mode, the fast-path read/write bypasses
+            // the page table and accesses the arena buffer directly. But page-based
+            // memcpy above may have written to "owning" page objects that DON'T
+            // point to the arena (e.g. stack pages from before execve). Fix this by
+            // also writing segment data directly to the arena buffer.
+            if constexpr (riscv::encompassing_Nbit_arena > 0) {
+                auto* arena = (uint8_t*)machine.memory.memory_arena_ptr();
+                if (arena) {
+                    constexpr uint64_t ARENA_MASK = (1ULL << riscv::encompassing_Nbit_arena) - 1;
+                    uint64_t arena_dst = seg.vaddr & ARENA_MASK;
+                    size_t arena_size = machine.memory.memory_arena_size();
+                    if (seg.filesz > 0 && arena_dst + seg.filesz <= arena_size) {
+                        std::memcpy(arena + arena_dst,
+                                    elf_data.data() + seg.offset, seg.filesz);
+                    }
+                    // Zero BSS in arena too
+                    if (seg.memsz > seg.filesz) {
+                        uint64_t bss_dst = (seg.vaddr + seg.filesz) & ARENA_MASK;
+                        size_t bss_len = seg.memsz - seg.filesz;
+                        if (bss_dst + bss_len <= arena_size) {
+                            std::memset(arena + bss_dst, 0, bss_len);
+                        }
                     }
                 }
             }
         }
     }
 
-    // Pass 2: Set page permissions with proper merging.
-    // For each page touched by any segment, OR the permissions from all
-    // overlapping segments. This prevents a data segment (RW) from removing
-    // execute permission on a page shared with a code segment (RX).
-    constexpr uint64_t RISCV_PAGE = 4096;
-    constexpr uint64_t RISCV_PAGE_MASK = ~(RISCV_PAGE - 1);
-
-    // Find overall page range
-    uint64_t range_lo = UINT64_MAX, range_hi = 0;
-    for (const auto& seg : segments) {
-        uint64_t lo = seg.vaddr & RISCV_PAGE_MASK;
-        uint64_t hi = (seg.vaddr + seg.memsz + RISCV_PAGE - 1) & RISCV_PAGE_MASK;
-        if (lo < range_lo) range_lo = lo;
-        if (hi > range_hi) range_hi = hi;
-    }
-
-    // Set merged permissions per page
-    for (uint64_t page = range_lo; page < range_hi; page += RISCV_PAGE) {
-        bool r = false, w = false, x = false;
-        bool touched = false;
-
-        for (const auto& seg : segments) {
-            uint64_t seg_end = seg.vaddr + seg.memsz;
-            // Does this page overlap with this segment?
-            if (page < seg_end && page + RISCV_PAGE > seg.vaddr) {
-                touched = true;
-                r |= (seg.flags & elf::PF_R) != 0;
-                w |= (seg.flags & elf::PF_W) != 0;
-                x |= (seg.flags & elf::PF_X) != 0;
-            }
-        }
-
-        if (touched) {
-            riscv::PageAttributes attr;
-            attr.read = r;
-            attr.write = w;
-            attr.exec = x;
-            machine.memory.set_page_attr(page, RISCV_PAGE, attr);
-        }
+    for (const auto& r : detail::merged_page_ranges(segments)) {
+        riscv::PageAttributes attr;
+        attr.read = (r.flags & elf::PF_R) != 0;
+        attr.write = (r.flags & elf::PF_W) != 0;
+        attr.exec = (r.flags & elf::PF_X) != 0;
+        pageattr::set(machine.memory, r.lo, r.hi - r.lo, attr);
     }
 
     return base_adjust;
 }
 
+inline uint64_t load_elf_segments(
+    Machine& machine,
+    const std::vector<uint8_t>& elf_data,
+    uint64_t requested_base = 0
+) {
+    return load_elf_segments(machine, elf_data, elf::parse_layout(elf_data, false), requested_base);
+}
+
 // Set up the stack for the dynamic linker
 // Returns the initial stack pointer
 inline uint64_t setup_dynamic_stack(
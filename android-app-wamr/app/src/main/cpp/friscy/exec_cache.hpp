@@ -0,0 +1,436 @@
+// exec_cache.hpp - Post-relocation process images for repeated execve
+//
+// A dynamically linked exec spends most of its startup inside ld-musl:
+// mapping the libraries, then symbol lookup and relocation of the program
+// and every library. The outcome only depends on the binaries involved and
+// where they were loaded, so it is captured once, at the moment ld-musl
+// jumps to the program's entry point, and later execs of the same binary
+// restore it and start at the entry directly.
+//
+// The handoff is observed by pointing AT_ENTRY at a two-instruction stub
+// (li a7, SYS_ENTRY_STUB; ecall) just above the initial stack. Its handler
+// puts the real AT_ENTRY back and, when a capture is armed, records:
+//   - the writable segments of the program and the interpreter (GOT, data,
+//     ld-musl's DSO list and libc state)
+//   - the brk and mmap ranges used while linking (library segments, TLS)
+//   - the page permissions mmap/mprotect set in that window
+//   - the registers (tp points at the main thread's TLS)
+//
+// The key is the content hash of the program and the interpreter, the load
+// bases, the stack top and the AT_EXECFN string address (ld-musl keeps that
+// pointer as the program's name), and LD_LIBRARY_PATH/LD_PRELOAD. Libraries
+// are only known after the first run, so an image stores their paths and
+// hashes and a lookup checks them: a replaced library turns a hit into a
+// miss. Images are restored at the addresses they were captured at; the
+// previous process image is gone by then, and the vfork emulation saves
+// and restores the parent's mmap region around the child.
+//
+// Libraries at prelinked bases (prelink.hpp) lie outside the mmap window.
+// Only their writable mappings are captured; an image names the libraries
+// whose text it expects at their bases, and a restore makes that resident.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <libriscv/machine.hpp>
+#include "vfs.hpp"
+#include "elf_loader.hpp"
+#include "prelink.hpp"
+#include "page_cache.hpp"
+#include "chunk_store.hpp"
+
+namespace execcache {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+inline constexpr int SYS_ENTRY_STUB = 500;          // friscy-private, above every Linux number
+inline constexpr uint64_t STUB_SLOT = 16;           // Reserved at the top of the stack
+inline constexpr size_t MAX_IMAGES = 8;
+inline constexpr size_t MAX_BYTES = 64ull << 20;    // All images together
+inline constexpr size_t MAX_IMAGE_BYTES = 32ull << 20;
+
+struct Key {
+    uint64_t exec_hash = 0;
+    uint64_t interp_hash = 0;
+    uint64_t exec_base = 0;
+    uint64_t interp_base = 0;
+    uint64_t brk_start = 0;
+    uint64_t stack_top = 0;
+    uint64_t execfn = 0;
+    uint64_t env_hash = 0;
+
+    auto fields() const {
+        return std::tie(exec_hash, interp_hash, exec_base, interp_base, brk_start,
+                        stack_top, execfn, env_hash);
+    }
+    bool operator==(const Key& o) const { return fields() == o.fields(); }
+};
+
+// Guest state live at exec time that the link writes into
+struct Layout {
+    uint64_t exec_rw_start = 0, exec_rw_end = 0;
+    uint64_t interp_rw_start = 0, interp_rw_end = 0;
+    uint64_t brk_start = 0;
+    uint64_t mmap_start = 0;    // mmap frontier
+};
+
+struct Range {
+    uint64_t addr;
+    std::vector<uint8_t> data;
+};
+
+struct Attr {
+    uint64_t addr;
+    uint64_t len;
+    int prot;
+};
+
+struct Lib {
+    std::string path;
+    uint64_t hash;
+};
+
+// A library mapped at its prelinked base while linking
+struct Prelinked {
+    std::string path;
+    uint64_t base = 0;
+};
+
+struct Image {
+    Key key;
+    std::vector<Lib> libs;
+    std::vector<Prelinked> prelinked;
+    std::vector<Range> ranges;
+    std::vector<Attr> attrs;      // In the order they were applied
+    uint64_t map_lo = 0, map_hi = 0;
+    uint64_t regs[32] = {};
+    uint64_t entry = 0;
+    uint64_t brk_end = 0;
+    size_t bytes = 0;
+    uint64_t last_use = 0;
+};
+
+// Armed by execve on a miss, consumed by the entry stub
+struct Capture {
+    bool active = false;
+    Key key;
+    Layout layout;
+    uint64_t brk_end = 0;
+    uint64_t map_lo = UINT64_MAX, map_hi = 0;
+    std::vector<Attr> attrs;
+    std::vector<Lib> libs;
+    std::vector<Prelinked> prelinked;
+    std::vector<std::pair<uint64_t, uint64_t>> fixed;   // Writable spans at prelinked bases
+};
+
+struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t captures = 0;
+    uint64_t rejected = 0;     // Too large, or nothing to key on
+};
+
+inline std::vector<Image> g_images;
+inline Capture g_capture;
+inline Stats g_stats;
+inline uint64_t g_clock = 0;
+
+// ---- Content hashes ----
+//
+// chunkstore::chunk_hash() of the whole content (64 bits, length mixed in,
+// never 0), memoized per VFS entry and generation so a hit costs a map
+// lookup rather than a pass over a multi-MB binary. The weak_ptr keeps the Entry allocation (it came from
+// make_shared), so its address cannot be reused while the memo exists.
+
+struct HashMemo {
+    std::weak_ptr<vfs::Entry> entry;
+    uint64_t generation = 0;
+    uint64_t hash = 0;
+};
+
+inline std::unordered_map<const vfs::Entry*, HashMemo> g_hashes;
+
+inline uint64_t content_hash(const std::shared_ptr<vfs::Entry>& e) {
+    if (g_hashes.size() > 256) {
+        std::erase_if(g_hashes, [](const auto& kv) { return kv.second.entry.expired(); });
+    }
+    auto& h = g_hashes[e.get()];
+    if (h.entry.lock() != e || h.generation != e->generation) {
+        h = {e, e->generation, chunkstore::chunk_hash(e->content.data(), e->content.size())};
+    }
+    return h.hash;
+}
+
+inline uint64_t path_hash(vfs::VirtualFS& fs, const std::string& path) {
+    if (path.empty()) return 0;
+    auto e = fs.resolve(path);
+    return e && e->is_file() ? content_hash(e) : 0;
+}
+
+// ---- Guest memory ----
+
+// Address of the value of auxv entry `type` in the initial stack at sp
+// (argc, argv..., 0, envp..., 0, auxv pairs), or 0.
+inline uint64_t aux_slot(Machine& m, uint64_t sp, uint64_t type) {
+    uint64_t p = sp + 8;
+    for (int pass = 0; pass < 2; pass++) {      // argv, then envp
+        for (int i = 0; i < 4096 && m.memory.template read<uint64_t>(p) != 0; i++) p += 8;
+        p += 8;
+    }
+    for (int i = 0; i < 64; i++, p += 16) {
+        uint64_t t = m.memory.template read<uint64_t>(p);
+        if (t == type) return p + 8;
+        if (t == elf::AT_NULL) break;
+    }
+    return 0;
+}
+
+// Flat-arena copies, like the anonymous mmap path: the arena is what the
+// guest reads, whatever the page attributes say
+inline void poke(Machine& m, uint64_t addr, const uint8_t* src, size_t n) {
+    if constexpr (riscv::encompassing_Nbit_arena > 0) {
+        auto* arena = static_cast<uint8_t*>(m.memory.memory_arena_ptr());
+        if (arena && addr + n <= m.memory.memory_arena_size()) {
+            std::memcpy(arena + addr, src, n);
+            return;
+        }
+    }
+    m.memory.memcpy(addr, src, n);
+}
+
+inline void peek(Machine& m, uint8_t* dst, uint64_t addr, size_t n) {
+    if constexpr (riscv::encompassing_Nbit_arena > 0) {
+        const auto* arena = static_cast<const uint8_t*>(m.memory.memory_arena_ptr());
+        if (arena && addr + n <= m.memory.memory_arena_size()) {
+            std::memcpy(dst, arena + addr, n);
+            return;
+        }
+    }
+    m.memory.memcpy_out(dst, addr, n);
+}
+
+// ---- Lookup / restore ----
+
+inline Key make_key(Machine& m, vfs::VirtualFS& fs, const std::string& exec_path,
+                    const std::string& interp_path, const Layout& layout,
+                    uint64_t exec_base, uint64_t interp_base, uint64_t stack_top, uint64_t sp,
+                    const std::vector<std::string>& env) {
+    Key k;
+    k.exec_hash = path_hash(fs, exec_path);
+    k.interp_hash = path_hash(fs, interp_path);
+    k.exec_base = exec_base;
+    k.interp_base = interp_base;
+    k.brk_start = layout.brk_start;
+    k.stack_top = stack_top;
+    uint64_t slot = aux_slot(m, sp, elf::AT_EXECFN);
+    k.execfn = slot ? m.memory.template read<uint64_t>(slot) : 0;
+    std::string linker_env;
+    for (const auto& e : env) {
+        if (e.starts_with("LD_LIBRARY_PATH=") || e.starts_with("LD_PRELOAD=")) {
+            linker_env.append(e.c_str(), e.size() + 1);
+        }
+    }
+    k.env_hash = chunkstore::chunk_hash(reinterpret_cast<const uint8_t*>(linker_env.data()),
+                                      linker_env.size());
+    return k;
+}
+
+// True when the key names real files (a deleted binary is not cached)
+inline bool cacheable(const Key& k) {
+    return k.exec_hash != 0 && k.interp_hash != 0 && k.execfn != 0;
+}
+
+inline const Image* lookup(vfs::VirtualFS& fs, const Key& key) {
+    for (auto& img : g_images) {
+        if (!(img.key == key)) continue;
+        bool libs_ok = std::all_of(img.libs.begin(), img.libs.end(), [&](const Lib& l) {
+            return path_hash(fs, l.path) == l.hash;
+        });
+        // Prelinked libraries must still have that base and be free to map
+        libs_ok = libs_ok && std::all_of(img.prelinked.begin(), img.prelinked.end(),
+            [&](const Prelinked& p) {
+                const auto* lib = prelink::by_path(fs, p.path);
+                return lib && lib->base == p.base && !lib->live && !lib->parent_live;
+            });
+        if (!libs_ok) break;
+        img.last_use = ++g_clock;
+        g_stats.hits++;
+        return &img;
+    }
+    g_stats.misses++;
+    return nullptr;
+}
+
+// Install `img` and continue at the program entry with the stack at sp.
+// The caller moves its brk and mmap pointers past the image.
+inline void restore(Machine& m, vfs::VirtualFS& fs, const Image& img, uint64_t sp) {
+    for (const auto& p : img.prelinked) {
+        if (auto* lib = prelink::by_path(fs, p.path)) {
+            prelink::ensure_resident(m, *lib);
+            lib->live = true;
+        }
+    }
+    if (img.map_hi > img.map_lo) {
+        prelink::clobber(img.map_lo, img.map_hi - img.map_lo);
+        // Whatever the dead image left there (code of other libraries)
+        riscv::PageAttributes rw;
+        rw.read = true; rw.write = true;
+        pageattr::set(m.memory, img.map_lo, img.map_hi - img.map_lo, rw);
+        pagecache::release(m, img.map_lo, img.map_hi - img.map_lo);
+        m.memory.memdiscard(img.map_lo, img.map_hi - img.map_lo, true);
+    }
+    for (const auto& r : img.ranges) {
+        prelink::clobber(r.addr, r.data.size());
+        poke(m, r.addr, r.data.data(), r.data.size());
+    }
+    for (const auto& a : img.attrs) pageattr::set(m.memory, a.addr, a.len, pageattr::attr_of(a.prot));
+
+    for (int i = 1; i < 32; i++) m.cpu.reg(i) = img.regs[i];
+    m.cpu.reg(riscv::REG_SP) = sp;
+    m.cpu.jump(img.entry);
+}
+
+// ---- Capture ----
+
+// Point AT_ENTRY of the stack at sp to the stub at `stub`, so that the
+// interpreter's jump to the program is observed (SYS_ENTRY_STUB)
+inline bool redirect_entry(Machine& m, uint64_t stub, uint64_t sp) {
+    uint64_t slot = aux_slot(m, sp, elf::AT_ENTRY);
+    if (!slot) return false;
+
+    constexpr uint32_t LI_A7 = (uint32_t(SYS_ENTRY_STUB) << 20) | (17u << 7) | 0x13;  // addi a7, x0, N
+    constexpr uint32_t ECALL = 0x00000073;
+    riscv::PageAttributes rwx;
+    rwx.read = true; rwx.write = true; rwx.exec = true;
+    pageattr::set(m.memory, stub & ~0xFFFULL, 4096, rwx);
+    m.memory.template write<uint32_t>(stub, LI_A7);
+    m.memory.template write<uint32_t>(stub + 4, ECALL);
+    m.memory.template write<uint64_t>(slot, stub);
+    return true;
+}
+
+// Redirect AT_ENTRY (redirect_entry()) and record what the link touches
+// until the stub runs
+inline void arm(Machine& m, const Key& key, const Layout& layout, uint64_t stub, uint64_t sp) {
+    if (!redirect_entry(m, stub, sp)) return;
+
+    g_capture = {};
+    g_capture.active = true;
+    g_capture.key = key;
+    g_capture.layout = layout;
+    g_capture.brk_end = layout.brk_start;
+}
+
+inline void note_map(uint64_t addr, uint64_t len, int prot, bool file) {
+    auto& c = g_capture;
+    if (!c.active || len == 0) return;
+    if (prelink::containing(addr)) {
+        // Outside the mmap window; text is covered by residency
+        if (!file || (prot & 2)) c.fixed.emplace_back(addr, addr + len);
+        if (file) c.attrs.push_back({addr, len, prot});
+        return;
+    }
+    c.map_lo = std::min(c.map_lo, addr);
+    c.map_hi = std::max(c.map_hi, addr + len);
+    if (file) c.attrs.push_back({addr, len, prot});
+}
+
+inline void note_protect(uint64_t addr, uint64_t len, int prot) {
+    if (g_capture.active) g_capture.attrs.push_back({addr, len, prot});
+}
+
+inline void note_brk(uint64_t end) {
+    if (g_capture.active) g_capture.brk_end = std::max(g_capture.brk_end, end);
+}
+
+inline void note_lib(const std::string& path, const std::shared_ptr<vfs::Entry>& e) {
+    auto& c = g_capture;
+    if (!c.active || path.empty()) return;
+    for (const auto& l : c.libs) {
+        if (l.path == path) return;
+    }
+    c.libs.push_back({path, content_hash(e)});
+}
+
+inline void note_prelinked(const std::string& path, uint64_t base) {
+    if (g_capture.active) g_capture.prelinked.push_back({path, base});
+}
+
+inline void evict_for(size_t bytes) {
+    auto total = [] {
+        size_t t = 0;
+        for (const auto& img : g_images) t += img.bytes;
+        return t;
+    };
+    while (!g_images.empty() && (g_images.size() >= MAX_IMAGES || total() + bytes > MAX_BYTES)) {
+        auto oldest = std::min_element(g_images.begin(), g_images.end(),
+            [](const Image& a, const Image& b) { return a.last_use < b.last_use; });
+        g_images.erase(oldest);
+    }
+}
+
+// Entry stub handler: ld-musl has linked the program and jumped to AT_ENTRY.
+// Restores the real AT_ENTRY (`entry`) in the stack at sp, keeps an image if
+// a capture is armed, and leaves the jump to `entry` to the caller.
+inline void capture(Machine& m, uint64_t entry, uint64_t sp, uint64_t mmap_frontier) {
+    if (uint64_t slot = aux_slot(m, sp, elf::AT_ENTRY)) {
+        m.memory.template write<uint64_t>(slot, entry);
+    }
+    auto& c = g_capture;
+    if (!c.active) return;
+    c.active = false;
+
+    Image img;
+    img.key = c.key;
+    img.libs = std::move(c.libs);
+    img.prelinked = std::move(c.prelinked);
+    img.attrs = std::move(c.attrs);
+    img.entry = entry;
+    img.brk_end = c.brk_end;
+    img.map_lo = std::min(c.map_lo, c.layout.mmap_start);
+    img.map_hi = std::max(c.map_hi, mmap_frontier);
+    if (img.map_hi <= img.map_lo) img.map_lo = img.map_hi = 0;
+
+    std::vector<std::pair<uint64_t, uint64_t>> spans = {
+        {img.map_lo, img.map_hi},
+        {c.layout.exec_rw_start, c.layout.exec_rw_end},
+        {c.layout.interp_rw_start, c.layout.interp_rw_end},
+        {c.layout.brk_start, c.brk_end},
+    };
+    spans.insert(spans.end(), c.fixed.begin(), c.fixed.end());
+    size_t bytes = 0;
+    for (auto [lo, hi] : spans) {
+        if (hi > lo) bytes += hi - lo;
+    }
+    if (bytes > MAX_IMAGE_BYTES) {
+        g_stats.rejected++;
+        fprintf(stderr, "[exec-cache] image of %zu KB not kept\n", bytes >> 10);
+        return;
+    }
+    for (auto [lo, hi] : spans) {
+        if (hi <= lo) continue;
+        Range r{lo, std::vector<uint8_t>(hi - lo)};
+        peek(m, r.data.data(), lo, r.data.size());
+        img.ranges.push_back(std::move(r));
+    }
+    for (int i = 0; i < 32; i++) img.regs[i] = m.cpu.reg(i);
+    img.bytes = bytes;
+    img.last_use = ++g_clock;
+
+    evict_for(bytes);
+    g_images.push_back(std::move(img));
+    g_stats.captures++;
+    fprintf(stderr, "[exec-cache] captured %zu KB, %zu libraries (%zu images)\n",
+            bytes >> 10, g_images.back().libs.size(), g_images.size());
+}
+
+}  // namespace execcache
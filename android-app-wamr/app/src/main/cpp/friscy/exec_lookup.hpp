@@ -0,0 +1,206 @@
+// exec_lookup.hpp - Shebang and PATH lookup caches for execve
+//
+// Exec'ing a script means reading its first line, parsing "#!interp [arg]"
+// and, for "#!/usr/bin/env cmd", searching PATH for cmd with a lookup in
+// every PATH directory. npm's .bin shims and shell scripts exec the same
+// handful of files over and over, so both answers are cached:
+//
+//   - The parsed shebang, per inode. It stays valid while the file's
+//     generation is unchanged (every write bumps it).
+//   - PATH lookups per (PATH, command), like a shell's command hash. A hit
+//     stays valid while none of the directories it searched has gained or
+//     lost an entry (their generation) and no directory or symlink has been
+//     added, moved or removed anywhere (VirtualFS::tree_generation), since
+//     either can change what a PATH element resolves to. Unlike a shell's
+//     hash, it never needs a manual `hash -r`.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "vfs.hpp"
+
+namespace execlookup {
+
+inline constexpr size_t MAX_SHEBANGS = 256;
+inline constexpr size_t MAX_PATHS = 256;
+inline constexpr size_t SHEBANG_MAX = 255;      // Bytes of the first line looked at
+
+struct Shebang {
+    bool script = false;    // Starts with "#!"
+    std::string interp;
+    std::string arg;        // Optional single argument, as Linux passes it
+};
+
+struct ShebangSlot {
+    std::weak_ptr<vfs::Entry> inode;
+    uint64_t generation = 0;
+    Shebang result;
+};
+
+// One PATH element as it was when a lookup was cached
+struct PathDir {
+    std::weak_ptr<vfs::Entry> dir;  // Expired/empty when it did not exist
+    uint64_t generation = 0;
+    bool exists = false;
+};
+
+struct PathSlot {
+    uint64_t tree_generation = 0;
+    std::vector<PathDir> dirs;      // The elements searched, in order
+    std::string found;              // Candidate path, or empty for not found
+};
+
+struct Stats {
+    uint64_t shebang_hits = 0;
+    uint64_t shebang_misses = 0;
+    uint64_t path_hits = 0;
+    uint64_t path_misses = 0;
+};
+
+inline std::unordered_map<const vfs::Entry*, ShebangSlot> g_shebangs;
+inline std::unordered_map<std::string, PathSlot> g_paths;
+inline Stats g_stats;
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+// Parse the first line of a file. The interpreter ends at the first blank;
+// the rest of the line, trimmed, is one argument.
+inline Shebang parse_shebang(const uint8_t* data, size_t n) {
+    Shebang sb;
+    if (n < 4 || data[0] != '#' || data[1] != '!') return sb;
+    std::string_view line(reinterpret_cast<const char*>(data) + 2, std::min(n, SHEBANG_MAX) - 2);
+    line = line.substr(0, line.find_first_of(std::string_view("\n\0", 2)));
+
+    while (!line.empty() && is_blank(line.front())) line.remove_prefix(1);
+    while (!line.empty() && (is_blank(line.back()) || line.back() == '\r')) line.remove_suffix(1);
+    size_t blank = line.find_first_of(" \t");
+    sb.script = true;
+    sb.interp = line.substr(0, blank);
+    if (blank != std::string_view::npos) {
+        auto arg = line.substr(blank + 1);
+        while (!arg.empty() && is_blank(arg.front())) arg.remove_prefix(1);
+        sb.arg = arg;
+    }
+    return sb;
+}
+
+// The shebang of a regular file (script == false when it has none)
+inline Shebang shebang(const std::shared_ptr<vfs::Entry>& file) {
+    auto it = g_shebangs.find(file.get());
+    if (it != g_shebangs.end() && it->second.inode.lock() == file &&
+        it->second.generation == file->generation) {
+        g_stats.shebang_hits++;
+        return it->second.result;
+    }
+    g_stats.shebang_misses++;
+    if (g_shebangs.size() >= MAX_SHEBANGS) {
+        std::erase_if(g_shebangs, [](const auto& kv) { return kv.second.inode.expired(); });
+        if (g_shebangs.size() >= MAX_SHEBANGS) g_shebangs.clear();
+    }
+    auto& slot = g_shebangs[file.get()];
+    slot = {file, file->generation, parse_shebang(file->content.data(), file->content.size())};
+    return slot.result;
+}
+
+inline bool still_valid(vfs::VirtualFS& fs, const PathSlot& slot) {
+    if (slot.tree_generation != fs.tree_generation()) return false;
+    for (const auto& d : slot.dirs) {
+        if (!d.exists) continue;    // Creating it would have bumped the tree generation
+        auto dir = d.dir.lock();
+        if (!dir || dir->generation != d.generation) return false;
+    }
+    // The hit may be a symlink whose target has since gone away
+    if (slot.found.empty()) return true;
+    auto target = fs.resolve(slot.found);
+    return target && target->is_file();
+}
+
+// Search `path_val` (a PATH value) for `cmd`. Returns the first candidate
+// "dir/cmd" that resolves to a regular file, unresolved, or empty.
+inline std::string search_path(vfs::VirtualFS& fs, const std::string& path_val,
+                               const std::string& cmd) {
+    if (cmd.empty() || cmd[0] == '/') return cmd;
+
+    // Relative elements resolve against the cwd, so it is part of the key
+    bool relative = false;
+    for (size_t pos = 0; pos <= path_val.size() && !relative;) {
+        size_t colon = path_val.find(':', pos);
+        if (colon == std::string::npos) colon = path_val.size();
+        relative = colon > pos && path_val[pos] != '/';
+        pos = colon + 1;
+    }
+    std::string key = path_val;
+    key += '\0';
+    if (relative) key += fs.getcwd();
+    key += '\0';
+    key += cmd;
+
+    auto it = g_paths.find(key);
+    if (it != g_paths.end() && still_valid(fs, it->second)) {
+        g_stats.path_hits++;
+        return it->second.found;
+    }
+    g_stats.path_misses++;
+
+    PathSlot slot;
+    slot.tree_generation = fs.tree_generation();
+    bool cacheable = true;
+    size_t pos = 0;
+    while (pos < path_val.size()) {
+        size_t colon = path_val.find(':', pos);
+        std::string dir = (colon == std::string::npos)
+            ? path_val.substr(pos) : path_val.substr(pos, colon - pos);
+        std::string candidate = dir + "/" + cmd;
+
+        std::string parent_path = candidate.substr(0, candidate.rfind('/'));
+        auto parent = fs.resolve(parent_path.empty() ? "/" : parent_path);
+        PathDir pd;
+        if (parent && parent->is_dir()) {
+            pd = {parent, parent->generation, true};
+        } else {
+            cacheable = cacheable && !parent;   // A file or device in PATH: just don't cache
+        }
+        slot.dirs.push_back(pd);
+
+        auto target = fs.resolve(candidate);
+        if (target && target->is_file()) {
+            slot.found = candidate;         // Return unresolved (let caller resolve)
+            break;
+        }
+        // A name that exists but does not resolve to a file (e.g. a dangling
+        // symlink) can start resolving without this directory changing
+        if (parent && parent->is_dir() &&
+            parent->children.count(candidate.substr(candidate.rfind('/') + 1))) {
+            cacheable = false;
+        }
+        pos = (colon == std::string::npos) ? path_val.size() : colon + 1;
+    }
+
+    if (cacheable) {
+        if (g_paths.size() >= MAX_PATHS) g_paths.clear();
+        g_paths[key] = slot;
+    }
+    return slot.found;
+}
+
+inline std::string stats_json() {
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+        "{\"shebang_hits\":%llu,\"shebang_misses\":%llu,"
+        "\"path_hits\":%llu,\"path_misses\":%llu}",
+        (unsigned long long)g_stats.shebang_hits,
+        (unsigned long long)g_stats.shebang_misses,
+        (unsigned long long)g_stats.path_hits,
+        (unsigned long long)g_stats.path_misses);
+    return buf;
+}
+
+}  // namespace execlookup
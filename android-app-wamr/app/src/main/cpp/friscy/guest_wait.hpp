@@ -0,0 +1,122 @@
+// guest_wait.hpp - Interruptible host waits on behalf of the guest
+//
+// Syscall handlers that block on the host — a blocking recv, send, accept
+// or connect, nanosleep — wait here rather than in the raw call, so that a
+// pause (snapshot save/restore) is never stuck behind them. interrupt()
+// wakes every such wait; the handler then calls restart(), which rewinds
+// the ecall and stops the machine exactly like a stdin read that finds no
+// data, and the syscall re-executes once the execution thread resumes.
+//
+// The wakeup is a self-pipe: eventfd's header pulls in <fcntl.h> on
+// Android, which syscalls.hpp must not see.
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include <poll.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace guestwait {
+
+inline std::atomic<bool> g_interrupted{false};
+inline int g_wake_pipe[2] = {-1, -1};
+inline std::once_flag g_wake_once;
+
+// Set by restart(), consumed by the execution loop (execution thread only)
+inline bool g_restart = false;
+
+inline int wake_fd() {
+    std::call_once(g_wake_once, [] {
+        if (::pipe(g_wake_pipe) != 0) g_wake_pipe[0] = g_wake_pipe[1] = -1;
+    });
+    return g_wake_pipe[0];
+}
+
+// Wake every current and future wait until clear()
+inline void interrupt() {
+    if (g_interrupted.exchange(true)) return;   // At most one byte in the pipe
+    wake_fd();
+    if (g_wake_pipe[1] >= 0) {
+        char b = 1;
+        ssize_t r = ::write(g_wake_pipe[1], &b, 1);
+        (void)r;
+    }
+}
+
+inline void clear() {
+    if (!g_interrupted.exchange(false)) return;
+    char b;
+    struct pollfd pfd = {wake_fd(), POLLIN, 0};
+    if (pfd.fd >= 0 && ::poll(&pfd, 1, 0) > 0) {
+        ssize_t r = ::read(pfd.fd, &b, 1);
+        (void)r;
+    }
+}
+
+// Wait for `events` on fd (fd < 0: just the timeout). timeout_ms < 0 waits
+// forever. Returns 1 when ready, 0 on timeout, -1 when interrupted.
+inline int wait(int fd, short events, int timeout_ms = -1) {
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        if (g_interrupted.load()) return -1;
+        struct pollfd pfds[2] = {{fd, events, 0}, {wake_fd(), POLLIN, 0}};
+        int left = -1;
+        if (timeout_ms >= 0) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - Clock::now()).count();
+            left = static_cast<int>(ms > 0 ? ms : 0);
+        }
+        int r = ::poll(pfds, 2, left);
+        if (r < 0 && errno != EINTR) return 1;   // Let the caller's own call report it
+        if (g_interrupted.load()) return -1;
+        if (r > 0 && pfds[1].revents) {
+            char b;     // Stale byte from an interrupt() racing clear()
+            ssize_t n = ::read(pfds[1].fd, &b, 1);
+            (void)n;
+        }
+        if (r > 0 && pfds[0].revents) return 1;
+        if (r == 0 && left >= 0) return 0;
+    }
+}
+
+// Sleep until `deadline_ns` on the steady clock. False when interrupted.
+inline bool sleep_until(uint64_t deadline_ns) {
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (deadline_ns <= now) return !g_interrupted.load();
+    uint64_t ms = (deadline_ns - now + 999'999) / 1'000'000;
+    return wait(-1, 0, static_cast<int>(ms < INT32_MAX ? ms : INT32_MAX)) >= 0;
+}
+
+// Run `op` — a host call made with MSG_DONTWAIT — on behalf of a guest
+// call on fd that blocks unless `nonblocking`, waiting for `events` while
+// it would block. Returns false when a pause interrupted the wait;
+// otherwise `result` (and errno) are op's.
+template <typename Op>
+inline bool blocking_call(int fd, short events, bool nonblocking, ssize_t& result, Op op) {
+    for (;;) {
+        result = op();
+        if (result >= 0 || nonblocking || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return true;
+        }
+        if (wait(fd, events) < 0) return false;
+    }
+}
+
+// Re-execute the current syscall after the pause: rewind past the ecall
+// and stop the machine
+template <typename Machine>
+inline void restart(Machine& m) {
+    g_restart = true;
+    m.cpu.increment_pc(-4);
+    m.stop();
+}
+
+}  // namespace guestwait
@@ -0,0 +1,180 @@
+// io_buffer_pool.hpp - Slab-backed staging buffers for syscall I/O
+//
+// Socket and VFS syscalls sometimes need a host-side staging buffer between
+// guest memory and the destination (recv into a buffer then memcpy into the
+// guest, VFS reads, scatter/gather). Allocating a std::vector per call turns
+// a streaming download into millions of malloc/free pairs, and the vector
+// zero-fills bytes that are about to be overwritten anyway.
+//
+// iobuf::Buffer hands out uninitialized buffers from power-of-four size
+// classes (4K..1M). Each thread keeps a small cache per class, backed by a
+// global mutex-protected free list that is refilled a slab at a time. Slabs
+// are retained for the life of the process, so steady-state I/O performs no
+// heap allocation at all. Requests above the largest class fall back to a
+// plain allocation and are counted separately.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace iobuf {
+
+inline constexpr size_t CLASS_SIZES[] = {
+    4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024,
+};
+inline constexpr int NUM_CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+inline constexpr size_t MAX_POOLED_SIZE = CLASS_SIZES[NUM_CLASSES - 1];
+inline constexpr size_t SLAB_BYTES = 1024 * 1024;  // Carved into class-sized buffers
+inline constexpr int THREAD_CACHE_DEPTH = 4;       // Buffers per class per thread
+
+struct Stats {
+    std::atomic<uint64_t> acquires{0};
+    std::atomic<uint64_t> thread_cache_hits{0};
+    std::atomic<uint64_t> global_hits{0};
+    std::atomic<uint64_t> slab_allocs{0};      // Heap allocations for new slabs
+    std::atomic<uint64_t> slab_bytes{0};
+    std::atomic<uint64_t> oversize_allocs{0};  // Heap allocations above MAX_POOLED_SIZE
+    std::atomic<uint64_t> oversize_bytes{0};
+};
+
+inline Stats g_stats;
+
+inline int size_class(size_t size) {
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        if (size <= CLASS_SIZES[i]) return i;
+    }
+    return -1;
+}
+
+// Global free lists, one per size class
+class SlabPool {
+public:
+    uint8_t* take(int cls) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& list = free_[cls];
+        if (list.empty()) {
+            refill(cls);
+        } else {
+            g_stats.global_hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        uint8_t* p = list.back();
+        list.pop_back();
+        return p;
+    }
+
+    void give(int cls, uint8_t* p) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_[cls].push_back(p);
+    }
+
+private:
+    void refill(int cls) {
+        size_t buf_size = CLASS_SIZES[cls];
+        size_t slab_size = buf_size > SLAB_BYTES ? buf_size : SLAB_BYTES;
+        slabs_.emplace_back(new uint8_t[slab_size]);
+        uint8_t* base = slabs_.back().get();
+        for (size_t off = 0; off + buf_size <= slab_size; off += buf_size) {
+            free_[cls].push_back(base + off);
+        }
+        g_stats.slab_allocs.fetch_add(1, std::memory_order_relaxed);
+        g_stats.slab_bytes.fetch_add(slab_size, std::memory_order_relaxed);
+    }
+
+    std::mutex mutex_;
+    std::vector<uint8_t*> free_[NUM_CLASSES];
+    std::vector<std::unique_ptr<uint8_t[]>> slabs_;
+};
+
+inline SlabPool& global_pool() {
+    static SlabPool pool;
+    return pool;
+}
+
+// Per-thread LIFO cache in front of the global pool. Returned to the global
+// pool when the thread exits.
+struct ThreadCache {
+    uint8_t* bufs[NUM_CLASSES][THREAD_CACHE_DEPTH] = {};
+    int count[NUM_CLASSES] = {};
+
+    ~ThreadCache() {
+        for (int c = 0; c < NUM_CLASSES; c++) {
+            for (int i = 0; i < count[c]; i++) global_pool().give(c, bufs[c][i]);
+        }
+    }
+};
+
+inline thread_local ThreadCache t_cache;
+
+// RAII staging buffer. Contents are uninitialized.
+class Buffer {
+public:
+    explicit Buffer(size_t size) : size_(size) {
+        if (size == 0) return;
+        g_stats.acquires.fetch_add(1, std::memory_order_relaxed);
+        cls_ = size_class(size);
+        if (cls_ < 0) {
+            data_ = new uint8_t[size];
+            g_stats.oversize_allocs.fetch_add(1, std::memory_order_relaxed);
+            g_stats.oversize_bytes.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+        auto& tc = t_cache;
+        if (tc.count[cls_] > 0) {
+            data_ = tc.bufs[cls_][--tc.count[cls_]];
+            g_stats.thread_cache_hits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            data_ = global_pool().take(cls_);
+        }
+    }
+
+    ~Buffer() {
+        if (!data_) return;
+        if (cls_ < 0) {
+            delete[] data_;
+            return;
+        }
+        auto& tc = t_cache;
+        if (tc.count[cls_] < THREAD_CACHE_DEPTH) {
+            tc.bufs[cls_][tc.count[cls_]++] = data_;
+        } else {
+            global_pool().give(cls_, data_);
+        }
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    int cls_ = -1;
+};
+
+inline std::string stats_json() {
+    char buf[384];
+    snprintf(buf, sizeof(buf),
+        "{\"acquires\":%llu,\"thread_cache_hits\":%llu,\"global_hits\":%llu,"
+        "\"slab_allocs\":%llu,\"slab_bytes\":%llu,"
+        "\"oversize_allocs\":%llu,\"oversize_bytes\":%llu}",
+        (unsigned long long)g_stats.acquires.load(),
+        (unsigned long long)g_stats.thread_cache_hits.load(),
+        (unsigned long long)g_stats.global_hits.load(),
+        (unsigned long long)g_stats.slab_allocs.load(),
+        (unsigned long long)g_stats.slab_bytes.load(),
+        (unsigned long long)g_stats.oversize_allocs.load(),
+        (unsigned long long)g_stats.oversize_bytes.load());
+    return buf;
+}
+
+}  // namespace iobuf
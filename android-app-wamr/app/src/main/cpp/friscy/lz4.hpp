@@ -0,0 +1,171 @@
+// lz4.hpp - Minimal LZ4 block-format codec for friscy snapshots
+//
+// The Android build has no compression library vendored (NDK zlib is far
+// slower than we want on the restore path), so this is a small greedy
+// LZ4 block compressor plus a bounds-checked decompressor. Output is the
+// standard LZ4 *block* format (no frame header), so chunks can be inspected
+// with any LZ4 implementation given the raw size.
+//
+// Speed, not ratio, is the goal: guest memory is mostly zero pages (skipped
+// before we get here), code, and heap data that compresses 2-4x even with a
+// single-probe hash table.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace lz4 {
+
+inline constexpr size_t MIN_MATCH = 4;
+inline constexpr size_t LAST_LITERALS = 5;   // Block must end with >= 5 literals
+inline constexpr size_t MF_LIMIT = 12;       // Last match must start >= 12 bytes from end
+inline constexpr int HASH_LOG = 14;
+inline constexpr size_t MAX_OFFSET = 65535;
+
+// Worst-case compressed size for n input bytes.
+inline constexpr size_t compress_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+namespace detail {
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint32_t hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+inline uint8_t* write_length(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+}  // namespace detail
+
+// Compress src[0..n) into dst (capacity >= compress_bound(n)).
+// Returns the compressed size.
+inline size_t compress(const uint8_t* src, size_t n, uint8_t* dst) {
+    using namespace detail;
+    uint8_t* op = dst;
+    size_t anchor = 0;
+
+    if (n >= MF_LIMIT + 1) {
+        int32_t table[1 << HASH_LOG];
+        memset(table, 0xFF, sizeof(table));  // -1 = empty
+
+        const size_t match_limit = n - LAST_LITERALS;
+        const size_t mf_limit = n - MF_LIMIT;
+        size_t ip = 0;
+
+        while (ip < mf_limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash(seq);
+            int32_t ref = table[h];
+            table[h] = static_cast<int32_t>(ip);
+
+            if (ref < 0 || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                // Skip faster through incompressible data
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            size_t mlen = MIN_MATCH;
+            while (ip + mlen < match_limit && src[ref + mlen] == src[ip + mlen]) mlen++;
+
+            size_t lit = ip - anchor;
+            uint8_t* token = op++;
+            size_t ml_code = mlen - MIN_MATCH;
+            *token = static_cast<uint8_t>(((lit >= 15 ? 15 : lit) << 4) |
+                                          (ml_code >= 15 ? 15 : ml_code));
+            if (lit >= 15) op = write_length(op, lit - 15);
+            memcpy(op, src + anchor, lit);
+            op += lit;
+            uint16_t off = static_cast<uint16_t>(ip - ref);
+            *op++ = static_cast<uint8_t>(off);
+            *op++ = static_cast<uint8_t>(off >> 8);
+            if (ml_code >= 15) op = write_length(op, ml_code - 15);
+
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    // Trailing literals
+    size_t lit = n - anchor;
+    *op++ = static_cast<uint8_t>((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = write_length(op, lit - 15);
+    if (lit) memcpy(op, src + anchor, lit);
+    op += lit;
+    return static_cast<size_t>(op - dst);
+}
+
+// Decompress an LZ4 block into exactly raw_size bytes.
+// Returns false on malformed or truncated input.
+inline bool decompress(const uint8_t* src, size_t src_size,
+                       uint8_t* dst, size_t raw_size) {
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + raw_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op)) {
+            return false;
+        }
+        if (lit) memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == iend) break;  // Last sequence has no match
+
+        if (iend - ip < 2) return false;
+        size_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > static_cast<size_t>(op - dst)) return false;
+
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += MIN_MATCH;
+        if (mlen > static_cast<size_t>(oend - op)) return false;
+
+        const uint8_t* match = op - off;
+        if (off >= mlen) {
+            memcpy(op, match, mlen);
+            op += mlen;
+        } else {
+            // Overlapping copy (run-length style)
+            for (size_t i = 0; i < mlen; i++) *op++ = match[i];
+        }
+    }
+    return op == oend;
+}
+
+}  // namespace lz4
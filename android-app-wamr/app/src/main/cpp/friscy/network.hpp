@@ -23,17 +23,28 @@
 #include <vector>
 #include <functional>
 #include <cstring>
+#include <cstddef>
+#include <string>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #else
 // Native: use real POSIX sockets
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include "io_buffer_pool.hpp"
+#include "guest_wait.hpp"
+#include "traffic_shaper.hpp"
+#include "serial.hpp"
 #endif
 
 namespace net {
@@ -118,6 +129,9 @@ struct VSocket {
 
 #ifndef __EMSCRIPTEN__
     int native_fd;           // Real socket fd for native builds
+    int shaped_fd = -1;      // Real socket when native_fd is a shaper relay end
+    bool shape_pending = false;  // Non-blocking connect in flight (see finish_connect)
+    std::string unix_path;   // Guest path for bound AF_UNIX sockets
 #endif
 
     // For connected sockets
@@ -135,6 +149,98 @@ struct VSocket {
     {}
 };
 
+#ifndef __EMSCRIPTEN__
+// =============================================================================
+// Guest listener registry
+// =============================================================================
+//
+// Records every guest socket that has successfully called listen(), together
+// with the host address its native socket is actually reachable on. The port
+// forwarder (port_forward.hpp) resolves forwarding targets through this
+// registry from its own threads, so unlike NetworkContext it is locked.
+
+struct GuestListener {
+    int guest_fd = -1;
+    int domain = 0;
+    uint16_t port = 0;           // Host byte order (INET/INET6)
+    std::string unix_path;       // Guest path (UNIX)
+    struct sockaddr_storage addr{};  // Connectable host address
+    socklen_t addr_len = 0;
+};
+
+class ListenerRegistry {
+public:
+    void add(const GuestListener& l) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners_[l.guest_fd] = l;
+    }
+
+    void remove(int guest_fd) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners_.erase(guest_fd);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners_.clear();
+    }
+
+    bool find_port(uint16_t port, GuestListener& out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [fd, l] : listeners_) {
+            if ((l.domain == af::INET || l.domain == af::INET6) && l.port == port) {
+                out = l;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool find_unix(const std::string& path, GuestListener& out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [fd, l] : listeners_) {
+            if (l.domain == af::UNIX && l.unix_path == path) {
+                out = l;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<int, GuestListener> listeners_;
+};
+
+inline ListenerRegistry& get_listener_registry() {
+    static ListenerRegistry registry;
+    return registry;
+}
+
+// Guest AF_UNIX sockets live in the host's abstract namespace so they never
+// touch the host filesystem: guest "/tmp/app.sock" -> host "\0friscy/tmp/app.sock".
+inline socklen_t make_host_unix_addr(const std::string& guest_path,
+                                     struct sockaddr_un& out) {
+    static constexpr char PREFIX[] = "friscy";
+    memset(&out, 0, sizeof(out));
+    out.sun_family = AF_UNIX;
+    size_t max_name = sizeof(out.sun_path) - 1 - (sizeof(PREFIX) - 1);
+    size_t n = std::min(guest_path.size(), max_name);
+    memcpy(out.sun_path + 1, PREFIX, sizeof(PREFIX) - 1);
+    memcpy(out.sun_path + 1 + sizeof(PREFIX) - 1, guest_path.data(), n);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) +
+                                  1 + (sizeof(PREFIX) - 1) + n);
+}
+
+// Extract the path from a guest sockaddr_un (same layout as Linux).
+inline std::string guest_unix_path(const uint8_t* addr, uint32_t addrlen) {
+    if (addrlen <= 2) return {};
+    const char* p = reinterpret_cast<const char*>(addr + 2);
+    size_t max = std::min<size_t>(addrlen - 2, 108);
+    return std::string(p, strnlen(p, max));
+}
+#endif
+
 // Network context - holds all virtual sockets
 class NetworkContext {
 public:
@@ -143,9 +249,16 @@ public:
     NetworkContext() : next_fd_(SOCKET_FD_BASE) {}
 
     int create_socket(int domain, int type, int protocol) {
+#ifdef __EMSCRIPTEN__
         if (domain != af::INET && domain != af::INET6) {
             return err::AFNOSUPPORT;
         }
+#else
+        if (domain != af::INET && domain != af::INET6 && domain != af::UNIX) {
+            return err::AFNOSUPPORT;
+        }
+        if (domain == af::UNIX) protocol = 0;
+#endif
         if (type != sock::STREAM && type != sock::DGRAM) {
             return err::PROTOTYPE;
         }
@@ -196,6 +309,12 @@ public:
         notify_socket_closed(fd);
 #else
         // Native: close real socket
+        if (it->second.listening) {
+            get_listener_registry().remove(fd);
+        }
+        if (it->second.type == sock::DGRAM && it->second.native_fd >= 0) {
+            get_traffic_shaper().release_datagrams(it->second.native_fd);
+        }
         if (it->second.native_fd >= 0) {
             ::close(it->second.native_fd);
         }
@@ -209,17 +328,48 @@ public:
         return fd >= SOCKET_FD_BASE && sockets_.count(fd) > 0;
     }
 
+    // O_NONBLOCK via SOCK_NONBLOCK, fcntl or FIONBIO. The native fd follows,
+    // so host calls made on the guest's behalf never block when the guest
+    // asked them not to.
+    int set_nonblocking(int fd, bool enabled) {
+        auto it = sockets_.find(fd);
+        if (it == sockets_.end()) return err::NOTSOCK;
+        it->second.nonblocking = enabled;
+#ifndef __EMSCRIPTEN__
+        int native_fd = it->second.native_fd;
+        int flags = native_fd >= 0 ? ::fcntl(native_fd, F_GETFL, 0) : -1;
+        if (flags >= 0) {
+            flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+            ::fcntl(native_fd, F_SETFL, flags);
+        }
+#endif
+        return 0;
+    }
+
 #ifndef __EMSCRIPTEN__
     int get_native_fd(int fd) const {
         auto it = sockets_.find(fd);
         if (it == sockets_.end()) return -1;
         return it->second.native_fd;
     }
+
+
+    // When set, guest binds to INADDR_ANY / in6addr_any are narrowed to
+    // loopback so guest servers are only reachable through port forwards.
+    void set_loopback_only(bool enabled) { loopback_only_.store(enabled); }
+    bool loopback_only() const { return loopback_only_.load(); }
+
+    // Snapshot state (defined after register_listener)
+    void save_state(serial::Writer& w) const;
+    bool load_state(serial::Reader& r);
 #endif
 
 private:
     int next_fd_;
     std::unordered_map<int, VSocket> sockets_;
+#ifndef __EMSCRIPTEN__
+    std::atomic<bool> loopback_only_{false};     // Set from the JNI thread
+#endif
 
 #ifdef __EMSCRIPTEN__
     // JavaScript bridge functions (implemented in network_bridge.js)
@@ -247,6 +397,80 @@ inline NetworkContext& get_network_ctx() {
     return ctx;
 }
 
+#ifndef __EMSCRIPTEN__
+// Route a freshly connected/accepted TCP socket through the traffic shaper
+// if its peer matches a shaping rule. The guest keeps using native_fd,
+// which becomes the shaper's relay end; the real socket moves to shaped_fd.
+inline void maybe_shape(VSocket& sock) {
+    sock.shape_pending = false;
+    if (sock.type != sock::STREAM || sock.shaped_fd >= 0) return;
+    if (sock.domain != af::INET && sock.domain != af::INET6) return;
+
+    struct sockaddr_storage peer{};
+    socklen_t len = sizeof(peer);
+    if (::getpeername(sock.native_fd, (struct sockaddr*)&peer, &len) != 0) return;
+
+    ShapingProfile profile;
+    if (!get_traffic_shaper().lookup((struct sockaddr*)&peer, profile)) return;
+
+    int relay_fd = get_traffic_shaper().interpose(sock.native_fd, profile, sock.nonblocking);
+    if (relay_fd < 0) return;
+    sock.shaped_fd = sock.native_fd;
+    sock.native_fd = relay_fd;
+}
+
+// A non-blocking connect returned EINPROGRESS. Once the real socket is
+// writable the handshake is over: mark it connected and shape it before the
+// guest moves any data. Called on every entry point that touches the socket.
+inline void finish_connect(VSocket& sock) {
+    if (!sock.shape_pending) return;
+    struct pollfd pfd = {sock.native_fd, POLLOUT, 0};
+    if (::poll(&pfd, 1, 0) <= 0) return;
+    sock.shape_pending = false;
+
+    // SO_ERROR is left for the guest to read; getpeername tells success apart
+    struct sockaddr_storage peer{};
+    socklen_t len = sizeof(peer);
+    if (::getpeername(sock.native_fd, (struct sockaddr*)&peer, &len) != 0) return;
+    sock.connected = true;
+    maybe_shape(sock);
+}
+
+// The host socket backing guest read/write/poll (syscalls.hpp bridge)
+inline int io_native_fd(int fd) {
+    auto* sock = get_network_ctx().get_socket(fd);
+    if (!sock) return -1;
+    finish_connect(*sock);
+    return sock->native_fd;
+}
+
+// The real network socket, behind the shaper's relay if there is one
+inline int real_fd(const VSocket& sock) {
+    return sock.shaped_fd >= 0 ? sock.shaped_fd : sock.native_fd;
+}
+
+// Finish a blocking guest connect() whose handshake is in flight
+// (shape_pending). The wait is interruptible: on a pause the call is set up
+// to re-execute, and the re-executed connect() comes back here.
+inline void wait_connect(Machine& m, VSocket& sock) {
+    if (guestwait::wait(sock.native_fd, POLLOUT) < 0) {
+        guestwait::restart(m);
+        return;
+    }
+    sock.shape_pending = false;
+    int error = 0;
+    socklen_t len = sizeof(error);
+    ::getsockopt(sock.native_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0) {
+        m.set_result(-error);
+        return;
+    }
+    sock.connected = true;
+    maybe_shape(sock);
+    m.set_result(0);
+}
+#endif
+
 // =============================================================================
 // Syscall handlers
 // =============================================================================
@@ -265,8 +489,7 @@ inline void sys_socket(Machine& m) {
     int result = get_network_ctx().create_socket(domain, type, protocol);
 
     if (result >= 0 && nonblock) {
-        auto* sock = get_network_ctx().get_socket(result);
-        if (sock) sock->nonblocking = true;
+        get_network_ctx().set_nonblocking(result, true);
     }
 
     m.set_result(result);
@@ -315,9 +538,40 @@ inline void sys_bind(Machine& m) {
     }
 #else
     // Native: use real bind
-    struct ::sockaddr_in native_addr;
+    if (sock->domain == af::UNIX) {
+        std::string path = guest_unix_path(addr_data.data(), addrlen);
+        if (path.empty()) {
+            m.set_result(-22);  // EINVAL (autobind not supported)
+            return;
+        }
+        struct sockaddr_un host_addr;
+        socklen_t host_len = make_host_unix_addr(path, host_addr);
+        if (::bind(sock->native_fd, (struct sockaddr*)&host_addr, host_len) != 0) {
+            m.set_result(-errno);
+            return;
+        }
+        sock->unix_path = path;
+        m.set_result(0);
+        return;
+    }
+
+    struct sockaddr_storage native_addr{};
     memcpy(&native_addr, addr_data.data(), std::min(addrlen, (uint32_t)sizeof(native_addr)));
 
+    if (get_network_ctx().loopback_only()) {
+        if (sock->domain == af::INET) {
+            auto* in = reinterpret_cast<struct ::sockaddr_in*>(&native_addr);
+            if (in->sin_addr.s_addr == htonl(INADDR_ANY)) {
+                in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            }
+        } else if (sock->domain == af::INET6) {
+            auto* in6 = reinterpret_cast<struct ::sockaddr_in6*>(&native_addr);
+            if (memcmp(&in6->sin6_addr, &in6addr_any, sizeof(in6addr_any)) == 0) {
+                in6->sin6_addr = in6addr_loopback;
+            }
+        }
+    }
+
     int result = ::bind(sock->native_fd, (struct sockaddr*)&native_addr, addrlen);
     if (result == 0) {
         m.set_result(0);
@@ -327,6 +581,156 @@ inline void sys_bind(Machine& m) {
 #endif
 }
 
+#ifndef __EMSCRIPTEN__
+// Publish a listening guest socket to the port forwarder. The connectable
+// address is taken from the kernel (so ephemeral ports resolve), with
+// wildcard binds rewritten to the matching loopback address.
+inline void register_listener(const VSocket& sock) {
+    GuestListener l;
+    l.guest_fd = sock.fd;
+    l.domain = sock.domain;
+
+    if (sock.domain == af::UNIX) {
+        if (sock.unix_path.empty()) return;
+        l.unix_path = sock.unix_path;
+        struct sockaddr_un host_addr;
+        l.addr_len = make_host_unix_addr(sock.unix_path, host_addr);
+        memcpy(&l.addr, &host_addr, l.addr_len);
+        get_listener_registry().add(l);
+        return;
+    }
+
+    socklen_t len = sizeof(l.addr);
+    if (::getsockname(sock.native_fd, (struct sockaddr*)&l.addr, &len) != 0) return;
+    l.addr_len = len;
+
+    if (l.addr.ss_family == AF_INET) {
+        auto* in = reinterpret_cast<struct ::sockaddr_in*>(&l.addr);
+        if (in->sin_addr.s_addr == htonl(INADDR_ANY)) {
+            in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        }
+        l.port = ntohs(in->sin_port);
+    } else if (l.addr.ss_family == AF_INET6) {
+        auto* in6 = reinterpret_cast<struct ::sockaddr_in6*>(&l.addr);
+        if (memcmp(&in6->sin6_addr, &in6addr_any, sizeof(in6addr_any)) == 0) {
+            in6->sin6_addr = in6addr_loopback;
+        }
+        l.port = ntohs(in6->sin6_port);
+    } else {
+        return;
+    }
+    get_listener_registry().add(l);
+}
+
+// --- Snapshot state ---
+//
+// Host sockets cannot be saved, only described. On restore, listening
+// sockets are re-created on the address they were bound to and published
+// to the port forwarder again, so guest servers keep accepting. Connected
+// sockets are replaced with a stream whose peer has already closed: the
+// guest sees EOF/EPIPE and drops the connection the way it would after a
+// network failure. Other sockets come back fresh, re-bound if they were.
+
+inline void NetworkContext::save_state(serial::Writer& w) const {
+    w.i32(next_fd_);
+    w.u8(loopback_only_.load());
+    w.u32(static_cast<uint32_t>(sockets_.size()));
+    for (const auto& [fd, sock] : sockets_) {
+        w.i32(fd);
+        w.i32(sock.domain);
+        w.i32(sock.type);
+        w.i32(sock.protocol);
+        w.u8(sock.connected);
+        w.u8(sock.listening);
+        w.u8(sock.nonblocking);
+        w.str(sock.unix_path);
+
+        // Bound host address, if any (UNIX sockets rebind via unix_path)
+        std::vector<uint8_t> addr;
+        struct sockaddr_storage ss{};
+        socklen_t len = sizeof(ss);
+        if (sock.domain != af::UNIX && sock.native_fd >= 0 &&
+            ::getsockname(sock.native_fd, (struct sockaddr*)&ss, &len) == 0) {
+            uint16_t port = ss.ss_family == AF_INET6
+                ? reinterpret_cast<struct ::sockaddr_in6*>(&ss)->sin6_port
+                : reinterpret_cast<struct ::sockaddr_in*>(&ss)->sin_port;
+            if (port != 0) {
+                const uint8_t* p = reinterpret_cast<const uint8_t*>(&ss);
+                addr.assign(p, p + len);
+            }
+        }
+        w.bytes(addr);
+    }
+}
+
+inline bool NetworkContext::load_state(serial::Reader& r) {
+    // Drop the current session's sockets (and their listener entries)
+    std::vector<int> open_fds;
+    for (const auto& [fd, sock] : sockets_) open_fds.push_back(fd);
+    for (int fd : open_fds) close_socket(fd);
+
+    int next_fd = r.i32();
+    bool loopback_only = r.u8() != 0;
+    uint32_t count = r.u32();
+    for (uint32_t i = 0; i < count && r.ok(); i++) {
+        VSocket sock;
+        sock.fd = r.i32();
+        sock.domain = r.i32();
+        sock.type = r.i32();
+        sock.protocol = r.i32();
+        sock.connected = r.u8() != 0;
+        sock.listening = r.u8() != 0;
+        sock.nonblocking = r.u8() != 0;
+        sock.unix_path = r.str();
+        std::vector<uint8_t> addr = r.bytes();
+        if (!r.ok() || addr.size() > sizeof(struct sockaddr_storage)) return false;
+
+        if (sock.connected) {
+            int pair[2];
+            if (::socketpair(AF_UNIX, sock.type == sock::DGRAM ? SOCK_DGRAM : SOCK_STREAM,
+                             0, pair) == 0) {
+                ::close(pair[1]);
+                sock.native_fd = pair[0];
+            }
+            sockets_[sock.fd] = std::move(sock);
+            continue;
+        }
+
+        sock.native_fd = ::socket(sock.domain, sock.type, sock.protocol);
+        if (sock.native_fd >= 0) {
+            bool bound = false;
+            if (sock.domain == af::UNIX && !sock.unix_path.empty()) {
+                struct sockaddr_un host_addr;
+                socklen_t host_len = make_host_unix_addr(sock.unix_path, host_addr);
+                bound = ::bind(sock.native_fd, (struct sockaddr*)&host_addr, host_len) == 0;
+            } else if (!addr.empty()) {
+                int one = 1;
+                ::setsockopt(sock.native_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                bound = ::bind(sock.native_fd, (const struct sockaddr*)addr.data(),
+                               static_cast<socklen_t>(addr.size())) == 0;
+            }
+            if (sock.listening) {
+                sock.listening = bound && ::listen(sock.native_fd, SOMAXCONN) == 0;
+                if (sock.listening) {
+                    int flags = ::fcntl(sock.native_fd, F_GETFL, 0);
+                    if (flags >= 0) ::fcntl(sock.native_fd, F_SETFL, flags | O_NONBLOCK);
+                } else {
+                    fprintf(stderr, "[net] Could not re-listen guest fd %d: %s\n",
+                            sock.fd, strerror(errno));
+                }
+            }
+        }
+        int fd = sock.fd;
+        sockets_[fd] = std::move(sock);
+        if (sockets_[fd].nonblocking) set_nonblocking(fd, true);
+        if (sockets_[fd].listening) register_listener(sockets_[fd]);
+    }
+    next_fd_ = next_fd;
+    loopback_only_.store(loopback_only);
+    return r.ok();
+}
+#endif
+
 // syscall 201: listen(sockfd, backlog)
 inline void sys_listen(Machine& m) {
     int sockfd = m.template sysarg<int>(0);
@@ -360,6 +764,7 @@ inline void sys_listen(Machine& m) {
         if (cur_flags >= 0) {
             ::fcntl(sock->native_fd, F_SETFL, cur_flags | O_NONBLOCK);
         }
+        register_listener(*sock);
         m.set_result(0);
     } else {
         m.set_result(-errno);
@@ -456,7 +861,16 @@ inline void sys_accept(Machine& m) {
     struct ::sockaddr_in peer_addr;
     socklen_t peer_len = sizeof(peer_addr);
 
-    int new_fd = ::accept(sock->native_fd, (struct sockaddr*)&peer_addr, &peer_len);
+    // The native listener is always non-blocking; a blocking guest
+    // listener waits here, interruptibly
+    ssize_t accepted;
+    if (!guestwait::blocking_call(sock->native_fd, POLLIN, sock->nonblocking, accepted, [&] {
+            return ::accept(sock->native_fd, (struct sockaddr*)&peer_addr, &peer_len);
+        })) {
+        guestwait::restart(m);
+        return;
+    }
+    int new_fd = static_cast<int>(accepted);
     if (new_fd < 0) {
         m.set_result(-errno);
         return;
@@ -474,6 +888,7 @@ inline void sys_accept(Machine& m) {
     if (new_sock) {
         new_sock->native_fd = new_fd;
         new_sock->connected = true;
+        maybe_shape(*new_sock);
     }
 
     // Write peer address
@@ -570,7 +985,14 @@ inline void sys_accept4(Machine& m) {
     struct ::sockaddr_in peer_addr;
     socklen_t peer_len = sizeof(peer_addr);
 
-    int new_native_fd = ::accept(sock->native_fd, (struct sockaddr*)&peer_addr, &peer_len);
+    ssize_t accepted;
+    if (!guestwait::blocking_call(sock->native_fd, POLLIN, sock->nonblocking, accepted, [&] {
+            return ::accept(sock->native_fd, (struct sockaddr*)&peer_addr, &peer_len);
+        })) {
+        guestwait::restart(m);
+        return;
+    }
+    int new_native_fd = static_cast<int>(accepted);
     if (new_native_fd < 0) {
         m.set_result(-errno);
         return;
@@ -596,6 +1018,7 @@ inline void sys_accept4(Machine& m) {
         new_sock->native_fd = new_native_fd;
         new_sock->connected = true;
         if (nonblock) new_sock->nonblocking = true;
+        maybe_shape(*new_sock);
     }
 
     if (addr_ptr && addrlen_ptr) {
@@ -622,6 +1045,13 @@ inline void sys_connect(Machine& m) {
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    if (sock->shape_pending && !sock->nonblocking) {
+        wait_connect(m, *sock);   // Re-executed after a pause
+        return;
+    }
+    finish_connect(*sock);
+#endif
     if (sock->connected) {
         m.set_result(err::ISCONN);
         return;
@@ -647,15 +1077,44 @@ inline void sys_connect(Machine& m) {
     m.set_result(result);
 #else
     // Native: use real connect
+    if (sock->domain == af::UNIX) {
+        struct sockaddr_un host_addr;
+        socklen_t host_len = make_host_unix_addr(
+            guest_unix_path(addr_data.data(), addrlen), host_addr);
+        if (::connect(sock->native_fd, (struct sockaddr*)&host_addr, host_len) != 0) {
+            if (errno == EINPROGRESS) sock->shape_pending = true;
+            m.set_result(-errno);
+            return;
+        }
+        sock->connected = true;
+        m.set_result(0);
+        return;
+    }
+
     struct ::sockaddr_in native_addr;
     memcpy(&native_addr, addr_data.data(), std::min(addrlen, (uint32_t)sizeof(native_addr)));
 
+    // A blocking connect is issued non-blocking and waited for in
+    // wait_connect(), so a pause can interrupt the handshake
+    int flags = sock->nonblocking ? -1 : ::fcntl(sock->native_fd, F_GETFL, 0);
+    if (flags >= 0) ::fcntl(sock->native_fd, F_SETFL, flags | O_NONBLOCK);
     int result = ::connect(sock->native_fd, (struct sockaddr*)&native_addr, addrlen);
+    int error = result == 0 ? 0 : errno;
+    if (flags >= 0) ::fcntl(sock->native_fd, F_SETFL, flags);
+
     if (result == 0) {
         sock->connected = true;
+        maybe_shape(*sock);
         m.set_result(0);
+    } else if (error == EINPROGRESS) {
+        sock->shape_pending = true;
+        if (sock->nonblocking) {
+            m.set_result(-error);
+        } else {
+            wait_connect(m, *sock);
+        }
     } else {
-        m.set_result(-errno);
+        m.set_result(-error);
     }
 #endif
 }
@@ -674,16 +1133,57 @@ inline void sys_sendto(Machine& m) {
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    finish_connect(*sock);
+#endif
     if (sock->type == sock::STREAM && !sock->connected) {
         m.set_result(err::NOTCONN);
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    // UDP: an explicit destination, shaped by the delay line if a rule
+    // matches it (or the connected peer)
+    struct sockaddr_storage dest{};
+    socklen_t dest_len = 0;
+    if (sock->type == sock::DGRAM) {
+        uint64_t dest_ptr = m.template sysarg<uint64_t>(4);
+        uint32_t guest_dest_len = m.template sysarg<uint32_t>(5);
+        struct sockaddr_storage peer{};
+        socklen_t peer_len = sizeof(peer);
+        bool have_dest = false;
+        if (dest_ptr && guest_dest_len >= 2) {
+            dest_len = std::min<uint32_t>(guest_dest_len, sizeof(dest));
+            m.memory.memcpy_out(&dest, dest_ptr, dest_len);
+            peer = dest;
+            have_dest = true;
+        } else {
+            have_dest = ::getpeername(sock->native_fd, (struct sockaddr*)&peer, &peer_len) == 0;
+        }
+        ShapingProfile profile;
+        int64_t delay_ms = 0;
+        if (have_dest && get_traffic_shaper().lookup((struct sockaddr*)&peer, profile)) {
+            if (!get_traffic_shaper().shape_datagram(profile, delay_ms)) {
+                m.set_result(static_cast<int64_t>(len));  // Lost in transit
+                return;
+            }
+            if (delay_ms > 0) {
+                iobuf::Buffer data(len);
+                m.memory.memcpy_out(data.data(), buf_ptr, len);
+                get_traffic_shaper().send_later(sock->native_fd, data.data(), len,
+                                                (struct sockaddr*)&dest, dest_len, delay_ms);
+                m.set_result(static_cast<int64_t>(len));   // In flight
+                return;
+            }
+        }
+    }
+#endif
+
+#ifdef __EMSCRIPTEN__
     // Read data from guest memory
     std::vector<uint8_t> data(len);
     m.memory.memcpy_out(data.data(), buf_ptr, len);
 
-#ifdef __EMSCRIPTEN__
     int result = EM_ASM_INT({
         if (typeof Module.onSocketSend === 'function') {
             const data = new Uint8Array(Module.HEAPU8.buffer, $1, $2);
@@ -694,8 +1194,26 @@ inline void sys_sendto(Machine& m) {
 
     m.set_result(result >= 0 ? (int64_t)len : result);
 #else
-    // Native: use real send
-    ssize_t result = ::send(sock->native_fd, data.data(), len, 0);
+    // Native: send straight from the arena when the range is contiguous,
+    // otherwise stage through a pooled buffer
+    const uint8_t* direct = nullptr;
+    try {
+        direct = reinterpret_cast<const uint8_t*>(m.memory.memview(buf_ptr, len).data());
+    } catch (...) {}
+
+    const struct sockaddr* to = dest_len ? (struct sockaddr*)&dest : nullptr;
+    iobuf::Buffer staged(direct ? 0 : len);
+    if (!direct) {
+        m.memory.memcpy_out(staged.data(), buf_ptr, len);
+        direct = staged.data();
+    }
+    ssize_t result;
+    if (!guestwait::blocking_call(sock->native_fd, POLLOUT, sock->nonblocking, result, [&] {
+            return ::sendto(sock->native_fd, direct, len, MSG_DONTWAIT, to, dest_len);
+        })) {
+        guestwait::restart(m);
+        return;
+    }
     if (result >= 0) {
         m.set_result(result);
     } else {
@@ -718,6 +1236,9 @@ inline void sys_recvfrom(Machine& m) {
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    finish_connect(*sock);
+#endif
     if (sock->type == sock::STREAM && !sock->connected) {
         m.set_result(err::NOTCONN);
         return;
@@ -742,9 +1263,16 @@ inline void sys_recvfrom(Machine& m) {
         m.set_result(-11);
     }
 #else
-    // Native: use real recv
-    std::vector<uint8_t> buf(len);
-    ssize_t result = ::recv(sock->native_fd, buf.data(), len, 0);
+    // Native: use real recv. Stage through a pooled buffer capped at the
+    // largest size class (larger than any datagram; streams may short-read).
+    iobuf::Buffer buf(std::min(len, iobuf::MAX_POOLED_SIZE));
+    ssize_t result;
+    if (!guestwait::blocking_call(sock->native_fd, POLLIN, sock->nonblocking, result, [&] {
+            return ::recv(sock->native_fd, buf.data(), buf.size(), MSG_DONTWAIT);
+        })) {
+        guestwait::restart(m);
+        return;
+    }
     if (result > 0) {
         m.memory.memcpy(buf_ptr, buf.data(), result);
         m.set_result(result);
@@ -756,13 +1284,16 @@ inline void sys_recvfrom(Machine& m) {
 #endif
 }
 
+// Largest socket option value passed through (struct linger, timeval, ...)
+constexpr uint32_t MAX_SOCKOPT_LEN = 256;
+
 // syscall 208: setsockopt
 inline void sys_setsockopt(Machine& m) {
     int sockfd = m.template sysarg<int>(0);
     int level = m.template sysarg<int>(1);
     int optname = m.template sysarg<int>(2);
-    (void)level;
-    (void)optname;
+    uint64_t optval_ptr = m.template sysarg<uint64_t>(3);
+    uint32_t optlen = m.template sysarg<uint32_t>(4);
 
     auto* sock = get_network_ctx().get_socket(sockfd);
     if (!sock) {
@@ -770,7 +1301,29 @@ inline void sys_setsockopt(Machine& m) {
         return;
     }
 
-    // Accept most options silently
+#ifndef __EMSCRIPTEN__
+    // Native: apply to the real socket (not a shaper relay end), so
+    // TCP_NODELAY, keepalive, buffer sizes etc. act on the network
+    finish_connect(*sock);
+    if (optlen > MAX_SOCKOPT_LEN) {
+        m.set_result(-22);  // EINVAL
+        return;
+    }
+    uint8_t optval[MAX_SOCKOPT_LEN];
+    if (optlen) m.memory.memcpy_out(optval, optval_ptr, optlen);
+    if (::setsockopt(real_fd(*sock), level, optname, optval, optlen) != 0 &&
+        errno != ENOPROTOOPT && errno != EOPNOTSUPP) {
+        m.set_result(-errno);
+        return;
+    }
+#else
+    (void)level;
+    (void)optname;
+    (void)optval_ptr;
+    (void)optlen;
+#endif
+
+    // Accept unsupported options silently
     m.set_result(0);
 }
 
@@ -781,7 +1334,6 @@ inline void sys_getsockopt(Machine& m) {
     int optname = m.template sysarg<int>(2);
     uint64_t optval_ptr = m.template sysarg<uint64_t>(3);
     uint64_t optlen_ptr = m.template sysarg<uint64_t>(4);
-    (void)level;
 
     auto* sock = get_network_ctx().get_socket(sockfd);
     if (!sock) {
@@ -789,6 +1341,25 @@ inline void sys_getsockopt(Machine& m) {
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    // Native: read from the real socket, so SO_ERROR reports the outcome of
+    // a non-blocking connect even when the guest talks to a shaper relay
+    finish_connect(*sock);
+    uint32_t optlen = 0;
+    m.memory.memcpy_out(&optlen, optlen_ptr, sizeof(optlen));
+    uint8_t optval[MAX_SOCKOPT_LEN] = {};
+    socklen_t len = std::min(optlen, MAX_SOCKOPT_LEN);
+    if (::getsockopt(real_fd(*sock), level, optname, optval, &len) != 0) {
+        m.set_result(-errno);
+        return;
+    }
+    uint32_t copy_len = std::min<uint32_t>(optlen, len);
+    if (copy_len) m.memory.memcpy(optval_ptr, optval, copy_len);
+    m.memory.memcpy(optlen_ptr, &copy_len, sizeof(copy_len));
+    m.set_result(0);
+#else
+    (void)level;
+
     // Handle SO_ERROR specially
     if (optname == so::ERROR) {
         int32_t error = 0;
@@ -800,6 +1371,7 @@ inline void sys_getsockopt(Machine& m) {
     }
 
     m.set_result(err::NOPROTOOPT);
+#endif
 }
 
 // syscall 210: shutdown
@@ -842,7 +1414,8 @@ inline void sys_getsockname(Machine& m) {
     if (sock->native_fd >= 0) {
         struct ::sockaddr_in native_addr;
         socklen_t native_len = sizeof(native_addr);
-        if (::getsockname(sock->native_fd, (struct sockaddr*)&native_addr, &native_len) == 0) {
+        finish_connect(*sock);
+        if (::getsockname(real_fd(*sock), (struct sockaddr*)&native_addr, &native_len) == 0) {
             uint32_t addrlen;
             m.memory.memcpy_out(&addrlen, addrlen_ptr, sizeof(addrlen));
             uint32_t copy_len = std::min(addrlen, (uint32_t)native_len);
@@ -880,13 +1453,34 @@ inline void sys_getpeername(Machine& m) {
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    finish_connect(*sock);
+#endif
     if (!sock->connected) {
         m.set_result(err::NOTCONN);
         return;
     }
 
+#ifndef __EMSCRIPTEN__
+    // Native: the real peer, not the shaper relay's other end
+    uint64_t addr_ptr = m.template sysarg<uint64_t>(1);
+    uint64_t addrlen_ptr = m.template sysarg<uint64_t>(2);
+    struct sockaddr_storage peer{};
+    socklen_t peer_len = sizeof(peer);
+    if (::getpeername(real_fd(*sock), (struct sockaddr*)&peer, &peer_len) != 0) {
+        m.set_result(-errno);
+        return;
+    }
+    uint32_t addrlen;
+    m.memory.memcpy_out(&addrlen, addrlen_ptr, sizeof(addrlen));
+    uint32_t copy_len = std::min(addrlen, (uint32_t)peer_len);
+    m.memory.memcpy(addr_ptr, &peer, copy_len);
+    m.memory.memcpy(addrlen_ptr, &copy_len, sizeof(copy_len));
+    m.set_result(0);
+#else
     // Would need to track peer address
     m.set_result(err::NOSYS);
+#endif
 }
 
 // syscall 72: pselect6 (for socket readiness checking)
@@ -0,0 +1,167 @@
+// output_ring.hpp - Lock-free byte ring between the guest and the terminal
+//
+// Guest stdout used to reach Java synchronously: every print on the
+// execution thread took the callback mutex, attached to the JVM, copied
+// into a std::string and built a jstring, so the guest could only write as
+// fast as JNI accepted it. Now the execution thread copies its bytes into
+// this ring and carries on, and a single delivery thread drains it.
+//
+// One producer and one consumer: each side owns one free-running position
+// (head for the producer, tail for the consumer) and only reads the
+// other's, so the data path takes no lock. Blocking only happens
+// at the edges. The consumer parks on a condition variable when the ring
+// is empty, and the producer signals it only when it sees it parked. The
+// producer waits for space only when the ring is full, i.e. the terminal
+// is a whole ring behind (the backpressure a pty would apply).
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace outring {
+
+inline constexpr size_t CAPACITY = 1 << 20;     // Power of two
+
+struct Stats {
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> batches{0};           // Deliveries to the terminal
+    std::atomic<uint64_t> producer_waits{0};    // Writes that found the ring full
+    std::atomic<uint64_t> max_fill{0};          // Most bytes ever queued
+};
+
+class Ring {
+public:
+    Ring() : buf_(new uint8_t[CAPACITY]) {}
+
+    // Producer: queue all of [data, data+len), waiting for space when the
+    // ring is full. Returns the bytes queued (short only once closed).
+    size_t write(const void* data, size_t len) {
+        const auto* src = static_cast<const uint8_t*>(data);
+        size_t done = 0;
+        while (done < len) {
+            uint64_t head = head_.load(std::memory_order_relaxed);
+            uint64_t tail = tail_.load(std::memory_order_acquire);
+            size_t space = CAPACITY - static_cast<size_t>(head - tail);
+            if (space == 0) {
+                if (!wait_for_space()) break;
+                continue;
+            }
+            size_t n = std::min(space, len - done);
+            size_t at = static_cast<size_t>(head & (CAPACITY - 1));
+            size_t first = std::min(n, CAPACITY - at);
+            std::memcpy(buf_.get() + at, src + done, first);
+            std::memcpy(buf_.get(), src + done + first, n - first);
+            head_.store(head + n, std::memory_order_seq_cst);
+            done += n;
+
+            uint64_t fill = head + n - tail;
+            if (fill > stats_.max_fill.load(std::memory_order_relaxed)) {
+                stats_.max_fill.store(fill, std::memory_order_relaxed);
+            }
+            if (consumer_parked_.load(std::memory_order_seq_cst)) wake();
+        }
+        stats_.bytes_in.fetch_add(done, std::memory_order_relaxed);
+        return done;
+    }
+
+    // Consumer: take up to `max` queued bytes without waiting
+    size_t read(void* out, size_t max) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        size_t n = std::min(max, static_cast<size_t>(head - tail));
+        if (n == 0) return 0;
+        size_t at = static_cast<size_t>(tail & (CAPACITY - 1));
+        size_t first = std::min(n, CAPACITY - at);
+        auto* dst = static_cast<uint8_t*>(out);
+        std::memcpy(dst, buf_.get() + at, first);
+        std::memcpy(dst + first, buf_.get(), n - first);
+        tail_.store(tail + n, std::memory_order_seq_cst);
+        stats_.bytes_out.fetch_add(n, std::memory_order_relaxed);
+        if (producer_parked_.load(std::memory_order_seq_cst)) wake();
+        return n;
+    }
+
+    // Consumer: wait up to `timeout` for bytes. False on timeout or close
+    // with nothing queued.
+    bool wait_readable(std::chrono::milliseconds timeout) {
+        if (readable()) return true;
+        std::unique_lock<std::mutex> lock(mutex_);
+        consumer_parked_.store(true, std::memory_order_seq_cst);
+        cv_.wait_for(lock, timeout, [&] { return readable() || closed_.load(); });
+        consumer_parked_.store(false, std::memory_order_relaxed);
+        return readable();
+    }
+
+    bool readable() const {
+        return head_.load(std::memory_order_seq_cst) != tail_.load(std::memory_order_relaxed);
+    }
+
+    // Release both sides: writes stop waiting for space, reads for data
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_.store(true);
+        cv_.notify_all();
+    }
+
+    void open() { closed_.store(false); }
+
+    bool closed() const { return closed_.load(); }
+
+    Stats& stats() { return stats_; }
+
+    std::string stats_json() const {
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+            "{\"bytes_in\":%llu,\"bytes_out\":%llu,\"batches\":%llu,\"producer_waits\":%llu,"
+            "\"max_fill\":%llu,\"capacity\":%zu}",
+            (unsigned long long)stats_.bytes_in.load(),
+            (unsigned long long)stats_.bytes_out.load(),
+            (unsigned long long)stats_.batches.load(),
+            (unsigned long long)stats_.producer_waits.load(),
+            (unsigned long long)stats_.max_fill.load(),
+            CAPACITY);
+        return buf;
+    }
+
+private:
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+    bool wait_for_space() {
+        stats_.producer_waits.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lock(mutex_);
+        producer_parked_.store(true, std::memory_order_seq_cst);
+        cv_.wait(lock, [&] {
+            return closed_.load() ||
+                   head_.load(std::memory_order_relaxed) -
+                       tail_.load(std::memory_order_seq_cst) < CAPACITY;
+        });
+        producer_parked_.store(false, std::memory_order_relaxed);
+        return !closed_.load();
+    }
+
+    std::unique_ptr<uint8_t[]> buf_;
+    alignas(64) std::atomic<uint64_t> head_{0};     // Producer's
+    alignas(64) std::atomic<uint64_t> tail_{0};     // Consumer's
+    alignas(64) std::atomic<bool> consumer_parked_{false};
+    std::atomic<bool> producer_parked_{false};
+    std::atomic<bool> closed_{false};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    Stats stats_;
+};
+
+}  // namespace outring
@@ -0,0 +1,132 @@
+// page_attrs.hpp - Record of the guest page permissions set by the runtime
+//
+// libriscv keeps page attributes in its page table, which neither the
+// snapshot arena nor the runtime state captures. A state restored into a
+// freshly booted machine would otherwise run with the boot binary's
+// permissions instead of the session's (its ELF segments, mmap/mprotect
+// ranges, RELRO). Every attribute change goes through set(), which applies
+// it and records the range; syscalls::save_state() writes the record and
+// load_state() puts it back with apply().
+//
+// Protections use the mmap bits: 1 = read, 2 = write, 4 = exec.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <libriscv/machine.hpp>
+#include "serial.hpp"
+
+namespace pageattr {
+
+struct Range {
+    uint64_t addr;
+    uint64_t len;
+    int prot;
+};
+
+// Non-overlapping ranges by start address; adjacent ranges of the same
+// protection are merged
+struct Span {
+    uint64_t end;
+    int prot;
+};
+inline std::map<uint64_t, Span> g_spans;
+
+inline int prot_of(const riscv::PageAttributes& attr) {
+    return (attr.read ? 1 : 0) | (attr.write ? 2 : 0) | (attr.exec ? 4 : 0);
+}
+
+inline riscv::PageAttributes attr_of(int prot) {
+    riscv::PageAttributes attr;
+    attr.read = (prot & 1) != 0;
+    attr.write = (prot & 2) != 0;
+    attr.exec = (prot & 4) != 0;
+    return attr;
+}
+
+inline void note(uint64_t addr, uint64_t len, int prot) {
+    if (len == 0) return;
+    uint64_t end = addr + len < addr ? UINT64_MAX : addr + len;
+
+    // Cut what overlaps [addr, end) out of the existing spans
+    auto it = g_spans.lower_bound(addr);
+    if (it != g_spans.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second.end > addr) {
+            if (prev->second.end > end) g_spans[end] = prev->second;
+            prev->second.end = addr;
+        }
+    }
+    it = g_spans.lower_bound(addr);
+    while (it != g_spans.end() && it->first < end) {
+        if (it->second.end > end) g_spans[end] = it->second;
+        it = g_spans.erase(it);
+    }
+
+    auto at = g_spans.emplace(addr, Span{end, prot}).first;
+    if (at != g_spans.begin()) {
+        auto prev = std::prev(at);
+        if (prev->second.end == addr && prev->second.prot == prot) {
+            prev->second.end = end;
+            g_spans.erase(at);
+            at = prev;
+        }
+    }
+    auto next = std::next(at);
+    if (next != g_spans.end() && next->first == at->second.end && next->second.prot == prot) {
+        at->second.end = next->second.end;
+        g_spans.erase(next);
+    }
+}
+
+template <typename Memory>
+inline void set(Memory& memory, uint64_t addr, uint64_t len, riscv::PageAttributes attr) {
+    memory.set_page_attr(addr, len, attr);
+    note(addr, len, prot_of(attr));
+}
+
+// A new machine starts with no attributes of its own
+inline void reset() { g_spans.clear(); }
+
+inline std::vector<Range> ranges() {
+    std::vector<Range> out;
+    out.reserve(g_spans.size());
+    for (const auto& [addr, s] : g_spans) out.push_back({addr, s.end - addr, s.prot});
+    return out;
+}
+
+inline void save(serial::Writer& w) {
+    w.u32(static_cast<uint32_t>(g_spans.size()));
+    for (const auto& [addr, s] : g_spans) {
+        w.u64(addr);
+        w.u64(s.end - addr);
+        w.u8(static_cast<uint8_t>(s.prot));
+    }
+}
+
+inline void read(serial::Reader& r, std::vector<Range>& out) {
+    uint32_t count = r.u32();
+    for (uint32_t i = 0; i < count && r.ok(); i++) {
+        Range range;
+        range.addr = r.u64();
+        range.len = r.u64();
+        range.prot = r.u8();
+        out.push_back(range);
+    }
+}
+
+// Replace the machine's attributes with `saved`: whatever this process set
+// goes back to libriscv's default first, so no boot permission survives
+template <typename Memory>
+inline void apply(Memory& memory, const std::vector<Range>& saved) {
+    for (const auto& [addr, s] : g_spans) {
+        memory.set_page_attr(addr, s.end - addr, riscv::PageAttributes{});
+    }
+    g_spans.clear();
+    for (const auto& range : saved) set(memory, range.addr, range.len, attr_of(range.prot));
+}
+
+}  // namespace pageattr
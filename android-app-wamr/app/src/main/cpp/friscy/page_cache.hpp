@@ -0,0 +1,285 @@
+// page_cache.hpp - Shared host pages for file-backed guest mmaps
+//
+// Every file-backed mmap used to copy its bytes into the arena, so each
+// process mapping the same library (or node spawning node) paid for the
+// copy and for its own copy of the pages. Instead, each file version
+// (inode, generation) is written once into a memfd, and mappings of it
+// are mmap'd MAP_PRIVATE|MAP_FIXED from that memfd straight over the
+// arena, the same way a lazy snapshot restore maps its file. All guest
+// mappings of a file then share the memfd's pages until one of them is
+// written, which copies just that page (copy-on-write), so private
+// writable mappings keep their semantics. Guest page permissions are
+// still enforced by libriscv's page attributes; the host mapping is
+// always read-write.
+//
+// Only the host-page-aligned interior of a mapping can be aliased, and
+// only when the guest address and file offset agree modulo the host page
+// size. The unaligned head and tail are copied as before. Aliased ranges
+// are tracked so that a range being discarded or unmapped gets fresh
+// anonymous pages instead of the file's (release()).
+//
+// Nothing is remapped while a background snapshot save has the arena
+// write-protected (arena_busy): it must see every write. The host mapping
+// itself goes through map_fixed, wired up by session.hpp: <sys/mman.h>'s
+// MAP_* macros would collide with syscalls.hpp's guest constants.
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <libriscv/machine.hpp>
+#include "vfs.hpp"
+
+namespace pagecache {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+// Host memory held in memfds; least recently used files are closed past
+// this (their pages live on while mapped)
+inline constexpr uint64_t MAX_BYTES = 256ull << 20;
+inline constexpr unsigned MEMFD_CLOEXEC = 1;     // MFD_CLOEXEC, not in every libc's headers
+
+struct File {
+    std::weak_ptr<vfs::Entry> inode;
+    uint64_t generation = 0;
+    int fd = -1;
+    uint64_t size = 0;
+    uint64_t last_use = 0;
+};
+
+struct Stats {
+    uint64_t files = 0;             // memfds created
+    uint64_t aliased_bytes = 0;     // Mapped from a memfd instead of copied
+    uint64_t shared_bytes = 0;      // ...of which from a memfd an earlier mmap populated
+    uint64_t copied_bytes = 0;      // Unaligned heads/tails and fallbacks
+    uint64_t released_bytes = 0;    // Aliased ranges given back as anonymous pages
+    uint64_t map_ns = 0;            // Time spent aliasing
+    uint64_t copy_ns = 0;           // Time spent copying
+};
+
+inline std::unordered_map<const vfs::Entry*, File> g_files;
+inline std::map<uint64_t, uint64_t> g_aliased;     // Guest start -> end, host-page aligned
+inline uint64_t g_bytes = 0;
+inline uint64_t g_clock = 0;
+inline bool g_enabled = true;       // Cleared when memfds are unavailable
+inline Stats g_stats;
+
+// Set by the runtime: true while the arena must not be remapped
+inline bool (*arena_busy)() = nullptr;
+// Set by the runtime: map `len` bytes of `fd` from `offset` private and
+// read-write at `at`, or fresh anonymous pages when fd < 0. Aliasing is off
+// while unset.
+inline bool (*map_fixed)(void* at, uint64_t len, int fd, uint64_t offset) = nullptr;
+
+inline uint64_t host_page() {
+    static const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint8_t* arena_of(Machine& m) {
+    if constexpr (riscv::encompassing_Nbit_arena > 0) {
+        auto* arena = static_cast<uint8_t*>(m.memory.memory_arena_ptr());
+        if (arena && reinterpret_cast<uintptr_t>(arena) % host_page() == 0) return arena;
+    }
+    return nullptr;
+}
+
+inline void close_file(File& f) {
+    if (f.fd >= 0) close(f.fd);
+    g_bytes -= f.size;
+    f.fd = -1;
+}
+
+inline void evict_for(uint64_t bytes) {
+    while (g_bytes + bytes > MAX_BYTES && !g_files.empty()) {
+        auto lru = g_files.begin();
+        for (auto it = g_files.begin(); it != g_files.end(); ++it) {
+            if (it->second.last_use < lru->second.last_use) lru = it;
+        }
+        close_file(lru->second);
+        g_files.erase(lru);
+    }
+}
+
+// The memfd holding this version of `e`, or -1. `fresh` is set when it was
+// created for this call.
+inline int memfd_for(const std::shared_ptr<vfs::Entry>& e, bool& fresh) {
+    fresh = false;
+    auto it = g_files.find(e.get());
+    if (it != g_files.end()) {
+        if (it->second.inode.lock() == e && it->second.generation == e->generation) {
+            it->second.last_use = ++g_clock;
+            return it->second.fd;
+        }
+        close_file(it->second);
+        g_files.erase(it);
+    }
+    if (e->content.size() > MAX_BYTES) return -1;
+    for (auto f = g_files.begin(); f != g_files.end();) {
+        if (!f->second.inode.expired()) {
+            ++f;
+            continue;
+        }
+        close_file(f->second);
+        f = g_files.erase(f);
+    }
+    evict_for(e->content.size());
+
+    int fd = static_cast<int>(syscall(__NR_memfd_create, "friscy-file", MEMFD_CLOEXEC));
+    if (fd < 0) {
+        fprintf(stderr, "[pagecache] memfd_create failed (%s), copying mmaps\n", strerror(errno));
+        g_enabled = false;
+        return -1;
+    }
+    const auto& c = e->content;
+    size_t done = 0;
+    while (done < c.size()) {
+        ssize_t n = pwrite(fd, c.data() + done, c.size() - done, static_cast<off_t>(done));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        done += static_cast<size_t>(n);
+    }
+    g_files[e.get()] = {e, e->generation, fd, c.size(), ++g_clock};
+    g_bytes += c.size();
+    g_stats.files++;
+    fresh = true;
+    return fd;
+}
+
+inline void copy(Machine& m, uint64_t dst, const uint8_t* src, uint64_t n) {
+    if (n == 0) return;
+    uint64_t t0 = now_ns();
+    auto* arena = static_cast<uint8_t*>(m.memory.memory_arena_ptr());
+    if (arena && dst + n <= m.memory.memory_arena_size()) {
+        std::memcpy(arena + dst, src, n);
+    } else {
+        m.memory.memcpy(dst, src, n);
+    }
+    g_stats.copied_bytes += n;
+    g_stats.copy_ns += now_ns() - t0;
+}
+
+// Give the aliased host pages wholly inside [addr, addr+len) back as fresh
+// anonymous (zero) pages. Call before discarding or unmapping guest memory.
+inline void release(Machine& m, uint64_t addr, uint64_t len) {
+    if (g_aliased.empty() || len == 0 || !map_fixed || (arena_busy && arena_busy())) return;
+    uint8_t* arena = arena_of(m);
+    if (!arena) return;
+    const uint64_t page = host_page();
+    uint64_t lo = (addr + page - 1) & ~(page - 1);
+    uint64_t hi = (addr + len) & ~(page - 1);
+    if (hi <= lo) return;
+
+    auto it = g_aliased.upper_bound(lo);
+    if (it != g_aliased.begin()) --it;
+    while (it != g_aliased.end() && it->first < hi) {
+        uint64_t a_lo = it->first, a_hi = it->second;
+        if (a_hi <= lo) {
+            ++it;
+            continue;
+        }
+        uint64_t cut_lo = std::max(a_lo, lo), cut_hi = std::min(a_hi, hi);
+        if (!map_fixed(arena + cut_lo, cut_hi - cut_lo, -1, 0)) {
+            // Leave it aliased: writes still copy-on-write correctly
+            ++it;
+            continue;
+        }
+        g_stats.released_bytes += cut_hi - cut_lo;
+        it = g_aliased.erase(it);
+        if (a_lo < cut_lo) g_aliased[a_lo] = cut_lo;
+        if (cut_hi < a_hi) it = g_aliased.emplace(cut_hi, a_hi).first;
+    }
+}
+
+// Put `n` bytes of `e` from `offset` at guest `dst`, aliasing the memfd's
+// pages where alignment allows and copying the rest. The range must have
+// been released (it is about to be overwritten).
+inline void populate(Machine& m, const std::shared_ptr<vfs::Entry>& e,
+                     uint64_t dst, uint64_t offset, uint64_t n) {
+    const uint8_t* src = e->content.data() + offset;
+    const uint64_t page = host_page();
+    uint8_t* arena = g_enabled && map_fixed && !(arena_busy && arena_busy()) ? arena_of(m)
+                                                                               : nullptr;
+    uint64_t lo = (dst + page - 1) & ~(page - 1);
+    uint64_t hi = (dst + n) & ~(page - 1);
+    if (!arena || dst % page != offset % page || hi <= lo ||
+        dst + n > m.memory.memory_arena_size()) {
+        copy(m, dst, src, n);
+        return;
+    }
+    bool fresh = false;
+    int fd = memfd_for(e, fresh);
+    if (fd < 0) {
+        copy(m, dst, src, n);
+        return;
+    }
+
+    uint64_t t0 = now_ns();
+    if (!map_fixed(arena + lo, hi - lo, fd, offset + (lo - dst))) {
+        // A failed MAP_FIXED may have unmapped the range: put zero pages back
+        map_fixed(arena + lo, hi - lo, -1, 0);
+        copy(m, dst, src, n);
+        return;
+    }
+    g_stats.map_ns += now_ns() - t0;
+    g_stats.aliased_bytes += hi - lo;
+    if (!fresh) g_stats.shared_bytes += hi - lo;
+
+    // Track it, merging with neighbours
+    uint64_t a_lo = lo, a_hi = hi;
+    auto it = g_aliased.lower_bound(lo);
+    if (it != g_aliased.begin() && std::prev(it)->second >= lo) --it;
+    while (it != g_aliased.end() && it->first <= a_hi) {
+        a_lo = std::min(a_lo, it->first);
+        a_hi = std::max(a_hi, it->second);
+        it = g_aliased.erase(it);
+    }
+    g_aliased[a_lo] = a_hi;
+
+    copy(m, dst, src, lo - dst);
+    copy(m, hi, src + (hi - dst), dst + n - hi);
+}
+
+// The arena was replaced or rewritten wholesale (new machine, snapshot
+// restore): nothing in it is aliased any more
+inline void reset() {
+    g_aliased.clear();
+}
+
+inline std::string stats_json() {
+    char buf[384];
+    snprintf(buf, sizeof(buf),
+        "{\"files\":%llu,\"memfd_bytes\":%llu,\"aliased_bytes\":%llu,\"shared_bytes\":%llu,"
+        "\"copied_bytes\":%llu,\"released_bytes\":%llu,\"map_ms\":%.2f,\"copy_ms\":%.2f}",
+        (unsigned long long)g_stats.files,
+        (unsigned long long)g_bytes,
+        (unsigned long long)g_stats.aliased_bytes,
+        (unsigned long long)g_stats.shared_bytes,
+        (unsigned long long)g_stats.copied_bytes,
+        (unsigned long long)g_stats.released_bytes,
+        g_stats.map_ns / 1e6, g_stats.copy_ns / 1e6);
+    return buf;
+}
+
+}  // namespace pagecache
@@ -0,0 +1,431 @@
+// port_forward.hpp - Host-to-guest port forwarding for friscy
+//
+// Lets host clients (on-device browsers, adb-forwarded test tools) reach
+// servers listening inside the guest without the guest binding to every
+// host interface. Each forward owns a host listener on 127.0.0.1:host_port
+// and relays accepted connections to a guest listening socket, resolved by
+// port (TCP) or by guest path (AF_UNIX) through net::ListenerRegistry.
+//
+// Relaying happens entirely on host threads: bytes move socket -> pipe ->
+// socket with splice(2), so payload never crosses into user space. If the
+// kernel refuses splice for a pair of fds the connection falls back to a
+// read/write loop. Per-forward connection limits and metrics are kept with
+// atomics and exported as JSON for the JNI layer.
+//
+// Native builds only — the Emscripten build has no host sockets to relay.
+
+#pragma once
+
+#ifndef __EMSCRIPTEN__
+
+#include "network.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace net {
+
+struct PortForwardStats {
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> rejected{0};         // Over max_connections
+    std::atomic<uint64_t> connect_failures{0}; // No guest listener / connect error
+    std::atomic<uint32_t> active{0};
+    std::atomic<uint64_t> bytes_to_guest{0};
+    std::atomic<uint64_t> bytes_to_host{0};
+    std::atomic<uint64_t> splice_bytes{0};     // Moved without a user-space copy
+    std::atomic<uint64_t> copy_bytes{0};       // Moved by the read/write fallback
+};
+
+class PortForwarder {
+public:
+    static constexpr int DEFAULT_MAX_CONNECTIONS = 16;
+    static constexpr size_t SPLICE_CHUNK = 64 * 1024;
+
+    // splice(2); tests swap in one that fails to exercise the fallback
+    static inline ssize_t (*splice_fn)(int, loff_t*, int, loff_t*, size_t,
+                                       unsigned int) = ::splice;
+
+    ~PortForwarder() { remove_all(); }
+
+    // Start forwarding 127.0.0.1:host_port to the guest. If guest_unix_path
+    // is non-empty the target is the guest AF_UNIX listener bound to that
+    // path, otherwise the guest TCP listener on guest_port.
+    // Returns a forward id (>0) or a negative errno.
+    int add(uint16_t host_port, uint16_t guest_port,
+            const std::string& guest_unix_path, int max_connections) {
+        // Guest listeners are host sockets on the same loopback: the forward
+        // would either fail to bind or take the guest's own port
+        if (guest_unix_path.empty() && host_port == guest_port) return -EINVAL;
+
+        int lfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (lfd < 0) return -errno;
+
+        int one = 1;
+        ::setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct ::sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(host_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            ::listen(lfd, 64) != 0) {
+            int e = errno;
+            ::close(lfd);
+            return -e;
+        }
+
+        int wake[2];
+        if (::pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+            int e = errno;
+            ::close(lfd);
+            return -e;
+        }
+
+        auto fwd = std::make_unique<Forward>();
+        fwd->host_port = host_port;
+        fwd->guest_port = guest_port;
+        fwd->guest_unix_path = guest_unix_path;
+        fwd->max_connections = max_connections > 0 ? max_connections
+                                                   : DEFAULT_MAX_CONNECTIONS;
+        fwd->listen_fd = lfd;
+        fwd->wake_rd = wake[0];
+        fwd->wake_wr = wake[1];
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        int id = next_id_++;
+        fwd->id = id;
+        Forward* raw = fwd.get();
+        fwd->acceptor = std::thread([raw] { accept_loop(*raw); });
+        forwards_[id] = std::move(fwd);
+        fprintf(stderr, "[portfwd] #%d 127.0.0.1:%u -> guest %s%s\n", id, host_port,
+                guest_unix_path.empty() ? "port " : "unix:",
+                guest_unix_path.empty() ? std::to_string(guest_port).c_str()
+                                        : guest_unix_path.c_str());
+        return id;
+    }
+
+    bool remove(int id) {
+        std::unique_ptr<Forward> fwd;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = forwards_.find(id);
+            if (it == forwards_.end()) return false;
+            fwd = std::move(it->second);
+            forwards_.erase(it);
+        }
+        shutdown_forward(*fwd);
+        return true;
+    }
+
+    void remove_all() {
+        std::map<int, std::unique_ptr<Forward>> all;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            all.swap(forwards_);
+        }
+        for (auto& [id, fwd] : all) shutdown_forward(*fwd);
+    }
+
+    // {"forwards":[{"id":1,"host_port":8080,"guest":"3000",...}]}
+    std::string stats_json() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string out = "{\"forwards\":[";
+        bool first = true;
+        for (const auto& [id, fwd] : forwards_) {
+            const auto& s = fwd->stats;
+            char buf[512];
+            snprintf(buf, sizeof(buf),
+                "%s{\"id\":%d,\"host_port\":%u,\"guest\":\"%s\",\"max_connections\":%d,"
+                "\"active\":%u,\"accepted\":%llu,\"rejected\":%llu,\"connect_failures\":%llu,"
+                "\"bytes_to_guest\":%llu,\"bytes_to_host\":%llu,"
+                "\"splice_bytes\":%llu,\"copy_bytes\":%llu}",
+                first ? "" : ",", id, fwd->host_port,
+                fwd->guest_unix_path.empty()
+                    ? std::to_string(fwd->guest_port).c_str()
+                    : ("unix:" + fwd->guest_unix_path).c_str(),
+                fwd->max_connections,
+                s.active.load(),
+                (unsigned long long)s.accepted.load(),
+                (unsigned long long)s.rejected.load(),
+                (unsigned long long)s.connect_failures.load(),
+                (unsigned long long)s.bytes_to_guest.load(),
+                (unsigned long long)s.bytes_to_host.load(),
+                (unsigned long long)s.splice_bytes.load(),
+                (unsigned long long)s.copy_bytes.load());
+            out += buf;
+            first = false;
+        }
+        out += "]}";
+        return out;
+    }
+
+private:
+    struct Connection {
+        int client_fd = -1;
+        int guest_fd = -1;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    struct Forward {
+        int id = 0;
+        uint16_t host_port = 0;
+        uint16_t guest_port = 0;
+        std::string guest_unix_path;
+        int max_connections = DEFAULT_MAX_CONNECTIONS;
+        int listen_fd = -1;
+        int wake_rd = -1;
+        int wake_wr = -1;
+        std::atomic<bool> stopping{false};
+        std::thread acceptor;
+        std::mutex conns_mutex;
+        std::list<std::unique_ptr<Connection>> conns;
+        PortForwardStats stats;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<int, std::unique_ptr<Forward>> forwards_;
+    int next_id_ = 1;
+
+    static void shutdown_forward(Forward& fwd) {
+        fwd.stopping.store(true);
+        char c = 1;
+        (void)!::write(fwd.wake_wr, &c, 1);
+        if (fwd.acceptor.joinable()) fwd.acceptor.join();
+
+        // Unblock relays still waiting in poll/splice, then join them
+        {
+            std::lock_guard<std::mutex> lock(fwd.conns_mutex);
+            for (auto& conn : fwd.conns) {
+                ::shutdown(conn->client_fd, SHUT_RDWR);
+                ::shutdown(conn->guest_fd, SHUT_RDWR);
+            }
+        }
+        for (auto& conn : fwd.conns) {
+            if (conn->thread.joinable()) conn->thread.join();
+        }
+        fwd.conns.clear();
+
+        ::close(fwd.listen_fd);
+        ::close(fwd.wake_rd);
+        ::close(fwd.wake_wr);
+        fprintf(stderr, "[portfwd] #%d removed\n", fwd.id);
+    }
+
+    // Join relays that have finished so the connection list stays bounded.
+    static void reap(Forward& fwd) {
+        std::lock_guard<std::mutex> lock(fwd.conns_mutex);
+        for (auto it = fwd.conns.begin(); it != fwd.conns.end();) {
+            if ((*it)->done.load()) {
+                if ((*it)->thread.joinable()) (*it)->thread.join();
+                it = fwd.conns.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    static int connect_guest(const Forward& fwd) {
+        GuestListener target;
+        bool found = fwd.guest_unix_path.empty()
+            ? get_listener_registry().find_port(fwd.guest_port, target)
+            : get_listener_registry().find_unix(fwd.guest_unix_path, target);
+        if (!found) return -111;  // ECONNREFUSED
+
+        int fd = ::socket(target.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -errno;
+        if (::connect(fd, (struct sockaddr*)&target.addr, target.addr_len) != 0) {
+            int e = errno;
+            ::close(fd);
+            return -e;
+        }
+        if (target.addr.ss_family != AF_UNIX) {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return fd;
+    }
+
+    static void accept_loop(Forward& fwd) {
+        while (!fwd.stopping.load()) {
+            struct pollfd pfds[2] = {
+                {fwd.listen_fd, POLLIN, 0},
+                {fwd.wake_rd, POLLIN, 0},
+            };
+            int r = ::poll(pfds, 2, -1);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (pfds[1].revents) break;
+            if (!(pfds[0].revents & POLLIN)) continue;
+
+            int client = ::accept4(fwd.listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) continue;
+
+            reap(fwd);
+            if (fwd.stats.active.load() >= static_cast<uint32_t>(fwd.max_connections)) {
+                fwd.stats.rejected++;
+                ::close(client);
+                continue;
+            }
+
+            int guest = connect_guest(fwd);
+            if (guest < 0) {
+                fwd.stats.connect_failures++;
+                ::close(client);
+                continue;
+            }
+
+            int one = 1;
+            ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            fwd.stats.accepted++;
+            fwd.stats.active++;
+            auto conn = std::make_unique<Connection>();
+            conn->client_fd = client;
+            conn->guest_fd = guest;
+            Connection* raw = conn.get();
+            std::lock_guard<std::mutex> lock(fwd.conns_mutex);
+            conn->thread = std::thread([&fwd, raw] { relay(fwd, *raw); });
+            fwd.conns.push_back(std::move(conn));
+        }
+    }
+
+    // One direction of a relay: a pipe for splice plus half-close state.
+    struct Pump {
+        int from;
+        int to;
+        int pipe_rd = -1;
+        int pipe_wr = -1;
+        bool use_splice = true;
+        bool eof = false;
+        std::atomic<uint64_t>* counter;
+    };
+
+    // Move whatever is readable on p.from to p.to. Returns false on error.
+    static bool pump_once(Pump& p, PortForwardStats& stats) {
+        if (p.use_splice) {
+            ssize_t n = splice_fn(p.from, nullptr, p.pipe_wr, nullptr,
+                                  SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                p.use_splice = false;  // Kernel can't splice these fds
+            } else if (n < 0) {
+                return errno == EAGAIN || errno == EINTR;
+            } else if (n == 0) {
+                p.eof = true;
+                ::shutdown(p.to, SHUT_WR);
+                return true;
+            } else {
+                ssize_t left = n;
+                while (left > 0) {
+                    ssize_t w = splice_fn(p.pipe_rd, nullptr, p.to, nullptr,
+                                          left, SPLICE_F_MOVE);
+                    if (w < 0) {
+                        if (errno == EINTR) continue;
+                        return false;
+                    }
+                    left -= w;
+                }
+                *p.counter += n;
+                stats.splice_bytes += n;
+                return true;
+            }
+        }
+
+        uint8_t buf[16 * 1024];
+        ssize_t n = ::recv(p.from, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EINTR;
+        if (n == 0) {
+            p.eof = true;
+            ::shutdown(p.to, SHUT_WR);
+            return true;
+        }
+        ssize_t off = 0;
+        while (off < n) {
+            ssize_t w = ::send(p.to, buf + off, n - off, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            off += w;
+        }
+        *p.counter += n;
+        stats.copy_bytes += n;
+        return true;
+    }
+
+    static void relay(Forward& fwd, Connection& conn) {
+        Pump up{conn.client_fd, conn.guest_fd};
+        Pump down{conn.guest_fd, conn.client_fd};
+        up.counter = &fwd.stats.bytes_to_guest;
+        down.counter = &fwd.stats.bytes_to_host;
+
+        int p1[2], p2[2];
+        bool have_pipes = ::pipe2(p1, O_CLOEXEC) == 0;
+        if (have_pipes && ::pipe2(p2, O_CLOEXEC) != 0) {
+            ::close(p1[0]);
+            ::close(p1[1]);
+            have_pipes = false;
+        }
+        if (have_pipes) {
+            up.pipe_rd = p1[0]; up.pipe_wr = p1[1];
+            down.pipe_rd = p2[0]; down.pipe_wr = p2[1];
+        } else {
+            up.use_splice = down.use_splice = false;
+        }
+
+        while (!fwd.stopping.load() && !(up.eof && down.eof)) {
+            struct pollfd pfds[2] = {
+                {up.eof ? -1 : up.from, POLLIN, 0},
+                {down.eof ? -1 : down.from, POLLIN, 0},
+            };
+            int r = ::poll(pfds, 2, -1);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            bool ok = true;
+            if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) ok = pump_once(up, fwd.stats);
+            if (ok && (pfds[1].revents & (POLLIN | POLLHUP | POLLERR))) ok = pump_once(down, fwd.stats);
+            if (!ok) break;
+        }
+
+        if (have_pipes) {
+            ::close(p1[0]); ::close(p1[1]);
+            ::close(p2[0]); ::close(p2[1]);
+        }
+        // Close under the lock so shutdown_forward never touches a reused fd
+        {
+            std::lock_guard<std::mutex> lock(fwd.conns_mutex);
+            ::close(conn.client_fd);
+            ::close(conn.guest_fd);
+            conn.client_fd = conn.guest_fd = -1;
+        }
+        fwd.stats.active--;
+        conn.done.store(true);
+    }
+};
+
+inline PortForwarder& get_port_forwarder() {
+    static PortForwarder forwarder;
+    return forwarder;
+}
+
+}  // namespace net
+
+#endif  // !__EMSCRIPTEN__
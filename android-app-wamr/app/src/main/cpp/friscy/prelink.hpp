@@ -0,0 +1,381 @@
+// prelink.hpp - Fixed library bases from an image's prelink manifest
+//
+// ld-musl maps every shared library with a file-backed mmap at an address
+// of our choosing, and each mmap copies the file into the arena. An image
+// built with tools/prelink carries a manifest (MANIFEST_PATH) giving every
+// shared object its own base in a window below the interpreter, no two
+// overlapping. The runtime puts the library there instead of at the mmap
+// frontier, which makes its read-only part (code and rodata, everything
+// below its first writable segment) position-stable across processes: once
+// copied, it stays valid until something else writes over it, and later
+// processes mapping the same library skip the copy. Only the writable
+// segments are copied and relocated per process.
+//
+// Residency (the memory at base still holds the file's first `text` bytes)
+// is dropped by clobber(), which every runtime path that writes guest
+// memory outside a library's own mapping calls for the range it writes.
+// Guest code cannot store into a library's text without an mmap/mprotect
+// making it writable first, and those are hooked too.
+//
+// A library is placed at its base only while it is not already mapped
+// there by the running program (live) or by the parent waiting on a vfork
+// child (parent_live), and only if its span is clear of the program, brk,
+// stack and interpreter. Otherwise it falls back to the mmap frontier.
+//
+// Manifest lines: "<base> <span> <text> <path>" (hex, hex, hex, absolute
+// path), '#' starts a comment. An entry applies only while the library is
+// the file that was there when the manifest was read, and only if that
+// file's layout still gives the same span and text (measure()).
+
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <libriscv/machine.hpp>
+#include "vfs.hpp"
+#include "elf_loader.hpp"
+#include "serial.hpp"
+
+namespace prelink {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+inline constexpr const char* MANIFEST_PATH = "/etc/friscy/prelink.map";
+
+// Default window the tool assigns bases in: above a ~120MB program plus
+// its brk, below the stack under the interpreter at 0x18000000
+inline constexpr uint64_t WINDOW_LO = 0x08000000;
+inline constexpr uint64_t WINDOW_HI = 0x17000000;
+inline constexpr uint64_t ALIGN = 0x10000;
+
+struct Lib {
+    std::string path;
+    uint64_t base = 0;
+    uint64_t span = 0;              // Page-rounded extent of its PT_LOADs
+    uint64_t text = 0;              // Read-only prefix mapped at file offset == vaddr
+    std::weak_ptr<vfs::Entry> inode;
+    uint64_t generation = 0;
+    bool resident = false;          // [base, base+text) holds the file's first text bytes
+    bool live = false;              // Mapped at base by the running program
+    bool parent_live = false;       // Mapped at base by a parent waiting on its vfork child
+};
+
+struct Stats {
+    uint64_t placed = 0;            // Mappings put at their prelinked base
+    uint64_t fallbacks = 0;         // Listed, but mapped at the frontier
+    uint64_t text_copied = 0;       // Bytes of library text copied in
+    uint64_t text_reused = 0;       // Bytes of library text found resident
+};
+
+inline std::vector<Lib> g_libs;
+inline std::unordered_map<const vfs::Entry*, size_t> g_by_entry;
+inline std::weak_ptr<vfs::Entry> g_manifest;
+inline uint64_t g_manifest_generation = 0;
+inline Stats g_stats;
+
+// Span and read-only prefix of a shared object. False when its lowest
+// segment is not at vaddr == offset == 0 or a read-only segment before
+// the first writable one is not at vaddr == offset: ld-musl's first mmap
+// copies the file from offset 0 over the whole span, so only then does
+// the memory below the first writable page hold the file's bytes.
+inline bool measure(const elf::Layout& l, size_t file_size, uint64_t& span, uint64_t& text) {
+    constexpr uint64_t PAGE = 4096;
+    if (l.loads.empty()) return false;
+    auto loads = l.loads;
+    std::sort(loads.begin(), loads.end(),
+              [](const elf::Segment& a, const elf::Segment& b) { return a.vaddr < b.vaddr; });
+    if (loads.front().vaddr != 0 || loads.front().offset != 0) return false;
+
+    uint64_t ro_end = l.load_range.second;
+    for (const auto& s : loads) {
+        if (s.flags & elf::PF_W) {
+            ro_end = s.vaddr;
+            break;
+        }
+        if (s.vaddr != s.offset) return false;
+    }
+    span = (l.load_range.second + PAGE - 1) & ~(PAGE - 1);
+    text = std::min<uint64_t>(ro_end, file_size) & ~(PAGE - 1);
+    return span > 0;
+}
+
+inline bool measure(const std::vector<uint8_t>& file, uint64_t& span, uint64_t& text) {
+    try {
+        auto l = elf::parse_layout(file, false);
+        return !l.info.is_dynamic && l.info.type == elf::ET_DYN && measure(l, file.size(), span, text);
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+inline std::string format_line(const Lib& lib) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%" PRIx64 " %" PRIx64 " %" PRIx64 " ", lib.base, lib.span, lib.text);
+    return buf + lib.path + "\n";
+}
+
+inline bool parse_line(const std::string& line, Lib& out) {
+    if (line.empty() || line[0] == '#') return false;
+    int path_at = 0;
+    if (sscanf(line.c_str(), "%" SCNx64 " %" SCNx64 " %" SCNx64 " %n",
+               &out.base, &out.span, &out.text, &path_at) != 3 || path_at == 0) {
+        return false;
+    }
+    out.path = line.substr(path_at);
+    while (!out.path.empty() && (out.path.back() == '\r' || out.path.back() == ' ')) out.path.pop_back();
+    return !out.path.empty() && out.path[0] == '/' && out.span > 0 && out.text <= out.span &&
+           out.base % ALIGN == 0 && out.base + out.span > out.base;
+}
+
+// (Re)read the manifest when it appeared, changed or went away. Library
+// state survives for entries whose line and file are unchanged.
+inline void refresh(vfs::VirtualFS& fs) {
+    auto manifest = fs.resolve(MANIFEST_PATH);
+    if (manifest && !manifest->is_file()) manifest = nullptr;
+    if (manifest == g_manifest.lock() &&
+        (!manifest || manifest->generation == g_manifest_generation)) {
+        return;
+    }
+    g_manifest = manifest;
+    g_manifest_generation = manifest ? manifest->generation : 0;
+
+    std::vector<Lib> libs;
+    if (manifest) {
+        std::string text(manifest->content.begin(), manifest->content.end());
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string::npos) nl = text.size();
+            Lib lib;
+            if (parse_line(text.substr(pos, nl - pos), lib)) {
+                auto e = fs.resolve(lib.path);
+                uint64_t span = 0, text = 0;
+                if (e && e->is_file() && measure(e->content, span, text) &&
+                    span == lib.span && text == lib.text) {
+                    lib.inode = e;
+                    lib.generation = e->generation;
+                    libs.push_back(std::move(lib));
+                }
+            }
+            pos = nl + 1;
+        }
+    }
+    // Overlapping lines would let two libraries share text: drop them all
+    std::sort(libs.begin(), libs.end(), [](const Lib& a, const Lib& b) { return a.base < b.base; });
+    for (size_t i = 1; i < libs.size(); i++) {
+        if (libs[i].base < libs[i - 1].base + libs[i - 1].span) {
+            fprintf(stderr, "[prelink] %s overlaps %s, manifest ignored\n",
+                    libs[i].path.c_str(), libs[i - 1].path.c_str());
+            libs.clear();
+            break;
+        }
+    }
+    for (auto& lib : libs) {
+        for (const auto& old : g_libs) {
+            if (old.path == lib.path && old.base == lib.base && old.text == lib.text &&
+                old.inode.lock() == lib.inode.lock() && old.generation == lib.generation) {
+                lib.resident = old.resident;
+                lib.live = old.live;
+                lib.parent_live = old.parent_live;
+            }
+        }
+    }
+    g_libs = std::move(libs);
+    g_by_entry.clear();
+    for (size_t i = 0; i < g_libs.size(); i++) g_by_entry[g_libs[i].inode.lock().get()] = i;
+    if (!g_libs.empty()) fprintf(stderr, "[prelink] %zu libraries in manifest\n", g_libs.size());
+}
+
+// The manifest entry for the file `e`, if it is still that version
+inline Lib* find(vfs::VirtualFS& fs, const std::shared_ptr<vfs::Entry>& e) {
+    refresh(fs);
+    auto it = g_by_entry.find(e.get());
+    if (it == g_by_entry.end()) return nullptr;
+    Lib& lib = g_libs[it->second];
+    return lib.inode.lock() == e && lib.generation == e->generation ? &lib : nullptr;
+}
+
+inline Lib* by_path(vfs::VirtualFS& fs, const std::string& path) {
+    auto e = fs.resolve(path);
+    return e && e->is_file() ? find(fs, e) : nullptr;
+}
+
+// The library whose span contains addr, if any
+inline Lib* containing(uint64_t addr) {
+    for (auto& lib : g_libs) {
+        if (addr >= lib.base && addr < lib.base + lib.span) return &lib;
+    }
+    return nullptr;
+}
+
+// Something other than a library's own mapping writes [addr, addr+len)
+inline void clobber(uint64_t addr, uint64_t len) {
+    for (auto& lib : g_libs) {
+        if (lib.resident && addr < lib.base + lib.text && addr + len > lib.base) {
+            lib.resident = false;
+        }
+    }
+}
+
+// Base for mapping `lib` (its whole span, as ld-musl's first mmap does), or
+// 0 to fall back. `busy` are ranges the span must stay clear of.
+inline uint64_t place(Lib& lib, uint64_t len,
+                      const std::vector<std::pair<uint64_t, uint64_t>>& busy) {
+    bool clear = !lib.live && !lib.parent_live && len <= lib.span;
+    for (auto [lo, hi] : busy) {
+        if (clear && lo < lib.base + lib.span && hi > lib.base) clear = false;
+    }
+    if (!clear) {
+        g_stats.fallbacks++;
+        return 0;
+    }
+    g_stats.placed++;
+    lib.live = true;
+    return lib.base;
+}
+
+inline void copy_in(Machine& m, uint64_t addr, const uint8_t* src, size_t n) {
+    if constexpr (riscv::encompassing_Nbit_arena > 0) {
+        auto* arena = static_cast<uint8_t*>(m.memory.memory_arena_ptr());
+        if (arena && addr + n <= m.memory.memory_arena_size()) {
+            std::memcpy(arena + addr, src, n);
+            return;
+        }
+    }
+    m.memory.memcpy(addr, src, n);
+}
+
+// Bytes at the start of a mapping of [offset, offset+len) of lib's file at
+// its natural address (base + offset) that already hold the file
+inline uint64_t resident_prefix(const Lib& lib, uint64_t offset, uint64_t len) {
+    if (!lib.resident || offset >= lib.text) return 0;
+    uint64_t keep = std::min(len, lib.text - offset);
+    g_stats.text_reused += keep;
+    return keep;
+}
+
+// Such a mapping has copied [offset + keep, offset + len) of the file
+inline void mapped(Lib& lib, uint64_t offset, uint64_t len, uint64_t keep) {
+    if (offset + keep < lib.text) {
+        g_stats.text_copied += std::min(offset + len, lib.text) - (offset + keep);
+    }
+    auto e = lib.inode.lock();
+    if (offset == 0 && len >= lib.text && e && e->content.size() >= lib.text) lib.resident = true;
+}
+
+// Make lib's text resident at its base (for a restored exec-cache image)
+inline bool ensure_resident(Machine& m, Lib& lib) {
+    if (lib.resident) {
+        g_stats.text_reused += lib.text;
+        return true;
+    }
+    auto e = lib.inode.lock();
+    if (!e || e->content.size() < lib.text) return false;
+    clobber(lib.base, lib.text);
+    copy_in(m, lib.base, e->content.data(), lib.text);
+    g_stats.text_copied += lib.text;
+    lib.resident = true;
+    return true;
+}
+
+// ---- Process lifecycle ----
+
+// A new machine: its arena holds none of the libraries
+inline void reset() {
+    for (auto& lib : g_libs) lib.resident = lib.live = lib.parent_live = false;
+}
+
+// execve: the old program's mappings are gone
+inline void new_image() {
+    for (auto& lib : g_libs) lib.live = false;
+}
+
+// vfork: the child runs in the parent's address space until it execs
+inline void fork_child() {
+    for (auto& lib : g_libs) lib.parent_live = lib.live;
+}
+
+// The vfork child exited and the parent resumes
+inline void fork_exit() {
+    for (auto& lib : g_libs) {
+        lib.live = lib.parent_live;
+        lib.parent_live = false;
+    }
+}
+
+// ---- Snapshot state ----
+//
+// Which libraries are mapped where is part of the process; residency is
+// not saved (a restored arena is treated as unknown).
+
+struct Mapped {
+    std::string path;
+    uint64_t base = 0;
+    bool live = false;
+    bool parent_live = false;
+};
+
+inline void save_state(serial::Writer& w) {
+    uint32_t n = 0;
+    for (const auto& lib : g_libs) n += lib.live || lib.parent_live;
+    w.u32(n);
+    for (const auto& lib : g_libs) {
+        if (!lib.live && !lib.parent_live) continue;
+        w.str(lib.path);
+        w.u64(lib.base);
+        w.u8(uint8_t(lib.live) | uint8_t(lib.parent_live) << 1);
+    }
+}
+
+inline std::vector<Mapped> read_state(serial::Reader& r) {
+    std::vector<Mapped> out;
+    uint32_t n = r.u32();
+    for (uint32_t i = 0; i < n && r.ok(); i++) {
+        Mapped mp;
+        mp.path = r.str();
+        mp.base = r.u64();
+        uint8_t flags = r.u8();
+        mp.live = flags & 1;
+        mp.parent_live = flags & 2;
+        out.push_back(std::move(mp));
+    }
+    return out;
+}
+
+// Call with the VFS state already restored
+inline void apply_state(vfs::VirtualFS& fs, const std::vector<Mapped>& mapped) {
+    refresh(fs);
+    for (auto& lib : g_libs) lib.resident = lib.live = lib.parent_live = false;
+    for (const auto& mp : mapped) {
+        for (auto& lib : g_libs) {
+            if (lib.path != mp.path || lib.base != mp.base) continue;
+            lib.live = mp.live;
+            lib.parent_live = mp.parent_live;
+        }
+    }
+}
+
+inline std::string stats_json() {
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+        "{\"libraries\":%zu,\"placed\":%llu,\"fallbacks\":%llu,"
+        "\"text_copied\":%llu,\"text_reused\":%llu}",
+        g_libs.size(),
+        (unsigned long long)g_stats.placed,
+        (unsigned long long)g_stats.fallbacks,
+        (unsigned long long)g_stats.text_copied,
+        (unsigned long long)g_stats.text_reused);
+    return buf;
+}
+
+}  // namespace prelink
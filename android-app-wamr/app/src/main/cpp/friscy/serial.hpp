@@ -0,0 +1,106 @@
+// serial.hpp - Little-endian binary encoding for friscy runtime state
+//
+// Used by the snapshot state section: VFS delta, syscall globals and
+// network state each append themselves to one Writer and read back
+// through a Reader in the same order. The Reader is bounds-checked and
+// sticky: the first short read clears ok() and every later read returns
+// zero/empty, so decoders can read a whole record and check once.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace serial {
+
+class Writer {
+public:
+    void u8(uint8_t v) { buf_.push_back(v); }
+    void u32(uint32_t v) { raw(&v, 4); }
+    void u64(uint64_t v) { raw(&v, 8); }
+    void i32(int32_t v) { raw(&v, 4); }
+    void str(const std::string& s) {
+        u32(static_cast<uint32_t>(s.size()));
+        raw(s.data(), s.size());
+    }
+    void bytes(const std::vector<uint8_t>& b) {
+        u64(b.size());
+        raw(b.data(), b.size());
+    }
+    void raw(const void* p, size_t n) {
+        if (n == 0) return;
+        const uint8_t* b = static_cast<const uint8_t*>(p);
+        buf_.insert(buf_.end(), b, b + n);
+    }
+
+    std::vector<uint8_t>& data() { return buf_; }
+
+private:
+    std::vector<uint8_t> buf_;
+};
+
+class Reader {
+public:
+    Reader(const uint8_t* p, size_t n) : p_(p), n_(n) {}
+    explicit Reader(const std::vector<uint8_t>& v) : Reader(v.data(), v.size()) {}
+
+    uint8_t u8() {
+        uint8_t v = 0;
+        raw(&v, 1);
+        return v;
+    }
+    uint32_t u32() {
+        uint32_t v = 0;
+        raw(&v, 4);
+        return v;
+    }
+    uint64_t u64() {
+        uint64_t v = 0;
+        raw(&v, 8);
+        return v;
+    }
+    int32_t i32() {
+        int32_t v = 0;
+        raw(&v, 4);
+        return v;
+    }
+    std::string str() {
+        uint32_t len = u32();
+        if (!take(len)) return {};
+        std::string s(reinterpret_cast<const char*>(p_ + pos_ - len), len);
+        return s;
+    }
+    std::vector<uint8_t> bytes() {
+        uint64_t len = u64();
+        if (!take(len)) return {};
+        return std::vector<uint8_t>(p_ + pos_ - len, p_ + pos_);
+    }
+    bool raw(void* out, size_t n) {
+        if (!take(n)) return false;
+        if (n) memcpy(out, p_ + pos_ - n, n);
+        return true;
+    }
+
+    bool ok() const { return ok_; }
+    bool at_end() const { return pos_ == n_; }
+    void fail() { ok_ = false; }
+
+private:
+    bool take(uint64_t n) {
+        if (!ok_ || n > n_ - pos_) {
+            ok_ = false;
+            return false;
+        }
+        pos_ += n;
+        return true;
+    }
+
+    const uint8_t* p_;
+    size_t n_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+}  // namespace serial
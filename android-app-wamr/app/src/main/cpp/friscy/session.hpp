@@ -0,0 +1,534 @@
+// session.hpp - Boot a friscy session from a rootfs tar, independent of JNI
+//
+// Everything between "here are the rootfs bytes" and "the machine is ready
+// to simulate()": VFS population, ELF and interpreter loading, syscall
+// installation and stack setup, plus the runtime state blob a snapshot
+// stores next to the arena. Independent load phases run side by side on a
+// worker thread and are timed (LoadTimings); the boot trace
+// (boot_trace.hpp) carries on into the guest up to its prompt. The JNI
+// runtime (friscy_runtime.cpp) and the host-side boot snapshot tool
+// (tools/boot_snapshot) both boot through here, so a snapshot taken on a
+// Linux host restores on the device.
+
+#pragma once
+
+#include <libriscv/machine.hpp>
+#include "vfs.hpp"
+#include "elf_loader.hpp"
+#include "syscalls.hpp"
+#include "network.hpp"
+#include "serial.hpp"
+#include "snapshot.hpp"
+#include "boot_trace.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace session {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+// Syscall bases for libriscv native heap/memory management
+inline constexpr uint32_t HEAP_SYSCALLS_BASE = 480;
+inline constexpr uint32_t MEMORY_SYSCALLS_BASE = 485;
+
+// ============================================================================
+// Virtual /proc and /dev files (synced from friscy-standalone)
+// ============================================================================
+
+inline void setup_virtual_files(vfs::VirtualFS& vfs) {
+    // /dev/null
+    vfs.add_virtual_file("/dev/null", std::vector<uint8_t>{});
+
+    // /dev/tty and /dev/console — controlling terminal
+    vfs.add_virtual_file("/dev/tty", std::vector<uint8_t>{});
+    vfs.add_virtual_file("/dev/console", std::vector<uint8_t>{});
+    vfs.add_virtual_file("/dev/pts/0", std::vector<uint8_t>{});
+    vfs.add_virtual_file("/dev/ptmx", std::vector<uint8_t>{});
+
+    // /dev/urandom (reads handled by getrandom syscall)
+    vfs.add_virtual_file("/dev/urandom", std::vector<uint8_t>{});
+    vfs.add_virtual_file("/dev/random", std::vector<uint8_t>{});
+
+    // /etc/passwd, /etc/group (minimal)
+    vfs.add_virtual_file("/etc/passwd", "root:x:0:0:root:/root:/bin/sh\n");
+    vfs.add_virtual_file("/etc/group", "root:x:0:\n");
+
+    // /etc/hosts, /etc/resolv.conf
+    vfs.add_virtual_file("/etc/hosts", "127.0.0.1 localhost\n");
+    vfs.add_virtual_file("/etc/resolv.conf", "nameserver 8.8.8.8\n");
+
+    // Timezone data — needed by Node.js (abseil/cctz) to avoid abort()
+    static const uint8_t utc_tzif[] = {
+        // TZif v1 header
+        'T','Z','i','f','2',  0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,  0,0,0,0,  0,0,0,0,  0,0,0,0,
+        0,0,0,1,  0,0,0,4,
+        0,0,0,0, 0, 0,  'U','T','C',0,
+        // TZif v2 header
+        'T','Z','i','f','2',  0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,  0,0,0,0,  0,0,0,0,  0,0,0,0,
+        0,0,0,1,  0,0,0,4,
+        0,0,0,0, 0, 0,  'U','T','C',0,
+        '\n','U','T','C','0','\n',
+    };
+    std::vector<uint8_t> utc_tz(utc_tzif, utc_tzif + sizeof(utc_tzif));
+    vfs.add_virtual_file("/etc/localtime", utc_tz);
+    vfs.add_virtual_file("/usr/share/zoneinfo/UTC", utc_tz);
+    vfs.add_virtual_file("/usr/share/zoneinfo/Etc/UTC", utc_tz);
+
+    // /proc — needed by V8/Node.js
+    vfs.add_virtual_file("/proc/version_signature",
+        "Linux version 6.8.0 (friscy@libriscv) (riscv64-linux-gnu-gcc)\n");
+    vfs.add_virtual_file("/proc/cpuinfo",
+        "processor\t: 0\n"
+        "hart\t\t: 0\n"
+        "isa\t\t: rv64imafdc_zicsr_zifencei\n"
+        "mmu\t\t: sv39\n"
+        "uarch\t\t: friscy,libriscv\n"
+        "\n");
+    vfs.add_virtual_file("/proc/self/maps", "");
+    vfs.add_virtual_file("/proc/sys/vm/overcommit_memory", "0\n");
+
+    // /tmp directory and NODE_COMPILE_CACHE directory
+    vfs.mkdir("/tmp", 0777);
+    vfs.mkdir("/tmp/node-compile-cache", 0777);
+}
+
+// ============================================================================
+// VFS helpers
+// ============================================================================
+
+inline std::string resolve_vfs_path(vfs::VirtualFS& fs, const std::string& path) {
+    // Try the path directly
+    auto entry = fs.resolve(path);
+    if (entry) return path;
+
+    // Not found
+    return "";
+}
+
+// ============================================================================
+// Boot
+// ============================================================================
+
+// Identifies the base image the VFS delta in a snapshot applies to
+inline uint64_t image_digest(const uint8_t* tar, size_t tar_len, const std::string& entry_path) {
+    uint64_t parts[2] = {
+        snapshot::chunk_hash(tar, tar_len),
+        snapshot::chunk_hash(reinterpret_cast<const uint8_t*>(entry_path.data()),
+                             entry_path.size()),
+    };
+    return snapshot::chunk_hash(reinterpret_cast<const uint8_t*>(parts), sizeof(parts));
+}
+
+// Load a rootfs tar into a fresh VFS with the virtual /proc, /dev and /etc
+// files, and mark it as the base snapshots store their delta against.
+inline std::unique_ptr<vfs::VirtualFS> load_vfs(const uint8_t* tar, size_t tar_len,
+                                                const std::string& entry_path) {
+    auto fs = std::make_unique<vfs::VirtualFS>();
+    fs->load_tar(tar, tar_len);
+    boottrace::mark("tar_ingest");
+    setup_virtual_files(*fs);
+    fs->add_virtual_file("/proc/self/exe", entry_path);
+    fs->mark_base();
+    boottrace::mark("vfs_setup");
+    return fs;
+}
+
+// ============================================================================
+// Load timings and startup profile
+// ============================================================================
+//
+// Loading overlaps the phases that do not depend on each other: the image
+// digest is hashed while the tar is parsed into the VFS, and while the
+// machine is built from the entry binary (arena plus segments), a worker
+// reads and parses the interpreter and then prefetches the startup
+// profile: the binaries the previous boot of the same image went on to
+// exec, up to what elfcache keeps around.
+
+struct LoadTimings {
+    double vfs_ms = 0;          // Tar parse + virtual files
+    double digest_ms = 0;       // Image digest (worker, alongside vfs)
+    double entry_ms = 0;        // Entry binary read + parse
+    double machine_ms = 0;      // Arena + entry segments
+    double interp_ms = 0;       // Interpreter read + parse (worker, alongside machine)
+    double prefetch_ms = 0;     // Startup profile (worker, after interp)
+    double interp_load_ms = 0;  // Interpreter segments into the arena
+    double setup_ms = 0;        // Heap, syscalls, stack
+    double total_ms = 0;        // load_image() through boot()
+    size_t prefetched = 0;
+};
+
+inline LoadTimings g_load;
+inline std::chrono::steady_clock::time_point g_load_started;
+inline uint64_t g_profile_key = 0;      // Digest of the image being loaded
+inline std::unordered_map<uint64_t, std::vector<std::string>> g_profiles;
+
+// The entry and interpreter take two of elfcache's recent slots
+inline constexpr size_t MAX_PREFETCH = elfcache::MAX_RECENT - 2;
+
+inline double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// load_vfs() with the image digest computed alongside
+inline std::unique_ptr<vfs::VirtualFS> load_image(const uint8_t* tar, size_t tar_len,
+                                                  const std::string& entry_path,
+                                                  uint64_t& digest) {
+    elfcache::g_trace = nullptr;
+    g_load = {};
+    g_load_started = std::chrono::steady_clock::now();
+    if (!boottrace::running()) boottrace::start();
+    auto hashed = std::async(std::launch::async, [tar, tar_len, &entry_path] {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t d = image_digest(tar, tar_len, entry_path);
+        return std::make_pair(d, ms_since(t0));
+    });
+    auto fs = load_vfs(tar, tar_len, entry_path);
+    g_load.vfs_ms = ms_since(g_load_started);
+    auto [d, ms] = hashed.get();
+    g_load.digest_ms = ms;
+    digest = d;
+    g_profile_key = d;
+    return fs;
+}
+
+// The startup is over (the guest reached its ready point): stop recording
+inline void end_startup_profile() {
+    elfcache::g_trace = nullptr;
+}
+
+inline std::string load_stats_json() {
+    const auto& t = g_load;
+    char buf[384];
+    snprintf(buf, sizeof(buf),
+        "{\"vfs_ms\":%.2f,\"digest_ms\":%.2f,\"entry_ms\":%.2f,\"machine_ms\":%.2f,"
+        "\"interp_ms\":%.2f,\"prefetch_ms\":%.2f,\"interp_load_ms\":%.2f,"
+        "\"setup_ms\":%.2f,\"total_ms\":%.2f,\"prefetched\":%zu}",
+        t.vfs_ms, t.digest_ms, t.entry_ms, t.machine_ms, t.interp_ms, t.prefetch_ms,
+        t.interp_load_ms, t.setup_ms, t.total_ms, t.prefetched);
+    return buf;
+}
+
+struct BootInfo {
+    std::string resolved_entry;
+    size_t binary_size = 0;
+    std::string interpreter;    // Empty for static binaries
+    uint64_t pie_base = 0;
+};
+
+// Create a machine for `entry_path` in `fs`: load it (and its interpreter
+// when dynamic), install the friscy syscalls and set up argv/envp. Returns
+// nullptr with `error` set when a binary cannot be found or read; machine
+// exceptions propagate. The printer and unhandled-syscall hook are left to
+// the caller.
+inline std::unique_ptr<Machine> boot(vfs::VirtualFS& fs, const std::string& entry_path,
+                                     BootInfo& info, std::string& error) {
+    // Timed from load_image() when the VFS came from there
+    auto t_boot = std::chrono::steady_clock::now();
+    auto started = g_load_started;
+    if (started == std::chrono::steady_clock::time_point{}) {
+        g_load = {};
+        started = t_boot;
+        boottrace::start();
+    }
+    g_load_started = {};
+
+    // Resolve the entry path (may be a symlink, e.g. /bin/sh -> /bin/busybox)
+    std::string resolved_entry = resolve_vfs_path(fs, entry_path);
+    if (resolved_entry.empty()) {
+        error = "Entry not found: " + entry_path;
+        return nullptr;
+    }
+
+    // The entry binary, shared with later execs of the same file
+    auto blob = elfcache::get(fs, resolved_entry);
+    if (!blob || blob->bytes.empty()) {
+        error = "Failed to read entry binary: " + resolved_entry;
+        return nullptr;
+    }
+    info.resolved_entry = resolved_entry;
+    info.binary_size = blob->bytes.size();
+
+    // Check for dynamic linking (parse errors surface like parse_elf's)
+    if (!blob->error.empty() || !blob->is_elf) elf::parse_elf(blob->bytes);
+    const auto& binary = blob->bytes;
+    auto exec_info = blob->elf.info;
+    bool use_dynamic_linker = exec_info.is_dynamic &&
+                              !exec_info.interpreter.empty();
+    g_load.entry_ms = ms_since(t_boot);
+
+    elfcache::BlobRef interp_blob;
+    std::string interp_resolved;
+    elf::ElfInfo interp_info{};
+    uint64_t interp_base = 0;
+
+    // Worker: the interpreter, then the startup profile. Only it touches the
+    // VFS and elfcache until it is joined; the machine is built meanwhile.
+    std::vector<std::string> profile = g_profiles[g_profile_key];
+    auto worker = std::async(std::launch::async, [&] {
+        auto t0 = std::chrono::steady_clock::now();
+        if (use_dynamic_linker) {
+            interp_resolved = resolve_vfs_path(fs, exec_info.interpreter);
+            if (!interp_resolved.empty()) interp_blob = elfcache::get(fs, interp_resolved);
+        }
+        g_load.interp_ms = ms_since(t0);
+        auto t1 = std::chrono::steady_clock::now();
+        for (const auto& path : profile) {
+            if (g_load.prefetched >= MAX_PREFETCH) break;
+            if (path != resolved_entry && path != interp_resolved && elfcache::get(fs, path)) {
+                g_load.prefetched++;
+            }
+        }
+        g_load.prefetch_ms = ms_since(t1);
+    });
+
+    // Create the RISC-V machine (512MB arena for container workloads)
+    auto t_machine = std::chrono::steady_clock::now();
+    riscv::MachineOptions<riscv::RISCV64> options{
+        .memory_max = 512ull << 20,  // 512MB
+    };
+    auto machine = std::make_unique<Machine>(binary, options);
+    pageattr::reset();
+    g_load.machine_ms = ms_since(t_machine);
+    worker.get();
+
+    // Record what this boot goes on to exec as the profile for the next one
+    g_profiles[g_profile_key].clear();
+    elfcache::g_trace = &g_profiles[g_profile_key];
+
+    if (use_dynamic_linker) {
+        info.interpreter = exec_info.interpreter;
+        if (interp_resolved.empty()) {
+            error = "Interpreter not found: " + exec_info.interpreter;
+            return nullptr;
+        }
+        if (!interp_blob || interp_blob->bytes.empty()) {
+            error = "Failed to read interpreter: " + interp_resolved;
+            return nullptr;
+        }
+        if (!interp_blob->error.empty() || !interp_blob->is_elf) elf::parse_elf(interp_blob->bytes);
+        interp_info = interp_blob->elf.info;
+    }
+
+    // If dynamic, load interpreter and set up auxiliary vector
+    auto t_interp = std::chrono::steady_clock::now();
+    if (use_dynamic_linker) {
+        // Load interpreter within the 512MB arena (at 384MB mark)
+        interp_base = 0x18000000;
+
+        dynlink::load_elf_segments(*machine, interp_blob->bytes, interp_blob->elf, interp_base);
+
+        // Calculate interpreter entry point
+        uint64_t interp_entry = interp_info.entry_point;
+        if (interp_info.type == elf::ET_DYN) {
+            interp_entry = interp_info.entry_point - interp_blob->elf.load_range.first + interp_base;
+        }
+
+        // Advance mmap past interpreter to prevent overlap (from standalone)
+        auto [interp_lo, interp_hi] = interp_blob->elf.load_range;
+        uint64_t interp_end_page = (interp_base + interp_hi + 0xFFF) & ~0xFFFULL;
+        if (machine->memory.mmap_address() < interp_end_page) {
+            machine->memory.mmap_address() = interp_end_page;
+        }
+
+        // Jump to interpreter instead of main binary
+        machine->cpu.jump(interp_entry);
+    }
+
+    // Where the main binary landed: PIE (dynamic or static-PIE) images are
+    // placed by libriscv, ET_EXEC ones at their link addresses
+    {
+        uint64_t exec_base = 0;
+        if (exec_info.type == elf::ET_DYN) {
+            uint64_t actual_entry = machine->memory.start_address();
+            exec_base = actual_entry - exec_info.entry_point;
+            exec_info.phdr_addr += exec_base;
+            exec_info.entry_point = actual_entry;
+            info.pie_base = exec_base;
+        }
+        syscalls::g_exec_ctx.exec_base = exec_base + blob->elf.load_range.first;
+        auto [rw_lo, rw_hi] = blob->elf.writable_range;
+        if (rw_lo < rw_hi) {
+            syscalls::g_exec_ctx.exec_rw_start = exec_base + rw_lo;
+            syscalls::g_exec_ctx.exec_rw_end = exec_base + rw_hi;
+        }
+    }
+
+    // Save execution context for execve support
+    syscalls::g_exec_ctx.exec_blob = blob;
+    syscalls::g_exec_ctx.exec_path = resolved_entry;
+    syscalls::g_exec_ctx.exec_info = exec_info;
+    if (use_dynamic_linker) {
+        syscalls::g_exec_ctx.interp_blob = interp_blob;
+        syscalls::g_exec_ctx.interp_path = interp_resolved;
+        syscalls::g_exec_ctx.interp_base = interp_base;
+        syscalls::g_exec_ctx.interp_entry = machine->cpu.pc();
+        syscalls::g_exec_ctx.dynamic = true;
+        auto [irw_lo, irw_hi] = interp_blob->elf.writable_range;
+        syscalls::g_exec_ctx.interp_rw_start = interp_base + irw_lo;
+        syscalls::g_exec_ctx.interp_rw_end = interp_base + irw_hi;
+    }
+
+    g_load.interp_load_ms = ms_since(t_interp);
+    boottrace::mark("elf_load");
+    auto t_setup = std::chrono::steady_clock::now();
+
+    // Install Linux syscall emulation (defaults from libriscv)
+    machine->setup_linux_syscalls();
+
+    // Set up heap and mmap area (64MB)
+    const auto heap_area = machine->memory.mmap_allocate(64ULL << 20);
+    machine->setup_native_heap(HEAP_SYSCALLS_BASE, heap_area, 64ULL << 20);
+    syscalls::g_exec_ctx.heap_start = heap_area;
+    syscalls::g_exec_ctx.heap_size = 64ULL << 20;
+
+    Machine::setup_native_memory(MEMORY_SYSCALLS_BASE);
+
+    // Install our custom VFS-backed syscall handlers (overrides libriscv defaults)
+    syscalls::install_syscalls(*machine, fs);
+
+    // Install network syscall handlers (real POSIX sockets via Android)
+    net::install_network_syscalls(*machine);
+
+    // Wire up network bridge function pointers for syscalls.hpp
+    // (syscalls.hpp uses these to delegate socket I/O without including network.hpp)
+    syscalls::net_is_socket_fd = [](int fd) -> bool {
+        return net::get_network_ctx().is_socket_fd(fd);
+    };
+    syscalls::net_get_native_fd = [](int fd) -> int {
+        return net::io_native_fd(fd);
+    };
+    syscalls::net_close_socket = [](int fd) -> int {
+        return net::get_network_ctx().close_socket(fd);
+    };
+    syscalls::net_is_nonblocking = [](int fd) -> bool {
+        auto* sock = net::get_network_ctx().get_socket(fd);
+        return sock && sock->nonblocking;
+    };
+    syscalls::net_set_nonblocking = [](int fd, bool enabled) {
+        net::get_network_ctx().set_nonblocking(fd, enabled);
+    };
+    pagecache::arena_busy = [] { return snapshot::background_pending(); };
+    pagecache::map_fixed = [](void* at, uint64_t len, int fd, uint64_t offset) {
+        int flags = MAP_PRIVATE | MAP_FIXED | (fd < 0 ? MAP_ANONYMOUS : 0);
+        return mmap(at, len, PROT_READ | PROT_WRITE, flags, fd,
+                    static_cast<off_t>(offset)) != MAP_FAILED;
+    };
+
+    // Initialize cooperative thread scheduler (for CLONE_THREAD support)
+    syscalls::g_sched = {};
+    syscalls::g_fork = {};
+    syscalls::g_next_pid = 100;
+    syscalls::g_mmap_bump = 0;
+    prelink::reset();
+    pagecache::reset();
+
+    // Environment variables (synced from standalone)
+    std::vector<std::string> guest_env = {
+        "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin",
+        "HOME=/root",
+        "USER=root",
+        "TERM=xterm-256color",
+        "LANG=C.UTF-8",
+        "HOSTNAME=friscy",
+        "TZ=UTC",
+        "NODE_OPTIONS=--jitless --max-old-space-size=256",
+        "NODE_COMPILE_CACHE=/tmp/node-compile-cache",
+    };
+    syscalls::g_exec_ctx.env = guest_env;
+
+    // Arguments
+    std::vector<std::string> guest_args = {entry_path};
+
+    // Set up program stack. Static images get the same auxv execve builds
+    // for them, with AT_BASE 0 so a static-PIE relocates itself. The top
+    // slot holds the signal return trampoline, as after an execve.
+    uint64_t stack_top = machine->cpu.reg(riscv::REG_SP);
+    syscalls::g_exec_ctx.original_stack_top = stack_top;
+    signals::reset();
+    signals::install_trampoline(*machine, stack_top);
+    uint64_t sp = dynlink::setup_dynamic_stack(
+        *machine, exec_info, interp_base,
+        guest_args, guest_env, stack_top - execcache::STUB_SLOT);
+    machine->cpu.reg(riscv::REG_SP) = sp;
+
+    // The boot trace sees ld-musl hand over to the program through the exec
+    // cache's entry stub; a static program starts at its entry
+    if (use_dynamic_linker && boottrace::running()) {
+        execcache::redirect_entry(*machine, stack_top - execcache::STUB_SLOT, sp);
+    }
+    boottrace::mark("boot_setup");
+    if (!use_dynamic_linker) boottrace::mark("entry");
+    boottrace::wrap_syscalls();
+
+    g_load.setup_ms = ms_since(t_setup);
+    g_load.total_ms = ms_since(started);
+    fprintf(stderr, "[load] %.1f ms: vfs %.1f (digest %.1f), entry %.1f, machine %.1f "
+            "(interp %.1f, %zu prefetched %.1f), interp load %.1f, setup %.1f\n",
+            g_load.total_ms, g_load.vfs_ms, g_load.digest_ms, g_load.entry_ms,
+            g_load.machine_ms, g_load.interp_ms, g_load.prefetched, g_load.prefetch_ms,
+            g_load.interp_load_ms, g_load.setup_ms);
+    return machine;
+}
+
+// ============================================================================
+// Runtime state
+// ============================================================================
+//
+// A snapshot's arena is only resumable together with the state around it
+// (VFS delta, fds, threads, exec context, sockets). The blob starts with a
+// version and the image digest so a mismatch is caught before the arena is
+// touched.
+
+// Bump when the layout written by capture_state() changes
+inline constexpr uint32_t RUNTIME_STATE_VERSION = 4;
+
+inline std::vector<uint8_t> capture_state(uint64_t digest, vfs::VirtualFS& fs, Machine& machine) {
+    serial::Writer w;
+    w.u32(RUNTIME_STATE_VERSION);
+    w.u64(digest);
+    fs.save_state(w);
+    syscalls::save_state(w, machine, fs);
+    net::get_network_ctx().save_state(w);
+    return std::move(w.data());
+}
+
+// Checked before the arena is touched, so a snapshot taken from another
+// image is rejected without clobbering the running session.
+inline bool state_compatible(const std::vector<uint8_t>& state, uint64_t digest,
+                             std::string& error) {
+    serial::Reader r(state);
+    uint32_t version = r.u32();
+    uint64_t state_digest = r.u64();
+    if (!r.ok() || version != RUNTIME_STATE_VERSION) {
+        error = "Snapshot runtime state version " + std::to_string(version) + " unsupported";
+        return false;
+    }
+    if (state_digest != digest) {
+        error = "Snapshot was taken from a different rootfs/entry";
+        return false;
+    }
+    return true;
+}
+
+inline bool apply_state(const std::vector<uint8_t>& state, vfs::VirtualFS& fs, Machine& machine) {
+    serial::Reader r(state);
+    r.u32();
+    r.u64();
+    return fs.load_state(r) &&
+           syscalls::load_state(r, machine, fs) &&
+           net::get_network_ctx().load_state(r) &&
+           r.at_end();
+}
+
+}  // namespace session
@@ -0,0 +1,307 @@
+// signals.hpp - Guest signal dispositions, masks and handler frames
+//
+// Signals used to be accepted and dropped. Go relies on them: its
+// scheduler preempts a goroutine that has run too long by sending that
+// thread SIGURG (tgkill), and the handler rewrites the interrupted PC in
+// the signal frame so the thread enters asyncPreempt. Signals sent with
+// kill/tkill/tgkill are now delivered to handlers installed with
+// rt_sigaction. A Linux riscv64 rt_sigframe (siginfo, then a ucontext
+// holding every integer and FP register) is built on the thread's stack,
+// or on its sigaltstack, and rt_sigreturn resumes from whatever the
+// handler left in it.
+//
+// Delivery happens when the target thread next runs. A thread signalling
+// itself sees the handler right after that syscall returns; any other
+// thread sees it when the scheduler switches to it (syscalls.hpp). There
+// is no vDSO, so handlers return through a two-instruction trampoline
+// (li a7, rt_sigreturn; ecall) at a fixed slot just above the initial
+// stack, next to the exec cache's entry stub.
+//
+// Signals with no handler installed keep the old behaviour: they are
+// dropped, never acted on (no process is killed or stopped).
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <libriscv/machine.hpp>
+#include "page_attrs.hpp"
+
+namespace signals {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+inline constexpr int NSIG = 64;
+inline constexpr int SIGKILL = 9;
+inline constexpr int SIGSTOP = 19;
+inline constexpr int SYS_RT_SIGRETURN = 139;
+
+inline constexpr uint64_t SIG_DFL = 0;
+inline constexpr uint64_t SIG_IGN = 1;
+inline constexpr uint64_t SA_NODEFER = 0x40000000;
+inline constexpr uint64_t SA_RESETHAND = 0x80000000;
+inline constexpr uint64_t SA_ONSTACK = 0x08000000;
+inline constexpr uint32_t SS_ONSTACK = 1;
+inline constexpr uint32_t SS_DISABLE = 2;
+inline constexpr uint64_t MINSIGSTKSZ = 2048;
+inline constexpr int32_t SI_TKILL = -6;
+
+// Linux riscv64 frame layout
+inline constexpr uint64_t SIGINFO_SIZE = 128;
+inline constexpr uint64_t UC_STACK = 16;        // stack_t uc_stack
+inline constexpr uint64_t UC_SIGMASK = 40;      // sigset_t uc_sigmask (+120 bytes reserved)
+inline constexpr uint64_t UC_MCONTEXT = 176;    // struct sigcontext, 16-byte aligned
+inline constexpr uint64_t MC_FPREGS = 256;      // After sc_regs (pc, x1..x31)
+inline constexpr uint64_t MC_FCSR = MC_FPREGS + 32 * 8;
+inline constexpr uint64_t UCONTEXT_SIZE = UC_MCONTEXT + MC_FPREGS + 528;
+inline constexpr uint64_t FRAME_SIZE = SIGINFO_SIZE + UCONTEXT_SIZE;
+
+// Offset of the return trampoline below the initial stack top (inside
+// execcache::STUB_SLOT, after the entry stub)
+inline constexpr uint64_t TRAMPOLINE_SLOT = 8;
+
+inline constexpr uint64_t bit(int sig) { return 1ull << (sig - 1); }
+inline constexpr uint64_t UNBLOCKABLE = bit(SIGKILL) | bit(SIGSTOP);
+
+// rt_sigaction's struct: handler, flags, mask (8 bytes on riscv64)
+struct Action {
+    uint64_t handler = SIG_DFL;
+    uint64_t flags = 0;
+    uint64_t mask = 0;
+};
+
+// Per guest thread. Plain data: it lives in the scheduler's VThread, which
+// snapshots store raw.
+struct Thread {
+    uint64_t pending = 0;
+    uint64_t blocked = 0;
+    uint64_t alt_sp = 0;
+    uint64_t alt_size = 0;
+    uint32_t alt_flags = SS_DISABLE;
+    uint32_t reserved = 0;
+};
+
+struct Stats {
+    uint64_t sent = 0;         // Queued for a handler
+    uint64_t delivered = 0;    // Frames built
+    uint64_t returned = 0;     // rt_sigreturn
+    uint64_t dropped = 0;      // No handler installed
+};
+
+inline Action g_actions[NSIG];
+inline Action g_parent_actions[NSIG];   // Saved across an emulated vfork
+inline Thread g_parent_thread;
+inline Stats g_stats;
+
+inline void reset() {
+    for (auto& a : g_actions) a = {};
+    g_stats = {};
+}
+
+// execve: caught signals go back to their default, ignored ones stay ignored
+inline void new_image() {
+    for (auto& a : g_actions) {
+        if (a.handler != SIG_IGN) a = {};
+    }
+}
+
+// The emulated fork child runs on the parent's thread: its sigaction and
+// sigprocmask calls are undone when it exits
+inline void fork_child(const Thread& t) {
+    std::memcpy(g_parent_actions, g_actions, sizeof(g_actions));
+    g_parent_thread = t;
+}
+inline void fork_exit(Thread& t) {
+    std::memcpy(g_actions, g_parent_actions, sizeof(g_actions));
+    t = g_parent_thread;
+}
+
+inline bool on_altstack(const Thread& t, uint64_t sp) {
+    return t.alt_size != 0 && sp > t.alt_sp && sp - t.alt_sp <= t.alt_size;
+}
+
+// Write the return trampoline below `stack_top`. Written with every new
+// stack, before anything can run from that page.
+inline void install_trampoline(Machine& m, uint64_t stack_top) {
+    if (stack_top < TRAMPOLINE_SLOT) return;
+    uint64_t at = stack_top - TRAMPOLINE_SLOT;
+    constexpr uint32_t LI_A7 = (uint32_t(SYS_RT_SIGRETURN) << 20) | (17u << 7) | 0x13;  // addi a7, x0, N
+    constexpr uint32_t ECALL = 0x00000073;
+    riscv::PageAttributes rwx;
+    rwx.read = true; rwx.write = true; rwx.exec = true;
+    pageattr::set(m.memory, at & ~0xFFFULL, 4096, rwx);
+    m.memory.template write<uint32_t>(at, LI_A7);
+    m.memory.template write<uint32_t>(at + 4, ECALL);
+}
+
+// Queue `sig` for `t`. Returns false when it is dropped (no handler).
+inline bool raise(Thread& t, int sig) {
+    if (sig < 1 || sig > NSIG) return false;
+    if (g_actions[sig - 1].handler <= SIG_IGN) {
+        g_stats.dropped++;
+        return false;
+    }
+    t.pending |= bit(sig);
+    g_stats.sent++;
+    return true;
+}
+
+// Enter the handler of the lowest pending, unblocked signal of `t`, which
+// must be the thread currently in the machine. The interrupted context is
+// the machine's registers, resumed at pc(). Returns whether one was entered.
+inline bool deliver(Machine& m, Thread& t, uint64_t stack_top) {
+    uint64_t ready = t.pending & ~t.blocked;
+    if (ready == 0 || stack_top < TRAMPOLINE_SLOT) return false;
+    int sig = __builtin_ctzll(ready) + 1;
+    t.pending &= ~bit(sig);
+    const Action a = g_actions[sig - 1];
+    if (a.handler <= SIG_IGN) return false;   // Reset since it was raised
+
+    uint64_t sp = m.cpu.reg(riscv::REG_SP);
+    bool was_on_alt = on_altstack(t, sp);
+    if ((a.flags & SA_ONSTACK) && t.alt_size && !(t.alt_flags & SS_DISABLE) && !was_on_alt) {
+        sp = t.alt_sp + t.alt_size;
+    }
+    sp = (sp - FRAME_SIZE) & ~15ULL;
+
+    uint8_t frame[FRAME_SIZE] = {};
+    auto put32 = [&](uint64_t off, uint32_t v) { std::memcpy(frame + off, &v, 4); };
+    auto put64 = [&](uint64_t off, uint64_t v) { std::memcpy(frame + off, &v, 8); };
+    put32(0, static_cast<uint32_t>(sig));                   // si_signo
+    put32(8, static_cast<uint32_t>(SI_TKILL));              // si_code
+    put32(16, 1);                                           // si_pid
+
+    const uint64_t uc = SIGINFO_SIZE;
+    put64(uc + UC_STACK, t.alt_sp);
+    put32(uc + UC_STACK + 8, t.alt_size ? (was_on_alt ? SS_ONSTACK : t.alt_flags) : SS_DISABLE);
+    put64(uc + UC_STACK + 16, t.alt_size);
+    put64(uc + UC_SIGMASK, t.blocked);
+    const uint64_t mc = uc + UC_MCONTEXT;
+    put64(mc, m.cpu.pc());
+    for (int i = 1; i < 32; i++) put64(mc + i * 8, m.cpu.reg(i));
+    auto& regs = m.cpu.registers();
+    for (int i = 0; i < 32; i++) put64(mc + MC_FPREGS + i * 8, regs.getfl(i).i64);
+    put32(mc + MC_FCSR, regs.fcsr().whole);
+    m.memory.memcpy(sp, frame, sizeof(frame));
+
+    t.blocked |= a.mask;
+    if (!(a.flags & SA_NODEFER)) t.blocked |= bit(sig);
+    t.blocked &= ~UNBLOCKABLE;
+    if (a.flags & SA_RESETHAND) g_actions[sig - 1] = {};
+
+    m.cpu.reg(riscv::REG_SP) = sp;
+    m.cpu.reg(10) = static_cast<uint64_t>(sig);   // a0
+    m.cpu.reg(11) = sp;                            // a1: siginfo
+    m.cpu.reg(12) = sp + uc;                       // a2: ucontext
+    m.cpu.reg(1) = stack_top - TRAMPOLINE_SLOT;    // ra
+    m.cpu.jump(a.handler);
+    g_stats.delivered++;
+    return true;
+}
+
+// rt_sigreturn: resume the context in the frame at sp, as the handler left it
+inline void sigreturn(Machine& m, Thread& t) {
+    uint64_t sp = m.cpu.reg(riscv::REG_SP);
+    uint8_t frame[FRAME_SIZE];
+    m.memory.memcpy_out(frame, sp, sizeof(frame));
+    auto get32 = [&](uint64_t off) { uint32_t v; std::memcpy(&v, frame + off, 4); return v; };
+    auto get64 = [&](uint64_t off) { uint64_t v; std::memcpy(&v, frame + off, 8); return v; };
+
+    const uint64_t uc = SIGINFO_SIZE;
+    const uint64_t mc = uc + UC_MCONTEXT;
+    t.blocked = get64(uc + UC_SIGMASK) & ~UNBLOCKABLE;
+    auto& regs = m.cpu.registers();
+    for (int i = 0; i < 32; i++) regs.getfl(i).i64 = get64(mc + MC_FPREGS + i * 8);
+    regs.fcsr().whole = get32(mc + MC_FCSR);
+    for (int i = 1; i < 32; i++) m.cpu.reg(i) = get64(mc + i * 8);
+    m.cpu.jump(get64(mc));
+    g_stats.returned++;
+}
+
+// rt_sigaction(sig, act, oldact, sigsetsize). Returns the syscall result.
+inline int64_t sigaction(Machine& m, Thread& t, int sig, uint64_t act_addr, uint64_t old_addr,
+                         uint64_t sigsetsize) {
+    if (sig < 1 || sig > NSIG || sigsetsize != 8) return -22;   // -EINVAL
+    if (act_addr && (sig == SIGKILL || sig == SIGSTOP)) return -22;
+    Action old = g_actions[sig - 1];
+    if (act_addr) {
+        Action a;
+        a.handler = m.memory.template read<uint64_t>(act_addr);
+        a.flags = m.memory.template read<uint64_t>(act_addr + 8);
+        a.mask = m.memory.template read<uint64_t>(act_addr + 16) & ~UNBLOCKABLE;
+        g_actions[sig - 1] = a;
+        if (a.handler <= SIG_IGN) t.pending &= ~bit(sig);
+    }
+    if (old_addr) {
+        m.memory.template write<uint64_t>(old_addr, old.handler);
+        m.memory.template write<uint64_t>(old_addr + 8, old.flags);
+        m.memory.template write<uint64_t>(old_addr + 16, old.mask);
+    }
+    return 0;
+}
+
+// rt_sigprocmask(how, set, oldset, sigsetsize)
+inline int64_t sigprocmask(Machine& m, Thread& t, int how, uint64_t set_addr, uint64_t old_addr,
+                           uint64_t sigsetsize) {
+    constexpr int SIG_BLOCK = 0, SIG_UNBLOCK = 1, SIG_SETMASK = 2;
+    if (sigsetsize != 8) return -22;
+    uint64_t old = t.blocked;
+    if (set_addr) {
+        uint64_t set = m.memory.template read<uint64_t>(set_addr);
+        switch (how) {
+            case SIG_BLOCK:   t.blocked |= set; break;
+            case SIG_UNBLOCK: t.blocked &= ~set; break;
+            case SIG_SETMASK: t.blocked = set; break;
+            default: return -22;
+        }
+        t.blocked &= ~UNBLOCKABLE;
+    }
+    if (old_addr) m.memory.template write<uint64_t>(old_addr, old);
+    return 0;
+}
+
+// sigaltstack(ss, old_ss)
+inline int64_t sigaltstack(Machine& m, Thread& t, uint64_t ss_addr, uint64_t old_addr) {
+    bool on_alt = on_altstack(t, m.cpu.reg(riscv::REG_SP));
+    if (old_addr) {
+        m.memory.template write<uint64_t>(old_addr, t.alt_sp);
+        m.memory.template write<uint32_t>(old_addr + 8, on_alt ? SS_ONSTACK : t.alt_flags);
+        m.memory.template write<uint64_t>(old_addr + 16, t.alt_size);
+    }
+    if (ss_addr) {
+        if (on_alt) return -1;   // -EPERM
+        uint64_t sp = m.memory.template read<uint64_t>(ss_addr);
+        uint32_t flags = m.memory.template read<uint32_t>(ss_addr + 8);
+        uint64_t size = m.memory.template read<uint64_t>(ss_addr + 16);
+        if (flags & ~SS_DISABLE) return -22;
+        if (flags & SS_DISABLE) {
+            t.alt_sp = t.alt_size = 0;
+            t.alt_flags = SS_DISABLE;
+        } else {
+            if (size < MINSIGSTKSZ) return -12;   // -ENOMEM
+            t.alt_sp = sp;
+            t.alt_size = size;
+            t.alt_flags = 0;
+        }
+    }
+    return 0;
+}
+
+inline std::string stats_json() {
+    int handled = 0;
+    for (const auto& a : g_actions) handled += a.handler > SIG_IGN;
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+        "{\"handlers\":%d,\"sent\":%llu,\"delivered\":%llu,\"returned\":%llu,\"dropped\":%llu}",
+        handled,
+        (unsigned long long)g_stats.sent,
+        (unsigned long long)g_stats.delivered,
+        (unsigned long long)g_stats.returned,
+        (unsigned long long)g_stats.dropped);
+    return buf;
+}
+
+}  // namespace signals
@@ -0,0 +1,2121 @@
+// snapshot.hpp - Machine snapshot save/restore for friscy
+//
+// libriscv's built-in serialize() does not work with RISCV_FLAT_RW_ARENA,
+// so friscy snapshots the CPU registers and the flat arena directly.
+//
+// Format v1 (legacy, restore only):
+//   [magic: 8]  [version: 4]  [regs_size: 4]
+//   [arena_size: 8]  [instruction_counter: 8]
+//   [registers: regs_size bytes]
+//   [arena: arena_size bytes]
+//
+// Format v2 (sparse, chunked, compressed):
+//   [FileHeader]                      magic/version at the same offsets as v1
+//   [chunk payloads ...]              only stored chunks, LZ4 or raw
+//   [sections ...]                    REGS, INDEX, HASHES, META, STATE
+//   [SectionEntry x section_count]    at header.section_table_offset
+//
+// The arena is split into CHUNK_SIZE chunks. All-zero chunks are not stored
+// at all (a 512MB arena is mostly untouched), the rest are LZ4-compressed on
+// a small worker pool and kept raw when compression does not help. The
+// INDEX section maps each stored chunk to its file range. Restore reads the
+// index, then decompresses chunks straight into the arena in parallel and
+// zero-fills the chunks that are absent.
+//
+// Incremental snapshots: every v2 file carries a hash per chunk (HASHES).
+// The hashes of the last snapshot saved or restored are kept as the
+// baseline; an incremental save stores only the chunks whose hash differs
+// and names the baseline file as its parent (META). Chunks missing from an
+// incremental file are resolved by walking the parent chain; CODEC_ZERO
+// entries record chunks that became zero. Chains are capped at
+// MAX_CHAIN_DEPTH, after which the next save is written in full, and
+// consolidate() rewrites a chain member into a standalone file in place.
+//
+// Lazy restore: raw chunks whose file offset and arena address are both
+// page-aligned are mmap'd MAP_PRIVATE|MAP_FIXED straight over the arena
+// instead of being read, and zero runs are replaced with fresh anonymous
+// mappings. Restore is then a handful of mmap calls and the kernel pages
+// guest memory in on first touch. Layout::Mappable saves store every chunk
+// raw at CHUNK_SIZE-aligned offsets (valid for 4K and 16K page kernels) so
+// the whole file qualifies; compressed chunks are still decoded eagerly.
+// Snapshot files are only ever replaced by rename, never rewritten in
+// place, so pages mapped from them stay stable.
+//
+// Runtime state: the arena alone is not a resumable session. The caller
+// can attach an opaque blob (VFS delta, fd tables, threads, exec context;
+// see friscy_runtime.cpp) that is stored LZ4-compressed in a STATE section.
+// It is never chained: every file, incremental or not, carries the full
+// state for its own point in time, and read_state() fetches it without
+// touching the arena so it can be validated before a restore commits.
+//
+// Background saves: save_background() holds the guest only while the arena
+// is write-protected and writes the chunks from a thread, copying a chunk
+// aside when the guest writes to it first (see "Background save" below).
+//
+// Deduplicated snapshots: Layout::Stored writes no payloads into the file.
+// Each non-zero chunk goes to the content-addressed store next to it
+// (chunk_store.hpp) unless an identical chunk is already there, and the
+// INDEX entry says CODEC_STORED; the KEYS section carries the second half
+// of each chunk's 128-bit store key. Stored snapshots are always full (dedup
+// already skips unchanged chunks), so they never form chains and delete
+// with remove(), which drops their chunk references.
+//
+// Integrity: every v2 file carries FLAG_CHECKSUMS, a CRC32C of every
+// payload (as stored, so it is checked before decompressing) in its INDEX
+// entry, and a CHECK section with a CRC32C over the header fields, the
+// section table and the contents of every other section. open_v2() checks
+// the manifest, so a damaged index or state blob is rejected before any
+// chunk is read. Restore then runs every payload it is about to decode
+// through the CRC, straight from a read-only mapping of the file, and only
+// decodes into the arena once all of them have verified: a truncated or
+// corrupt file fails with the arena untouched, and the check costs about
+// one CRC per payload (the decode pass finds the file in the page cache).
+// Raw chunks that are mapped rather than decoded are not read at restore,
+// which is what keeps a Mappable restore to a few mmap calls; a thread
+// checks them once restore has returned, and the runtime stops the guest
+// if one fails (see "Background check of mapped chunks"). The
+// flag is required rather than optional: open_v2() rejects a v2 file
+// without it, so a damaged flags word cannot switch the checks off (and
+// the flags are sealed into the CHECK section with the rest of the
+// header).
+//
+// Sections are addressed through a table, so new sections can be added
+// without breaking older readers.
+
+#pragma once
+
+#include <libriscv/machine.hpp>
+#include "lz4.hpp"
+#include "chunk_store.hpp"
+#include "crc32c.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace snapshot {
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+inline constexpr uint64_t MAGIC = 0x4653524953435946ULL;  // "FYSCRISF"
+inline constexpr uint32_t VERSION_V1 = 1;
+inline constexpr uint32_t VERSION = 2;
+// 64KB matches the LZ4 window and keeps incremental deltas small
+inline constexpr uint32_t CHUNK_SIZE = 64 * 1024;
+inline constexpr uint32_t MAX_SECTIONS = 64;
+inline constexpr uint32_t MAX_CHAIN_DEPTH = 8;
+inline constexpr size_t MAX_PARENT_NAME = 255;
+
+inline constexpr uint32_t FLAG_INCREMENTAL = 1u << 0;
+inline constexpr uint32_t FLAG_MAPPABLE    = 1u << 1;   // Raw, aligned payloads
+inline constexpr uint32_t FLAG_STORED      = 1u << 2;   // Payloads in the chunk store
+inline constexpr uint32_t FLAG_CHECKSUMS   = 1u << 3;   // Payload CRCs and CHECK section
+
+// Seed of the second half of a chunk store key
+inline constexpr uint64_t STORE_KEY_SEED = 0x6A09E667F3BCC908ULL;
+
+enum SectionType : uint32_t {
+    SECTION_REGS   = 1,   // [regs_size u32][reserved u32][counter u64][registers]
+    SECTION_INDEX  = 2,   // ChunkEntry[]
+    SECTION_HASHES = 3,   // u64 per arena chunk, 0 = all-zero chunk
+    SECTION_META   = 4,   // MetaHeader + parent file name
+    SECTION_STATE  = 5,   // [raw_size u64][LZ4 block] runtime state blob
+    SECTION_KEYS   = 6,   // Stored only: u64 per INDEX entry, store key low half
+    SECTION_CHECK  = 7,   // [manifest crc32c u32][reserved u32]
+};
+
+enum Codec : uint32_t {
+    CODEC_RAW  = 1,
+    CODEC_LZ4  = 2,
+    CODEC_ZERO = 3,   // Incremental only: chunk is zero, no payload
+    CODEC_STORED = 4, // Stored only: payload lives in the chunk store
+};
+
+enum class SaveMode { Full, Incremental };
+enum class Layout { Compressed, Mappable, Stored };
+
+struct FileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t arena_size;
+    uint32_t chunk_size;
+    uint32_t section_count;
+    uint64_t section_table_offset;
+};
+static_assert(sizeof(FileHeader) == 40, "snapshot header layout");
+
+struct SectionEntry {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+static_assert(sizeof(SectionEntry) == 24, "snapshot section layout");
+
+struct ChunkEntry {
+    uint64_t arena_offset;
+    uint64_t file_offset;
+    uint32_t stored_size;
+    uint32_t raw_size;
+    uint32_t codec;
+    uint32_t checksum;   // CRC32C of the stored payload (FLAG_CHECKSUMS; 0 for STORED/ZERO)
+};
+static_assert(sizeof(ChunkEntry) == 32, "snapshot chunk entry layout");
+
+// Parent name is stored relative to the snapshot's directory, so a chain
+// can be moved as a unit.
+struct MetaHeader {
+    uint64_t snapshot_id;
+    uint64_t parent_id;     // 0 for a full snapshot
+    uint32_t depth;         // Number of ancestors
+    uint32_t parent_name_len;
+};
+static_assert(sizeof(MetaHeader) == 24, "snapshot meta layout");
+
+// Throughput report for the last save/restore, compared against what the
+// v1 format would have written for the same arena.
+struct IoStats {
+    uint32_t version = 0;
+    bool incremental = false;
+    uint32_t chain_depth = 0;
+    uint64_t arena_bytes = 0;
+    uint64_t file_bytes = 0;
+    uint64_t v1_bytes = 0;
+    uint64_t state_bytes = 0;      // Save: compressed STATE section
+    uint32_t chunks_total = 0;
+    uint32_t chunks_zero = 0;
+    uint32_t chunks_lz4 = 0;
+    uint32_t chunks_raw = 0;
+    uint32_t chunks_unchanged = 0;
+    uint32_t chunks_deduped = 0;   // Save: already in the chunk store
+    uint64_t store_bytes = 0;      // Save: payload bytes added to the chunk store
+    uint64_t mapped_bytes = 0;     // Restore: file-backed, paged in lazily
+    uint32_t mapped_regions = 0;
+    uint32_t chunks_verified = 0;  // Restore: payload checksums checked
+    uint32_t chunks_mapped = 0;    // Restore: file-backed, checked in the background
+    double verify_seconds = 0.0;   // Restore: checksum time, summed over workers
+    uint32_t threads = 0;
+    bool background = false;       // Save: written copy-on-write while the guest ran
+    uint32_t cow_chunks = 0;       // Save: chunks copied aside on a guest write
+    double pause_seconds = 0.0;    // Save: how long the guest was held
+    double seconds = 0.0;
+
+    double arena_mb_per_sec() const {
+        return seconds > 0 ? arena_bytes / 1e6 / seconds : 0.0;
+    }
+};
+
+// Chunk hashes of the most recent snapshot saved or restored. Incremental
+// saves diff against this.
+struct Baseline {
+    std::string path;
+    uint64_t snapshot_id = 0;
+    uint32_t depth = 0;
+    uint32_t chunk_size = 0;
+    std::vector<uint64_t> hashes;
+
+    bool valid() const { return snapshot_id != 0 && !hashes.empty(); }
+};
+
+inline std::mutex g_mutex;   // Serializes save/restore/consolidate
+inline Baseline g_baseline;
+inline IoStats g_last_save;
+inline IoStats g_last_restore;
+
+// Time from the end of the last restore to the guest's first output, the
+// number that matters for a resumed session. -1 until measured.
+inline std::atomic<int64_t> g_restored_at_ns{0};
+inline std::atomic<int64_t> g_first_output_us{-1};
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+inline uint32_t worker_count() {
+    unsigned n = std::thread::hardware_concurrency();
+    return std::clamp(n, 1u, 4u);
+}
+
+// Run fn(i) for i in [0, n) on up to `threads` threads (including the caller).
+template <typename Fn>
+inline void parallel_for(size_t n, uint32_t threads, Fn&& fn) {
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < n;) fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (uint32_t t = 1; t < threads && t < n; t++) pool.emplace_back(work);
+    work();
+    for (auto& th : pool) th.join();
+}
+
+inline bool is_zero(const uint8_t* p, size_t n) {
+    const uint64_t* w = reinterpret_cast<const uint64_t*>(p);
+    size_t words = n / 8;
+    for (size_t i = 0; i < words; i += 64) {
+        uint64_t acc = 0;
+        size_t end = std::min(words, i + 64);
+        for (size_t j = i; j < end; j++) acc |= w[j];
+        if (acc) return false;
+    }
+    for (size_t i = words * 8; i < n; i++) {
+        if (p[i]) return false;
+    }
+    return true;
+}
+
+// 64-bit content hash of a chunk (chunk_store.hpp; exec_cache keys binaries
+// with it too)
+using chunkstore::chunk_hash;
+
+inline chunkstore::Key store_key(const uint8_t* p, size_t n, uint64_t hash) {
+    return {hash, chunk_hash(p, n, STORE_KEY_SEED)};
+}
+
+// Last step of the manifest checksum, after every section: the header
+// fields that shape the file. Writer::finish() and check_manifest() agree
+// on this.
+inline uint32_t seal_manifest(uint32_t crc, const FileHeader& hdr) {
+    crc = crc32c::update(crc, &hdr.flags, sizeof(hdr.flags));
+    crc = crc32c::update(crc, &hdr.arena_size, sizeof(hdr.arena_size));
+    return crc32c::update(crc, &hdr.chunk_size, sizeof(hdr.chunk_size));
+}
+
+inline uint64_t new_snapshot_id() {
+    std::random_device rd;
+    uint64_t id = (static_cast<uint64_t>(rd()) << 32) ^ rd() ^
+                  static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    return id ? id : 1;
+}
+
+inline std::string dir_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+inline std::string base_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+inline bool write_all(int fd, const void* data, size_t len, uint64_t offset) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, void* data, size_t len, uint64_t offset) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = ::pread(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return false;  // Truncated
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// [offset, offset + size) lies within [0, limit), without the sum (which
+// a corrupt file can make wrap) ever being formed
+inline bool in_bounds(uint64_t offset, uint64_t size, uint64_t limit) {
+    return offset <= limit && size <= limit - offset;
+}
+
+inline double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Called from the guest output path. One relaxed load when no restore is pending.
+inline void note_guest_output() {
+    int64_t t = g_restored_at_ns.load(std::memory_order_relaxed);
+    if (t == 0 || !g_restored_at_ns.compare_exchange_strong(t, 0)) return;
+    g_first_output_us.store((now_ns() - t) / 1000, std::memory_order_relaxed);
+}
+
+inline size_t host_page_size() {
+    static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+// ============================================================================
+// Reading v2 files
+// ============================================================================
+
+// An opened, validated v2 snapshot file.
+struct SnapshotFile {
+    int fd = -1;
+    std::string path;
+    uint64_t file_size = 0;
+    FileHeader hdr{};
+    MetaHeader meta{};
+    std::string parent_name;
+    SectionEntry regs{};
+    SectionEntry hashes{};
+    SectionEntry state{};
+    std::vector<ChunkEntry> index;
+    std::vector<int32_t> chunk_slot;   // Chunk number -> index position, -1 if absent
+    std::vector<uint64_t> chunk_hashes;   // Stored only: HASHES
+    std::vector<uint64_t> store_keys;     // Stored only: KEYS, per index entry
+    const uint8_t* view = nullptr;        // Whole file, mapped by map_view()
+
+    SnapshotFile() = default;
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+    ~SnapshotFile() {
+        if (view) munmap(const_cast<uint8_t*>(view), file_size);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool incremental() const { return hdr.flags & FLAG_INCREMENTAL; }
+    bool stored() const { return hdr.flags & FLAG_STORED; }
+    std::string store_dir() const { return dir_of(path) + "/chunks"; }
+    chunkstore::Key key_of(size_t slot) const {
+        return {chunk_hashes[index[slot].arena_offset / hdr.chunk_size], store_keys[slot]};
+    }
+    size_t chunk_count() const {
+        return (hdr.arena_size + hdr.chunk_size - 1) / hdr.chunk_size;
+    }
+    std::string parent_path() const { return dir_of(path) + "/" + parent_name; }
+};
+
+using Chain = std::vector<std::unique_ptr<SnapshotFile>>;
+
+// Recompute the manifest checksum of a file (every section
+// but CHECK, entry and contents in table order, then the header) and
+// compare it with the CHECK section.
+inline bool check_manifest(const SnapshotFile& f, const std::vector<SectionEntry>& sections) {
+    uint32_t crc = 0;
+    const SectionEntry* check = nullptr;
+    std::vector<uint8_t> buf;
+    for (const auto& s : sections) {
+        if (s.type == SECTION_CHECK) {
+            check = &s;
+            continue;
+        }
+        crc = crc32c::update(crc, &s, sizeof(s));
+        buf.resize(std::min<uint64_t>(s.size, 1u << 20));
+        for (uint64_t pos = 0; pos < s.size;) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(buf.size(), s.size - pos));
+            if (!read_all(f.fd, buf.data(), n, s.offset + pos)) return false;
+            crc = crc32c::update(crc, buf.data(), n);
+            pos += n;
+        }
+    }
+    uint32_t want[2] = {0, 0};
+    bool ok = check && check->size == sizeof(want) &&
+              read_all(f.fd, want, sizeof(want), check->offset) &&
+              seal_manifest(crc, f.hdr) == want[0];
+    if (!ok) fprintf(stderr, "[snapshot] Manifest checksum mismatch in %s\n", f.path.c_str());
+    return ok;
+}
+
+// Open `path` as a v2 snapshot and validate its header, sections and index.
+// When `with_index` is false only the header and META are loaded.
+inline bool open_v2(const std::string& path, SnapshotFile& f, bool with_index = true) {
+    f.path = path;
+    f.fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f.fd < 0) {
+        fprintf(stderr, "[snapshot] Cannot open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st{};
+    if (::fstat(f.fd, &st) != 0) return false;
+    f.file_size = static_cast<uint64_t>(st.st_size);
+
+    auto& hdr = f.hdr;
+    if (!read_all(f.fd, &hdr, sizeof(hdr), 0) || hdr.magic != MAGIC || hdr.version != VERSION) {
+        fprintf(stderr, "[snapshot] %s is not a v2 snapshot\n", path.c_str());
+        return false;
+    }
+    if (hdr.chunk_size == 0 || hdr.section_count == 0 || hdr.section_count > MAX_SECTIONS ||
+        !in_bounds(hdr.section_table_offset, hdr.section_count * sizeof(SectionEntry),
+                   f.file_size)) {
+        fprintf(stderr, "[snapshot] Corrupt header in %s\n", path.c_str());
+        return false;
+    }
+    if (!(hdr.flags & FLAG_CHECKSUMS)) {
+        fprintf(stderr, "[snapshot] %s has no checksums, refusing it\n", path.c_str());
+        return false;
+    }
+
+    std::vector<SectionEntry> sections(hdr.section_count);
+    if (!read_all(f.fd, sections.data(), sections.size() * sizeof(SectionEntry),
+                  hdr.section_table_offset)) {
+        return false;
+    }
+    SectionEntry index_sec{};
+    SectionEntry meta_sec{};
+    SectionEntry keys_sec{};
+    for (const auto& s : sections) {
+        if (!in_bounds(s.offset, s.size, f.file_size)) {
+            fprintf(stderr, "[snapshot] Section %u out of bounds\n", s.type);
+            return false;
+        }
+        switch (s.type) {
+            case SECTION_REGS:   f.regs = s; break;
+            case SECTION_INDEX:  index_sec = s; break;
+            case SECTION_HASHES: f.hashes = s; break;
+            case SECTION_META:   meta_sec = s; break;
+            case SECTION_STATE:  f.state = s; break;
+            case SECTION_KEYS:   keys_sec = s; break;
+            default: break;   // Unknown sections are skipped
+        }
+    }
+    if (!check_manifest(f, sections)) return false;
+    if (f.regs.type != SECTION_REGS || index_sec.type != SECTION_INDEX ||
+        index_sec.size % sizeof(ChunkEntry) != 0) {
+        fprintf(stderr, "[snapshot] Missing REGS/INDEX section\n");
+        return false;
+    }
+    if (f.hashes.type == SECTION_HASHES && f.hashes.size != f.chunk_count() * sizeof(uint64_t)) {
+        fprintf(stderr, "[snapshot] Corrupt HASHES section\n");
+        return false;
+    }
+
+    // META is absent in files written before incremental support
+    if (meta_sec.type == SECTION_META) {
+        if (meta_sec.size < sizeof(MetaHeader) ||
+            !read_all(f.fd, &f.meta, sizeof(MetaHeader), meta_sec.offset) ||
+            f.meta.parent_name_len > MAX_PARENT_NAME ||
+            meta_sec.size != sizeof(MetaHeader) + f.meta.parent_name_len) {
+            fprintf(stderr, "[snapshot] Corrupt META section\n");
+            return false;
+        }
+        f.parent_name.resize(f.meta.parent_name_len);
+        if (!f.parent_name.empty() &&
+            !read_all(f.fd, f.parent_name.data(), f.parent_name.size(),
+                      meta_sec.offset + sizeof(MetaHeader))) {
+            return false;
+        }
+    }
+    if (f.incremental() && (f.parent_name.empty() || f.meta.parent_id == 0 ||
+                            f.parent_name.find('/') != std::string::npos)) {
+        fprintf(stderr, "[snapshot] Incremental snapshot without valid parent\n");
+        return false;
+    }
+    if (!with_index) return true;
+
+    f.index.resize(index_sec.size / sizeof(ChunkEntry));
+    if (!read_all(f.fd, f.index.data(), index_sec.size, index_sec.offset)) return false;
+
+    // Validate every entry before anything touches the arena
+    f.chunk_slot.assign(f.chunk_count(), -1);
+    for (size_t i = 0; i < f.index.size(); i++) {
+        const auto& e = f.index[i];
+        bool valid = e.arena_offset % hdr.chunk_size == 0 &&
+                     in_bounds(e.arena_offset, e.raw_size, hdr.arena_size) &&
+                     e.raw_size <= hdr.chunk_size &&
+                     in_bounds(e.file_offset, e.stored_size, f.file_size);
+        switch (e.codec) {
+            case CODEC_RAW:  valid = valid && e.stored_size == e.raw_size; break;
+            case CODEC_LZ4:  valid = valid && e.stored_size <= lz4::compress_bound(e.raw_size); break;
+            case CODEC_ZERO: valid = valid && e.stored_size == 0 && f.incremental(); break;
+            case CODEC_STORED: valid = valid && e.stored_size == 0 && f.stored(); break;
+            default:         valid = false; break;
+        }
+        if (!valid) {
+            fprintf(stderr, "[snapshot] Corrupt chunk entry %zu in %s\n", i, path.c_str());
+            return false;
+        }
+        f.chunk_slot[e.arena_offset / hdr.chunk_size] = static_cast<int32_t>(i);
+    }
+
+    // Stored files need both key halves to find their payloads
+    if (f.stored()) {
+        if (f.hashes.type != SECTION_HASHES || keys_sec.type != SECTION_KEYS ||
+            keys_sec.size != f.index.size() * sizeof(uint64_t)) {
+            fprintf(stderr, "[snapshot] Stored snapshot without HASHES/KEYS\n");
+            return false;
+        }
+        f.chunk_hashes.resize(f.chunk_count());
+        f.store_keys.resize(f.index.size());
+        if (!read_all(f.fd, f.chunk_hashes.data(), f.hashes.size, f.hashes.offset) ||
+            !read_all(f.fd, f.store_keys.data(), keys_sec.size, keys_sec.offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Open `path` and every ancestor it depends on, newest first.
+inline bool load_chain(const std::string& path, Chain& chain) {
+    auto f = std::make_unique<SnapshotFile>();
+    if (!open_v2(path, *f)) return false;
+    chain.push_back(std::move(f));
+
+    while (chain.back()->incremental()) {
+        const SnapshotFile& child = *chain.back();
+        if (chain.size() > MAX_CHAIN_DEPTH) {
+            fprintf(stderr, "[snapshot] Snapshot chain too deep\n");
+            return false;
+        }
+        auto parent = std::make_unique<SnapshotFile>();
+        if (!open_v2(child.parent_path(), *parent)) return false;
+        if (parent->meta.snapshot_id != child.meta.parent_id ||
+            parent->hdr.arena_size != child.hdr.arena_size ||
+            parent->hdr.chunk_size != child.hdr.chunk_size) {
+            fprintf(stderr, "[snapshot] Parent %s does not match %s\n",
+                    parent->path.c_str(), child.path.c_str());
+            return false;
+        }
+        chain.push_back(std::move(parent));
+    }
+    return true;
+}
+
+// Where chunk `c` lives in a chain: the newest file with an entry for it.
+// Returns nullptr for a zero chunk.
+inline const ChunkEntry* resolve(const Chain& chain, size_t c, const SnapshotFile*& owner) {
+    for (const auto& f : chain) {
+        int32_t slot = f->chunk_slot[c];
+        if (slot >= 0) {
+            owner = f.get();
+            const ChunkEntry* e = &f->index[slot];
+            return e->codec == CODEC_ZERO ? nullptr : e;
+        }
+        if (!f->incremental()) break;
+    }
+    owner = nullptr;
+    return nullptr;
+}
+
+// Fetch the payload of a CODEC_STORED entry from the chunk store and
+// report the codec it was stored with.
+inline bool read_stored(const SnapshotFile& f, const ChunkEntry& e, uint32_t& codec,
+                        std::vector<uint8_t>& payload) {
+    chunkstore::ChunkHeader hdr{};
+    size_t slot = f.chunk_slot[e.arena_offset / f.hdr.chunk_size];
+    if (!chunkstore::Store(f.store_dir()).get(f.key_of(slot), hdr, payload)) return false;
+    bool valid = hdr.raw_size == e.raw_size &&
+                 ((hdr.codec == CODEC_RAW && hdr.stored_size == hdr.raw_size) ||
+                  (hdr.codec == CODEC_LZ4 && hdr.stored_size <= lz4::compress_bound(hdr.raw_size)));
+    if (!valid) {
+        fprintf(stderr, "[snapshot] Stored chunk does not match its entry\n");
+        return false;
+    }
+    codec = hdr.codec;
+    return true;
+}
+
+// Checksums checked while reading chunks, for the restore stats.
+struct VerifyTally {
+    std::atomic<uint32_t> chunks{0};
+    std::atomic<uint64_t> ns{0};
+};
+
+// Check a payload read from `f` against its INDEX checksum.
+inline bool payload_ok(const SnapshotFile& f, const ChunkEntry& e, const uint8_t* payload,
+                       VerifyTally* tally = nullptr) {
+    int64_t t0 = tally ? now_ns() : 0;
+    bool ok = crc32c::compute(payload, e.stored_size) == e.checksum;
+    if (tally) {
+        tally->chunks.fetch_add(1, std::memory_order_relaxed);
+        tally->ns.fetch_add(now_ns() - t0, std::memory_order_relaxed);
+    }
+    if (!ok) {
+        fprintf(stderr, "[snapshot] Checksum mismatch in chunk at 0x%llx of %s\n",
+                (unsigned long long)e.arena_offset, f.path.c_str());
+    }
+    return ok;
+}
+
+// Map all of `f` read-only for check_chunk(). Optional: without a view,
+// payloads are read into a buffer instead.
+inline void map_view(SnapshotFile& f) {
+    if (f.view || f.file_size == 0) return;
+    void* p = mmap(nullptr, f.file_size, PROT_READ, MAP_PRIVATE, f.fd, 0);
+    if (p != MAP_FAILED) f.view = static_cast<const uint8_t*>(p);
+}
+
+// Check the payload of `e` against its checksum (the chunk store checks
+// its own in get()), without decoding it.
+inline bool check_chunk(const SnapshotFile& f, const ChunkEntry& e, VerifyTally* tally = nullptr) {
+    thread_local std::vector<uint8_t> buf;
+    if (e.codec == CODEC_STORED) {
+        uint32_t codec = 0;
+        if (!read_stored(f, e, codec, buf)) return false;
+        if (tally) tally->chunks.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if (f.view) return payload_ok(f, e, f.view + e.file_offset, tally);
+    buf.resize(e.stored_size);
+    return read_all(f.fd, buf.data(), e.stored_size, e.file_offset) &&
+           payload_ok(f, e, buf.data(), tally);
+}
+
+inline bool read_chunk(const SnapshotFile& f, const ChunkEntry& e, uint8_t* dst) {
+    if (e.codec == CODEC_RAW) return read_all(f.fd, dst, e.raw_size, e.file_offset);
+    thread_local std::vector<uint8_t> buf;
+    if (e.codec == CODEC_STORED) {
+        uint32_t codec = 0;
+        if (!read_stored(f, e, codec, buf)) return false;
+        if (codec == CODEC_RAW) {
+            memcpy(dst, buf.data(), e.raw_size);
+            return true;
+        }
+        return lz4::decompress(buf.data(), buf.size(), dst, e.raw_size);
+    }
+    buf.resize(e.stored_size);
+    return read_all(f.fd, buf.data(), e.stored_size, e.file_offset) &&
+           lz4::decompress(buf.data(), e.stored_size, dst, e.raw_size);
+}
+
+// Store keys referenced by a stored snapshot, one per CODEC_STORED entry.
+inline std::vector<chunkstore::Key> manifest_keys(const SnapshotFile& f) {
+    std::vector<chunkstore::Key> keys;
+    if (!f.stored()) return keys;
+    for (size_t i = 0; i < f.index.size(); i++) {
+        if (f.index[i].codec == CODEC_STORED) keys.push_back(f.key_of(i));
+    }
+    return keys;
+}
+
+// Quiet header check, so directory scans skip other files without noise.
+inline bool is_stored_file(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    FileHeader hdr{};
+    bool ok = read_all(fd, &hdr, sizeof(hdr), 0) && hdr.magic == MAGIC &&
+              hdr.version == VERSION && (hdr.flags & FLAG_STORED);
+    ::close(fd);
+    return ok;
+}
+
+// Keys of every stored snapshot in `snap_dir`: the live set for a sweep.
+inline bool live_store_keys(const std::string& snap_dir, std::vector<chunkstore::Key>& keys) {
+    DIR* dir = opendir(snap_dir.c_str());
+    if (!dir) return false;
+    bool ok = true;
+    while (dirent* d = readdir(dir)) {
+        std::string path = snap_dir + "/" + d->d_name;
+        if (d->d_name[0] == '.' || !is_stored_file(path)) continue;
+        SnapshotFile f;
+        if (!open_v2(path, f)) {
+            // Never sweep on a partial view: an unreadable manifest may
+            // still own chunks
+            ok = false;
+            break;
+        }
+        auto k = manifest_keys(f);
+        keys.insert(keys.end(), k.begin(), k.end());
+    }
+    closedir(dir);
+    return ok;
+}
+
+inline bool load_hashes(const SnapshotFile& f, std::vector<uint64_t>& out) {
+    if (f.hashes.type != SECTION_HASHES) return false;
+    out.resize(f.chunk_count());
+    return read_all(f.fd, out.data(), f.hashes.size, f.hashes.offset);
+}
+
+// ============================================================================
+// Writing v2 files
+// ============================================================================
+
+// Appends payloads and sections to a v2 file. The header is written last,
+// so a torn write never looks valid. With FLAG_CHECKSUMS in the header,
+// finish() appends the CHECK section over everything written by section().
+class Writer {
+public:
+    Writer(int fd, uint64_t pos) : fd_(fd), pos_(pos) {}
+
+    bool payload(const void* data, uint32_t size, uint64_t& file_offset, uint32_t align = 1) {
+        pos_ = (pos_ + align - 1) / align * align;   // Padding is left as a hole
+        file_offset = pos_;
+        pos_ += size;
+        return write_all(fd_, data, size, file_offset);
+    }
+
+    bool section(uint32_t type, const void* data, uint64_t size) {
+        SectionEntry s{type, 0, pos_, size};
+        sections_.push_back(s);
+        crc_ = crc32c::update(crc32c::update(crc_, &s, sizeof(s)), data, size);
+        pos_ += size;
+        return write_all(fd_, data, size, pos_ - size);
+    }
+
+    bool finish(FileHeader hdr) {
+        if (hdr.flags & FLAG_CHECKSUMS) {
+            uint32_t check[2] = {seal_manifest(crc_, hdr), 0};
+            sections_.push_back({SECTION_CHECK, 0, pos_, sizeof(check)});
+            pos_ += sizeof(check);
+            if (!write_all(fd_, check, sizeof(check), pos_ - sizeof(check))) return false;
+        }
+        hdr.magic = MAGIC;
+        hdr.version = VERSION;
+        hdr.section_count = static_cast<uint32_t>(sections_.size());
+        hdr.section_table_offset = pos_;
+        size_t table = sections_.size() * sizeof(SectionEntry);
+        pos_ += table;
+        return write_all(fd_, sections_.data(), table, hdr.section_table_offset) &&
+               write_all(fd_, &hdr, sizeof(hdr), 0);
+    }
+
+    uint64_t size() const { return pos_; }
+
+private:
+    int fd_;
+    uint64_t pos_;
+    uint32_t crc_ = 0;
+    std::vector<SectionEntry> sections_;
+};
+
+inline std::vector<uint8_t> encode_regs(Machine& machine) {
+    auto& regs = machine.cpu.registers();
+    uint32_t regs_size = static_cast<uint32_t>(sizeof(regs));
+    uint64_t counter = machine.instruction_counter();
+    std::vector<uint8_t> out(16 + regs_size, 0);
+    memcpy(out.data(), &regs_size, 4);
+    memcpy(out.data() + 8, &counter, 8);
+    memcpy(out.data() + 16, &regs, regs_size);
+    return out;
+}
+
+inline std::vector<uint8_t> encode_state(const std::vector<uint8_t>& state) {
+    uint64_t raw_size = state.size();
+    std::vector<uint8_t> out(8 + lz4::compress_bound(state.size()));
+    memcpy(out.data(), &raw_size, 8);
+    out.resize(8 + lz4::compress(state.data(), state.size(), out.data() + 8));
+    return out;
+}
+
+inline std::vector<uint8_t> encode_meta(uint64_t id, uint64_t parent_id, uint32_t depth,
+                                        const std::string& parent_name) {
+    MetaHeader meta{id, parent_id, depth, static_cast<uint32_t>(parent_name.size())};
+    std::vector<uint8_t> out(sizeof(meta) + parent_name.size());
+    memcpy(out.data(), &meta, sizeof(meta));
+    if (!parent_name.empty()) memcpy(out.data() + sizeof(meta), parent_name.data(), parent_name.size());
+    return out;
+}
+
+// Can an incremental save to `path` use the current baseline as its parent?
+inline bool baseline_usable(const std::string& path, uint64_t arena_size) {
+    const auto& b = g_baseline;
+    if (!b.valid() || b.chunk_size != CHUNK_SIZE || b.depth + 1 > MAX_CHAIN_DEPTH) return false;
+    if (b.hashes.size() != (arena_size + CHUNK_SIZE - 1) / CHUNK_SIZE) return false;
+    if (b.path == path || dir_of(b.path) != dir_of(path)) return false;
+    if (base_of(b.path).size() > MAX_PARENT_NAME) return false;
+    // The parent must still be on disk, unchanged
+    SnapshotFile parent;
+    return open_v2(b.path, parent, false) && parent.meta.snapshot_id == b.snapshot_id &&
+           parent.hdr.arena_size == arena_size;
+}
+
+// ============================================================================
+// Save (v2)
+// ============================================================================
+
+// Everything a save needs apart from the chunk contents. Built while the
+// guest is stopped; the chunks themselves may be read later (background
+// saves), so nothing here refers back to the machine.
+struct SavePlan {
+    std::string path;
+    const uint8_t* arena = nullptr;
+    uint64_t arena_size = 0;
+    bool incremental = false;
+    bool mappable = false;
+    bool stored = false;
+    std::vector<chunkstore::Key> replaced_keys;   // Stored file this save overwrites
+    std::vector<uint64_t> parent_hashes;
+    uint64_t parent_id = 0;
+    std::string parent_name;
+    std::vector<uint8_t> regs;
+    bool has_state = false;
+    std::vector<uint8_t> state;
+};
+
+// A save that is still being written by a background thread. Its result
+// is committed (baseline, g_last_save) by the next caller of
+// reap_background() once the thread has finished.
+struct BackgroundSave {
+    std::thread thread;
+    std::atomic<bool> done{false};
+    bool ok = false;
+    SavePlan plan;
+    IoStats stats;
+    uint64_t id = 0;
+    std::vector<uint64_t> hashes;
+
+    ~BackgroundSave() {
+        if (thread.joinable()) thread.join();
+    }
+};
+
+inline BackgroundSave g_background;
+inline std::atomic<uint32_t> g_background_failures{0};
+
+// Requires g_mutex.
+inline bool plan_save(Machine& machine, const std::string& path, SaveMode mode, Layout layout,
+                      const std::vector<uint8_t>* state, SavePlan& plan) {
+    auto& mem = machine.memory;
+    plan.arena = static_cast<const uint8_t*>(mem.memory_arena_ptr());
+    plan.arena_size = mem.memory_arena_size();
+    if (!plan.arena || plan.arena_size == 0) {
+        fprintf(stderr, "[snapshot] No flat arena to save\n");
+        return false;
+    }
+    plan.path = path;
+    plan.stored = layout == Layout::Stored;
+    plan.incremental = !plan.stored && mode == SaveMode::Incremental &&
+                       baseline_usable(path, plan.arena_size);
+    plan.mappable = layout == Layout::Mappable;
+    if (plan.incremental) {
+        plan.parent_hashes = g_baseline.hashes;
+        plan.parent_id = g_baseline.snapshot_id;
+        plan.parent_name = base_of(g_baseline.path);
+    }
+    plan.regs = encode_regs(machine);
+    plan.has_state = state != nullptr;
+    if (state) plan.state = *state;
+    return true;
+}
+
+// Note the chunk references of the stored file this save replaces. Reads
+// the old manifest, so background saves do it from the writer thread.
+inline void plan_replaced(SavePlan& plan) {
+    SnapshotFile old;
+    if (is_stored_file(plan.path) && open_v2(plan.path, old)) {
+        plan.replaced_keys = manifest_keys(old);
+    }
+}
+
+inline IoStats plan_stats(const SavePlan& plan) {
+    IoStats stats;
+    stats.version = VERSION;
+    stats.incremental = plan.incremental;
+    stats.chain_depth = plan.incremental ? g_baseline.depth + 1 : 0;
+    stats.arena_bytes = plan.arena_size;
+    stats.v1_bytes = 32 + (plan.regs.size() - 16) + plan.arena_size;
+    stats.threads = worker_count();
+    return stats;
+}
+
+// Chunks hashed and compressed per round; a source may keep one chunk of
+// scratch per slot.
+inline size_t save_batch(uint32_t threads) {
+    return threads * 32;
+}
+
+// Write `plan` to disk. `chunk(c, slot)` returns the contents of arena
+// chunk c; the pointer must stay valid until the batch has been written,
+// and slot (< save_batch) is the chunk's position in its batch.
+template <typename Source>
+inline bool write_v2(const SavePlan& plan, Source&& chunk, IoStats& stats,
+                     std::vector<uint64_t>& hashes, uint64_t& id) {
+    const uint64_t arena_size = plan.arena_size;
+    const bool incremental = plan.incremental;
+    const bool mappable = plan.mappable;
+    const bool stored = plan.stored;
+    chunkstore::Store store(dir_of(plan.path) + "/chunks");
+    const std::vector<uint64_t>* parent_hashes = incremental ? &plan.parent_hashes : nullptr;
+
+    // Write to a temp file and rename, so a failed save never clobbers a
+    // snapshot that other chain members may depend on
+    const std::string tmp_path = plan.path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[snapshot] Cannot open %s: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    const size_t n_chunks = (arena_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    stats.chunks_total = static_cast<uint32_t>(n_chunks);
+
+    enum Kind : uint8_t { SKIP, ZERO, STORE, DEDUP };
+
+    // Hash and compress in batches so only a few MB of output is buffered
+    const size_t batch = save_batch(stats.threads);
+    std::vector<std::vector<uint8_t>> out(batch);
+    std::vector<const uint8_t*> src(batch);
+    std::vector<Kind> kind(batch);
+    std::vector<uint32_t> codec(batch);
+    std::vector<uint32_t> stored_size(batch);
+    std::vector<uint64_t> key_lo(batch);
+    std::vector<uint32_t> crc(batch);
+    std::vector<ChunkEntry> index;
+    std::vector<uint64_t> keys;   // KEYS section, stored layout only
+    hashes.assign(n_chunks, 0);
+
+    Writer writer(fd, sizeof(FileHeader));
+    bool ok = true;
+
+    for (size_t base = 0; base < n_chunks && ok; base += batch) {
+        size_t count = std::min(batch, n_chunks - base);
+        parallel_for(count, stats.threads, [&](size_t i) {
+            size_t c = base + i;
+            uint64_t off = c * CHUNK_SIZE;
+            size_t raw = std::min<uint64_t>(CHUNK_SIZE, arena_size - off);
+            const uint8_t* data = src[i] = chunk(c, i);
+            bool zero = is_zero(data, raw);
+            hashes[c] = zero ? 0 : chunk_hash(data, raw);
+            if (parent_hashes && (*parent_hashes)[c] == hashes[c]) {
+                kind[i] = SKIP;
+                return;
+            }
+            if (zero) {
+                kind[i] = incremental ? ZERO : SKIP;
+                return;
+            }
+            kind[i] = STORE;
+            if (stored) {
+                // Already in the store: nothing to compress or write
+                key_lo[i] = store_key(data, raw, hashes[c]).lo;
+                if (store.contains({hashes[c], key_lo[i]})) {
+                    kind[i] = DEDUP;
+                    return;
+                }
+            }
+            codec[i] = CODEC_RAW;
+            stored_size[i] = static_cast<uint32_t>(raw);
+            if (!mappable) {
+                out[i].resize(lz4::compress_bound(raw));
+                size_t cs = lz4::compress(data, raw, out[i].data());
+                if (cs < raw) {
+                    codec[i] = CODEC_LZ4;
+                    stored_size[i] = static_cast<uint32_t>(cs);
+                }
+            }
+            // The chunk store checksums its own copy in put()
+            if (!stored) {
+                crc[i] = crc32c::compute(codec[i] == CODEC_LZ4 ? out[i].data() : data,
+                                         stored_size[i]);
+            }
+        });
+
+        for (size_t i = 0; i < count; i++) {
+            uint64_t off = (base + i) * CHUNK_SIZE;
+            uint32_t raw = static_cast<uint32_t>(std::min<uint64_t>(CHUNK_SIZE, arena_size - off));
+            if (kind[i] == SKIP) {
+                (hashes[base + i] == 0 ? stats.chunks_zero : stats.chunks_unchanged)++;
+                continue;
+            }
+            if (kind[i] == ZERO) {
+                index.push_back({off, 0, 0, raw, CODEC_ZERO, 0});
+                stats.chunks_zero++;
+                continue;
+            }
+            const void* data = codec[i] == CODEC_LZ4 ? out[i].data()
+                                                     : static_cast<const void*>(src[i]);
+            if (stored) {
+                bool added = false;
+                if (kind[i] == STORE &&
+                    !store.put({hashes[base + i], key_lo[i]}, codec[i], raw, data,
+                               stored_size[i], added)) {
+                    ok = false;
+                    break;
+                }
+                index.push_back({off, 0, 0, raw, CODEC_STORED, 0});
+                keys.push_back(key_lo[i]);
+                if (!added) {
+                    stats.chunks_deduped++;
+                    continue;
+                }
+                stats.store_bytes += sizeof(chunkstore::ChunkHeader) + stored_size[i];
+            } else {
+                uint64_t file_offset = 0;
+                if (!writer.payload(data, stored_size[i], file_offset, mappable ? CHUNK_SIZE : 1)) {
+                    ok = false;
+                    break;
+                }
+                index.push_back({off, file_offset, stored_size[i], raw, codec[i], crc[i]});
+            }
+            (codec[i] == CODEC_LZ4 ? stats.chunks_lz4 : stats.chunks_raw)++;
+        }
+    }
+
+    id = new_snapshot_id();
+    auto meta = encode_meta(id, plan.parent_id, stats.chain_depth, plan.parent_name);
+    auto state_sec = plan.has_state ? encode_state(plan.state) : std::vector<uint8_t>();
+
+    FileHeader hdr{};
+    hdr.flags = FLAG_CHECKSUMS | (incremental ? FLAG_INCREMENTAL : 0) |
+                (mappable ? FLAG_MAPPABLE : 0) | (stored ? FLAG_STORED : 0);
+    hdr.arena_size = arena_size;
+    hdr.chunk_size = CHUNK_SIZE;
+    ok = ok &&
+         writer.section(SECTION_REGS, plan.regs.data(), plan.regs.size()) &&
+         writer.section(SECTION_INDEX, index.data(), index.size() * sizeof(ChunkEntry)) &&
+         writer.section(SECTION_HASHES, hashes.data(), hashes.size() * sizeof(uint64_t)) &&
+         writer.section(SECTION_META, meta.data(), meta.size()) &&
+         (!plan.has_state || writer.section(SECTION_STATE, state_sec.data(), state_sec.size())) &&
+         (!stored || writer.section(SECTION_KEYS, keys.data(), keys.size() * sizeof(uint64_t))) &&
+         writer.finish(hdr);
+
+    ::close(fd);
+    if (!ok || ::rename(tmp_path.c_str(), plan.path.c_str()) != 0) {
+        fprintf(stderr, "[snapshot] Write failed: %s\n", strerror(errno));
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+    stats.file_bytes = writer.size();
+    stats.state_bytes = state_sec.size();
+    return true;
+}
+
+// Rewrite the refs of the store under `snap_dir` from its manifests,
+// deleting unreferenced chunks. Requires g_mutex.
+inline bool sweep_store(const std::string& snap_dir, uint32_t* removed = nullptr) {
+    std::vector<chunkstore::Key> live;
+    if (!live_store_keys(snap_dir, live)) return false;
+    chunkstore::Store store(snap_dir + "/chunks");
+    uint32_t n = store.rebuild(live);
+    if (removed) *removed = n;
+    return store.save_refs();
+}
+
+// Count the references of a newly written stored manifest and drop those
+// of the file it replaced. Requires g_mutex.
+inline void update_store_refs(const SavePlan& plan) {
+    chunkstore::Store store(dir_of(plan.path) + "/chunks");
+    SnapshotFile f;
+    if (!store.load_refs() || !open_v2(plan.path, f)) {
+        sweep_store(dir_of(plan.path));
+        return;
+    }
+    store.add_refs(manifest_keys(f));
+    store.release(plan.replaced_keys);
+    store.save_refs();
+}
+
+// Make a written snapshot the baseline. Requires g_mutex.
+inline void commit_save(const SavePlan& plan, uint64_t id, std::vector<uint64_t>&& hashes,
+                        const IoStats& stats) {
+    if (plan.stored) update_store_refs(plan);
+    g_baseline.path = plan.path;
+    g_baseline.snapshot_id = id;
+    g_baseline.depth = stats.chain_depth;
+    g_baseline.chunk_size = CHUNK_SIZE;
+    g_baseline.hashes = std::move(hashes);
+    g_last_save = stats;
+}
+
+// Commit a finished background save. With `wait`, blocks until a running
+// one finishes. Requires g_mutex; every entry point that reads or replaces
+// the baseline or the arena calls this first.
+inline void reap_background(bool wait) {
+    auto& bg = g_background;
+    if (!bg.thread.joinable() || (!wait && !bg.done.load(std::memory_order_acquire))) return;
+    bg.thread.join();
+    if (bg.ok) commit_save(bg.plan, bg.id, std::move(bg.hashes), bg.stats);
+    bg.plan = SavePlan{};
+    bg.hashes = {};
+}
+
+// Save the machine to `path`. In Incremental mode only chunks that differ
+// from the baseline are stored; falls back to a full save when there is no
+// usable baseline or the chain has reached MAX_CHAIN_DEPTH. Layout::Mappable
+// trades file size for a lazy restore that maps instead of decoding (after
+// one CRC pass over the file). `state`, if given, is stored
+// as the STATE section.
+inline bool save(Machine& machine, const std::string& path, SaveMode mode = SaveMode::Full,
+                 Layout layout = Layout::Compressed,
+                 const std::vector<uint8_t>* state = nullptr) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    auto t0 = std::chrono::steady_clock::now();
+
+    SavePlan plan;
+    if (!plan_save(machine, path, mode, layout, state, plan)) return false;
+    plan_replaced(plan);
+    IoStats stats = plan_stats(plan);
+    std::vector<uint64_t> hashes;
+    uint64_t id = 0;
+    auto direct = [&plan](size_t c, size_t) { return plan.arena + c * CHUNK_SIZE; };
+    if (!write_v2(plan, direct, stats, hashes, id)) return false;
+
+    stats.seconds = seconds_since(t0);
+    stats.pause_seconds = stats.seconds;
+    commit_save(plan, id, std::move(hashes), stats);
+    return true;
+}
+
+// ============================================================================
+// Background save (copy-on-write)
+// ============================================================================
+//
+// save_background() stops the guest only long enough to capture registers
+// and write-protect the arena; a writer thread then streams the chunks out
+// while the guest keeps running. The first guest write to a chunk the
+// writer has not reached faults, and the SIGSEGV handler copies the chunk's
+// original contents aside before unprotecting it, so the file is exactly
+// the arena at the moment of the pause. The writer unprotects each chunk as
+// soon as it has its own copy, so faults die out as the save progresses.
+//
+// Copies are made per chunk rather than per page: a fault costs one 64KB
+// memcpy, and mprotect never splits the arena into more mappings than it
+// has chunks.
+//
+// The pause is what the caller holds the guest for, from asking it to stop
+// to save_background() returning, and is what pause_ms reports. None of
+// its three parts is constant:
+//
+//   - parking: the execution thread stops at its next dispatch boundary or
+//     interruptible host wait, usually well under a millisecond (the
+//     runtime gives up after PAUSE_TIMEOUT);
+//   - the runtime state blob: serializing the VFS delta copies every file
+//     changed since the base image, about 2ms per MB;
+//   - write-protecting the arena: one mprotect, linear in its resident
+//     pages, about 12ms for a fully populated 512MB arena.
+//
+// (Figures from tools/runtime_tests/pause_test on an x86-64 host.) The
+// mprotect dominates, so PAUSE_BUDGET_MS covers a full 512MB arena with a
+// few MB of VFS delta; a pause over budget is logged with its state size.
+// Reading the manifest of a stored file being replaced is left to the
+// writer thread.
+
+enum CowState : uint32_t {
+    COW_PENDING = 0,   // Protected, not captured yet
+    COW_BUSY    = 1,   // Being copied by the writer or the fault handler
+    COW_COPIED  = 2,   // Original is in the copy area (guest wrote first)
+    COW_DONE    = 3,   // Captured by the writer
+    COW_WAITED  = 4,   // BUSY, and someone is asleep on it (futex)
+};
+
+// One futex word per chunk
+using CowWord = std::atomic<uint32_t>;
+static_assert(sizeof(CowWord) == sizeof(uint32_t), "futex word must be a plain uint32_t");
+
+struct CowSession {
+    std::atomic<bool> active{false};
+    uint8_t* arena = nullptr;
+    uint64_t size = 0;
+    uint8_t* copies = nullptr;   // Arena-shaped, NORESERVE: only copied chunks use memory
+    size_t chunks = 0;
+    std::unique_ptr<CowWord[]> state;
+    std::atomic<uint32_t> faults{0};
+};
+
+inline CowSession g_cow;
+inline struct sigaction g_prev_segv{};
+inline bool g_cow_handler_installed = false;
+
+inline void cow_unprotect(size_t c) {
+    ::mprotect(g_cow.arena + c * CHUNK_SIZE, CHUNK_SIZE, PROT_READ | PROT_WRITE);
+}
+
+// Wait until whoever is copying chunk c is done. Sleeps on a futex rather
+// than spinning: the fault handler may be waiting on a writer thread that
+// is not running. Raw syscalls only, so it is safe in the SIGSEGV handler.
+inline void cow_wait(CowWord& st) {
+    uint32_t v = COW_BUSY;
+    if (!st.compare_exchange_strong(v, COW_WAITED, std::memory_order_acq_rel) &&
+        v != COW_WAITED) {
+        return;
+    }
+    auto* word = reinterpret_cast<uint32_t*>(&st);
+    while (st.load(std::memory_order_acquire) == COW_WAITED) {
+        ::syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, COW_WAITED, nullptr, nullptr, 0);
+    }
+}
+
+// Leave BUSY for `done`, waking anyone in cow_wait()
+inline void cow_finish(CowWord& st, CowState done) {
+    if (st.exchange(done, std::memory_order_acq_rel) == COW_WAITED) {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&st), FUTEX_WAKE_PRIVATE, INT32_MAX,
+                  nullptr, nullptr, 0);
+    }
+}
+
+inline void cow_fault(int sig, siginfo_t* info, void* uctx) {
+    auto addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    auto base = reinterpret_cast<uintptr_t>(g_cow.arena);
+    if (g_cow.active.load(std::memory_order_acquire) && addr >= base && addr < base + g_cow.size) {
+        int saved_errno = errno;
+        size_t c = (addr - base) / CHUNK_SIZE;
+        auto& st = g_cow.state[c];
+        uint32_t expected = COW_PENDING;
+        if (st.compare_exchange_strong(expected, COW_BUSY, std::memory_order_acq_rel)) {
+            memcpy(g_cow.copies + c * CHUNK_SIZE, g_cow.arena + c * CHUNK_SIZE, CHUNK_SIZE);
+            g_cow.faults.fetch_add(1, std::memory_order_relaxed);
+            cow_finish(st, COW_COPIED);
+        } else {
+            cow_wait(st);   // The writer is copying this chunk
+        }
+        cow_unprotect(c);
+        errno = saved_errno;
+        return;   // The faulting store is retried
+    }
+
+    // Not ours: hand it to whoever was installed before us
+    if (g_prev_segv.sa_flags & SA_SIGINFO) {
+        g_prev_segv.sa_sigaction(sig, info, uctx);
+    } else if (g_prev_segv.sa_handler == SIG_DFL || g_prev_segv.sa_handler == SIG_IGN) {
+        ::sigaction(SIGSEGV, &g_prev_segv, nullptr);   // Re-fault into the default action
+    } else {
+        g_prev_segv.sa_handler(sig);
+    }
+}
+
+// Requires g_mutex with the guest stopped.
+inline bool begin_cow(const uint8_t* arena, uint64_t size) {
+    const size_t page = host_page_size();
+    if (reinterpret_cast<uintptr_t>(arena) % page != 0 || CHUNK_SIZE % page != 0 ||
+        size % CHUNK_SIZE != 0) {
+        return false;
+    }
+    void* copies = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (copies == MAP_FAILED) return false;
+
+    if (!g_cow_handler_installed) {
+        struct sigaction sa{};
+        sa.sa_sigaction = cow_fault;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        if (::sigaction(SIGSEGV, &sa, &g_prev_segv) != 0) {
+            munmap(copies, size);
+            return false;
+        }
+        g_cow_handler_installed = true;
+    }
+
+    const size_t chunks = size / CHUNK_SIZE;
+    if (g_cow.chunks != chunks) {
+        g_cow.state.reset(new CowWord[chunks]);
+        g_cow.chunks = chunks;
+    }
+    for (size_t c = 0; c < chunks; c++) g_cow.state[c].store(COW_PENDING, std::memory_order_relaxed);
+    g_cow.arena = const_cast<uint8_t*>(arena);
+    g_cow.size = size;
+    g_cow.copies = static_cast<uint8_t*>(copies);
+    g_cow.faults.store(0, std::memory_order_relaxed);
+    g_cow.active.store(true, std::memory_order_release);
+
+    if (::mprotect(g_cow.arena, size, PROT_READ) != 0) {
+        fprintf(stderr, "[snapshot] Cannot write-protect arena: %s\n", strerror(errno));
+        g_cow.active.store(false, std::memory_order_release);
+        munmap(copies, size);
+        return false;
+    }
+    return true;
+}
+
+// Called by the writer when it is finished (or has failed) with the arena.
+// Every chunk that was captured or faulted is already writable again; only
+// the ones still pending (all of them after an early failure, none after a
+// complete save) are unprotected here, a contiguous run at a time.
+inline void end_cow() {
+    size_t run = 0, run_len = 0;
+    auto flush = [&] {
+        if (run_len) {
+            ::mprotect(g_cow.arena + run * CHUNK_SIZE, run_len * CHUNK_SIZE,
+                       PROT_READ | PROT_WRITE);
+        }
+        run_len = 0;
+    };
+    for (size_t c = 0; c < g_cow.chunks; c++) {
+        uint32_t expected = COW_PENDING;
+        if (g_cow.state[c].compare_exchange_strong(expected, COW_DONE,
+                                                   std::memory_order_acq_rel)) {
+            if (run_len && run + run_len != c) flush();
+            if (!run_len) run = c;
+            run_len++;
+        } else {
+            cow_wait(g_cow.state[c]);
+        }
+    }
+    flush();
+    g_cow.active.store(false, std::memory_order_release);
+    munmap(g_cow.copies, g_cow.size);
+    g_cow.copies = nullptr;
+}
+
+// Capture chunk c for the writer: copy it while it is still protected, or
+// take the copy the fault handler made when the guest got there first.
+inline const uint8_t* cow_capture(size_t c, uint8_t* scratch) {
+    auto& st = g_cow.state[c];
+    uint32_t expected = COW_PENDING;
+    if (st.compare_exchange_strong(expected, COW_BUSY, std::memory_order_acq_rel)) {
+        memcpy(scratch, g_cow.arena + c * CHUNK_SIZE, CHUNK_SIZE);
+        cow_finish(st, COW_DONE);
+        cow_unprotect(c);
+        return scratch;
+    }
+    cow_wait(st);
+    return g_cow.copies + c * CHUNK_SIZE;
+}
+
+inline constexpr double PAUSE_BUDGET_MS = 25.0;
+
+inline bool background_pending() {
+    return g_background.thread.joinable() && !g_background.done.load(std::memory_order_acquire);
+}
+
+// Like save(), but returns once the arena is write-protected and leaves the
+// chunks to a background thread. The caller stops the guest for the call
+// and resumes it as soon as it returns; `paused_at` is when it asked the
+// guest to stop, so pause_seconds covers the whole pause. `state` is moved
+// into the save. Returns false without saving while an earlier background
+// save is still running. Falls back to a synchronous save when the arena
+// cannot be write-protected.
+inline bool save_background(Machine& machine, const std::string& path,
+                            SaveMode mode = SaveMode::Full, Layout layout = Layout::Compressed,
+                            std::vector<uint8_t>* state = nullptr,
+                            std::chrono::steady_clock::time_point paused_at =
+                                std::chrono::steady_clock::now()) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    if (background_pending()) {
+        fprintf(stderr, "[snapshot] Background save still running, skipping %s\n", path.c_str());
+        return false;
+    }
+    reap_background(true);
+    auto t0 = std::chrono::steady_clock::now();
+
+    auto& bg = g_background;
+    SavePlan plan;
+    if (!plan_save(machine, path, mode, layout, nullptr, plan)) return false;
+    plan.has_state = state != nullptr;
+    if (state) plan.state = std::move(*state);
+    if (!begin_cow(plan.arena, plan.arena_size)) {
+        lock.unlock();
+        return save(machine, path, mode, layout, plan.has_state ? &plan.state : nullptr);
+    }
+
+    bg.plan = std::move(plan);
+    bg.stats = plan_stats(bg.plan);
+    bg.stats.background = true;
+    // Leave a core to the guest
+    bg.stats.threads = std::max(1u, bg.stats.threads - 1);
+    bg.stats.pause_seconds = seconds_since(paused_at);
+    bg.ok = false;
+    bg.done.store(false, std::memory_order_relaxed);
+    if (bg.stats.pause_seconds * 1000.0 > PAUSE_BUDGET_MS) {
+        fprintf(stderr, "[snapshot] Guest paused %.2f ms for %s (budget %.0f ms, state %zu bytes)\n",
+                bg.stats.pause_seconds * 1000.0, path.c_str(), PAUSE_BUDGET_MS,
+                bg.plan.state.size());
+    }
+
+    bg.thread = std::thread([t0] {
+        auto& bg = g_background;
+        plan_replaced(bg.plan);
+        std::vector<uint8_t> scratch(save_batch(bg.stats.threads) * size_t(CHUNK_SIZE));
+        auto capture = [&scratch](size_t c, size_t slot) {
+            return cow_capture(c, scratch.data() + slot * CHUNK_SIZE);
+        };
+        bg.ok = write_v2(bg.plan, capture, bg.stats, bg.hashes, bg.id);
+        end_cow();
+        bg.stats.cow_chunks = g_cow.faults.load(std::memory_order_relaxed);
+        bg.stats.seconds = seconds_since(t0);
+        if (!bg.ok) {
+            fprintf(stderr, "[snapshot] Background save of %s failed\n", bg.plan.path.c_str());
+            g_background_failures.fetch_add(1, std::memory_order_relaxed);
+        }
+        bg.done.store(true, std::memory_order_release);
+    });
+    return true;
+}
+
+// Block until any background save is on disk and committed. Must be called
+// before the machine (and so the arena) is destroyed or replaced.
+inline void wait_background() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+}
+
+// ============================================================================
+// Restore
+// ============================================================================
+
+// ============================================================================
+// Background check of mapped chunks
+// ============================================================================
+//
+// restore_v2() checks every payload it decodes before touching the arena,
+// but reading the raw chunks it maps would cost a pass over the whole file
+// and undo the lazy restore. Those are checked by one thread after restore
+// returns, while the guest runs. A mismatch found then cannot be undone
+// (the guest may already have read the page), so it is reported through
+// g_on_mapped_corrupt, which the runtime uses to stop the guest.
+
+// Set once by the runtime; called from the check thread
+inline void (*g_on_mapped_corrupt)(const std::string& path) = nullptr;
+inline std::atomic<uint32_t> g_mapped_failures{0};
+
+struct MappedCheck {
+    std::thread thread;
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> done{true};
+
+    void stop() {
+        if (!thread.joinable()) return;
+        cancel.store(true, std::memory_order_relaxed);
+        thread.join();
+        cancel.store(false, std::memory_order_relaxed);
+    }
+    ~MappedCheck() { stop(); }
+};
+
+inline MappedCheck g_mapped_check;
+
+// Stop a running check. Must be called before whatever g_on_mapped_corrupt
+// acts on (the machine) is destroyed or replaced.
+inline void cancel_mapped_check() {
+    g_mapped_check.stop();
+}
+
+inline bool mapped_check_pending() {
+    return !g_mapped_check.done.load(std::memory_order_acquire);
+}
+
+// Check the payloads of `chunks` (resolved through `chain`, which the
+// thread takes over) in the background.
+inline void start_mapped_check(Chain&& chain, std::vector<size_t>&& chunks) {
+    g_mapped_check.stop();
+    if (chunks.empty()) return;
+    g_mapped_check.done.store(false, std::memory_order_relaxed);
+    g_mapped_check.thread = std::thread([chain = std::move(chain), chunks = std::move(chunks)] {
+        const std::string& path = chain.front()->path;
+        for (size_t c : chunks) {
+            if (g_mapped_check.cancel.load(std::memory_order_relaxed)) break;
+            const SnapshotFile* owner = nullptr;
+            const ChunkEntry* e = resolve(chain, c, owner);
+            if (e && !check_chunk(*owner, *e)) {
+                g_mapped_failures.fetch_add(1, std::memory_order_relaxed);
+                fprintf(stderr, "[snapshot] Mapped chunk of %s is corrupt, stopping the guest\n",
+                        path.c_str());
+                if (auto hook = g_on_mapped_corrupt) hook(path);
+                break;
+            }
+        }
+        g_mapped_check.done.store(true, std::memory_order_release);
+    });
+}
+
+inline bool restore_v1(Machine& machine, int fd, uint64_t file_size, IoStats& stats) {
+    uint32_t regs_size = 0;
+    uint64_t arena_size = 0;
+    if (!read_all(fd, &regs_size, 4, 12) || !read_all(fd, &arena_size, 8, 16)) return false;
+
+    auto& cpu = machine.cpu;
+    auto& mem = machine.memory;
+    if (regs_size != sizeof(cpu.registers())) {
+        fprintf(stderr, "[snapshot] Register size mismatch: file=%u expected=%zu\n",
+                regs_size, sizeof(cpu.registers()));
+        return false;
+    }
+    if (arena_size != mem.memory_arena_size()) {
+        fprintf(stderr, "[snapshot] Arena size mismatch: file=%llu expected=%llu\n",
+                (unsigned long long)arena_size, (unsigned long long)mem.memory_arena_size());
+        return false;
+    }
+    if (file_size < 32 + regs_size + arena_size) {
+        fprintf(stderr, "[snapshot] Truncated v1 snapshot\n");
+        return false;
+    }
+
+    if (!read_all(fd, &cpu.registers(), regs_size, 32)) return false;
+    void* arena = mem.memory_arena_ptr();
+    if (arena && arena_size > 0 && !read_all(fd, arena, arena_size, 32 + regs_size)) {
+        return false;
+    }
+    stats.arena_bytes = arena_size;
+    stats.file_bytes = file_size;
+    stats.v1_bytes = file_size;
+    stats.threads = 1;
+    return true;
+}
+
+inline bool restore_v2(Machine& machine, const std::string& path, IoStats& stats) {
+    auto& cpu = machine.cpu;
+    auto& mem = machine.memory;
+
+    Chain chain;
+    if (!load_chain(path, chain)) return false;
+    const SnapshotFile& top = *chain.front();
+
+    if (top.hdr.arena_size != mem.memory_arena_size()) {
+        fprintf(stderr, "[snapshot] Arena size mismatch: file=%llu expected=%llu\n",
+                (unsigned long long)top.hdr.arena_size,
+                (unsigned long long)mem.memory_arena_size());
+        return false;
+    }
+    uint32_t regs_size = 0;
+    if (!read_all(top.fd, &regs_size, 4, top.regs.offset)) return false;
+    if (regs_size != sizeof(cpu.registers()) || top.regs.size != 16 + regs_size) {
+        fprintf(stderr, "[snapshot] Register size mismatch: file=%u expected=%zu\n",
+                regs_size, sizeof(cpu.registers()));
+        return false;
+    }
+
+    uint8_t* arena = static_cast<uint8_t*>(mem.memory_arena_ptr());
+    const uint64_t arena_size = top.hdr.arena_size;
+    const uint32_t chunk_size = top.hdr.chunk_size;
+    const size_t n_chunks = top.chunk_count();
+    const size_t page = host_page_size();
+    auto aligned = [page](uint64_t v) { return v % page == 0; };
+    const bool arena_aligned = aligned(reinterpret_cast<uintptr_t>(arena));
+
+    // Plan: merge runs of mappable chunks (contiguous in both the arena and
+    // one file) and runs of zero chunks, so restore costs a few mmap calls.
+    // Everything else is decoded in parallel afterwards.
+    struct Run {
+        const SnapshotFile* file;   // nullptr = zero run
+        uint64_t arena_offset;
+        uint64_t file_offset;
+        uint64_t size;
+    };
+    std::vector<Run> runs;
+    std::vector<size_t> decode;
+    std::vector<size_t> mapped;   // Chunks of file-backed runs, checked afterwards
+    uint32_t zero = 0, lz4 = 0, raw = 0;
+
+    for (size_t c = 0; c < n_chunks; c++) {
+        uint64_t off = c * chunk_size;
+        uint64_t len = std::min<uint64_t>(chunk_size, arena_size - off);
+        const SnapshotFile* owner = nullptr;
+        const ChunkEntry* e = resolve(chain, c, owner);
+        if (e) (e->codec == CODEC_LZ4 ? lz4 : raw)++;
+        else zero++;
+
+        bool mappable = arena_aligned && aligned(off) && aligned(len) &&
+                        (!e || (e->codec == CODEC_RAW && aligned(e->file_offset)));
+        if (!mappable) {
+            decode.push_back(c);
+            continue;
+        }
+        const SnapshotFile* file = e ? owner : nullptr;
+        uint64_t file_offset = e ? e->file_offset : 0;
+        if (e) mapped.push_back(c);
+        if (!runs.empty()) {
+            Run& last = runs.back();
+            if (last.file == file && last.arena_offset + last.size == off &&
+                (!file || last.file_offset + last.size == file_offset)) {
+                last.size += len;
+                continue;
+            }
+        }
+        runs.push_back({file, off, file_offset, len});
+    }
+
+    // Verify every payload about to be decoded before the arena is
+    // touched. The CRC runs straight over a read-only mapping of each file,
+    // so this pass copies nothing and leaves the file in the page cache for
+    // the decode pass. Mapped chunks are left to start_mapped_check().
+    for (auto& f : chain) {
+        map_view(*f);
+    }
+    stats.threads = worker_count();
+    VerifyTally tally;
+    std::atomic<bool> failed{false};
+    parallel_for(decode.size(), stats.threads, [&](size_t i) {
+        if (failed.load(std::memory_order_relaxed)) return;
+        const SnapshotFile* owner = nullptr;
+        const ChunkEntry* e = resolve(chain, decode[i], owner);
+        if (e && !check_chunk(*owner, *e, &tally)) failed = true;
+    });
+    if (failed) {
+        fprintf(stderr, "[snapshot] Snapshot failed verification, arena left untouched\n");
+        return false;
+    }
+    stats.chunks_verified = tally.chunks.load();
+    stats.verify_seconds = tally.ns.load() / 1e9;
+
+    for (const auto& r : runs) {
+        void* want = arena + r.arena_offset;
+        void* got = r.file
+            ? mmap(want, r.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                   r.file->fd, static_cast<off_t>(r.file_offset))
+            : mmap(want, r.size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (got == MAP_FAILED) {
+            // MAP_FIXED failure leaves the range in an unknown state; the
+            // machine must not be resumed
+            fprintf(stderr, "[snapshot] mmap of arena range failed: %s\n", strerror(errno));
+            return false;
+        }
+        if (r.file) {
+            stats.mapped_bytes += r.size;
+            stats.mapped_regions++;
+        }
+    }
+
+    parallel_for(decode.size(), stats.threads, [&](size_t i) {
+        if (failed.load(std::memory_order_relaxed)) return;
+        size_t c = decode[i];
+        uint64_t off = c * chunk_size;
+        const SnapshotFile* owner = nullptr;
+        const ChunkEntry* e = resolve(chain, c, owner);
+        if (!e) {
+            memset(arena + off, 0, std::min<uint64_t>(chunk_size, arena_size - off));
+        } else if (!read_chunk(*owner, *e, arena + off)) {
+            failed = true;
+        }
+    });
+    if (failed) {
+        fprintf(stderr, "[snapshot] Chunk read/decompress failed\n");
+        return false;
+    }
+
+    if (!read_all(top.fd, &cpu.registers(), regs_size, top.regs.offset + 16)) return false;
+
+    // The restored file becomes the baseline for the next incremental save
+    g_baseline = Baseline{};
+    if (top.meta.snapshot_id != 0 && load_hashes(top, g_baseline.hashes)) {
+        g_baseline.path = path;
+        g_baseline.snapshot_id = top.meta.snapshot_id;
+        g_baseline.depth = top.meta.depth;
+        g_baseline.chunk_size = chunk_size;
+    }
+
+    stats.incremental = top.incremental();
+    stats.chain_depth = static_cast<uint32_t>(chain.size() - 1);
+    stats.chunks_total = static_cast<uint32_t>(n_chunks);
+    stats.chunks_zero = zero;
+    stats.chunks_lz4 = lz4;
+    stats.chunks_raw = raw;
+    stats.arena_bytes = arena_size;
+    for (const auto& f : chain) stats.file_bytes += f->file_size;
+    stats.v1_bytes = 32 + regs_size + arena_size;
+    stats.chunks_mapped = static_cast<uint32_t>(mapped.size());
+    start_mapped_check(std::move(chain), std::move(mapped));
+    return true;
+}
+
+// Restore a v1 or v2 snapshot into an existing machine of the same shape.
+inline bool restore(Machine& machine, const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    cancel_mapped_check();
+    auto t0 = std::chrono::steady_clock::now();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "[snapshot] Cannot open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st{};
+    uint64_t magic = 0;
+    uint32_t version = 0;
+    bool ok = ::fstat(fd, &st) == 0 &&
+              read_all(fd, &magic, 8, 0) && read_all(fd, &version, 4, 8);
+    if (!ok || magic != MAGIC) {
+        fprintf(stderr, "[snapshot] Invalid snapshot magic\n");
+        ::close(fd);
+        return false;
+    }
+
+    IoStats stats;
+    stats.version = version;
+    if (version == VERSION_V1) {
+        ok = restore_v1(machine, fd, static_cast<uint64_t>(st.st_size), stats);
+        g_baseline = Baseline{};
+    } else if (version == VERSION) {
+        ok = restore_v2(machine, path, stats);
+    } else {
+        fprintf(stderr, "[snapshot] Unsupported snapshot version: %u\n", version);
+        ok = false;
+    }
+    ::close(fd);
+    if (!ok) return false;
+
+    // We don't restore the exact counter, just reset it
+    machine.reset_instruction_counter();
+
+    stats.seconds = seconds_since(t0);
+    g_last_restore = stats;
+    g_first_output_us.store(-1, std::memory_order_relaxed);
+    g_restored_at_ns.store(now_ns(), std::memory_order_relaxed);
+    return true;
+}
+
+// Check `path` and every file it depends on without restoring: manifest
+// checksums, then every payload, including the raw chunks a restore maps
+// lazily and so never reads.
+inline bool verify(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    Chain chain;
+    if (!load_chain(path, chain)) return false;
+    std::atomic<bool> failed{false};
+    for (const auto& f : chain) {
+        map_view(*f);
+        parallel_for(f->index.size(), worker_count(), [&](size_t i) {
+            const ChunkEntry& e = f->index[i];
+            if (failed.load(std::memory_order_relaxed) || e.codec == CODEC_ZERO) return;
+            if (!check_chunk(*f, e)) failed = true;
+        });
+    }
+    return !failed;
+}
+
+// ============================================================================
+// Chain maintenance
+// ============================================================================
+
+// Rewrite an incremental snapshot in place as a standalone full snapshot.
+// The snapshot id is kept, so snapshots that use `path` as their parent
+// remain valid. No-op for snapshots that are already standalone.
+inline bool consolidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    Chain chain;
+    if (!load_chain(path, chain)) return false;
+    const SnapshotFile& top = *chain.front();
+    if (!top.incremental()) return true;
+
+    const std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[snapshot] Cannot open %s: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Payloads are copied as stored; nothing is recompressed. Raw payloads
+    // keep their alignment so the result is still lazily mappable.
+    Writer writer(fd, sizeof(FileHeader));
+    std::vector<ChunkEntry> index;
+    std::vector<uint8_t> buf;
+    bool ok = true;
+    for (size_t c = 0; c < top.chunk_count() && ok; c++) {
+        const SnapshotFile* owner = nullptr;
+        const ChunkEntry* e = resolve(chain, c, owner);
+        if (!e) continue;
+        // Chunks of a stored ancestor are pulled into the file
+        // Payloads are checked on the way through so a damaged ancestor is
+        // not laundered into a file with fresh checksums
+        uint32_t codec = e->codec;
+        if (codec == CODEC_STORED) {
+            ok = read_stored(*owner, *e, codec, buf);
+        } else {
+            buf.resize(e->stored_size);
+            ok = read_all(owner->fd, buf.data(), e->stored_size, e->file_offset) &&
+                 payload_ok(*owner, *e, buf.data());
+        }
+        uint64_t file_offset = 0;
+        uint32_t size = static_cast<uint32_t>(buf.size());
+        ok = ok && writer.payload(buf.data(), size, file_offset,
+                                  codec == CODEC_RAW ? top.hdr.chunk_size : 1);
+        index.push_back({e->arena_offset, file_offset, size, e->raw_size, codec,
+                         crc32c::compute(buf.data(), size)});
+    }
+
+    std::vector<uint8_t> regs(top.regs.size);
+    std::vector<uint8_t> state(top.state.size);
+    std::vector<uint64_t> hashes;
+    auto meta = encode_meta(top.meta.snapshot_id, 0, 0, std::string());
+    FileHeader hdr{};
+    hdr.flags = FLAG_CHECKSUMS | (top.hdr.flags & FLAG_MAPPABLE);
+    hdr.arena_size = top.hdr.arena_size;
+    hdr.chunk_size = top.hdr.chunk_size;
+    ok = ok &&
+         read_all(top.fd, regs.data(), regs.size(), top.regs.offset) &&
+         read_all(top.fd, state.data(), state.size(), top.state.offset) &&
+         load_hashes(top, hashes) &&
+         writer.section(SECTION_REGS, regs.data(), regs.size()) &&
+         writer.section(SECTION_INDEX, index.data(), index.size() * sizeof(ChunkEntry)) &&
+         writer.section(SECTION_HASHES, hashes.data(), hashes.size() * sizeof(uint64_t)) &&
+         writer.section(SECTION_META, meta.data(), meta.size()) &&
+         (state.empty() || writer.section(SECTION_STATE, state.data(), state.size())) &&
+         writer.finish(hdr);
+
+    ::close(fd);
+    if (!ok || ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "[snapshot] Consolidate failed for %s\n", path.c_str());
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+    if (g_baseline.path == path) g_baseline.depth = 0;
+    return true;
+}
+
+// Read the runtime state blob stored with `path`. Returns false if the file
+// is unreadable, has no STATE section (v1 files, saves without state) or
+// the section is corrupt.
+inline bool read_state(const std::string& path, std::vector<uint8_t>& out) {
+    SnapshotFile f;
+    if (!open_v2(path, f, false) || f.state.type != SECTION_STATE || f.state.size < 8) {
+        return false;
+    }
+    std::vector<uint8_t> buf(f.state.size);
+    uint64_t raw_size = 0;
+    if (!read_all(f.fd, buf.data(), buf.size(), f.state.offset)) return false;
+    memcpy(&raw_size, buf.data(), 8);
+    if (raw_size > (buf.size() - 8) * 255) {   // Beyond LZ4's maximum ratio
+        fprintf(stderr, "[snapshot] Corrupt STATE section\n");
+        return false;
+    }
+    out.resize(raw_size);
+    if (!lz4::decompress(buf.data() + 8, buf.size() - 8, out.data(), raw_size)) {
+        fprintf(stderr, "[snapshot] Corrupt STATE section\n");
+        return false;
+    }
+    return true;
+}
+
+// Parent snapshot path of an incremental snapshot, or "" for a full one.
+inline std::string parent_of(const std::string& path) {
+    SnapshotFile f;
+    if (!open_v2(path, f, false) || !f.incremental()) return {};
+    return f.parent_path();
+}
+
+// ============================================================================
+// Deletion and chunk store maintenance
+// ============================================================================
+
+// Delete a snapshot file. A stored snapshot drops its chunk references, and
+// chunks no other snapshot uses are deleted with it. Snapshots that use
+// `path` as their parent must be consolidated first.
+inline bool remove(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    std::vector<chunkstore::Key> keys;
+    SnapshotFile f;
+    bool stored = is_stored_file(path) && open_v2(path, f);
+    if (stored) keys = manifest_keys(f);
+    if (::unlink(path.c_str()) != 0) {
+        fprintf(stderr, "[snapshot] Cannot delete %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (g_baseline.path == path) g_baseline = Baseline{};
+    if (!stored) return true;
+
+    chunkstore::Store store(f.store_dir());
+    if (!store.load_refs()) return sweep_store(dir_of(path));
+    uint32_t removed = store.release(keys);
+    fprintf(stderr, "[snapshot] Deleted %s, %u chunks freed\n", path.c_str(), removed);
+    return store.save_refs();
+}
+
+// Recount the chunk store of `snap_dir` from its manifests and delete every
+// chunk nothing references (e.g. left behind by a failed save). Returns the
+// number of files deleted, or -1 if a manifest could not be read.
+inline int collect_garbage(const std::string& snap_dir) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    uint32_t removed = 0;
+    if (!sweep_store(snap_dir, &removed)) return -1;
+    return static_cast<int>(removed);
+}
+
+inline std::string store_stats_json(const std::string& snap_dir) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    chunkstore::Store store(snap_dir + "/chunks");
+    store.load_refs();
+    auto st = store.stats();
+    char buf[192];
+    snprintf(buf, sizeof(buf),
+        "{\"chunks\":%llu,\"bytes\":%llu,\"references\":%llu,\"unreferenced\":%llu}",
+        (unsigned long long)st.chunks, (unsigned long long)st.bytes,
+        (unsigned long long)st.references, (unsigned long long)st.unreferenced);
+    return buf;
+}
+
+// ============================================================================
+// Chunk sync
+// ============================================================================
+//
+// Moving a stored snapshot between devices is its manifest plus whichever
+// chunks the other side lacks. The companion protocol (CompanionClient.kt)
+// asks for the missing keys, then ships chunks in packs:
+//   [hi u64][lo u64][size u32][chunk file: ChunkHeader + payload] ...
+// Payloads travel as stored (LZ4 or raw). Every imported chunk is decoded
+// and re-hashed against its key before it enters the store, and a manifest
+// is only adopted once all of its chunks are present, so an interrupted
+// transfer leaves nothing half-visible and the retry skips what arrived.
+
+inline constexpr size_t MAX_PACK_BYTES = 64u << 20;
+
+// Keys of the chunks `path` references; with `missing_only`, just those not
+// in the chunk store next to it. False if `path` is not a stored snapshot.
+inline bool chunk_keys(const std::string& path, bool missing_only,
+                       std::vector<chunkstore::Key>& out) {
+    SnapshotFile f;
+    if (!is_stored_file(path) || !open_v2(path, f)) return false;
+    chunkstore::Store store(f.store_dir());
+    for (const auto& k : manifest_keys(f)) {
+        if (!missing_only || !store.contains(k)) out.push_back(k);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return true;
+}
+
+// Decode a chunk and check it hashes to `key`.
+inline bool chunk_matches(const chunkstore::Key& key, const chunkstore::ChunkHeader& hdr,
+                          const uint8_t* payload) {
+    if (hdr.magic != chunkstore::CHUNK_MAGIC || hdr.raw_size == 0 || hdr.raw_size > CHUNK_SIZE) {
+        return false;
+    }
+    thread_local std::vector<uint8_t> raw;
+    raw.resize(hdr.raw_size);
+    if (hdr.codec == CODEC_RAW) {
+        if (hdr.stored_size != hdr.raw_size) return false;
+        memcpy(raw.data(), payload, hdr.raw_size);
+    } else if (hdr.codec != CODEC_LZ4 ||
+               !lz4::decompress(payload, hdr.stored_size, raw.data(), hdr.raw_size)) {
+        return false;
+    }
+    return chunk_hash(raw.data(), raw.size()) == key.hi &&
+           chunk_hash(raw.data(), raw.size(), STORE_KEY_SEED) == key.lo;
+}
+
+// Append the chunks `keys` from the store of `snap_dir` to a pack. Stops
+// at MAX_PACK_BYTES; `packed` says how many keys made it in.
+inline bool pack_chunks(const std::string& snap_dir, const std::vector<chunkstore::Key>& keys,
+                        std::vector<uint8_t>& out, size_t& packed) {
+    chunkstore::Store store(snap_dir + "/chunks");
+    std::vector<uint8_t> payload;
+    packed = 0;
+    for (const auto& k : keys) {
+        chunkstore::ChunkHeader hdr{};
+        if (!store.get(k, hdr, payload)) return false;
+        uint32_t size = static_cast<uint32_t>(sizeof(hdr) + payload.size());
+        if (packed > 0 && out.size() + 20 + size > MAX_PACK_BYTES) break;
+        size_t pos = out.size();
+        out.resize(pos + 20 + size);
+        memcpy(out.data() + pos, &k.hi, 8);
+        memcpy(out.data() + pos + 8, &k.lo, 8);
+        memcpy(out.data() + pos + 16, &size, 4);
+        memcpy(out.data() + pos + 20, &hdr, sizeof(hdr));
+        if (!payload.empty()) memcpy(out.data() + pos + 20 + sizeof(hdr), payload.data(), payload.size());
+        packed++;
+    }
+    return true;
+}
+
+// Verify and store every chunk of a pack. Returns the number of chunks
+// added, or -1 at the first malformed or mismatching record (chunks before
+// it are kept).
+inline int unpack_chunks(const std::string& snap_dir, const uint8_t* data, size_t len) {
+    chunkstore::Store store(snap_dir + "/chunks");
+    int added_count = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        chunkstore::Key k;
+        uint32_t size = 0;
+        chunkstore::ChunkHeader hdr{};
+        if (len - pos < 20) return -1;
+        memcpy(&k.hi, data + pos, 8);
+        memcpy(&k.lo, data + pos + 8, 8);
+        memcpy(&size, data + pos + 16, 4);
+        pos += 20;
+        if (size < sizeof(hdr) || size > len - pos) return -1;
+        memcpy(&hdr, data + pos, sizeof(hdr));
+        const uint8_t* payload = data + pos + sizeof(hdr);
+        if (hdr.stored_size != size - sizeof(hdr) ||
+            crc32c::compute(payload, hdr.stored_size) != hdr.checksum ||
+            !chunk_matches(k, hdr, payload)) {
+            fprintf(stderr, "[snapshot] Rejected chunk %s from pack\n", chunkstore::key_hex(k).c_str());
+            return -1;
+        }
+        bool added = false;
+        if (!store.put(k, hdr.codec, hdr.raw_size, payload, hdr.stored_size, added)) return -1;
+        added_count += added;
+        pos += size;
+    }
+    return added_count;
+}
+
+// Adopt a received stored manifest: once every chunk it references is in
+// the store, move it to `dest` (same directory) and count its references.
+inline bool import_manifest(const std::string& src, const std::string& dest) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    reap_background(true);
+    if (dir_of(src) != dir_of(dest)) return false;
+    std::vector<chunkstore::Key> missing;
+    if (!chunk_keys(src, true, missing)) {
+        fprintf(stderr, "[snapshot] %s is not a stored snapshot\n", src.c_str());
+        return false;
+    }
+    if (!missing.empty()) {
+        fprintf(stderr, "[snapshot] %s still misses %zu chunks\n", src.c_str(), missing.size());
+        return false;
+    }
+    SavePlan plan;
+    plan.path = dest;
+    plan.stored = true;
+    SnapshotFile old;
+    if (is_stored_file(dest) && open_v2(dest, old)) plan.replaced_keys = manifest_keys(old);
+    if (::rename(src.c_str(), dest.c_str()) != 0) return false;
+    if (g_baseline.path == dest) g_baseline = Baseline{};
+    update_store_refs(plan);
+    return true;
+}
+
+inline std::string io_stats_json(const IoStats& s) {
+    char buf[896];
+    snprintf(buf, sizeof(buf),
+        "{\"version\":%u,\"incremental\":%s,\"background\":%s,\"chain_depth\":%u,"
+        "\"arena_bytes\":%llu,\"file_bytes\":%llu,\"v1_bytes\":%llu,\"state_bytes\":%llu,"
+        "\"chunks_total\":%u,\"chunks_zero\":%u,\"chunks_lz4\":%u,\"chunks_raw\":%u,"
+        "\"chunks_unchanged\":%u,\"chunks_deduped\":%u,\"store_bytes\":%llu,"
+        "\"mapped_bytes\":%llu,\"mapped_regions\":%u,"
+        "\"chunks_verified\":%u,\"verify_ms\":%.2f,\"chunks_mapped\":%u,"
+        "\"cow_chunks\":%u,\"pause_ms\":%.2f,"
+        "\"threads\":%u,\"seconds\":%.4f,\"arena_mb_per_sec\":%.1f}",
+        s.version, s.incremental ? "true" : "false", s.background ? "true" : "false",
+        s.chain_depth,
+        (unsigned long long)s.arena_bytes, (unsigned long long)s.file_bytes,
+        (unsigned long long)s.v1_bytes, (unsigned long long)s.state_bytes,
+        s.chunks_total, s.chunks_zero, s.chunks_lz4, s.chunks_raw,
+        s.chunks_unchanged, s.chunks_deduped, (unsigned long long)s.store_bytes,
+        (unsigned long long)s.mapped_bytes, s.mapped_regions,
+        s.chunks_verified, s.verify_seconds * 1000.0, s.chunks_mapped,
+        s.cow_chunks, s.pause_seconds * 1000.0,
+        s.threads, s.seconds, s.arena_mb_per_sec());
+    return buf;
+}
+
+inline std::string stats_json() {
+    // Commit a finished background save, but never wait on a running one
+    bool pending = true;
+    std::unique_lock<std::mutex> lock(g_mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        reap_background(false);
+        pending = background_pending();
+    }
+    int64_t first_us = g_first_output_us.load(std::memory_order_relaxed);
+    char first[48];
+    snprintf(first, sizeof(first), "%.1f", first_us < 0 ? -1.0 : first_us / 1000.0);
+    return "{\"last_save\":" + io_stats_json(g_last_save) +
+           ",\"last_restore\":" + io_stats_json(g_last_restore) +
+           ",\"background_pending\":" + (pending ? "true" : "false") +
+           ",\"background_failures\":" +
+           std::to_string(g_background_failures.load(std::memory_order_relaxed)) +
+           ",\"mapped_check_pending\":" + (mapped_check_pending() ? "true" : "false") +
+           ",\"mapped_failures\":" +
+           std::to_string(g_mapped_failures.load(std::memory_order_relaxed)) +
+           ",\"restore_to_first_output_ms\":" + first + "}";
+}
+
+}  // namespace snapshot
@@ -7,17 +7,28 @@
 
 #include <libriscv/machine.hpp>
 #include "vfs.hpp"
+#include "serial.hpp"
 #include "elf_loader.hpp"
+#include "elf_cache.hpp"
+#include "exec_lookup.hpp"
+#include "exec_cache.hpp"
+#include "page_cache.hpp"
+#include "signals.hpp"
+#include "boot_trace.hpp"
+#include "guest_wait.hpp"
+#include <chrono>
+#include <thread>
 #include <ctime>
 #include <cstring>
 #include <random>
 #include <iostream>
 #include <set>
 #include <unordered_map>
-#include <unistd.h>  // usleep
+#include <unistd.h>
 #include <sys/socket.h>
 #include <poll.h>
 #include "android_io.hpp"
+#include "io_buffer_pool.hpp"
 
 namespace syscalls {
 
@@ -27,6 +38,9 @@ using Machine = riscv::Machine<riscv::RISCV64>;
 // Avoids including network.hpp here (which would cause macro clashes with fcntl.h).
 inline bool (*net_is_socket_fd)(int fd) = nullptr;
 inline int  (*net_get_native_fd)(int fd) = nullptr;  // returns native fd or -1
+inline int  (*net_close_socket)(int fd) = nullptr;
+inline bool (*net_is_nonblocking)(int fd) = nullptr;
+inline void (*net_set_nonblocking)(int fd, bool enabled) = nullptr;
 
 // Execve restart flag — set by sys_execve handler, checked by execution loop
 inline bool g_execve_restart = false;
@@ -107,6 +121,32 @@ struct TermiosState {
 inline TermiosState g_termios;
 inline std::set<int> g_tty_fds = {0, 1, 2};
 
+// Execution context saved from initial load — used by execve to
+// reload binary segments and set up a fresh stack.
+struct ExecContext {
+    elfcache::BlobRef exec_blob;         // Main executable as loaded
+    elfcache::BlobRef interp_blob;       // Interpreter (ld-musl)
+    std::string exec_path;               // VFS paths of the above (snapshot state)
+    std::string interp_path;
+    elf::ElfInfo exec_info;              // Adjusted ELF info (with PIE base)
+    uint64_t exec_base = 0;             // PIE base for main executable
+    uint64_t exec_rw_start = 0;         // First writable segment of main binary
+    uint64_t exec_rw_end = 0;           // End of writable segments of main binary
+    uint64_t interp_base = 0;           // Where interpreter was loaded
+    uint64_t interp_rw_start = 0;       // First writable segment of interpreter
+    uint64_t interp_rw_end = 0;         // End of writable segments of interpreter
+    uint64_t interp_entry = 0;          // Interpreter entry point
+    uint64_t original_stack_top = 0;    // Stack top from initial setup
+    uint64_t heap_start = 0;            // Start of brk heap area
+    uint64_t heap_size = 0;             // Size of brk heap area
+    uint64_t brk_base = 0;             // Current binary's break base (end of BSS, page-aligned)
+    uint64_t brk_current = 0;          // Current break pointer
+    bool brk_overridden = false;       // True after execve sets up new brk
+    std::vector<std::string> env;        // Environment variables
+    bool dynamic = false;                // Current image runs under the dynamic linker?
+};
+inline ExecContext g_exec_ctx;
+
 // Cooperative thread scheduler for CLONE_THREAD.
 struct VThread {
     uint64_t regs[32];
@@ -118,9 +158,25 @@ struct VThread {
     int32_t futex_val;
     uint64_t clear_child_tid;
     uint64_t syscall_budget;
+    uint64_t wake_at;            // Deadline of a timed wait (steady ns), 0 = none
+    int64_t timeout_result;      // a0 when that deadline passes
+    signals::Thread sig;
 };
 constexpr int MAX_VTHREADS = 8;
 constexpr uint64_t THREAD_QUANTUM = 50000;
+// Instructions a thread runs before the runtime switches threads under it
+// (time_slice()), for threads that rarely make syscalls
+constexpr uint64_t TIME_SLICE = 10'000'000;
+
+// CPUs the guest is told it has. All guest threads share the one host
+// thread running the machine, time-sliced, so a runtime sizing its worker
+// pool from this (GOMAXPROCS, libuv) would only add threads that spin.
+constexpr int GUEST_CPUS = 1;
+
+inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 struct ThreadScheduler {
     VThread threads[MAX_VTHREADS];
     int current = 0;
@@ -142,6 +198,8 @@ struct ThreadScheduler {
                 threads[i].waiting = false;
                 threads[i].clear_child_tid = 0;
                 threads[i].syscall_budget = THREAD_QUANTUM;
+                threads[i].wake_at = 0;
+                threads[i].sig = {};
                 count++;
                 return i;
             }
@@ -149,7 +207,33 @@ struct ThreadScheduler {
         return -1;
     }
 
+    // Timed waits that have run out become runnable, returning their
+    // timeout result
+    void expire(int skip) {
+        uint64_t now = 0;
+        for (int i = 0; i < MAX_VTHREADS; i++) {
+            auto& t = threads[i];
+            if (i == skip || !t.active || !t.waiting || !t.wake_at) continue;
+            if (!now) now = now_ns();
+            if (now >= t.wake_at) {
+                t.waiting = false;
+                t.wake_at = 0;
+                t.regs[10] = static_cast<uint64_t>(t.timeout_result);
+            }
+        }
+    }
+
+    // Earliest deadline among waiting threads, 0 if none
+    uint64_t earliest_wake() const {
+        uint64_t at = 0;
+        for (const auto& t : threads) {
+            if (t.active && t.waiting && t.wake_at && (!at || t.wake_at < at)) at = t.wake_at;
+        }
+        return at;
+    }
+
     int next_runnable(int skip = -1) {
+        expire(skip);
         for (int i = 0; i < MAX_VTHREADS; i++) {
             if (i != skip && threads[i].active && !threads[i].waiting) {
                 return i;
@@ -163,6 +247,7 @@ struct ThreadScheduler {
         for (int i = 0; i < MAX_VTHREADS && woken < max_wake; i++) {
             if (threads[i].active && threads[i].waiting && threads[i].futex_addr == addr) {
                 threads[i].waiting = false;
+                threads[i].wake_at = 0;
                 woken++;
             }
         }
@@ -192,6 +277,13 @@ inline void restore_thread(Machine& m, VThread& t) {
     m.cpu.jump(t.pc);
 }
 
+// Enter the handler of a signal pending on the running thread, if any.
+// Call with the thread's registers (and syscall result) final.
+inline bool deliver_signals(Machine& m) {
+    return signals::deliver(m, g_sched.threads[g_sched.current].sig,
+                            g_exec_ctx.original_stack_top);
+}
+
 inline bool switch_to_thread(Machine& m, int target_idx) {
     if (target_idx < 0 || target_idx == g_sched.current) return false;
     auto& cur = g_sched.threads[g_sched.current];
@@ -200,9 +292,104 @@ inline bool switch_to_thread(Machine& m, int target_idx) {
     restore_thread(m, tgt);
     g_sched.current = target_idx;
     tgt.syscall_budget = THREAD_QUANTUM;
+    deliver_signals(m);
     return true;
 }
 
+// The runtime calls this when the running thread has used up TIME_SLICE
+// instructions. Threads are switched at any instruction here, so one that
+// never makes a syscall (a goroutine in a loop) still shares the CPU, e.g.
+// with Go's sysmon, which then preempts it with SIGURG.
+inline void time_slice(Machine& m) {
+    int next = g_sched.count > 1 ? g_sched.next_runnable(g_sched.current) : -1;
+    if (!switch_to_thread(m, next)) deliver_signals(m);
+}
+
+// A timed wait interrupted by a pause (guest_wait.hpp) re-executes with its
+// original deadline, so the pause does not lengthen the guest's sleep
+struct ResumedWait {
+    uint64_t pc = 0;
+    int thread = -1;
+    uint64_t deadline = 0;
+};
+inline ResumedWait g_resumed_wait;
+
+// The deadline for a timed wait starting now: `deadline`, unless this is
+// the re-execution of one that was interrupted
+inline uint64_t resume_deadline(Machine& m, uint64_t deadline) {
+    auto r = std::exchange(g_resumed_wait, ResumedWait{});
+    bool same = r.deadline && r.pc == m.cpu.pc() && r.thread == g_sched.current;
+    return same ? r.deadline : deadline;
+}
+
+// Re-execute the current syscall after the pause. `arg0` puts back a0 in
+// case the handler has already set its result.
+inline void interrupt_wait(Machine& m, uint64_t arg0, uint64_t deadline) {
+    g_resumed_wait = {m.cpu.pc(), g_sched.current, deadline};
+    m.cpu.reg(10) = arg0;
+    guestwait::restart(m);
+}
+
+// Park the running thread until a futex wake or `deadline` (steady ns, 0 =
+// none), when its a0 becomes `timeout_result`, and run another thread. Set
+// the result of a normal wake-up before calling; `arg0` is the syscall's
+// first argument, for re-executing it if a pause interrupts the wait. With
+// no other thread runnable this sleeps until the earliest deadline; with no
+// deadline at all, a sleeping thread is force-woken rather than
+// deadlocking. Returns false, with the thread running again, when there is
+// no other thread.
+inline bool wait_current(Machine& m, uint64_t deadline, int64_t timeout_result,
+                         uint64_t arg0) {
+    auto& cur = g_sched.threads[g_sched.current];
+    cur.waiting = true;
+    cur.wake_at = deadline;
+    cur.timeout_result = timeout_result;
+
+    int next = g_sched.next_runnable(g_sched.current);
+    if (next < 0) {
+        if (uint64_t at = g_sched.earliest_wake()) {
+            if (!guestwait::sleep_until(at)) {
+                cur.waiting = false;
+                cur.wake_at = 0;
+                interrupt_wait(m, arg0, deadline);
+                return true;
+            }
+            if (cur.wake_at && now_ns() >= cur.wake_at) {
+                cur.waiting = false;
+                cur.wake_at = 0;
+                m.set_result(timeout_result);
+                deliver_signals(m);
+                return true;
+            }
+            next = g_sched.next_runnable(g_sched.current);
+        }
+    }
+    if (next >= 0) {
+        static int switch_count = 0;
+        if (++switch_count <= 50)
+            fprintf(stderr, "[sched] wait t%d->t%d\n", g_sched.current, next);
+        switch_to_thread(m, next);
+        return true;
+    }
+    // All threads waiting without deadlines — cooperative deadlock. Force-wake
+    // a sleeping thread so it can observe any shutdown signals written to memory.
+    for (int i = 0; i < MAX_VTHREADS; i++) {
+        if (i != g_sched.current && g_sched.threads[i].active && g_sched.threads[i].waiting) {
+            g_sched.threads[i].waiting = false;
+            static int deadlock_count = 0;
+            if (++deadlock_count <= 50)
+                fprintf(stderr, "[sched] deadlock-break: force-wake t%d, switch from t%d\n",
+                        i, g_sched.current);
+            switch_to_thread(m, i);
+            return true;
+        }
+    }
+    // Truly no other threads
+    cur.waiting = false;
+    cur.wake_at = 0;
+    return false;
+}
+
 inline void maybe_preempt(Machine& m) {
     if (g_sched.count <= 1) return;
     auto& cur = g_sched.threads[g_sched.current];
@@ -222,30 +409,6 @@ inline void maybe_preempt(Machine& m) {
     }
 }
 
-// Execution context saved from initial load — used by execve to
-// reload binary segments and set up a fresh stack.
-struct ExecContext {
-    std::vector<uint8_t> exec_binary;    // Original main executable
-    std::vector<uint8_t> interp_binary;  // Original interpreter (ld-musl)
-    elf::ElfInfo exec_info;              // Adjusted ELF info (with PIE base)
-    uint64_t exec_base = 0;             // PIE base for main executable
-    uint64_t exec_rw_start = 0;         // First writable segment of main binary
-    uint64_t exec_rw_end = 0;           // End of writable segments of main binary
-    uint64_t interp_base = 0;           // Where interpreter was loaded
-    uint64_t interp_rw_start = 0;       // First writable segment of interpreter
-    uint64_t interp_rw_end = 0;         // End of writable segments of interpreter
-    uint64_t interp_entry = 0;          // Interpreter entry point
-    uint64_t original_stack_top = 0;    // Stack top from initial setup
-    uint64_t heap_start = 0;            // Start of brk heap area
-    uint64_t heap_size = 0;             // Size of brk heap area
-    uint64_t brk_base = 0;             // Current binary's break base (end of BSS, page-aligned)
-    uint64_t brk_current = 0;          // Current break pointer
-    bool brk_overridden = false;       // True after execve sets up new brk
-    std::vector<std::string> env;        // Environment variables
-    bool dynamic = false;                // Using dynamic linker?
-};
-inline ExecContext g_exec_ctx;
-
 // RISC-V 64-bit syscall numbers (from Linux kernel)
 namespace nr {
     constexpr int getcwd        = 17;
@@ -403,6 +566,7 @@ namespace err {
     constexpr int64_t INVAL = -22;
     constexpr int64_t NOSYS = -38;
     constexpr int64_t NOTSUP = -95;
+    constexpr int64_t TIMEDOUT = -110;
 }
 
 // Context passed via machine userdata
@@ -484,6 +648,7 @@ static void sys_exit(Machine& m) {
         if (next >= 0) {
             restore_thread(m, g_sched.threads[next]);
             g_sched.current = next;
+            deliver_signals(m);
             return;
         }
     }
@@ -504,7 +669,7 @@ static void sys_exit(Machine& m) {
                 attr.read = true;
                 attr.write = true;
                 attr.exec = true;
-                m.memory.set_page_attr(addr, size, attr);
+                pageattr::set(m.memory, addr, size, attr);
             }
         };
         // Fix data/BSS + BRK region (includes RELRO pages)
@@ -528,8 +693,11 @@ static void sys_exit(Machine& m) {
         }
 
         // Now restore parent memory (data/BSS, interpreter, stack, mmap)
+        prelink::fork_exit();
+        signals::fork_exit(g_sched.threads[g_sched.current].sig);
         auto restore = [&](ForkState::MemRegion& r) {
             if (!r.data.empty()) {
+                prelink::clobber(r.addr, r.size);
                 m.memory.memcpy(r.addr, r.data.data(), r.size);
                 r.data.clear();
                 r.data.shrink_to_fit();
@@ -622,6 +790,9 @@ static void sys_clone(Machine& m) {
             g_sched.threads[child_idx].clear_child_tid = child_tidptr;
         }
 
+        // The new thread inherits the signal mask, not pending signals
+        g_sched.threads[child_idx].sig.blocked = g_sched.threads[parent_idx].sig.blocked;
+
         g_sched.current = child_idx;
         g_sched.threads[child_idx].pc = m.cpu.pc();
 
@@ -671,7 +842,7 @@ static void sys_clone(Machine& m) {
             // BRK pages may not have read attrs yet — make them readable.
             riscv::PageAttributes attr;
             attr.read = true; attr.write = true; attr.exec = true;
-            m.memory.set_page_attr(save_start, save_end - save_start, attr);
+            pageattr::set(m.memory, save_start, save_end - save_start, attr);
 
             auto& r = g_fork.exec_data;
             r.addr = save_start;
@@ -725,6 +896,8 @@ static void sys_clone(Machine& m) {
     // with in_child still false, allowing the save to be retried.
     g_fork.in_child = true;
     g_fork.child_reaped = false;
+    prelink::fork_child();
+    signals::fork_child(g_sched.threads[g_sched.current].sig);
 
     // Return 0 = "you are the child"
     m.set_result(0);
@@ -756,9 +929,9 @@ static void sys_wait4(Machine& m) {
 static std::string resolve_path(vfs::VirtualFS& fs, const std::string& path) {
     std::string resolved = path;
     for (int i = 0; i < 10; i++) {
-        vfs::Entry entry;
-        if (!fs.stat(resolved, entry)) return "";  // not found
-        if (entry.type != vfs::FileType::Symlink) break;
+        auto entry = fs.resolve(resolved);
+        if (!entry) return "";  // not found
+        if (!entry->is_symlink()) break;
         char target[256];
         ssize_t n = fs.readlink(resolved, target, sizeof(target));
         if (n <= 0) break;
@@ -773,54 +946,168 @@ static std::string resolve_path(vfs::VirtualFS& fs, const std::string& path) {
     return resolved;
 }
 
-// Helper: read a file from VFS into a byte vector.
-static std::vector<uint8_t> read_vfs_file(vfs::VirtualFS& fs, const std::string& path) {
-    int fd = fs.open(path, 0 /*O_RDONLY*/);
-    if (fd < 0) return {};
-    std::vector<uint8_t> data;
-    char buf[4096];
-    ssize_t n;
-    while ((n = fs.read(fd, buf, sizeof(buf))) > 0) {
-        data.insert(data.end(), buf, buf + n);
+// Helper: call fn(const uint8_t*) on guest bytes [addr, addr+len). Uses the
+// arena directly when the range is contiguous and readable, otherwise stages
+// the bytes through a pooled buffer.
+template <typename Fn>
+static auto with_guest_bytes(Machine& m, uint64_t addr, size_t len, Fn&& fn) {
+    const uint8_t* direct = nullptr;
+    try {
+        direct = reinterpret_cast<const uint8_t*>(m.memory.memview(addr, len).data());
+    } catch (...) {}
+    if (direct) return fn(direct);
+    iobuf::Buffer buf(len);
+    m.memory.memcpy_out(buf.data(), addr, len);
+    return fn(static_cast<const uint8_t*>(buf.data()));
+}
+
+// eventfd: an open file named EVENTFD_PATH whose content is the 8-byte
+// counter. Reads take the whole count (EAGAIN at zero, never blocking),
+// writes add to it; epoll reports it readable while it is non-zero.
+constexpr const char* EVENTFD_PATH = "[eventfd]";
+
+static bool is_eventfd(vfs::VirtualFS& fs, int fd) {
+    return fs.get_path(fd) == EVENTFD_PATH;
+}
+static uint64_t eventfd_count(const vfs::Entry& e) {
+    uint64_t v = 0;
+    if (e.content.size() >= 8) std::memcpy(&v, e.content.data(), 8);
+    return v;
+}
+static void eventfd_set(vfs::Entry& e, uint64_t v) {
+    e.content.resize(8);
+    std::memcpy(e.content.data(), &v, 8);
+}
+
+static void eventfd_read(Machine& m, vfs::VirtualFS& fs, int fd, uint64_t buf_addr, size_t count) {
+    auto entry = fs.get_entry(fd);
+    uint64_t v = eventfd_count(*entry);
+    if (count < 8) {
+        m.set_result(err::INVAL);
+    } else if (v == 0) {
+        m.set_result(-11);  // -EAGAIN
+    } else {
+        m.memory.template write<uint64_t>(buf_addr, v);
+        eventfd_set(*entry, 0);
+        m.set_result(8);
+    }
+}
+
+static void eventfd_write(Machine& m, vfs::VirtualFS& fs, int fd, uint64_t buf_addr, size_t count) {
+    auto entry = fs.get_entry(fd);
+    if (count < 8) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    uint64_t add = m.memory.template read<uint64_t>(buf_addr);
+    uint64_t v = eventfd_count(*entry);
+    if (add == ~0ULL || v > ~0ULL - 1 - add) {
+        m.set_result(add == ~0ULL ? err::INVAL : -11);  // Would overflow: -EAGAIN
+        return;
     }
-    fs.close(fd);
-    return data;
+    eventfd_set(*entry, v + add);
+    m.set_result(8);
 }
 
 // Helper: search PATH for a command name, return full path or empty.
+// Lookups are cached per (PATH, command) (exec_lookup.hpp).
 static std::string search_path(vfs::VirtualFS& fs, const std::string& cmd) {
-    if (cmd.empty() || cmd[0] == '/') return cmd;
     std::string path_val = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
     for (auto& e : g_exec_ctx.env) {
         if (e.substr(0, 5) == "PATH=") { path_val = e.substr(5); break; }
     }
-    size_t pos = 0;
-    while (pos < path_val.size()) {
-        size_t colon = path_val.find(':', pos);
-        std::string dir = (colon == std::string::npos)
-            ? path_val.substr(pos) : path_val.substr(pos, colon - pos);
-        std::string candidate = dir + "/" + cmd;
-        std::string resolved = resolve_path(fs, candidate);
-        if (!resolved.empty()) {
-            vfs::Entry e2;
-            if (fs.stat(resolved, e2) && e2.type == vfs::FileType::Regular)
-                return candidate;  // return unresolved (let caller resolve)
-        }
-        pos = (colon == std::string::npos) ? path_val.size() : colon + 1;
-    }
-    return "";
+    return execlookup::search_path(fs, path_val, cmd);
+}
+
+// execve resets handlers and the alternate stack, and the new stack needs
+// its sigreturn trampoline
+static void new_signal_image(Machine& m) {
+    signals::new_image();
+    auto& t = g_sched.threads[g_sched.current].sig;
+    t.alt_sp = t.alt_size = 0;
+    t.alt_flags = signals::SS_DISABLE;
+    signals::install_trampoline(m, g_exec_ctx.original_stack_top);
+}
+
+// Start the loaded dynamic program with a fresh stack: straight at its
+// entry when a linked image of it is cached (exec_cache.hpp), otherwise
+// through the interpreter with the entry stub armed so this link is
+// captured. Returns the address execution continues at.
+static uint64_t start_dynamic(Machine& m, const std::vector<std::string>& args) {
+    auto& ec = g_exec_ctx;
+    auto& fs = get_fs(m);
+    uint64_t stack_top = ec.original_stack_top - execcache::STUB_SLOT;
+    prelink::new_image();
+    prelink::clobber(stack_top - (8ULL << 20), 8ULL << 20);
+    new_signal_image(m);
+    uint64_t sp = dynlink::setup_dynamic_stack(
+        m, ec.exec_info, ec.interp_base, args, ec.env, stack_top);
+    for (int i = 1; i < 32; i++) m.cpu.reg(i) = 0;
+    m.cpu.reg(riscv::REG_SP) = sp;
+
+    execcache::Layout layout;
+    layout.exec_rw_start = ec.exec_rw_start;
+    layout.exec_rw_end = ec.exec_rw_end;
+    layout.interp_rw_start = ec.interp_rw_start;
+    layout.interp_rw_end = ec.interp_rw_end;
+    layout.brk_start = ec.brk_overridden ? ec.brk_current : m.memory.heap_address();
+    layout.mmap_start = std::max(m.memory.mmap_address(), g_mmap_bump);
+    auto key = execcache::make_key(m, fs, ec.exec_path, ec.interp_path, layout,
+                                   ec.exec_base, ec.interp_base, stack_top, sp, ec.env);
+    if (!execcache::cacheable(key)) {
+        execcache::g_stats.rejected++;
+    } else if (const auto* img = execcache::lookup(fs, key)) {
+        execcache::restore(m, fs, *img, sp);
+        if (ec.brk_overridden) ec.brk_current = img->brk_end;
+        if (img->map_hi > m.memory.mmap_address()) m.memory.mmap_address() = img->map_hi;
+        if (img->map_hi > g_mmap_bump) g_mmap_bump = img->map_hi;
+        return img->entry;
+    } else {
+        execcache::arm(m, key, layout, stack_top, sp);
+    }
+    m.cpu.jump(ec.interp_entry);
+    return ec.interp_entry;
+}
+
+// Start the loaded static or static-PIE program with a fresh stack,
+// straight at its entry: there is no interpreter to run again. With
+// `reload_data` (same binary as before) only the writable segments are
+// copied in again, so data and BSS start clean while the code stays.
+// AT_BASE is 0: that is how a static-PIE's self-relocation (musl's
+// _dlstart_c) knows there is no interpreter and takes its own base from
+// AT_PHDR. Returns the entry point.
+static uint64_t start_static(Machine& m, const std::vector<std::string>& args, bool reload_data) {
+    auto& ec = g_exec_ctx;
+    if (reload_data) {
+        elf::Layout data = ec.exec_blob->elf;
+        std::erase_if(data.loads, [](const elf::Segment& seg) { return !(seg.flags & elf::PF_W); });
+        prelink::clobber(ec.exec_rw_start, ec.exec_rw_end - ec.exec_rw_start);
+        dynlink::load_elf_segments(m, ec.exec_blob->bytes, data,
+                                   data.info.type == elf::ET_DYN ? ec.exec_base : 0);
+        if (ec.brk_overridden) ec.brk_current = ec.brk_base;
+    }
+    uint64_t stack_top = ec.original_stack_top - execcache::STUB_SLOT;
+    prelink::new_image();
+    prelink::clobber(stack_top - (8ULL << 20), 8ULL << 20);
+    new_signal_image(m);
+    uint64_t sp = dynlink::setup_dynamic_stack(m, ec.exec_info, 0, args, ec.env, stack_top);
+    for (int i = 1; i < 32; i++) m.cpu.reg(i) = 0;
+    m.cpu.reg(riscv::REG_SP) = sp;
+    m.cpu.jump(ec.exec_info.entry_point);
+    return ec.exec_info.entry_point;
 }
 
 // execve — replace current "process" with a new program.
 // Supports:
 //   - Busybox applets (same binary, just new argv)
 //   - Arbitrary ELF binaries (loads new code + interpreter)
+//   - Static and static-PIE binaries (loads new code, no interpreter)
 //   - Shebang scripts (#!/path/to/interpreter)
 static void sys_execve(Machine& m) {
     auto path_addr = m.sysarg(0);
     auto argv_addr = m.sysarg(1);
 
-    if (!g_exec_ctx.dynamic || g_exec_ctx.exec_binary.empty()) {
+    if (!g_exec_ctx.exec_blob) {
         m.set_result(-38);  // -ENOSYS
         return;
     }
@@ -862,86 +1149,55 @@ static void sys_execve(Machine& m) {
 
     // Shebang handling: if the target file starts with "#!", parse the
     // interpreter line and rewrite args as: interpreter [arg] script argv[1..]
-    {
-        int fd = fs.open(resolved, 0 /*O_RDONLY*/);
-        if (fd >= 0) {
-            char hdr[256];
-            ssize_t n = fs.read(fd, hdr, sizeof(hdr) - 1);
-            fs.close(fd);
-            if (n >= 4 && hdr[0] == '#' && hdr[1] == '!') {
-                hdr[n] = '\0';
-                char* eol = std::strchr(hdr + 2, '\n');
-                if (eol) *eol = '\0';
-                char* interp = hdr + 2;
-                while (*interp == ' ' || *interp == '\t') interp++;
-                std::string interp_path;
-                std::string interp_arg;
-                char* space = std::strchr(interp, ' ');
-                if (!space) space = std::strchr(interp, '\t');
-                if (space) {
-                    interp_path = std::string(interp, space);
-                    char* a = space + 1;
-                    while (*a == ' ' || *a == '\t') a++;
-                    char* end = a + std::strlen(a) - 1;
-                    while (end > a && (*end == ' ' || *end == '\t' || *end == '\r')) *end-- = '\0';
-                    if (*a) interp_arg = a;
-                } else {
-                    char* end = interp + std::strlen(interp) - 1;
-                    while (end > interp && (*end == ' ' || *end == '\t' || *end == '\r')) *end-- = '\0';
-                    interp_path = interp;
-                }
-                std::vector<std::string> new_args;
-                new_args.push_back(interp_path);
-                if (!interp_arg.empty()) new_args.push_back(interp_arg);
-                new_args.push_back(resolved);
-                for (size_t i = 1; i < args.size(); i++)
-                    new_args.push_back(args[i]);
-                args = std::move(new_args);
-
-                // Handle /usr/bin/env: resolve command via PATH
-                if (interp_path == "/usr/bin/env" && args.size() >= 2) {
-                    std::string cmd = args[1];
-                    std::string found = search_path(fs, cmd);
-                    if (!found.empty()) {
-                        args[0] = found;
-                        args.erase(args.begin() + 1);
-                        resolved = resolve_path(fs, found);
-                    }
-                } else {
-                    resolved = resolve_path(fs, interp_path);
-                }
-                if (resolved.empty()) {
-                    m.set_result(-2);  // -ENOENT
-                    return;
+    // The parsed line is cached per file version (exec_lookup.hpp).
+    if (auto file = fs.resolve(resolved); file && file->is_file()) {
+        auto sb = execlookup::shebang(file);
+        if (sb.script) {
+            std::vector<std::string> new_args;
+            new_args.push_back(sb.interp);
+            if (!sb.arg.empty()) new_args.push_back(sb.arg);
+            new_args.push_back(resolved);
+            for (size_t i = 1; i < args.size(); i++)
+                new_args.push_back(args[i]);
+            args = std::move(new_args);
+
+            // Handle /usr/bin/env: resolve command via PATH
+            if (sb.interp == "/usr/bin/env" && args.size() >= 2) {
+                std::string cmd = args[1];
+                std::string found = search_path(fs, cmd);
+                if (!found.empty()) {
+                    args[0] = found;
+                    args.erase(args.begin() + 1);
+                    resolved = resolve_path(fs, found);
                 }
+            } else {
+                resolved = resolve_path(fs, sb.interp);
+            }
+            if (resolved.empty()) {
+                m.set_result(-2);  // -ENOENT
+                return;
             }
         }
     }
 
-    // Read the target binary from VFS to check if it's a different ELF
-    auto new_binary = read_vfs_file(fs, resolved);
-    bool is_new_elf = false;
+    // The target binary, shared with earlier execs of the same file version
+    auto new_blob = elfcache::get(fs, resolved);
+    bool is_new_elf = new_blob && new_blob->is_elf;
 
-    if (new_binary.size() >= sizeof(elf::Elf64_Ehdr)) {
-        const auto* ehdr = reinterpret_cast<const elf::Elf64_Ehdr*>(new_binary.data());
-        if (ehdr->e_ident[0] == 0x7f && ehdr->e_ident[1] == 'E' &&
-            ehdr->e_ident[2] == 'L' && ehdr->e_ident[3] == 'F' &&
-            ehdr->e_machine == elf::EM_RISCV) {
-            is_new_elf = true;
-        }
-    }
-
-    if (is_new_elf && new_binary != g_exec_ctx.exec_binary) {
+    if (is_new_elf && new_blob->id != g_exec_ctx.exec_blob->id) {
         // ---- Loading a NEW binary (e.g. /usr/bin/node) ----
         try {
-            auto exec_info = elf::parse_elf(new_binary);
+            if (!new_blob->error.empty()) throw std::runtime_error(new_blob->error);
+            const auto& layout = new_blob->elf;
+            auto exec_info = layout.info;
             std::cout << "[friscy] execve: loading new binary " << resolved
-                      << " (" << new_binary.size() << " bytes)\n";
+                      << " (" << new_blob->bytes.size() << " bytes)\n";
 
-            // Check if new binary fits in arena
+            // Check if new binary fits in arena. PIE images go at 0x40000,
+            // ET_EXEC ones (static Go tools, non-PIE BusyBox) where linked.
             constexpr uint64_t ARENA_SIZE = 1ULL << riscv::encompassing_Nbit_arena;
-            auto [new_lo, new_hi] = elf::get_load_range(new_binary);
-            uint64_t exec_base = 0x40000;
+            auto [new_lo, new_hi] = layout.load_range;
+            uint64_t exec_base = exec_info.type == elf::ET_DYN ? 0x40000 : new_lo;
             uint64_t load_end = exec_base + new_hi - new_lo;
             std::cerr << "[execve] ELF load range: lo=0x" << std::hex << new_lo
                       << " hi=0x" << new_hi << " load_end=0x" << load_end
@@ -957,43 +1213,48 @@ static void sys_execve(Machine& m) {
             {
                 riscv::PageAttributes rw;
                 rw.read = true; rw.write = true;
-                m.memory.set_page_attr(exec_base, load_end - exec_base, rw);
+                pageattr::set(m.memory, exec_base, load_end - exec_base, rw);
             }
             // Also make old binary range writable
             {
-                auto [old_lo, old_hi] = elf::get_load_range(g_exec_ctx.exec_binary);
+                auto [old_lo, old_hi] = g_exec_ctx.exec_blob->elf.load_range;
                 uint64_t old_start = g_exec_ctx.exec_base;
-                uint64_t old_end = old_start + old_hi;
+                uint64_t old_end = old_start + (old_hi - old_lo);
                 riscv::PageAttributes rw;
                 rw.read = true; rw.write = true;
-                m.memory.set_page_attr(old_start, old_end - old_start, rw);
+                pageattr::set(m.memory, old_start, old_end - old_start, rw);
             }
 
             // Load new main binary segments at PIE base
+            prelink::clobber(exec_base, load_end - exec_base);
             if (exec_info.type == elf::ET_DYN) {
-                auto [lo, hi] = elf::get_load_range(new_binary);
+                uint64_t lo = new_lo;
                 exec_base = 0x40000;
-                dynlink::load_elf_segments(m, new_binary, exec_base);
+                dynlink::load_elf_segments(m, new_blob->bytes, layout, exec_base);
                 exec_info.phdr_addr += (exec_base - lo);
                 exec_info.entry_point += (exec_base - lo);
                 g_exec_ctx.exec_base = exec_base;
-                auto [rw_lo, rw_hi] = elf::get_writable_range(new_binary);
+                auto [rw_lo, rw_hi] = layout.writable_range;
                 g_exec_ctx.exec_rw_start = (exec_base - lo) + rw_lo;
                 g_exec_ctx.exec_rw_end = (exec_base - lo) + rw_hi;
             } else {
-                dynlink::load_elf_segments(m, new_binary, 0);
-                auto [rw_lo, rw_hi] = elf::get_writable_range(new_binary);
+                dynlink::load_elf_segments(m, new_blob->bytes, layout, 0);
+                g_exec_ctx.exec_base = exec_base;
+                auto [rw_lo, rw_hi] = layout.writable_range;
                 g_exec_ctx.exec_rw_start = rw_lo;
                 g_exec_ctx.exec_rw_end = rw_hi;
             }
 
-            uint64_t interp_base = g_exec_ctx.interp_base;
+            // Booted from a static binary: the interpreter goes where boot()
+            // would have put it
+            uint64_t interp_base = g_exec_ctx.interp_base ? g_exec_ctx.interp_base : 0x18000000;
             uint64_t interp_entry = g_exec_ctx.interp_entry;
+            bool use_interp = exec_info.is_dynamic && !exec_info.interpreter.empty();
 
-            if (exec_info.is_dynamic && !exec_info.interpreter.empty()) {
+            if (use_interp) {
                 std::string interp_resolved = resolve_path(fs, exec_info.interpreter);
-                auto interp_binary = read_vfs_file(fs, interp_resolved);
-                if (interp_binary.empty()) {
+                auto interp_blob = elfcache::get(fs, interp_resolved);
+                if (!interp_blob || interp_blob->bytes.empty()) {
                     std::cerr << "[friscy] execve: interpreter not found: "
                               << exec_info.interpreter << "\n";
                     m.set_result(-2);
@@ -1001,38 +1262,44 @@ static void sys_execve(Machine& m) {
                 }
 
                 // Make old interpreter pages writable before overwriting
-                {
-                    auto [ilo, ihi] = elf::get_load_range(g_exec_ctx.interp_binary);
+                if (g_exec_ctx.interp_blob) {
+                    auto [ilo, ihi] = g_exec_ctx.interp_blob->elf.load_range;
                     riscv::PageAttributes rw;
                     rw.read = true; rw.write = true;
-                    m.memory.set_page_attr(interp_base, ihi - ilo, rw);
+                    pageattr::set(m.memory, interp_base, ihi - ilo, rw);
                 }
 
-                dynlink::load_elf_segments(m, interp_binary, interp_base);
+                if (!interp_blob->error.empty()) throw std::runtime_error(interp_blob->error);
+                const auto& ilayout = interp_blob->elf;
+                prelink::clobber(interp_base, ilayout.load_range.second - ilayout.load_range.first);
+                dynlink::load_elf_segments(m, interp_blob->bytes, ilayout, interp_base);
 
-                auto interp_info = elf::parse_elf(interp_binary);
+                const auto& interp_info = ilayout.info;
                 if (interp_info.type == elf::ET_DYN) {
-                    auto [lo, hi] = elf::get_load_range(interp_binary);
-                    interp_entry = interp_info.entry_point - lo + interp_base;
+                    interp_entry = interp_info.entry_point - ilayout.load_range.first + interp_base;
                 } else {
                     interp_entry = interp_info.entry_point;
                 }
 
-                auto [irw_lo, irw_hi] = elf::get_writable_range(interp_binary);
+                auto [irw_lo, irw_hi] = ilayout.writable_range;
                 g_exec_ctx.interp_rw_start = interp_base + irw_lo;
                 g_exec_ctx.interp_rw_end = interp_base + irw_hi;
-                g_exec_ctx.interp_binary = std::move(interp_binary);
+                g_exec_ctx.interp_blob = std::move(interp_blob);
+                g_exec_ctx.interp_path = interp_resolved;
+                g_exec_ctx.interp_base = interp_base;
                 g_exec_ctx.interp_entry = interp_entry;
             }
 
-            g_exec_ctx.exec_binary = std::move(new_binary);
+            g_exec_ctx.exec_blob = std::move(new_blob);
+            g_exec_ctx.exec_path = resolved;
             g_exec_ctx.exec_info = exec_info;
+            g_exec_ctx.dynamic = use_interp;
 
             // Reset memory layout after loading new binary
             {
                 uint64_t max_end = load_end;
-                if (exec_info.is_dynamic) {
-                    auto [ilo, ihi] = elf::get_load_range(g_exec_ctx.interp_binary);
+                if (use_interp) {
+                    auto [ilo, ihi] = g_exec_ctx.interp_blob->elf.load_range;
                     uint64_t interp_end2 = interp_base + (ihi - ilo);
                     if (interp_end2 > max_end) max_end = interp_end2;
                 }
@@ -1045,7 +1312,8 @@ static void sys_execve(Machine& m) {
                 constexpr uint64_t BRK_MAX = 16ULL << 20;
                 riscv::PageAttributes rw;
                 rw.read = true; rw.write = true;
-                m.memory.set_page_attr(new_brk_base, BRK_MAX, rw);
+                pageattr::set(m.memory, new_brk_base, BRK_MAX, rw);
+                prelink::clobber(new_brk_base, BRK_MAX);
 
                 uint64_t new_mmap_start = new_brk_base + BRK_MAX;
                 if (m.memory.mmap_address() < new_mmap_start) {
@@ -1066,21 +1334,14 @@ static void sys_execve(Machine& m) {
                           << new_stack_top << std::dec << "\n";
                 riscv::PageAttributes rw;
                 rw.read = true; rw.write = true;
-                m.memory.set_page_attr(new_stack_top - 0x10000, 0x10000, rw);
+                pageattr::set(m.memory, new_stack_top - 0x10000, 0x10000, rw);
                 g_exec_ctx.original_stack_top = new_stack_top;
             }
 
-            uint64_t sp = dynlink::setup_dynamic_stack(
-                m, exec_info, interp_base, args,
-                g_exec_ctx.env, new_stack_top);
-
-            for (int i = 1; i < 32; i++) m.cpu.reg(i) = 0;
-            m.cpu.reg(riscv::REG_SP) = sp;
-            m.cpu.jump(exec_info.is_dynamic ? interp_entry : exec_info.entry_point);
+            uint64_t target = use_interp ? start_dynamic(m, args) : start_static(m, args, false);
 
             std::cout << "[friscy] execve: jumping to 0x" << std::hex
-                      << (exec_info.is_dynamic ? interp_entry : exec_info.entry_point)
-                      << std::dec << "\n";
+                      << target << std::dec << "\n";
             return;
         } catch (const riscv::MachineException& e) {
             std::cerr << "[friscy] execve: MachineException loading " << resolved
@@ -1098,15 +1359,13 @@ static void sys_execve(Machine& m) {
     }
 
     // ---- Same binary (busybox applet) or non-ELF ----
-    // Just set up fresh stack with new argv and re-enter the dynamic linker.
-
-    uint64_t sp = dynlink::setup_dynamic_stack(
-        m, g_exec_ctx.exec_info, g_exec_ctx.interp_base,
-        args, g_exec_ctx.env, g_exec_ctx.original_stack_top);
-
-    for (int i = 1; i < 32; i++) m.cpu.reg(i) = 0;
-    m.cpu.reg(riscv::REG_SP) = sp;
-    m.cpu.jump(g_exec_ctx.interp_entry);
+    // Just set up fresh stack with new argv and re-enter the dynamic linker,
+    // or the static program's entry.
+    if (g_exec_ctx.dynamic) {
+        start_dynamic(m, args);
+    } else {
+        start_static(m, args, true);
+    }
 }
 
 static void sys_openat(Machine& m) {
@@ -1133,7 +1392,12 @@ static void sys_openat(Machine& m) {
 }
 
 static void sys_close(Machine& m) {
-    get_fs(m).close(m.template sysarg<int>(0));
+    int fd = m.template sysarg<int>(0);
+    if (net_is_socket_fd && net_is_socket_fd(fd)) {
+        m.set_result(net_close_socket ? net_close_socket(fd) : 0);
+        return;
+    }
+    get_fs(m).close(fd);
     m.set_result(0);
 }
 
@@ -1143,9 +1407,16 @@ static void sys_read(Machine& m) {
     auto buf_addr = m.sysarg(1);
     size_t count = m.sysarg(2);
 
+    if (is_eventfd(fs, fd)) {
+        eventfd_read(m, fs, fd, buf_addr, count);
+        return;
+    }
+
+    if (fd == 0) boottrace::first_stdin_read();
+
     // If fd has been redirected (e.g. dup2'd to a pipe), use VFS
     if (fd == 0 && fs.is_open(fd)) {
-        std::vector<uint8_t> buf(count);
+        iobuf::Buffer buf(count);
         ssize_t n = fs.read(fd, buf.data(), count);
         if (n > 0) {
             m.memory.memcpy(buf_addr, buf.data(), n);
@@ -1155,8 +1426,10 @@ static void sys_read(Machine& m) {
     }
 
     if (fd == 0) {
-        // Try non-blocking read from Android stdin buffer
-        std::vector<uint8_t> tmp(count);
+        // Try non-blocking read from Android stdin buffer (short reads are
+        // fine for a tty, so cap the staging buffer at the largest class)
+        count = std::min(count, iobuf::MAX_POOLED_SIZE);
+        iobuf::Buffer tmp(count);
         int bytes_read = android_io::try_read_stdin(tmp.data(), count);
         if (bytes_read >= 0) {
             if (bytes_read > 0) {
@@ -1178,8 +1451,17 @@ static void sys_read(Machine& m) {
     if (net_is_socket_fd && net_is_socket_fd(fd)) {
         int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
         if (native_fd >= 0) {
-            std::vector<uint8_t> buf(count);
-            ssize_t n = ::recv(native_fd, buf.data(), count, 0);
+            // Stream sockets may return short reads; never stage more than
+            // one pooled buffer
+            iobuf::Buffer buf(std::min(count, iobuf::MAX_POOLED_SIZE));
+            bool nonblocking = net_is_nonblocking && net_is_nonblocking(fd);
+            ssize_t n;
+            if (!guestwait::blocking_call(native_fd, POLLIN, nonblocking, n, [&] {
+                    return ::recv(native_fd, buf.data(), buf.size(), MSG_DONTWAIT);
+                })) {
+                guestwait::restart(m);
+                return;
+            }
             if (n > 0) {
                 m.memory.memcpy(buf_addr, buf.data(), n);
             }
@@ -1188,7 +1470,7 @@ static void sys_read(Machine& m) {
         }
     }
 
-    std::vector<uint8_t> buf(count);
+    iobuf::Buffer buf(count);
     ssize_t n = fs.read(fd, buf.data(), count);
     if (n > 0) {
         m.memory.memcpy(buf_addr, buf.data(), n);
@@ -1202,11 +1484,16 @@ static void sys_write(Machine& m) {
     auto buf_addr = m.sysarg(1);
     size_t count = m.sysarg(2);
 
+    if (is_eventfd(fs, fd)) {
+        eventfd_write(m, fs, fd, buf_addr, count);
+        return;
+    }
+
     // Check VFS first — fd 1/2 may have been dup2'd to a pipe/file
     if (fs.is_open(fd)) {
-        std::vector<uint8_t> buf(count);
-        m.memory.memcpy_out(buf.data(), buf_addr, count);
-        ssize_t n = fs.write(fd, buf.data(), count);
+        ssize_t n = with_guest_bytes(m, buf_addr, count, [&](const uint8_t* p) {
+            return fs.write(fd, p, count);
+        });
         m.set_result(n);
         return;
     }
@@ -1227,9 +1514,16 @@ static void sys_write(Machine& m) {
     if (net_is_socket_fd && net_is_socket_fd(fd)) {
         int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
         if (native_fd >= 0) {
-            std::vector<uint8_t> buf(count);
-            m.memory.memcpy_out(buf.data(), buf_addr, count);
-            ssize_t n = ::send(native_fd, buf.data(), count, 0);
+            bool nonblocking = net_is_nonblocking && net_is_nonblocking(fd);
+            ssize_t n;
+            if (!guestwait::blocking_call(native_fd, POLLOUT, nonblocking, n, [&] {
+                    return with_guest_bytes(m, buf_addr, count, [&](const uint8_t* p) {
+                        return ::send(native_fd, p, count, MSG_DONTWAIT);
+                    });
+                })) {
+                guestwait::restart(m);
+                return;
+            }
             m.set_result(n >= 0 ? n : -errno);
             return;
         }
@@ -1251,9 +1545,9 @@ static void sys_writev(Machine& m) {
             uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
             uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
             if (len > 0) {
-                std::vector<uint8_t> buf(len);
-                m.memory.memcpy_out(buf.data(), base, len);
-                ssize_t n = fs.write(fd, buf.data(), len);
+                ssize_t n = with_guest_bytes(m, base, len, [&](const uint8_t* p) {
+                    return fs.write(fd, p, len);
+                });
                 if (n < 0) {
                     m.set_result(total > 0 ? (int64_t)total : n);
                     return;
@@ -1285,14 +1579,23 @@ static void sys_writev(Machine& m) {
     if (net_is_socket_fd && net_is_socket_fd(fd)) {
         int native_fd = net_get_native_fd ? net_get_native_fd(fd) : -1;
         if (native_fd >= 0) {
+            bool nonblocking = net_is_nonblocking && net_is_nonblocking(fd);
             size_t total = 0;
             for (int i = 0; i < iovcnt; i++) {
                 uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
                 uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
                 if (len > 0) {
-                    std::vector<uint8_t> buf(len);
-                    m.memory.memcpy_out(buf.data(), base, len);
-                    ssize_t n = ::send(native_fd, buf.data(), len, 0);
+                    ssize_t n;
+                    bool done = guestwait::blocking_call(
+                        native_fd, POLLOUT, nonblocking || total > 0, n, [&] {
+                            return with_guest_bytes(m, base, len, [&](const uint8_t* p) {
+                                return ::send(native_fd, p, len, MSG_DONTWAIT);
+                            });
+                        });
+                    if (!done) {
+                        guestwait::restart(m);
+                        return;
+                    }
                     if (n < 0) {
                         m.set_result(total > 0 ? (int64_t)total : -errno);
                         return;
@@ -1324,7 +1627,7 @@ static void sys_getdents64(Machine& m) {
     auto buf_addr = m.sysarg(1);
     size_t count = m.sysarg(2);
 
-    std::vector<uint8_t> buf(count);
+    iobuf::Buffer buf(count);
     ssize_t n = fs.getdents64(fd, buf.data(), count);
     if (n > 0) {
         m.memory.memcpy(buf_addr, buf.data(), n);
@@ -1543,14 +1846,34 @@ static void sys_getrandom(Machine& m) {
     auto buf_addr = m.sysarg(0);
     size_t count = m.sysarg(1);
 
-    std::vector<uint8_t> buf(count);
+    iobuf::Buffer buf(count);
     for (size_t i = 0; i < count; i++) {
-        buf[i] = ctx->rng() & 0xFF;
+        buf.data()[i] = ctx->rng() & 0xFF;
     }
     m.memory.memcpy(buf_addr, buf.data(), count);
     m.set_result(count);
 }
 
+// Ranges a prelinked library must stay clear of: the program with room
+// for its brk, the stack, and the interpreter with the mmap area above it
+static std::vector<std::pair<uint64_t, uint64_t>> prelink_busy(Machine& m) {
+    constexpr uint64_t BRK_MAX = 16ULL << 20;
+    constexpr uint64_t STACK_RESERVE = 8ULL << 20;
+    const auto& ec = g_exec_ctx;
+    uint64_t exec_end = ec.exec_rw_end;
+    if (ec.exec_blob) {
+        auto [lo, hi] = ec.exec_blob->elf.load_range;
+        exec_end = std::max(exec_end, ec.exec_base + (hi - lo));
+    }
+    uint64_t brk_start = ec.brk_overridden ? ec.brk_base : m.memory.heap_address();
+    uint64_t stack_lo = ec.original_stack_top > STACK_RESERVE ? ec.original_stack_top - STACK_RESERVE : 0;
+    return {
+        {ec.exec_base, std::max(exec_end, brk_start + BRK_MAX)},
+        {stack_lo, ec.original_stack_top},
+        {ec.interp_base, UINT64_MAX},
+    };
+}
+
 // mmap — intercept file-backed mappings, custom bump allocator for anonymous
 static void sys_mmap(Machine& m) {
     auto* ctx = get_ctx(m);
@@ -1572,7 +1895,7 @@ static void sys_mmap(Machine& m) {
         constexpr uint64_t ARENA_LIMIT = (1ULL << riscv::encompassing_Nbit_arena);
 
         // Single bump pointer synced with mmap_address()
-        static uint64_t our_bump = 0;
+        uint64_t& our_bump = g_mmap_bump;
         uint64_t cur_mmap_addr = m.memory.mmap_address();
         if (our_bump == 0 || our_bump < cur_mmap_addr) {
             our_bump = cur_mmap_addr;
@@ -1606,6 +1929,7 @@ static void sys_mmap(Machine& m) {
         }
 
         // Zero-fill anonymous pages
+        pagecache::release(m, result, aligned_len);
         if (!(flags & MAP_FIXED)) {
             if constexpr (riscv::encompassing_Nbit_arena != 0) {
                 auto* arena = (uint8_t*)m.memory.memory_arena_ptr();
@@ -1619,6 +1943,8 @@ static void sys_mmap(Machine& m) {
             }
         }
 
+        prelink::clobber(result, aligned_len);
+        execcache::note_map(result, aligned_len, prot, false);
         m.set_result(result);
         maybe_preempt(m);
         return;
@@ -1656,7 +1982,17 @@ static void sys_mmap(Machine& m) {
     auto& nextfree = m.memory.mmap_address();
     uint64_t dst;
 
-    if (addr_g == 0) {
+    // A library listed in the image's prelink manifest goes to its own base
+    auto* lib = prelink::find(*ctx->fs, entry);
+    uint64_t prelinked = 0;
+    if (lib && addr_g == 0 && offset == 0) {
+        prelinked = prelink::place(*lib, length, prelink_busy(m));
+        if (prelinked) execcache::note_prelinked(fd_path, prelinked);
+    }
+
+    if (prelinked) {
+        dst = prelinked;
+    } else if (addr_g == 0) {
         if constexpr (riscv::encompassing_Nbit_arena > 0) {
             if (nextfree + length > riscv::encompassing_arena_mask) {
                 m.set_result(uint64_t(-12));
@@ -1684,25 +2020,37 @@ static void sys_mmap(Machine& m) {
         dst = addr_g;
     }
 
+    // The library's own mapping at its base (ld-musl's first mmap or a
+    // segment remap) skips whatever of its text is still in place there
+    bool natural = lib && lib->live && dst == lib->base + offset &&
+                   dst + length <= lib->base + lib->span;
+    uint64_t keep = natural ? prelink::resident_prefix(*lib, offset, length) : 0;
+    if (!natural) prelink::clobber(dst, length);
+
     riscv::PageAttributes rw_attr;
     rw_attr.read = true;
     rw_attr.write = true;
-    m.memory.set_page_attr(dst, length, rw_attr);
+    pageattr::set(m.memory, dst, length, rw_attr);
 
-    m.memory.memdiscard(dst, length, true);
+    pagecache::release(m, dst + keep, length - keep);
+    m.memory.memdiscard(dst + keep, length - keep, true);
 
+    // Shares the file's host pages with every other mapping of it
     const auto& content = entry->content;
-    if (offset < content.size()) {
-        size_t avail = content.size() - offset;
-        size_t to_copy = std::min((size_t)length, avail);
-        m.memory.memcpy(dst, content.data() + offset, to_copy);
+    if (offset + keep < content.size()) {
+        size_t avail = content.size() - offset - keep;
+        size_t to_copy = std::min((size_t)(length - keep), avail);
+        pagecache::populate(m, entry, dst + keep, offset + keep, to_copy);
     }
+    if (natural) prelink::mapped(*lib, offset, length, keep);
 
     riscv::PageAttributes attr;
     attr.read  = (prot & 1) != 0;
     attr.write = (prot & 2) != 0;
     attr.exec  = (prot & 4) != 0;
-    m.memory.set_page_attr(dst, length, attr);
+    pageattr::set(m.memory, dst, length, attr);
+    execcache::note_map(dst, length, prot, true);
+    execcache::note_lib(fd_path, entry);
 
     m.set_result(dst);
     std::cerr << "[mmap] => 0x" << std::hex << dst << std::dec
@@ -1721,18 +2069,33 @@ static void sys_mprotect(Machine& m) {
         fprintf(stderr, "[mprotect] addr=0x%lx len=0x%lx prot=%d pc=0x%lx\n",
                 (long)addr, (long)len, prot, (long)m.cpu.pc());
 
+    // Text made writable (DT_TEXTREL) may not stay what the file holds
+    if (prot & 2) prelink::clobber(addr, len);
+
     if (addr >= m.memory.mmap_start()) {
         riscv::PageAttributes attr;
         attr.read = (prot & 1) != 0;
         attr.write = (prot & 2) != 0;
         attr.exec = (prot & 4) != 0;
-        m.memory.set_page_attr(addr, len, attr);
+        pageattr::set(m.memory, addr, len, attr);
+        execcache::note_protect(addr, len, prot);
     }
     m.set_result(0);
 }
 
-static void sys_sigaction(Machine& m) { m.set_result(0); }
-static void sys_sigprocmask(Machine& m) { m.set_result(0); }
+// rt_sigaction / rt_sigprocmask (signals.hpp). Unblocking a pending signal
+// delivers it as the call returns.
+static void sys_sigaction(Machine& m) {
+    m.set_result(signals::sigaction(m, g_sched.threads[g_sched.current].sig,
+                                    m.template sysarg<int>(0), m.sysarg(1), m.sysarg(2),
+                                    m.sysarg(3)));
+}
+static void sys_sigprocmask(Machine& m) {
+    m.set_result(signals::sigprocmask(m, g_sched.threads[g_sched.current].sig,
+                                      m.template sysarg<int>(0), m.sysarg(1), m.sysarg(2),
+                                      m.sysarg(3)));
+    deliver_signals(m);
+}
 static void sys_prlimit64(Machine& m) {
     unsigned int resource = m.template sysarg<unsigned int>(1);
     auto new_rlim_addr = m.sysarg(2);
@@ -1788,7 +2151,7 @@ static void sys_sendfile(Machine& m) {
 
     // Read from in_fd
     if (count > 65536) count = 65536;  // cap single transfer
-    std::vector<uint8_t> buf(count);
+    iobuf::Buffer buf(count);
 
     // Handle offset if provided
     if (offset_ptr != 0) {
@@ -1862,6 +2225,11 @@ static void sys_ioctl(Machine& m) {
 
     // FIONBIO - set non-blocking mode (libuv uses this on pipes/sockets)
     if (request == 0x5421) {
+        if (net_is_socket_fd && net_is_socket_fd(fd) && net_set_nonblocking) {
+            int32_t on = 0;
+            m.memory.memcpy_out(&on, m.sysarg(2), sizeof(on));
+            net_set_nonblocking(fd, on != 0);
+        }
         m.set_result(0);
         return;
     }
@@ -1875,18 +2243,37 @@ static void sys_fcntl(Machine& m) {
     int fd = m.template sysarg<int>(0);
     int cmd = m.template sysarg<int>(1);
 
-    bool valid = (fd >= 0 && fd <= 2) || fs.is_open(fd);
-    if (!valid) {
-        m.set_result(err::BADF);
-        return;
-    }
-
     constexpr int FCNTL_DUPFD = 0;
     constexpr int FCNTL_GETFD = 1;
     constexpr int FCNTL_SETFD = 2;
     constexpr int FCNTL_GETFL = 3;
     constexpr int FCNTL_SETFL = 4;
     constexpr int FCNTL_DUPFD_CLOEXEC = 1030;
+    constexpr int FCNTL_O_RDWR = 02;
+    constexpr int FCNTL_O_NONBLOCK = 04000;
+
+    // Sockets live in the network layer; only their O_NONBLOCK is tracked
+    if (net_is_socket_fd && net_is_socket_fd(fd)) {
+        bool nonblocking = net_is_nonblocking && net_is_nonblocking(fd);
+        if (cmd == FCNTL_GETFL) {
+            m.set_result(FCNTL_O_RDWR | (nonblocking ? FCNTL_O_NONBLOCK : 0));
+        } else if (cmd == FCNTL_SETFL) {
+            int flags = m.template sysarg<int>(2);
+            if (net_set_nonblocking) net_set_nonblocking(fd, (flags & FCNTL_O_NONBLOCK) != 0);
+            m.set_result(0);
+        } else if (cmd == FCNTL_DUPFD || cmd == FCNTL_DUPFD_CLOEXEC) {
+            m.set_result(err::INVAL);
+        } else {
+            m.set_result(0);
+        }
+        return;
+    }
+
+    bool valid = (fd >= 0 && fd <= 2) || fs.is_open(fd);
+    if (!valid) {
+        m.set_result(err::BADF);
+        return;
+    }
 
     switch (cmd) {
         case FCNTL_DUPFD:
@@ -1969,7 +2356,7 @@ static void sys_readv(Machine& m) {
             uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
             uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
             if (len > 0) {
-                std::vector<uint8_t> buf(len);
+                iobuf::Buffer buf(len);
                 ssize_t n = fs.read(fd, buf.data(), len);
                 if (n < 0) {
                     m.set_result(total > 0 ? (int64_t)total : n);
@@ -2007,7 +2394,8 @@ static void sys_readv(Machine& m) {
             uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
             uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
             if (len > 0) {
-                std::vector<uint8_t> tmp(len);
+                len = std::min<uint64_t>(len, iobuf::MAX_POOLED_SIZE);
+                iobuf::Buffer tmp(len);
                 int bytes_read = android_io::try_read_stdin(tmp.data(), len);
                 if (bytes_read > 0) {
                     m.memory.memcpy(base, tmp.data(), bytes_read);
@@ -2025,7 +2413,7 @@ static void sys_readv(Machine& m) {
         uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
         uint64_t len = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
         if (len > 0) {
-            std::vector<uint8_t> buf(len);
+            iobuf::Buffer buf(len);
             ssize_t n = fs.read(fd, buf.data(), len);
             if (n < 0) {
                 m.set_result(total > 0 ? (int64_t)total : n);
@@ -2048,7 +2436,7 @@ static void sys_pread64(Machine& m) {
     size_t count = m.sysarg(2);
     uint64_t offset = m.sysarg(3);
 
-    std::vector<uint8_t> buf(count);
+    iobuf::Buffer buf(count);
     ssize_t n = fs.pread(fd, buf.data(), count, offset);
     if (n > 0) {
         m.memory.memcpy(buf_addr, buf.data(), n);
@@ -2063,9 +2451,9 @@ static void sys_pwrite64(Machine& m) {
     size_t count = m.sysarg(2);
     uint64_t offset = m.sysarg(3);
 
-    std::vector<uint8_t> buf(count);
-    m.memory.memcpy_out(buf.data(), buf_addr, count);
-    ssize_t n = fs.pwrite(fd, buf.data(), count, offset);
+    ssize_t n = with_guest_bytes(m, buf_addr, count, [&](const uint8_t* p) {
+        return fs.pwrite(fd, p, count, offset);
+    });
     m.set_result(n);
 }
 
@@ -2327,6 +2715,9 @@ static void sys_epoll_ctl(Machine& m) {
     }
 }
 
+// Longest a blocking epoll_pwait holds the host thread at a time
+constexpr int EPOLL_SLICE_MS = 50;
+
 static void sys_epoll_pwait(Machine& m) {
     int epfd = m.template sysarg<int>(0);
     auto events_addr = m.sysarg(1);
@@ -2358,7 +2749,12 @@ static void sys_epoll_pwait(Machine& m) {
                 revents |= 0x04;
         } else if (fs.is_open(fd)) {
             auto entry = fs.get_entry(fd);
-            if (entry && entry->type == vfs::FileType::Fifo) {
+            if (is_eventfd(fs, fd)) {
+                if ((interest.events & 0x01) && eventfd_count(*entry) > 0)
+                    revents |= 0x01;
+                if (interest.events & 0x04)
+                    revents |= 0x04;
+            } else if (entry && entry->type == vfs::FileType::Fifo) {
                 if ((interest.events & 0x01) && entry->content.size() > 0)
                     revents |= 0x01;
                 if (interest.events & 0x04)
@@ -2417,9 +2813,34 @@ static void sys_epoll_pwait(Machine& m) {
                 }
             }
         }
+        // Another guest thread may be what makes an fd ready (an eventfd
+        // or pipe write, Go's netpoll break): let it run, and re-enter this
+        // call when the scheduler comes back to this thread
+        if (g_sched.count > 1) {
+            int next = g_sched.next_runnable(g_sched.current);
+            if (next >= 0) {
+                m.cpu.increment_pc(-4);
+                switch_to_thread(m, next);
+                return;
+            }
+        }
+        // Otherwise block on the host, but only for a slice, so that timed
+        // waits of other threads still expire on time
+        int wait_ms = timeout < 0 ? EPOLL_SLICE_MS : std::min(timeout, EPOLL_SLICE_MS);
+        uint64_t wake_at = g_sched.count > 1 ? g_sched.earliest_wake() : 0;
+        if (wake_at) {
+            uint64_t now = now_ns();
+            wait_ms = static_cast<int>(std::min<uint64_t>(
+                wait_ms, wake_at > now ? (wake_at - now + 999'999) / 1'000'000 : 0));
+        }
+        if (pfds.empty() && (timeout > 0 || wake_at)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+            if (timeout < 0) m.cpu.increment_pc(-4);   // Infinite: wait again
+            else m.set_result(0);
+            return;
+        }
         if (!pfds.empty()) {
-            int poll_timeout = timeout;
-            int ret = ::poll(pfds.data(), pfds.size(), poll_timeout);
+            int ret = ::poll(pfds.data(), pfds.size(), wait_ms);
             if (ret > 0) {
                 for (size_t i = 0; i < pfds.size() && ready < maxevents; i++) {
                     uint32_t revents2 = 0;
@@ -2435,6 +2856,10 @@ static void sys_epoll_pwait(Machine& m) {
                     }
                 }
             }
+            if (ready == 0 && timeout < 0) {
+                m.cpu.increment_pc(-4);   // Infinite: poll again
+                return;
+            }
             m.set_result(ready);
             return;
         }
@@ -2468,46 +2893,48 @@ static void sys_futex(Machine& m) {
             return;
         }
 
+        // Timeout: relative for FUTEX_WAIT, absolute for FUTEX_WAIT_BITSET
+        // (every guest clock reads CLOCK_REALTIME, see sys_clock_gettime)
+        uint64_t deadline = 0;
+        if (auto ts_addr = m.sysarg(3)) {
+            int64_t ns = m.memory.template read<int64_t>(ts_addr) * 1'000'000'000 +
+                         m.memory.template read<int64_t>(ts_addr + 8);
+            if (cmd == FUTEX_WAIT_BITSET) {
+                struct timespec now;
+                clock_gettime(CLOCK_REALTIME, &now);
+                ns -= int64_t(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+            }
+            if (ns <= 0) {
+                m.set_result(err::TIMEDOUT);
+                return;
+            }
+            deadline = resume_deadline(m, now_ns() + static_cast<uint64_t>(ns));
+        }
+
         // Cooperative scheduling: if another thread is runnable, switch to it.
         if (g_sched.count > 1) {
             auto& cur = g_sched.threads[g_sched.current];
-            cur.waiting = true;
             cur.futex_addr = uaddr;
             cur.futex_val = expected;
             m.set_result(0);
-
-            int next = g_sched.next_runnable(g_sched.current);
-            if (next >= 0) {
-                static int switch_count = 0;
-                if (++switch_count <= 50)
-                    fprintf(stderr, "[futex] WAIT switch t%d->t%d addr=0x%lx exp=0x%x\n",
-                            g_sched.current, next, (long)uaddr, (unsigned)expected);
-                switch_to_thread(m, next);
-                return;
-            }
-            // All threads waiting — cooperative deadlock. Force-wake a sleeping
-            // thread so it can observe any shutdown signals written to memory.
-            for (int i = 0; i < MAX_VTHREADS; i++) {
-                if (i != g_sched.current && g_sched.threads[i].active && g_sched.threads[i].waiting) {
-                    g_sched.threads[i].waiting = false;
-                    static int deadlock_count = 0;
-                    if (++deadlock_count <= 50)
-                        fprintf(stderr, "[futex] deadlock-break: force-wake t%d, switch from t%d\n",
-                                i, g_sched.current);
-                    switch_to_thread(m, i);
-                    return;
-                }
-            }
-            // Truly no other threads — fall through
-            cur.waiting = false;
+            if (wait_current(m, deadline, err::TIMEDOUT, uaddr)) return;
         }
 
-        // Fallback: no cooperative threads (all exited).
+        // Fallback: no cooperative threads (all exited). Nothing can wake
+        // this thread but its timeout.
         static int futex_wait_count = 0;
         if (++futex_wait_count <= 50) {
             fprintf(stderr, "[futex] WAIT fallback addr=0x%lx exp=0x%x actual=0x%x count=%d\n",
                     (long)uaddr, (unsigned)expected, (unsigned)actual, g_sched.count);
         }
+        if (deadline) {
+            if (!guestwait::sleep_until(deadline)) {
+                interrupt_wait(m, uaddr, deadline);
+                return;
+            }
+            m.set_result(err::TIMEDOUT);
+            return;
+        }
         if (g_sched.count <= 1) {
             m.set_result(-11);  // -EAGAIN
             return;
@@ -2664,19 +3091,22 @@ static void sys_nanosleep(Machine& m) {
 
     int64_t tv_sec = m.memory.template read<int64_t>(req_addr);
     int64_t tv_nsec = m.memory.template read<int64_t>(req_addr + 8);
-    int ms = static_cast<int>(tv_sec * 1000 + tv_nsec / 1000000);
-    if (ms < 1) ms = 1;
+    uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(tv_sec * 1'000'000'000 + tv_nsec, 0));
+    uint64_t start = now_ns();
+    uint64_t deadline = resume_deadline(m, start + ns);
 
-    // Cooperative scheduling: nanosleep is a natural yield point
+    // Cooperative scheduling: other threads run while this one sleeps
     if (g_sched.count > 1) {
-        int next = g_sched.next_runnable(g_sched.current);
-        if (next >= 0) {
-            switch_to_thread(m, next);
-            return;
-        }
+        g_sched.threads[g_sched.current].futex_addr = 0;
+        m.set_result(0);
+        if (wait_current(m, deadline, 0, req_addr)) return;
     }
 
-    usleep(static_cast<useconds_t>(ms) * 1000);
+    // At least 1ms; interruptible, so a pause never waits out a long sleep
+    if (!guestwait::sleep_until(std::max<uint64_t>(deadline, start + 1'000'000))) {
+        interrupt_wait(m, req_addr, deadline);
+        return;
+    }
     m.set_result(0);
 }
 
@@ -2713,6 +3143,8 @@ static void sys_munmap(Machine& m) {
     auto addr = m.sysarg(0);
     auto len  = m.sysarg(1);
     uint64_t aligned_len = (len + 4095) & ~4095ULL;
+    prelink::clobber(addr, aligned_len);
+    pagecache::release(m, addr, aligned_len);
 
     // Zero the region to prevent stale data
     if constexpr (riscv::encompassing_Nbit_arena != 0) {
@@ -2731,7 +3163,8 @@ static void sys_eventfd2(Machine& m) {
     entry->mode = 0600;
     entry->size = 0;
     entry->content.resize(8, 0);
-    int fd = fs.open_pipe(entry, 0);
+    eventfd_set(*entry, m.template sysarg<uint32_t>(0));
+    int fd = fs.open_pipe(entry, 0, EVENTFD_PATH);
     fprintf(stderr, "[eventfd2] => fd=%d\n", fd);
     m.set_result(fd);
 }
@@ -2750,9 +3183,14 @@ static void sys_sched_getparam(Machine& m) {
 }
 
 static void sys_sched_getaffinity(Machine& m) {
+    auto cpusetsize = m.sysarg(1);
     auto mask_addr = m.sysarg(2);
-    // Write 1-bit CPU mask (1 core)
-    uint64_t mask = 1;
+    if (cpusetsize < 8) {
+        m.set_result(err::INVAL);
+        return;
+    }
+    // One bit per guest CPU: this is where Go takes GOMAXPROCS from
+    uint64_t mask = (1ull << GUEST_CPUS) - 1;
     m.memory.template write<uint64_t>(mask_addr, mask);
     m.set_result(8);  // Return size of mask in bytes
 }
@@ -2797,8 +3235,8 @@ static void sys_getresgid(Machine& m) {
 }
 
 static void sys_sigaltstack(Machine& m) {
-    // Accept silently — we don't deliver signals, so alternate stack is unused
-    m.set_result(0);
+    m.set_result(signals::sigaltstack(m, g_sched.threads[g_sched.current].sig,
+                                      m.sysarg(0), m.sysarg(1)));
 }
 
 static void sys_clock_getres(Machine& m) {
@@ -2875,7 +3313,7 @@ static void sys_recvmsg(Machine& m) {
         uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
         uint64_t len  = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
         if (len > 0) {
-            std::vector<uint8_t> buf(len);
+            iobuf::Buffer buf(len);
             ssize_t n = fs.read(fd, buf.data(), len);
             if (n < 0) {
                 m.set_result(total > 0 ? (int64_t)total : n);
@@ -2910,6 +3348,7 @@ static void sys_fchmod(Machine& m) {
     uint32_t mode = m.template sysarg<uint32_t>(1);
     auto entry = fs.get_entry(fd);
     if (!entry) { m.set_result(err::BADF); return; }
+    fs.touch(entry);
     entry->mode = mode & 07777;
     m.set_result(0);
 }
@@ -2925,6 +3364,7 @@ static void sys_fchmodat(Machine& m) {
     catch (...) { m.set_result(err::INVAL); return; }
     auto entry = fs.resolve(path);
     if (!entry) { m.set_result(err::NOENT); return; }
+    fs.touch(entry);
     entry->mode = mode & 07777;
     m.set_result(0);
 }
@@ -2932,23 +3372,80 @@ static void sys_fchmodat(Machine& m) {
 static void sys_fchownat(Machine& m) { m.set_result(0); }
 static void sys_getgroups(Machine& m) { m.set_result(0); }
 
+// Scheduler slot of guest thread `tid`, or -1. The main thread keeps
+// answering to tid 1, what gettid() returned before any clone.
+static int thread_slot(int tid) {
+    if (tid == 1) return 0;
+    for (int i = 0; i < MAX_VTHREADS; i++) {
+        if (g_sched.threads[i].active && g_sched.threads[i].tid == tid) return i;
+    }
+    return -1;
+}
+
+// Queue `sig` for the thread in `slot`; a thread signalling itself enters
+// the handler as this syscall returns
+static void signal_thread(Machine& m, int slot, int sig) {
+    m.set_result(0);
+    if (sig == 0) return;   // Existence probe
+    if (signals::raise(g_sched.threads[slot].sig, sig) && slot == g_sched.current) {
+        deliver_signals(m);
+    }
+}
+
 static void sys_kill(Machine& m) {
     int pid = m.template sysarg<int>(0);
     int sig = m.template sysarg<int>(1);
-    if (pid <= 1 || pid == 100) {
-        m.set_result(0);
+    if (sig < 0 || sig > signals::NSIG) {
+        m.set_result(err::INVAL);
+    } else if (pid == 100) {
+        m.set_result(0);   // The emulated fork child: already gone or about to be
+    } else if (pid <= 1) {
+        // This process: the running thread unless it blocks the signal
+        int slot = g_sched.current;
+        if (sig && (g_sched.threads[slot].sig.blocked & signals::bit(sig))) {
+            for (int i = 0; i < MAX_VTHREADS; i++) {
+                if (g_sched.threads[i].active &&
+                    !(g_sched.threads[i].sig.blocked & signals::bit(sig))) {
+                    slot = i;
+                    break;
+                }
+            }
+        }
+        signal_thread(m, slot, sig);
     } else {
         m.set_result(-3);  // -ESRCH
     }
 }
 
 static void sys_tkill(Machine& m) {
+    int tid = m.template sysarg<int>(0);
     int sig = m.template sysarg<int>(1);
     if (sig == 6) { // SIGABRT
         fprintf(stderr, "[ABORT] tkill(SIGABRT)! PC=0x%lx RA=0x%lx SP=0x%lx\n",
                 (long)m.cpu.pc(), (long)m.cpu.reg(1), (long)m.cpu.reg(2));
     }
-    m.set_result(0);
+    int slot = thread_slot(tid);
+    if (sig < 0 || sig > signals::NSIG) {
+        m.set_result(err::INVAL);
+    } else if (slot < 0) {
+        m.set_result(-3);  // -ESRCH
+    } else {
+        signal_thread(m, slot, sig);
+    }
+}
+
+// tgkill(tgid, tid, sig) — how Go's sysmon preempts a thread (SIGURG)
+static void sys_tgkill(Machine& m) {
+    int tid = m.template sysarg<int>(1);
+    int sig = m.template sysarg<int>(2);
+    int slot = thread_slot(tid);
+    if (sig < 0 || sig > signals::NSIG) {
+        m.set_result(err::INVAL);
+    } else if (slot < 0) {
+        m.set_result(-3);  // -ESRCH
+    } else {
+        signal_thread(m, slot, sig);
+    }
 }
 
 static void sys_sched_yield(Machine& m) {
@@ -2961,7 +3458,11 @@ static void sys_sched_yield(Machine& m) {
     }
 }
 
-static void sys_rt_sigreturn(Machine& m) { m.set_result(0); }
+// Back from a handler: resume the frame's context (and the next pending signal)
+static void sys_rt_sigreturn(Machine& m) {
+    signals::sigreturn(m, g_sched.threads[g_sched.current].sig);
+    deliver_signals(m);
+}
 
 static void sys_pwritev(Machine& m) {
     auto& fs = get_fs(m);
@@ -3026,9 +3527,9 @@ static void sys_sendmsg(Machine& m) {
         uint64_t base = m.memory.template read<uint64_t>(iov_addr + i * 16);
         uint64_t len  = m.memory.template read<uint64_t>(iov_addr + i * 16 + 8);
         if (len > 0) {
-            std::vector<uint8_t> buf(len);
-            m.memory.memcpy_out(buf.data(), base, len);
-            ssize_t n = fs.write(fd, buf.data(), len);
+            ssize_t n = with_guest_bytes(m, base, len, [&](const uint8_t* p) {
+                return fs.write(fd, p, len);
+            });
             if (n < 0) {
                 m.set_result(total > 0 ? (int64_t)total : n);
                 return;
@@ -3051,6 +3552,7 @@ static void sys_brk(Machine& m) {
         // heap memory (page allocation, heap pointer tracking, etc.)
         if (libriscv_brk_handler) {
             libriscv_brk_handler(m);
+            execcache::note_brk(m.template return_value<uint64_t>());
             return;
         }
         // Fallback if no built-in handler saved
@@ -3077,10 +3579,11 @@ static void sys_brk(Machine& m) {
         uint64_t len = new_end - start;
         riscv::PageAttributes rw;
         rw.read = true; rw.write = true;
-        m.memory.set_page_attr(start, len, rw);
+        pageattr::set(m.memory, start, len, rw);
     }
 
     g_exec_ctx.brk_current = new_end;
+    execcache::note_brk(new_end);
     m.set_result(new_end);
 }
 
@@ -3098,6 +3601,17 @@ static void sys_riscv_hwprobe(Machine& m) {
     m.set_result(-38);  // -ENOSYS
 }
 
+// friscy-private: ld-musl jumped to AT_ENTRY, which execve (or boot, for
+// the boot trace) pointed at the exec cache stub. sp is still the initial stack (musl's CRTJMP), and the
+// registers are left as ld-musl set them.
+static void sys_exec_entry_stub(Machine& m) {
+    boottrace::mark("entry");
+    uint64_t entry = g_exec_ctx.exec_info.entry_point;
+    execcache::capture(m, entry, m.cpu.reg(riscv::REG_SP),
+                       std::max(m.memory.mmap_address(), g_mmap_bump));
+    m.cpu.jump(entry);
+}
+
 // Install all syscall handlers
 inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     // Create and store context
@@ -3215,7 +3729,7 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     machine.install_syscall_handler(nr::getgroups, sys_getgroups);
     machine.install_syscall_handler(nr::kill, sys_kill);
     machine.install_syscall_handler(nr::tkill, sys_tkill);
-    machine.install_syscall_handler(nr::tgkill, sys_tkill);  // same as tkill
+    machine.install_syscall_handler(nr::tgkill, sys_tgkill);
     machine.install_syscall_handler(nr::sched_yield, sys_sched_yield);
     machine.install_syscall_handler(nr::close_range, sys_close_range);
     machine.install_syscall_handler(nr::rt_sigreturn, sys_rt_sigreturn);
@@ -3226,6 +3740,239 @@ inline void install_syscalls(Machine& machine, vfs::VirtualFS& fs) {
     // Round 4: Node.js startup
     machine.install_syscall_handler(nr::getsockopt, sys_getsockopt);
     machine.install_syscall_handler(nr::riscv_hwprobe, sys_riscv_hwprobe);
+    machine.install_syscall_handler(execcache::SYS_ENTRY_STUB, sys_exec_entry_stub);
+}
+
+// ============================================================================
+// Snapshot state
+// ============================================================================
+//
+// Everything above that lives outside guest memory: exec context, threads,
+// fork emulation, tty, epoll and the mmap bump pointer. libriscv's built-in
+// brk is stateless (it clamps to the heap area) and g_exec_ctx carries the
+// brk once execve has taken over, so the memory layout is fully covered.
+// Binaries are stored as a VFS path when the file there is unchanged, so
+// the blob is usually a few KB.
+
+inline void save_binary(serial::Writer& w, vfs::VirtualFS& fs, const std::string& path,
+                        const elfcache::BlobRef& blob) {
+    bool by_path = !path.empty() && elfcache::current(fs, blob);
+    w.u8(by_path ? 0 : 1);
+    w.str(path);
+    if (!by_path) w.bytes(blob ? blob->bytes : std::vector<uint8_t>{});
+}
+
+inline bool load_binary(serial::Reader& r, vfs::VirtualFS& fs, std::string& path,
+                        elfcache::BlobRef& blob) {
+    bool by_path = r.u8() == 0;
+    path = r.str();
+    if (!by_path) {
+        auto bytes = r.bytes();
+        if (!bytes.empty()) blob = elfcache::adopt(path, std::move(bytes));
+        return r.ok();
+    }
+    blob = elfcache::get(fs, path);
+    if (!blob) {
+        fprintf(stderr, "[snapshot] Binary %s missing from restored VFS\n", path.c_str());
+        return false;
+    }
+    return r.ok();
+}
+
+inline void save_region(serial::Writer& w, const ForkState::MemRegion& region) {
+    w.bytes(region.data);
+    w.u64(region.addr);
+    w.u64(region.size);
+}
+
+inline void load_region(serial::Reader& r, ForkState::MemRegion& region) {
+    region.data = r.bytes();
+    region.addr = r.u64();
+    region.size = r.u64();
+}
+
+// Call with the VFS state already saved/restored: binaries resolve through it.
+inline void save_state(serial::Writer& w, Machine& m, vfs::VirtualFS& fs) {
+    const auto& ec = g_exec_ctx;
+    save_binary(w, fs, ec.exec_path, ec.exec_blob);
+    save_binary(w, fs, ec.interp_path, ec.interp_blob);
+    const auto& ei = ec.exec_info;
+    w.u64(ei.entry_point);
+    w.u64(ei.phdr_addr);
+    w.u32(ei.phdr_size);
+    w.u32(ei.phdr_count);
+    w.u64(ei.base_addr);
+    w.u8(ei.is_dynamic);
+    w.str(ei.interpreter);
+    w.u32(ei.type);
+    for (uint64_t v : {ec.exec_base, ec.exec_rw_start, ec.exec_rw_end, ec.interp_base,
+                       ec.interp_rw_start, ec.interp_rw_end, ec.interp_entry,
+                       ec.original_stack_top, ec.heap_start, ec.heap_size,
+                       ec.brk_base, ec.brk_current}) {
+        w.u64(v);
+    }
+    w.u8(ec.brk_overridden);
+    w.u8(ec.dynamic);
+    w.u32(static_cast<uint32_t>(ec.env.size()));
+    for (const auto& e : ec.env) w.str(e);
+
+    // Threads: VThread is plain data, stored raw with its size as a guard
+    w.u32(sizeof(g_sched.threads));
+    w.raw(g_sched.threads, sizeof(g_sched.threads));
+    w.i32(g_sched.current);
+    w.i32(g_sched.count);
+
+    w.raw(g_fork.regs, sizeof(g_fork.regs));
+    w.u64(g_fork.pc);
+    w.i32(g_fork.exit_status);
+    w.i32(g_fork.child_pid);
+    w.u8(g_fork.in_child);
+    w.u8(g_fork.child_reaped);
+    save_region(w, g_fork.exec_data);
+    save_region(w, g_fork.interp_data);
+    save_region(w, g_fork.stack_data);
+    save_region(w, g_fork.mmap_data);
+    w.u32(static_cast<uint32_t>(g_fork.parent_open_fds.size()));
+    for (int fd : g_fork.parent_open_fds) w.i32(fd);
+    w.i32(g_next_pid);
+
+    uint8_t termios[44];
+    g_termios.serialize(termios);
+    w.raw(termios, sizeof(termios));
+    w.u32(static_cast<uint32_t>(g_tty_fds.size()));
+    for (int fd : g_tty_fds) w.i32(fd);
+
+    w.u32(static_cast<uint32_t>(handlers::g_epoll_instances.size()));
+    for (const auto& [epfd, inst] : handlers::g_epoll_instances) {
+        w.i32(epfd);
+        w.u32(static_cast<uint32_t>(inst.interests.size()));
+        for (const auto& [fd, interest] : inst.interests) {
+            w.i32(fd);
+            w.u32(interest.events);
+            w.u64(interest.data);
+        }
+    }
+    w.i32(handlers::g_next_epoll_fd);
+
+    w.u64(g_mmap_bump);
+    w.u64(m.memory.mmap_address());
+    prelink::save_state(w);
+
+    w.u32(sizeof(signals::g_actions));
+    w.raw(signals::g_actions, sizeof(signals::g_actions));
+    w.raw(signals::g_parent_actions, sizeof(signals::g_parent_actions));
+    w.raw(&signals::g_parent_thread, sizeof(signals::g_parent_thread));
+    pageattr::save(w);
+}
+
+inline bool load_state(serial::Reader& r, Machine& m, vfs::VirtualFS& fs) {
+    ExecContext ec;
+    if (!load_binary(r, fs, ec.exec_path, ec.exec_blob) ||
+        !load_binary(r, fs, ec.interp_path, ec.interp_blob)) {
+        return false;
+    }
+    auto& ei = ec.exec_info;
+    ei.entry_point = r.u64();
+    ei.phdr_addr = r.u64();
+    ei.phdr_size = static_cast<uint16_t>(r.u32());
+    ei.phdr_count = static_cast<uint16_t>(r.u32());
+    ei.base_addr = r.u64();
+    ei.is_dynamic = r.u8() != 0;
+    ei.interpreter = r.str();
+    ei.type = static_cast<uint16_t>(r.u32());
+    for (uint64_t* v : {&ec.exec_base, &ec.exec_rw_start, &ec.exec_rw_end, &ec.interp_base,
+                        &ec.interp_rw_start, &ec.interp_rw_end, &ec.interp_entry,
+                        &ec.original_stack_top, &ec.heap_start, &ec.heap_size,
+                        &ec.brk_base, &ec.brk_current}) {
+        *v = r.u64();
+    }
+    ec.brk_overridden = r.u8() != 0;
+    ec.dynamic = r.u8() != 0;
+    uint32_t n_env = r.u32();
+    for (uint32_t i = 0; i < n_env && r.ok(); i++) ec.env.push_back(r.str());
+
+    ThreadScheduler sched;
+    if (r.u32() != sizeof(sched.threads)) return false;
+    r.raw(sched.threads, sizeof(sched.threads));
+    sched.current = r.i32();
+    sched.count = r.i32();
+    if (sched.current < 0 || sched.current >= MAX_VTHREADS ||
+        sched.count < 0 || sched.count > MAX_VTHREADS) {
+        return false;
+    }
+
+    ForkState fork{};
+    r.raw(fork.regs, sizeof(fork.regs));
+    fork.pc = r.u64();
+    fork.exit_status = r.i32();
+    fork.child_pid = r.i32();
+    fork.in_child = r.u8() != 0;
+    fork.child_reaped = r.u8() != 0;
+    load_region(r, fork.exec_data);
+    load_region(r, fork.interp_data);
+    load_region(r, fork.stack_data);
+    load_region(r, fork.mmap_data);
+    uint32_t n_fds = r.u32();
+    for (uint32_t i = 0; i < n_fds && r.ok(); i++) fork.parent_open_fds.insert(r.i32());
+    pid_t next_pid = r.i32();
+
+    uint8_t termios[44];
+    r.raw(termios, sizeof(termios));
+    std::set<int> tty_fds;
+    uint32_t n_tty = r.u32();
+    for (uint32_t i = 0; i < n_tty && r.ok(); i++) tty_fds.insert(r.i32());
+
+    std::unordered_map<int, handlers::EpollInstance> epoll;
+    uint32_t n_epoll = r.u32();
+    for (uint32_t i = 0; i < n_epoll && r.ok(); i++) {
+        auto& inst = epoll[r.i32()];
+        uint32_t n_interests = r.u32();
+        for (uint32_t j = 0; j < n_interests && r.ok(); j++) {
+            int fd = r.i32();
+            uint32_t events = r.u32();
+            inst.interests[fd] = {events, r.u64()};
+        }
+    }
+    int next_epoll_fd = r.i32();
+
+    uint64_t mmap_bump = r.u64();
+    uint64_t mmap_address = r.u64();
+    auto prelinked = prelink::read_state(r);
+    signals::Action actions[signals::NSIG], parent_actions[signals::NSIG];
+    signals::Thread parent_thread;
+    if (r.u32() != sizeof(actions)) return false;
+    r.raw(actions, sizeof(actions));
+    r.raw(parent_actions, sizeof(parent_actions));
+    r.raw(&parent_thread, sizeof(parent_thread));
+    std::vector<pageattr::Range> attrs;
+    pageattr::read(r, attrs);
+    if (!r.ok()) return false;
+
+    // Deadlines are on the saving process's clock: let them expire now
+    for (auto& t : sched.threads) {
+        if (t.waiting && t.wake_at) t.wake_at = 1;
+    }
+
+    // Commit only once everything parsed
+    g_exec_ctx = std::move(ec);
+    g_sched = sched;
+    g_fork = std::move(fork);
+    g_next_pid = next_pid;
+    g_termios.deserialize(termios);
+    g_tty_fds = std::move(tty_fds);
+    handlers::g_epoll_instances = std::move(epoll);
+    handlers::g_next_epoll_fd = next_epoll_fd;
+    g_mmap_bump = mmap_bump;
+    m.memory.mmap_address() = mmap_address;
+    g_execve_restart = false;
+    execcache::g_capture = {};
+    prelink::apply_state(fs, prelinked);
+    pagecache::reset();
+    std::memcpy(signals::g_actions, actions, sizeof(actions));
+    std::memcpy(signals::g_parent_actions, parent_actions, sizeof(parent_actions));
+    signals::g_parent_thread = parent_thread;
+    pageattr::apply(m.memory, attrs);
+    return true;
 }
 
 }  // namespace syscalls
\ No newline at end of file
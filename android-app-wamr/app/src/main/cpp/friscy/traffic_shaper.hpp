@@ -0,0 +1,635 @@
+// traffic_shaper.hpp - Bandwidth/latency/loss shaping for guest sockets
+//
+// Reproduces mobile-network conditions for guest workloads. Shaping is
+// applied on the host side of the socket bridge, so the guest sees a normal
+// socket whose data simply arrives later and slower.
+//
+// TCP: when a guest stream socket connects (or is accepted) and its peer
+// matches a rule, the guest's native fd is swapped for one end of an
+// AF_UNIX socketpair. A relay thread owns the real socket and moves bytes
+// between the two through a per-direction delay line:
+//
+//   due = max(arrival + latency ± jitter [+ retransmit stall], prev_due)
+//         + chunk_bytes / bandwidth
+//
+// Ordering is preserved (due times never decrease). TCP itself never loses
+// data, so "loss" is modelled as a retransmission stall on the affected
+// segment. Because the guest polls the socketpair end, epoll/ppoll readiness
+// reflects the shaped delivery time. The guest end keeps the socket's
+// O_NONBLOCK status; the relay never blocks on either end (a full socket
+// buffer parks the lane until it polls writable).
+//
+// UDP: datagrams are dropped with the loss probability. Delayed ones go on
+// the socket's own delay line (same due-time rule, without bandwidth) and
+// sendto returns at once; one datagram thread sends them when due, so the
+// guest's syscall thread never sleeps.
+//
+// Determinism: jitter and loss are drawn once per CHUNK-byte segment of each
+// direction's byte stream (by stream offset, not per recv() result), from a
+// PRNG of that direction seeded with (seed, connection index, direction).
+// With a non-zero seed the same transfer therefore gets the same delay and
+// stall for every segment on every run, however the kernel splits it up
+// and however the two directions interleave. Seed 0 uses a random seed.
+//
+// Native builds only.
+
+#pragma once
+
+#ifndef __EMSCRIPTEN__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace net {
+
+struct ShapingProfile {
+    uint64_t down_bps = 0;     // Bytes/sec toward the guest (0 = unlimited)
+    uint64_t up_bps = 0;       // Bytes/sec from the guest (0 = unlimited)
+    uint32_t latency_ms = 0;   // One-way delay, applied in each direction
+    uint32_t jitter_ms = 0;    // Uniform ± around latency
+    double loss = 0.0;         // Per-chunk (TCP) / per-datagram (UDP) probability
+
+    bool active() const {
+        return down_bps || up_bps || latency_ms || jitter_ms || loss > 0.0;
+    }
+};
+
+struct ShapingRule {
+    int family = 0;            // 0 = any, AF_INET, AF_INET6
+    uint8_t addr[16] = {};
+    int prefix_len = 0;
+    uint16_t port = 0;         // 0 = any (host byte order)
+    ShapingProfile profile;
+};
+
+// One jitter/loss draw, for set_segment_hook()
+struct SegmentDecision {
+    uint64_t conn;             // Connection index since set_seed()
+    bool up;                   // Guest -> peer
+    uint64_t segment;          // Stream offset / CHUNK
+    int64_t delay_ms;          // Latency ± jitter, plus the stall if lost
+    bool lost;
+};
+
+struct ShapingStats {
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint32_t> active{0};
+    std::atomic<uint64_t> bytes_up{0};
+    std::atomic<uint64_t> bytes_down{0};
+    std::atomic<uint64_t> loss_stalls{0};
+    std::atomic<uint64_t> udp_dropped{0};
+    std::atomic<uint64_t> udp_delayed{0};
+};
+
+class TrafficShaper {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t CHUNK = 16 * 1024;
+    static constexpr size_t MAX_QUEUED = 1024 * 1024;     // Per direction
+    static constexpr uint32_t MIN_RETRANSMIT_MS = 200;    // Linux TCP_RTO_MIN
+
+    ~TrafficShaper() { shutdown_all(); }
+
+    void set_default(const ShapingProfile& p) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        default_ = p;
+    }
+
+    // dest: "*", "10.0.0.0/8", "1.2.3.4:443", "[::1]:80", "*:53", ...
+    bool add_rule(const std::string& dest, const ShapingProfile& p) {
+        ShapingRule rule;
+        try {
+            if (!parse_dest(dest, rule)) return false;
+        } catch (const std::exception&) {
+            return false;  // Malformed port or prefix length
+        }
+        rule.profile = p;
+        std::lock_guard<std::mutex> lock(mutex_);
+        rules_.push_back(rule);
+        return true;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rules_.clear();
+        default_ = {};
+    }
+
+    // Called on the relay threads with every segment's draw (tests)
+    void set_segment_hook(void (*hook)(const SegmentDecision&)) {
+        segment_hook_.store(hook);
+    }
+
+    void set_seed(uint64_t seed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seed_ = seed;
+        conn_index_ = 0;
+        udp_rng_.seed(seed ? seed : std::random_device{}());
+    }
+
+    // First matching destination rule wins, then the VM-wide default.
+    bool lookup(const struct sockaddr* peer, ShapingProfile& out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& r : rules_) {
+            if (matches(r, peer)) {
+                out = r.profile;
+                return out.active();
+            }
+        }
+        out = default_;
+        return out.active();
+    }
+
+    // Take ownership of real_fd and return the guest end of a shaped relay,
+    // or -1 (real_fd untouched) if the relay could not be set up. The guest
+    // end is non-blocking when `nonblocking` (the guest socket's O_NONBLOCK).
+    int interpose(int real_fd, const ShapingProfile& p, bool nonblocking) {
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return -1;
+        if (nonblocking) {
+            int flags = ::fcntl(sv[0], F_GETFL, 0);
+            if (flags < 0 || ::fcntl(sv[0], F_SETFL, flags | O_NONBLOCK) != 0) {
+                ::close(sv[0]);
+                ::close(sv[1]);
+                return -1;
+            }
+        }
+
+        auto conn = std::make_unique<Conn>();
+        conn->real_fd = real_fd;
+        conn->relay_fd = sv[1];
+        conn->profile = p;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            conn->seed = seed_ ? seed_ * 0x9E3779B97F4A7C15ULL + conn_index_
+                               : std::random_device{}();
+            conn->index = conn_index_++;
+        }
+        stats_.connections++;
+        stats_.active++;
+
+        Conn* raw = conn.get();
+        std::lock_guard<std::mutex> lock(conns_mutex_);
+        reap_locked();
+        conn->thread = std::thread([this, raw] { relay(*raw); });
+        conns_.push_back(std::move(conn));
+        return sv[0];
+    }
+
+    // UDP: decide the fate of one outgoing datagram. Returns false if it
+    // should be dropped; otherwise `delay_ms` is how long to hold it back
+    // (see send_later).
+    bool shape_datagram(const ShapingProfile& p, int64_t& delay_ms) {
+        double draw;
+        int64_t jitter = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            draw = std::uniform_real_distribution<double>(0.0, 1.0)(udp_rng_);
+            if (p.jitter_ms) {
+                jitter = std::uniform_int_distribution<int64_t>(
+                    -(int64_t)p.jitter_ms, p.jitter_ms)(udp_rng_);
+            }
+        }
+        if (draw < p.loss) {
+            stats_.udp_dropped++;
+            return false;
+        }
+        delay_ms = std::max<int64_t>(0, (int64_t)p.latency_ms + jitter);
+        return true;
+    }
+
+    // Queue a datagram for `fd` on the socket's delay line, to be sent
+    // `delay_ms` from now (dest_len 0: to the connected peer). The line holds
+    // its own dup of the socket, so the guest may close it meanwhile.
+    // Returns false when the line is full and the datagram is dropped, as by
+    // a full router queue.
+    bool send_later(int fd, const uint8_t* data, size_t len,
+                    const struct sockaddr* dest, socklen_t dest_len, int64_t delay_ms) {
+        std::lock_guard<std::mutex> lock(dgram_mutex_);
+        auto& line = dgram_lines_[fd];
+        if (!line) {
+            int dup = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (dup < 0) {
+                dgram_lines_.erase(fd);
+                return false;
+            }
+            line = std::make_shared<DatagramLine>();
+            line->fd = dup;
+        }
+        if (line->queued + len > MAX_QUEUED) {
+            stats_.udp_dropped++;
+            return false;
+        }
+        auto due = std::max(Clock::now() + std::chrono::milliseconds(delay_ms), line->last_due);
+        line->last_due = due;
+        line->queued += len;
+
+        Datagram d;
+        d.line = line;
+        d.data.assign(data, data + len);
+        d.dest_len = std::min<socklen_t>(dest_len, sizeof(d.dest));
+        if (d.dest_len) std::memcpy(&d.dest, dest, d.dest_len);
+        dgram_queue_.emplace(due, std::move(d));   // After equal due times: FIFO
+        stats_.udp_delayed++;
+
+        if (!dgram_thread_.joinable()) {
+            dgram_stop_ = false;
+            dgram_thread_ = std::thread([this] { datagram_loop(); });
+        }
+        dgram_cv_.notify_one();
+        return true;
+    }
+
+    // The guest closed `fd`: a reused fd number must get a fresh line.
+    // Datagrams already queued are still sent.
+    void release_datagrams(int fd) {
+        std::lock_guard<std::mutex> lock(dgram_mutex_);
+        dgram_lines_.erase(fd);
+    }
+
+    void shutdown_all() {
+        {
+            std::lock_guard<std::mutex> lock(dgram_mutex_);
+            dgram_stop_ = true;
+            dgram_cv_.notify_all();
+        }
+        if (dgram_thread_.joinable()) dgram_thread_.join();
+        {
+            std::lock_guard<std::mutex> lock(dgram_mutex_);
+            dgram_queue_.clear();
+            dgram_lines_.clear();
+        }
+
+        std::list<std::unique_ptr<Conn>> all;
+        {
+            std::lock_guard<std::mutex> lock(conns_mutex_);
+            for (auto& c : conns_) {
+                c->stopping.store(true);
+                ::shutdown(c->relay_fd, SHUT_RDWR);
+                ::shutdown(c->real_fd, SHUT_RDWR);
+            }
+            all.swap(conns_);
+        }
+        for (auto& c : all) {
+            if (c->thread.joinable()) c->thread.join();
+        }
+    }
+
+    std::string stats_json() const {
+        char buf[320];
+        snprintf(buf, sizeof(buf),
+            "{\"connections\":%llu,\"active\":%u,\"bytes_up\":%llu,\"bytes_down\":%llu,"
+            "\"loss_stalls\":%llu,\"udp_dropped\":%llu,\"udp_delayed\":%llu}",
+            (unsigned long long)stats_.connections.load(),
+            stats_.active.load(),
+            (unsigned long long)stats_.bytes_up.load(),
+            (unsigned long long)stats_.bytes_down.load(),
+            (unsigned long long)stats_.loss_stalls.load(),
+            (unsigned long long)stats_.udp_dropped.load(),
+            (unsigned long long)stats_.udp_delayed.load());
+        return buf;
+    }
+
+private:
+    struct Chunk {
+        Clock::time_point due;
+        std::vector<uint8_t> data;
+    };
+
+    // One direction of the delay line
+    struct Lane {
+        int from = -1;
+        int to = -1;
+        uint64_t bps = 0;
+        std::deque<Chunk> queue;
+        size_t queued = 0;
+        size_t sent = 0;         // Bytes of the front chunk already written
+        Clock::time_point last_due{};
+        bool up = false;
+        std::mt19937_64 rng;     // Jitter/loss draws of this direction only
+        uint64_t offset = 0;     // Stream bytes scheduled so far
+        int64_t segment_delay_ms = 0;   // Draw of the segment at `offset`
+        bool blocked = false;    // Destination full: wait for POLLOUT
+        bool eof = false;        // Source reached EOF
+        bool closed = false;     // Destination write side shut down
+        std::atomic<uint64_t>* counter = nullptr;
+    };
+
+    // A UDP socket's delay line: its datagrams wait in dgram_queue_
+    struct DatagramLine {
+        int fd = -1;             // Our dup of the guest socket
+        size_t queued = 0;
+        Clock::time_point last_due{};
+        ~DatagramLine() {
+            if (fd >= 0) ::close(fd);
+        }
+    };
+
+    struct Datagram {
+        std::shared_ptr<DatagramLine> line;
+        std::vector<uint8_t> data;
+        struct sockaddr_storage dest{};
+        socklen_t dest_len = 0;
+    };
+
+    struct Conn {
+        int real_fd = -1;
+        int relay_fd = -1;
+        ShapingProfile profile;
+        uint64_t seed = 0;
+        uint64_t index = 0;
+        std::thread thread;
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> done{false};
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<ShapingRule> rules_;
+    ShapingProfile default_;
+    uint64_t seed_ = 0;
+    uint64_t conn_index_ = 0;
+    std::mt19937_64 udp_rng_{std::random_device{}()};
+    std::atomic<void (*)(const SegmentDecision&)> segment_hook_{nullptr};
+
+    std::mutex conns_mutex_;
+    std::list<std::unique_ptr<Conn>> conns_;
+    ShapingStats stats_;
+
+    std::mutex dgram_mutex_;
+    std::condition_variable dgram_cv_;
+    std::unordered_map<int, std::shared_ptr<DatagramLine>> dgram_lines_;   // By guest native fd
+    std::multimap<Clock::time_point, Datagram> dgram_queue_;
+    std::thread dgram_thread_;
+    bool dgram_stop_ = false;
+
+    void datagram_loop() {
+        std::unique_lock<std::mutex> lock(dgram_mutex_);
+        while (!dgram_stop_) {
+            if (dgram_queue_.empty()) {
+                dgram_cv_.wait(lock);
+                continue;
+            }
+            auto due = dgram_queue_.begin()->first;
+            if (due > Clock::now()) {
+                dgram_cv_.wait_until(lock, due);
+                continue;
+            }
+            Datagram d = std::move(dgram_queue_.begin()->second);
+            dgram_queue_.erase(dgram_queue_.begin());
+            d.line->queued -= d.data.size();
+            lock.unlock();
+            // A full socket buffer drops it, as the network would
+            ::sendto(d.line->fd, d.data.data(), d.data.size(), MSG_DONTWAIT | MSG_NOSIGNAL,
+                     d.dest_len ? reinterpret_cast<const struct sockaddr*>(&d.dest) : nullptr,
+                     d.dest_len);
+            d = {};      // Close a released line's dup outside the lock
+            lock.lock();
+        }
+    }
+
+    void reap_locked() {
+        for (auto it = conns_.begin(); it != conns_.end();) {
+            if ((*it)->done.load()) {
+                if ((*it)->thread.joinable()) (*it)->thread.join();
+                it = conns_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Draw the delay of the segment starting at lane.offset
+    void draw_segment(const Conn& c, Lane& lane) {
+        const auto& p = c.profile;
+        int64_t delay_ms = p.latency_ms;
+        if (p.jitter_ms) {
+            delay_ms += std::uniform_int_distribution<int64_t>(
+                -(int64_t)p.jitter_ms, p.jitter_ms)(lane.rng);
+        }
+        bool lost = p.loss > 0.0 &&
+                    std::uniform_real_distribution<double>(0.0, 1.0)(lane.rng) < p.loss;
+        if (lost) {
+            // Lost segment: the sender notices after an RTO and resends
+            delay_ms += std::max<uint32_t>(MIN_RETRANSMIT_MS, 2 * p.latency_ms);
+            stats_.loss_stalls++;
+        }
+        lane.segment_delay_ms = std::max<int64_t>(0, delay_ms);
+        if (auto hook = segment_hook_.load()) {
+            hook({c.index, lane.up, lane.offset / CHUNK, lane.segment_delay_ms, lost});
+        }
+    }
+
+    // Queue what one recv() returned, cut at segment boundaries so that
+    // each piece is delayed by the draw of the segment it belongs to
+    void schedule(const Conn& c, Lane& lane, const uint8_t* data, size_t n) {
+        auto now = Clock::now();
+        while (n > 0) {
+            if (lane.offset % CHUNK == 0) draw_segment(c, lane);
+            size_t take = std::min(n, CHUNK - lane.offset % CHUNK);
+            auto due = now + std::chrono::milliseconds(lane.segment_delay_ms);
+            due = std::max(due, lane.last_due);
+            if (lane.bps) {
+                due += std::chrono::microseconds(take * 1000000ULL / lane.bps);
+            }
+            lane.last_due = due;
+            lane.queued += take;
+            lane.queue.push_back({due, std::vector<uint8_t>(data, data + take)});
+            lane.offset += take;
+            data += take;
+            n -= take;
+        }
+    }
+
+    // Write every chunk whose due time has passed. Returns false on error;
+    // a full destination sets lane.blocked and keeps the rest queued.
+    static bool flush_due(Lane& lane, Clock::time_point now) {
+        lane.blocked = false;
+        while (!lane.queue.empty() && lane.queue.front().due <= now) {
+            auto& chunk = lane.queue.front();
+            while (lane.sent < chunk.data.size()) {
+                ssize_t w = ::send(lane.to, chunk.data.data() + lane.sent,
+                                   chunk.data.size() - lane.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        lane.blocked = true;
+                        return true;
+                    }
+                    return false;
+                }
+                lane.sent += w;
+            }
+            *lane.counter += chunk.data.size();
+            lane.queued -= chunk.data.size();
+            lane.queue.pop_front();
+            lane.sent = 0;
+        }
+        if (lane.eof && lane.queue.empty() && !lane.closed) {
+            ::shutdown(lane.to, SHUT_WR);
+            lane.closed = true;
+        }
+        return true;
+    }
+
+    void relay(Conn& c) {
+        Lane up, down;
+        up.from = c.relay_fd;  up.to = c.real_fd;  up.bps = c.profile.up_bps;
+        down.from = c.real_fd; down.to = c.relay_fd; down.bps = c.profile.down_bps;
+        up.counter = &stats_.bytes_up;
+        down.counter = &stats_.bytes_down;
+        up.up = true;
+        // (seed, connection, direction): the lanes never share a sequence
+        up.rng.seed(c.seed * 2);
+        down.rng.seed(c.seed * 2 + 1);
+        Lane* lanes[2] = {&up, &down};
+
+        std::vector<uint8_t> buf(CHUNK);
+        while (!c.stopping.load() && !(up.closed && down.closed)) {
+            auto now = Clock::now();
+            bool ok = flush_due(up, now) && flush_due(down, now);
+            if (!ok || (up.closed && down.closed)) break;
+
+            // Sleep until the next chunk is due, a source is readable or a
+            // blocked destination is writable again
+            int timeout = -1;
+            for (Lane* l : lanes) {
+                if (l->queue.empty() || l->blocked) continue;
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    l->queue.front().due - now).count();
+                int t = static_cast<int>(std::max<int64_t>(0, wait));
+                timeout = timeout < 0 ? t : std::min(timeout, t);
+            }
+
+            struct pollfd pfds[4];
+            for (int i = 0; i < 2; i++) {
+                bool want = !lanes[i]->eof && lanes[i]->queued < MAX_QUEUED;
+                pfds[i] = {want ? lanes[i]->from : -1, POLLIN, 0};
+                pfds[2 + i] = {lanes[i]->blocked ? lanes[i]->to : -1, POLLOUT, 0};
+            }
+            int r = ::poll(pfds, 4, timeout);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                ssize_t n = ::recv(lanes[i]->from, buf.data(), buf.size(), MSG_DONTWAIT);
+                if (n > 0) {
+                    schedule(c, *lanes[i], buf.data(), n);
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    lanes[i]->eof = true;
+                }
+            }
+        }
+
+        // Close under the lock so shutdown_all never touches a reused fd
+        {
+            std::lock_guard<std::mutex> lock(conns_mutex_);
+            ::close(c.relay_fd);
+            ::close(c.real_fd);
+            c.relay_fd = c.real_fd = -1;
+        }
+        stats_.active--;
+        c.done.store(true);
+    }
+
+    static bool matches(const ShapingRule& r, const struct sockaddr* peer) {
+        uint16_t port = 0;
+        const uint8_t* addr = nullptr;
+        int family = peer->sa_family;
+        if (family == AF_INET) {
+            auto* in = reinterpret_cast<const struct ::sockaddr_in*>(peer);
+            port = ntohs(in->sin_port);
+            addr = reinterpret_cast<const uint8_t*>(&in->sin_addr);
+        } else if (family == AF_INET6) {
+            auto* in6 = reinterpret_cast<const struct ::sockaddr_in6*>(peer);
+            port = ntohs(in6->sin6_port);
+            addr = reinterpret_cast<const uint8_t*>(&in6->sin6_addr);
+        } else {
+            return false;
+        }
+        if (r.port && r.port != port) return false;
+        if (r.family == 0) return true;
+        if (r.family != family) return false;
+        int full = r.prefix_len / 8, rem = r.prefix_len % 8;
+        if (memcmp(addr, r.addr, full) != 0) return false;
+        if (rem) {
+            uint8_t mask = static_cast<uint8_t>(0xFF << (8 - rem));
+            if ((addr[full] & mask) != (r.addr[full] & mask)) return false;
+        }
+        return true;
+    }
+
+    static bool parse_dest(std::string s, ShapingRule& r) {
+        // Optional port suffix
+        if (!s.empty() && s[0] == '[') {
+            size_t close = s.find(']');
+            if (close == std::string::npos) return false;
+            if (close + 1 < s.size()) {
+                if (s[close + 1] != ':') return false;
+                r.port = static_cast<uint16_t>(std::stoi(s.substr(close + 2)));
+            }
+            s = s.substr(1, close - 1);
+        } else if (std::count(s.begin(), s.end(), ':') == 1) {
+            size_t colon = s.find(':');
+            r.port = static_cast<uint16_t>(std::stoi(s.substr(colon + 1)));
+            s = s.substr(0, colon);
+        }
+
+        if (s.empty() || s == "*") {
+            r.family = 0;
+            return true;
+        }
+
+        size_t slash = s.find('/');
+        std::string host = s.substr(0, slash);
+        if (::inet_pton(AF_INET, host.c_str(), r.addr) == 1) {
+            r.family = AF_INET;
+            r.prefix_len = 32;
+        } else if (::inet_pton(AF_INET6, host.c_str(), r.addr) == 1) {
+            r.family = AF_INET6;
+            r.prefix_len = 128;
+        } else {
+            return false;
+        }
+        if (slash != std::string::npos) {
+            int len = std::stoi(s.substr(slash + 1));
+            if (len < 0 || len > r.prefix_len) return false;
+            r.prefix_len = len;
+        }
+        return true;
+    }
+};
+
+inline TrafficShaper& get_traffic_shaper() {
+    static TrafficShaper shaper;
+    return shaper;
+}
+
+}  // namespace net
+
+#endif  // !__EMSCRIPTEN__
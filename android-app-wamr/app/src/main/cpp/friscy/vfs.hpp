@@ -12,6 +12,8 @@
 #include <algorithm>
 #include <set>
 
+#include "serial.hpp"
+
 namespace vfs {
 
 // File types (matching Linux stat mode)
@@ -42,6 +44,15 @@ struct Entry {
     // Children (for directories)
     std::unordered_map<std::string, std::shared_ptr<Entry>> children;
 
+    // Snapshot delta tracking (see mark_base)
+    bool base = false;    // Part of the base image
+    bool dirty = false;   // Content or metadata changed since mark_base()
+
+    // Bumped by every touch(), and for a directory whenever an entry is
+    // added to or removed from it, so caches keyed on (entry, generation)
+    // see each change
+    uint64_t generation = 0;
+
     bool is_dir() const { return type == FileType::Directory; }
     bool is_file() const { return type == FileType::Regular; }
     bool is_symlink() const { return type == FileType::Symlink; }
@@ -314,6 +325,7 @@ public:
 
         // O_TRUNC: truncate to zero length
         if (flags & 01000) {
+            touch(entry);
             entry->content.clear();
             entry->size = 0;
         }
@@ -371,6 +383,8 @@ public:
         auto& fh = it->second;
         if (fh->entry->is_dir()) return -21;  // EISDIR
 
+        touch(fh->entry);
+
         // Extend if needed
         size_t end_pos = fh->offset + count;
         if (end_pos > fh->entry->content.size()) {
@@ -556,6 +570,7 @@ public:
         if (!is_dir && at_removedir) return -20;  // ENOTDIR
         if (is_dir && !it->second->children.empty()) return -39;  // ENOTEMPTY
 
+        changed_dir(*parent, it->second.get());
         parent->children.erase(it);
         return 0;
     }
@@ -618,9 +633,14 @@ public:
 
         // Remove any existing entry at the destination
         std::string new_name = abs_new.substr(new_slash + 1);
-        new_parent->children.erase(new_name);
+        if (auto it = new_parent->children.find(new_name); it != new_parent->children.end()) {
+            changed_dir(*new_parent, it->second.get());
+            new_parent->children.erase(it);
+        }
 
         // Move: remove from old parent, insert in new parent
+        changed_dir(*old_parent, entry.get());
+        changed_dir(*new_parent, entry.get());
         old_parent->children.erase(old_name);
         entry->name = new_name;
         new_parent->children[new_name] = entry;
@@ -633,6 +653,7 @@ public:
         if (!entry) return -2;  // ENOENT
         if (!entry->is_file()) return -21;  // EISDIR
 
+        touch(entry);
         entry->content.resize(length);
         entry->size = length;
         return 0;
@@ -646,6 +667,7 @@ public:
         auto& fh = it->second;
         if (!fh->entry->is_file()) return -22;  // EINVAL
 
+        touch(fh->entry);
         fh->entry->content.resize(length);
         fh->entry->size = length;
         if (fh->offset > length) fh->offset = length;
@@ -676,6 +698,7 @@ public:
         auto& fh = it->second;
         if (!fh->entry->is_file()) return -21;
 
+        touch(fh->entry);
         size_t end_pos = offset + count;
         if (end_pos > fh->entry->content.size()) {
             fh->entry->content.resize(end_pos);
@@ -731,10 +754,10 @@ public:
     }
 
     // Open a pipe end (0 = read, 1 = write)
-    int open_pipe(std::shared_ptr<Entry> pipe_entry, int end) {
+    int open_pipe(std::shared_ptr<Entry> pipe_entry, int end, const char* name = "[pipe]") {
         int fd = next_fd_++;
         int flags = (end == 0) ? 0 : 1;  // O_RDONLY or O_WRONLY
-        open_files_[fd] = std::make_unique<FileHandle>(pipe_entry, flags, "[pipe]");
+        open_files_[fd] = std::make_unique<FileHandle>(pipe_entry, flags, name);
         return fd;
     }
 
@@ -779,7 +802,200 @@ public:
         return out;
     }
 
+    // --- Snapshot state ---
+    //
+    // mark_base() pins the current tree (rootfs plus the virtual files set
+    // up at load) as the base image. save_state() writes only the delta
+    // against it: removed paths, entries that are new, replaced or touched,
+    // then the cwd and fd table. load_state() reverts the tree to the base
+    // first, so a snapshot can be restored over a session that has since
+    // modified the filesystem. Base entries stay referenced even when
+    // unlinked, and touch() stashes their original content before the
+    // first write, which is what makes the revert possible.
+
+    void mark_base() {
+        base_nodes_.clear();
+        base_index_.clear();
+        base_stash_.clear();
+        root_->base = true;
+        root_->dirty = false;
+        mark_base_recursive(root_, "");
+        has_base_ = true;
+    }
+
+    bool has_base() const { return has_base_; }
+
+    // Bumped whenever a directory or symlink is added, moved or removed, or
+    // the tree is reverted: anything that can change what a path resolves
+    // to other than the entries of the directory it ends in
+    uint64_t tree_generation() const { return tree_generation_; }
+
+    // Call before mutating an entry's content or metadata
+    void touch(const std::shared_ptr<Entry>& e) {
+        e->generation++;
+        if (e->dirty) return;
+        if (e->base) {
+            Entry& orig = base_stash_[e.get()];
+            orig.type = e->type;
+            orig.mode = e->mode;
+            orig.uid = e->uid;
+            orig.gid = e->gid;
+            orig.size = e->size;
+            orig.mtime = e->mtime;
+            orig.link_target = e->link_target;
+            orig.content = e->content;
+        }
+        e->dirty = true;
+    }
+
+    void save_state(serial::Writer& w) {
+        // Removed base paths; children of a removed directory are implied
+        std::vector<const std::string*> removed;
+        std::set<std::string> removed_set;
+        for (const auto& n : base_nodes_) {
+            if (resolve_no_symlink(n.path)) continue;
+            removed_set.insert(n.path);
+            if (!removed_set.count(parent_of(n.path))) removed.push_back(&n.path);
+        }
+        w.u32(static_cast<uint32_t>(removed.size()));
+        for (const auto* p : removed) w.str(*p);
+
+        // New, replaced or touched entries, parents before children
+        std::vector<std::pair<std::string, const Entry*>> changed;
+        collect_changes(root_, "", changed);
+        w.u32(static_cast<uint32_t>(changed.size()));
+        for (const auto& [path, e] : changed) {
+            w.str(path);
+            write_entry(w, *e);
+        }
+
+        w.str(cwd_);
+        w.i32(next_fd_);
+
+        // Open handles refer to their entry by path when it still resolves
+        // there; anything else (pipes, eventfds, unlinked files) is saved
+        // inline once and shared by id, so both ends of a pipe stay joined.
+        std::unordered_map<const Entry*, uint32_t> anon_ids;
+        std::vector<const Entry*> anon;
+        auto ref_of = [&](const std::shared_ptr<Entry>& e, const std::string& path) -> int64_t {
+            if (!path.empty() && path[0] != '[' && resolve(path) == e) return -1;
+            auto [it, inserted] = anon_ids.emplace(e.get(), static_cast<uint32_t>(anon.size()));
+            if (inserted) anon.push_back(e.get());
+            return it->second;
+        };
+        std::vector<int64_t> file_refs, dir_refs;
+        for (const auto& [fd, fh] : open_files_) file_refs.push_back(ref_of(fh->entry, fh->path));
+        for (const auto& [fd, dh] : open_dirs_) dir_refs.push_back(ref_of(dh->entry, dh->path));
+
+        w.u32(static_cast<uint32_t>(anon.size()));
+        for (const auto* e : anon) write_entry(w, *e);
+
+        w.u32(static_cast<uint32_t>(open_files_.size() + open_dirs_.size()));
+        size_t i = 0;
+        for (const auto& [fd, fh] : open_files_) {
+            write_handle(w, 0, fd, fh->flags, fh->offset, fh->path, file_refs[i++]);
+        }
+        i = 0;
+        for (const auto& [fd, dh] : open_dirs_) {
+            write_handle(w, 1, fd, 0, dh->index, dh->path, dir_refs[i++]);
+        }
+    }
+
+    // Revert to the base image and apply a delta written by save_state().
+    // Returns false if the state is malformed or no base was marked; the
+    // tree may then be partially applied.
+    bool load_state(serial::Reader& r) {
+        if (!has_base_) return false;
+        revert_to_base();
+
+        uint32_t n_removed = r.u32();
+        for (uint32_t i = 0; i < n_removed && r.ok(); i++) {
+            std::string path = r.str();
+            auto parent = resolve_no_symlink(parent_of(path));
+            if (parent && parent->is_dir()) {
+                parent->generation++;
+                parent->children.erase(path.substr(path.rfind('/') + 1));
+            }
+        }
+
+        uint32_t n_changed = r.u32();
+        for (uint32_t i = 0; i < n_changed && r.ok(); i++) {
+            std::string path = r.str();
+            Entry e;
+            if (!read_entry(r, e) || path.size() < 2 || path[0] != '/') return false;
+            auto existing = resolve_no_symlink(path);
+            if (existing && existing->type == e.type) {
+                // Update in place; a directory keeps its children
+                touch(existing);
+                existing->mode = e.mode;
+                existing->uid = e.uid;
+                existing->gid = e.gid;
+                existing->size = e.size;
+                existing->mtime = e.mtime;
+                existing->link_target = std::move(e.link_target);
+                existing->content = std::move(e.content);
+            } else {
+                insert_entry(path, std::make_shared<Entry>(std::move(e)));
+            }
+        }
+
+        cwd_ = r.str();
+        next_fd_ = r.i32();
+
+        uint32_t n_anon = r.u32();
+        std::vector<std::shared_ptr<Entry>> anon;
+        for (uint32_t i = 0; i < n_anon && r.ok(); i++) {
+            auto e = std::make_shared<Entry>();
+            if (!read_entry(r, *e)) return false;
+            anon.push_back(std::move(e));
+        }
+
+        uint32_t n_handles = r.u32();
+        for (uint32_t i = 0; i < n_handles && r.ok(); i++) {
+            uint8_t kind = r.u8();
+            int fd = r.i32();
+            int flags = r.i32();
+            uint64_t pos = r.u64();
+            std::string path = r.str();
+            int64_t ref = static_cast<int32_t>(r.u32());
+            if (!r.ok()) break;
+
+            std::shared_ptr<Entry> entry;
+            if (ref < 0) {
+                entry = resolve(path);
+            } else if (static_cast<size_t>(ref) < anon.size()) {
+                entry = anon[ref];
+            }
+            if (!entry) continue;   // Gone from the delta: the fd reads as closed
+
+            if (kind == 0) {
+                auto fh = std::make_unique<FileHandle>(entry, flags, path);
+                fh->offset = pos;
+                open_files_[fd] = std::move(fh);
+            } else if (entry->is_dir()) {
+                auto dh = std::make_unique<DirHandle>(entry, path);
+                dh->index = std::min<size_t>(pos, dh->names.size());
+                open_dirs_[fd] = std::move(dh);
+            }
+        }
+        return r.ok();
+    }
+
 private:
+    // Base image bookkeeping (mark_base). Nodes are in depth-first order,
+    // so every parent precedes its children.
+    struct BaseNode {
+        std::string path;
+        std::string name;
+        std::shared_ptr<Entry> parent;
+        std::shared_ptr<Entry> entry;
+    };
+    bool has_base_ = false;
+    uint64_t tree_generation_ = 0;
+    std::vector<BaseNode> base_nodes_;
+    std::unordered_map<std::string, size_t> base_index_;
+    std::unordered_map<Entry*, Entry> base_stash_;   // Original state of touched entries
+
     std::shared_ptr<Entry> root_;
     std::string cwd_;
     int next_fd_ = 3;  // 0, 1, 2 reserved for stdin/out/err
@@ -896,6 +1112,7 @@ private:
                     dir->name = part;
                     dir->type = FileType::Directory;
                     dir->mode = 0755;
+                    changed_dir(*parent, dir.get());
                     parent->children[part] = dir;
                     parent = dir;
                 } else {
@@ -904,7 +1121,120 @@ private:
             }
         }
 
-        parent->children[name] = entry;
+        auto& slot = parent->children[name];
+        if (slot) changed_dir(*parent, slot.get());
+        changed_dir(*parent, entry.get());
+        slot = entry;
+    }
+
+    // An entry is being added to or removed from `dir`
+    void changed_dir(Entry& dir, const Entry* child) {
+        dir.generation++;
+        if (child->is_dir() || child->is_symlink()) tree_generation_++;
+    }
+
+    // --- Snapshot state helpers ---
+
+    static std::string parent_of(const std::string& path) {
+        size_t slash = path.rfind('/');
+        return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+    }
+
+    void mark_base_recursive(const std::shared_ptr<Entry>& node, const std::string& prefix) {
+        for (const auto& [name, child] : node->children) {
+            std::string path = prefix + "/" + name;
+            base_index_[path] = base_nodes_.size();
+            base_nodes_.push_back({path, name, node, child});
+            child->base = true;
+            child->dirty = false;
+            if (child->is_dir()) mark_base_recursive(child, path);
+        }
+    }
+
+    void collect_changes(const std::shared_ptr<Entry>& node, const std::string& prefix,
+                         std::vector<std::pair<std::string, const Entry*>>& out) {
+        std::vector<std::string> names;
+        names.reserve(node->children.size());
+        for (const auto& [name, _] : node->children) names.push_back(name);
+        std::sort(names.begin(), names.end());
+
+        for (const auto& name : names) {
+            const auto& child = node->children.at(name);
+            std::string path = prefix + "/" + name;
+            auto it = base_index_.find(path);
+            bool unchanged = child->base && !child->dirty && it != base_index_.end() &&
+                             base_nodes_[it->second].entry == child;
+            if (!unchanged) out.emplace_back(path, child.get());
+            if (child->is_dir()) collect_changes(child, path, out);
+        }
+    }
+
+    void revert_to_base() {
+        tree_generation_++;
+        root_->generation++;
+        root_->children.clear();
+        for (const auto& n : base_nodes_) {
+            if (n.entry->is_dir()) {
+                n.entry->generation++;
+                n.entry->children.clear();
+            }
+        }
+        for (const auto& n : base_nodes_) {
+            n.entry->name = n.name;
+            n.parent->children[n.name] = n.entry;
+        }
+        for (auto& [e, orig] : base_stash_) {
+            e->generation++;
+            e->type = orig.type;
+            e->mode = orig.mode;
+            e->uid = orig.uid;
+            e->gid = orig.gid;
+            e->size = orig.size;
+            e->mtime = orig.mtime;
+            e->link_target = std::move(orig.link_target);
+            e->content = std::move(orig.content);
+        }
+        base_stash_.clear();
+        root_->dirty = false;
+        for (const auto& n : base_nodes_) n.entry->dirty = false;
+
+        open_files_.clear();
+        open_dirs_.clear();
+        cwd_ = "/";
+        next_fd_ = 3;
+    }
+
+    static void write_entry(serial::Writer& w, const Entry& e) {
+        w.u32(static_cast<uint32_t>(e.type));
+        w.u32(e.mode);
+        w.u32(e.uid);
+        w.u32(e.gid);
+        w.u64(e.size);
+        w.u64(e.mtime);
+        w.str(e.link_target);
+        w.bytes(e.content);
+    }
+
+    static bool read_entry(serial::Reader& r, Entry& e) {
+        e.type = static_cast<FileType>(r.u32());
+        e.mode = r.u32();
+        e.uid = r.u32();
+        e.gid = r.u32();
+        e.size = r.u64();
+        e.mtime = r.u64();
+        e.link_target = r.str();
+        e.content = r.bytes();
+        return r.ok();
+    }
+
+    static void write_handle(serial::Writer& w, uint8_t kind, int fd, int flags,
+                             uint64_t pos, const std::string& path, int64_t ref) {
+        w.u8(kind);
+        w.i32(fd);
+        w.i32(flags);
+        w.u64(pos);
+        w.str(path);
+        w.u32(static_cast<uint32_t>(static_cast<int32_t>(ref)));   // -1 = by path
     }
 
     // --- Tar serialization helpers ---
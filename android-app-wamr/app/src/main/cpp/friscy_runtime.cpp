@@ -31,6 +31,8 @@
 #include <cstring>
 #include <memory>
 #include <unordered_map>
+#include <algorithm>
+#include <atomic>
 
 #include <libriscv/machine.hpp>
 
@@ -40,6 +42,10 @@
 #include "friscy/elf_loader.hpp"
 #include "friscy/syscalls.hpp"
 #include "friscy/network.hpp"
+#include "friscy/port_forward.hpp"
+#include "friscy/snapshot.hpp"
+#include "friscy/session.hpp"
+#include "friscy/output_ring.hpp"
 
 #define LOG_TAG "friscy"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -50,10 +56,6 @@ using Machine = riscv::Machine<riscv::RISCV64>;
 // Maximum instructions per simulate() call (512 billion — matches standalone)
 static constexpr uint64_t MAX_INSTRUCTIONS = 512'000'000'000ULL;
 
-// Syscall bases for libriscv native heap/memory management
-static constexpr uint32_t HEAP_SYSCALLS_BASE = 480;
-static constexpr uint32_t MEMORY_SYSCALLS_BASE = 485;
-
 // ============================================================================
 // Global State
 // ============================================================================
@@ -68,40 +70,180 @@ static std::unique_ptr<Machine> g_machine;
 static std::unique_ptr<vfs::VirtualFS> g_vfs;
 static std::thread g_exec_thread;
 
+// Identifies the base image the VFS delta in a snapshot applies to
+static uint64_t g_rootfs_digest = 0;
+
+// Pausing parks the execution thread between simulate() calls, so the
+// machine, VFS and syscall globals can be read or replaced consistently.
+static std::mutex g_pause_mutex;
+static std::condition_variable g_pause_cv;
+static std::atomic<bool> g_pause_requested{false};
+static bool g_paused = false;
+static bool g_pause_stop = false;   // A pause's stop() may still land in simulate()
+
+// How long a pause waits for the execution thread to park. Blocking guest
+// calls are interruptible (guest_wait.hpp), so only a host call that is not
+// (a large VFS operation, say) can hold it off this long.
+static constexpr auto PAUSE_TIMEOUT = std::chrono::milliseconds(2000);
+
+// Set when a chunk the last restore mapped fails its background checksum
+// (snapshot::g_on_mapped_corrupt); the execution thread reports it and exits
+static std::atomic<bool> g_snapshot_corrupt{false};
+
+// Ready point for VM templates: the first time the guest blocks on an empty
+// stdin after the ready marker (if any) has appeared in its output, e.g. a
+// shell at its prompt or Node after module preload.
+static std::mutex g_ready_mutex;
+static std::condition_variable g_ready_cv;
+static bool g_ready = false;
+static bool g_ready_abandoned = false;               // User input came first
+static std::string g_ready_marker;
+static std::string g_ready_tail;                     // Output carried between writes
+static std::atomic<bool> g_ready_marker_pending{false};
+
 // ============================================================================
 // JNI Output Callback
 // ============================================================================
+//
+// Output is queued in a lock-free ring (friscy/output_ring.hpp) and handed
+// to Java by one delivery thread, attached to the JVM for its lifetime.
+// After the first bytes of a burst it waits out the rest of the frame, so
+// the terminal gets one batched callback per frame at most while the
+// execution thread keeps running. The ring has a single producer: the
+// execution thread, or the JNI thread while no execution thread runs.
+//
+// Batches cross as raw bytes: the thread drains the ring into a buffer it
+// exposes to Java once as a direct ByteBuffer, and calls
+// onOutput(ByteBuffer, int) with the batch length. No jstring is built, so
+// NUL bytes, invalid UTF-8 and sequences split across writes reach the
+// terminal emulator untouched, and it decodes them itself.
+
+// Delivery cadence and the most bytes handed over per callback
+static constexpr auto OUTPUT_FRAME = std::chrono::milliseconds(16);
+static constexpr size_t OUTPUT_BATCH = 64 * 1024;
+
+static outring::Ring g_output_ring;
+static std::thread g_output_thread;
+static std::atomic<bool> g_output_running{false};
+static std::atomic<uint64_t> g_output_delivered{0};     // Bytes the callback returned from
+
+// `buffer` wraps the delivery thread's batch; Java reads it during the call
+static void deliver_to_java(JNIEnv* env, jobject buffer, size_t len) {
+    if (len == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        if (g_callback_obj && g_on_output_method) {
+            env->CallVoidMethod(g_callback_obj, g_on_output_method, buffer, static_cast<jint>(len));
+            if (env->ExceptionCheck()) {
+                env->ExceptionDescribe();
+                env->ExceptionClear();
+            }
+            g_output_ring.stats().batches++;
+        }
+    }
+    g_output_delivered.fetch_add(len);
+}
 
-static void send_to_java(const char* data, size_t len) {
-    std::lock_guard<std::mutex> lock(g_callback_mutex);
-    if (!g_jvm || !g_callback_obj || !g_on_output_method || len == 0) return;
-
+static void output_loop() {
     JNIEnv* env = nullptr;
-    bool attached = false;
-
-    jint res = g_jvm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6);
-    if (res == JNI_EDETACHED) {
-        if (g_jvm->AttachCurrentThread(&env, nullptr) != 0) return;
-        attached = true;
+    if (!g_jvm || g_jvm->AttachCurrentThread(&env, nullptr) != 0) {
+        LOGE("Output thread could not attach to the JVM");
+        return;
+    }
+    std::unique_ptr<uint8_t[]> batch(new uint8_t[OUTPUT_BATCH]);
+    jobject buffer = env->NewDirectByteBuffer(batch.get(), OUTPUT_BATCH);
+    if (!buffer) {
+        LOGE("Output thread could not create its direct buffer");
+        env->ExceptionClear();
+        g_jvm->DetachCurrentThread();
+        return;
     }
+    auto next_frame = std::chrono::steady_clock::now();
 
-    if (env) {
-        // Handle potential non-UTF8 data by replacing invalid bytes
-        std::string str(data, len);
-        jstring jstr = env->NewStringUTF(str.c_str());
-        if (jstr) {
-            env->CallVoidMethod(g_callback_obj, g_on_output_method, jstr);
-            env->DeleteLocalRef(jstr);
+    while (true) {
+        if (!g_output_ring.wait_readable(std::chrono::milliseconds(500))) {
+            if (g_output_ring.closed()) break;
+            continue;
+        }
+        std::this_thread::sleep_until(next_frame);
+        next_frame = std::chrono::steady_clock::now() + OUTPUT_FRAME;
+
+        while (size_t n = g_output_ring.read(batch.get(), OUTPUT_BATCH)) {
+            deliver_to_java(env, buffer, n);
         }
     }
+    env->DeleteLocalRef(buffer);
+    g_jvm->DetachCurrentThread();
+}
 
-    if (attached) {
-        g_jvm->DetachCurrentThread();
+static void start_output_thread() {
+    if (g_output_running.load()) return;
+    g_output_ring.open();
+    g_output_thread = std::thread(output_loop);
+    g_output_running.store(true);
+}
+
+// Deliver what is queued, then end the thread. No producer may be running.
+static void stop_output_thread() {
+    if (!g_output_running.exchange(false)) return;
+    g_output_ring.close();
+    if (g_output_thread.joinable()) g_output_thread.join();
+}
+
+static void send_to_java(const char* data, size_t len) {
+    if (len == 0 || !g_output_running.load()) return;
+    g_output_ring.write(data, len);
+}
+
+// ============================================================================
+// Ready Point
+// ============================================================================
+
+static void reset_ready() {
+    std::lock_guard<std::mutex> lock(g_ready_mutex);
+    g_ready = false;
+    g_ready_abandoned = false;
+    g_ready_tail.clear();
+    g_ready_marker_pending.store(!g_ready_marker.empty());
+}
+
+// One relaxed load once the marker has been seen (or when there is none)
+static void scan_ready_marker(const char* data, size_t size) {
+    if (!g_ready_marker_pending.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lock(g_ready_mutex);
+    g_ready_tail.append(data, size);
+    if (g_ready_tail.find(g_ready_marker) != std::string::npos) {
+        g_ready_marker_pending.store(false);
+        g_ready_tail.clear();
+    } else if (g_ready_tail.size() >= g_ready_marker.size()) {
+        g_ready_tail.erase(0, g_ready_tail.size() - (g_ready_marker.size() - 1));
     }
 }
 
+// Called by the execution thread when the guest blocks on an empty stdin
+static void note_stdin_idle() {
+    // Whatever the guest exec'd up to its first prompt is its startup profile
+    session::end_startup_profile();
+    if (g_ready_marker_pending.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lock(g_ready_mutex);
+    if (g_ready || g_ready_abandoned) return;
+    g_ready = true;
+    g_ready_cv.notify_all();
+}
+
+// Input typed before the ready point would end up in the template
+static void abandon_ready_point() {
+    std::lock_guard<std::mutex> lock(g_ready_mutex);
+    if (g_ready) return;
+    g_ready_abandoned = true;
+    g_ready_cv.notify_all();
+}
+
 // libriscv printer callback (raw function pointer — no captures)
 static void friscy_printer(const Machine&, const char* data, size_t size) {
+    boottrace::first_output();
+    snapshot::note_guest_output();
+    scan_ready_marker(data, size);
     send_to_java(data, size);
 }
 
@@ -109,16 +251,95 @@ static void friscy_printer(const Machine&, const char* data, size_t size) {
 // Execution Thread
 // ============================================================================
 
+// Runs on the snapshot check thread, so it only stops the machine; the
+// execution thread, which owns guest output, reports the error and exits.
+static void stop_on_corrupt_snapshot(const std::string& path) {
+    LOGE("Restored snapshot %s failed its checksums, stopping the guest", path.c_str());
+    g_snapshot_corrupt.store(true);
+    if (g_machine) g_machine->stop();
+    guestwait::interrupt();
+    android_io::stdin_cv.notify_one();
+}
+
+static bool report_corrupt_snapshot() {
+    if (!g_snapshot_corrupt.load()) return false;
+    static const char msg[] =
+        "\r\n\033[31m[friscy error] Restored snapshot is corrupt, guest stopped\033[0m\r\n";
+    send_to_java(msg, sizeof(msg) - 1);
+    return true;
+}
+
+static void park_if_paused() {
+    std::unique_lock<std::mutex> lock(g_pause_mutex);
+    if (!g_pause_requested.load()) return;
+    g_paused = true;
+    g_pause_cv.notify_all();
+    g_pause_cv.wait(lock, [] {
+        return !g_pause_requested.load() || !android_io::running.load();
+    });
+    g_paused = false;
+    g_pause_stop = false;   // Every stop() issued before parking has landed or was lost
+}
+
+// Park the execution thread (no-op if it is not running). Returns false,
+// with nothing paused, if it does not park within PAUSE_TIMEOUT; otherwise
+// pair with resume_execution().
+static bool pause_execution() {
+    std::unique_lock<std::mutex> lock(g_pause_mutex);
+    g_pause_requested.store(true);
+    auto deadline = std::chrono::steady_clock::now() + PAUSE_TIMEOUT;
+    while (!g_paused && android_io::running.load()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            g_pause_requested.store(false);
+            guestwait::clear();
+            lock.unlock();
+            g_pause_cv.notify_all();
+            LOGE("Execution thread did not pause within %lld ms",
+                 (long long)PAUSE_TIMEOUT.count());
+            return false;
+        }
+        // Re-issue the stop until the thread notices: a stop() that lands
+        // between two simulate() calls is lost
+        if (g_machine) g_machine->stop();
+        g_pause_stop = true;
+        guestwait::interrupt();
+        android_io::stdin_cv.notify_one();
+        g_pause_cv.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void resume_execution() {
+    {
+        std::lock_guard<std::mutex> lock(g_pause_mutex);
+        g_pause_requested.store(false);
+        guestwait::clear();
+    }
+    g_pause_cv.notify_all();
+}
+
 static void execution_loop() {
     LOGI("Execution thread started");
 
     while (android_io::running.load()) {
+        park_if_paused();
+        if (!android_io::running.load() || report_corrupt_snapshot()) break;
         try {
             // Run until the machine stops (stdin wait, exit, or exception)
             // Retry on page faults by making the faulting page writable
             for (int retries = 0; retries < 8; retries++) {
                 try {
-                    g_machine->simulate(MAX_INSTRUCTIONS);
+                    // With guest threads, run in time slices so that one
+                    // spinning thread cannot starve the others
+                    if (syscalls::g_sched.count > 1) {
+                        if (!g_machine->template simulate<false>(syscalls::TIME_SLICE)) {
+                            syscalls::time_slice(*g_machine);
+                            retries = -1;
+                            continue;
+                        }
+                    } else {
+                        g_machine->simulate(MAX_INSTRUCTIONS);
+                    }
                     // execve: machine.stop() signals new binary loaded
                     if (syscalls::g_execve_restart) {
                         syscalls::g_execve_restart = false;
@@ -134,7 +355,7 @@ static void execution_loop() {
                         attr.read = true;
                         attr.write = true;
                         attr.exec = true;
-                        g_machine->memory.set_page_attr(page, 4096, attr);
+                        pageattr::set(g_machine->memory, page, 4096, attr);
                         LOGI("Fixed page fault at 0x%llx, retrying",
                              (unsigned long long)fault_addr);
                         continue;
@@ -142,17 +363,32 @@ static void execution_loop() {
                     throw;  // Re-throw if we can't fix it
                 }
             }
+            if (report_corrupt_snapshot()) break;
+
+            // Stopped for a pause (or one that timed out), or a blocking
+            // call was interrupted to re-execute: park if still requested,
+            // then resume simulate()
+            bool restarted = std::exchange(guestwait::g_restart, false);
+            bool paused;
+            {
+                std::lock_guard<std::mutex> lock(g_pause_mutex);
+                paused = g_pause_requested.load() || std::exchange(g_pause_stop, false);
+            }
+            if (paused || restarted) continue;
 
             if (android_io::waiting_for_stdin.load()) {
                 // Machine stopped because stdin has no data.
                 // Wait for input from the Java side.
                 android_io::waiting_for_stdin.store(false);
+                note_stdin_idle();
 
                 std::unique_lock<std::mutex> lock(android_io::stdin_mutex);
                 android_io::stdin_cv.wait(lock, [] {
                     return !android_io::stdin_buffer.empty() ||
                            android_io::stdin_eof.load() ||
-                           !android_io::running.load();
+                           !android_io::running.load() ||
+                           g_pause_requested.load() ||
+                           g_snapshot_corrupt.load();
                 });
 
                 if (!android_io::running.load()) {
@@ -187,101 +423,12 @@ static void execution_loop() {
     }
 
     android_io::running.store(false);
-    LOGI("Execution thread finished");
-}
-
-// ============================================================================
-// Helper: resolve a path through VFS symlinks
-// ============================================================================
-
-static std::string resolve_vfs_path(vfs::VirtualFS& fs, const std::string& path) {
-    // Try the path directly
-    auto entry = fs.resolve(path);
-    if (entry) return path;
-
-    // Not found
-    return "";
-}
-
-// Helper: read a file from VFS into a byte vector
-static std::vector<uint8_t> read_vfs_file(vfs::VirtualFS& fs, const std::string& path) {
-    int fd = fs.open(path, 0);
-    if (fd < 0) return {};
-
-    auto entry = fs.get_entry(fd);
-    if (!entry) {
-        fs.close(fd);
-        return {};
+    {
+        // The ready point can no longer be reached
+        std::lock_guard<std::mutex> lock(g_ready_mutex);
+        g_ready_cv.notify_all();
     }
-
-    std::vector<uint8_t> data(entry->content.begin(), entry->content.end());
-    fs.close(fd);
-    return data;
-}
-
-// ============================================================================
-// Virtual /proc and /dev files (synced from friscy-standalone)
-// ============================================================================
-
-static void setup_virtual_files(vfs::VirtualFS& vfs) {
-    // /dev/null
-    vfs.add_virtual_file("/dev/null", std::vector<uint8_t>{});
-
-    // /dev/tty and /dev/console — controlling terminal
-    vfs.add_virtual_file("/dev/tty", std::vector<uint8_t>{});
-    vfs.add_virtual_file("/dev/console", std::vector<uint8_t>{});
-    vfs.add_virtual_file("/dev/pts/0", std::vector<uint8_t>{});
-    vfs.add_virtual_file("/dev/ptmx", std::vector<uint8_t>{});
-
-    // /dev/urandom (reads handled by getrandom syscall)
-    vfs.add_virtual_file("/dev/urandom", std::vector<uint8_t>{});
-    vfs.add_virtual_file("/dev/random", std::vector<uint8_t>{});
-
-    // /etc/passwd, /etc/group (minimal)
-    vfs.add_virtual_file("/etc/passwd", "root:x:0:0:root:/root:/bin/sh\n");
-    vfs.add_virtual_file("/etc/group", "root:x:0:\n");
-
-    // /etc/hosts, /etc/resolv.conf
-    vfs.add_virtual_file("/etc/hosts", "127.0.0.1 localhost\n");
-    vfs.add_virtual_file("/etc/resolv.conf", "nameserver 8.8.8.8\n");
-
-    // Timezone data — needed by Node.js (abseil/cctz) to avoid abort()
-    static const uint8_t utc_tzif[] = {
-        // TZif v1 header
-        'T','Z','i','f','2',  0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,  0,0,0,0,  0,0,0,0,  0,0,0,0,
-        0,0,0,1,  0,0,0,4,
-        0,0,0,0, 0, 0,  'U','T','C',0,
-        // TZif v2 header
-        'T','Z','i','f','2',  0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,  0,0,0,0,  0,0,0,0,  0,0,0,0,
-        0,0,0,1,  0,0,0,4,
-        0,0,0,0, 0, 0,  'U','T','C',0,
-        '\n','U','T','C','0','\n',
-    };
-    std::vector<uint8_t> utc_tz(utc_tzif, utc_tzif + sizeof(utc_tzif));
-    vfs.add_virtual_file("/etc/localtime", utc_tz);
-    vfs.add_virtual_file("/usr/share/zoneinfo/UTC", utc_tz);
-    vfs.add_virtual_file("/usr/share/zoneinfo/Etc/UTC", utc_tz);
-
-    // /proc — needed by V8/Node.js
-    vfs.add_virtual_file("/proc/version_signature",
-        "Linux version 6.8.0 (friscy@libriscv) (riscv64-linux-gnu-gcc)\n");
-    vfs.add_virtual_file("/proc/cpuinfo",
-        "processor\t: 0\n"
-        "hart\t\t: 0\n"
-        "isa\t\t: rv64imafdc_zicsr_zifencei\n"
-        "mmu\t\t: sv39\n"
-        "uarch\t\t: friscy,libriscv\n"
-        "\n");
-    vfs.add_virtual_file("/proc/self/maps", "");
-    vfs.add_virtual_file("/proc/sys/vm/overcommit_memory", "0\n");
-
-    // /tmp directory and NODE_COMPILE_CACHE directory
-    vfs.mkdir("/tmp", 0777);
-    vfs.mkdir("/tmp/node-compile-cache", 0777);
+    LOGI("Execution thread finished");
 }
 
 // ============================================================================
@@ -292,6 +439,7 @@ extern "C" {
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
     g_jvm = vm;
+    snapshot::g_on_mapped_corrupt = stop_on_corrupt_snapshot;
     LOGI("friscy runtime loaded (libriscv RISC-V 64)");
     return JNI_VERSION_1_6;
 }
@@ -315,6 +463,7 @@ JNIEXPORT jboolean JNICALL
 Java_com_example_c2wdemo_FriscyRuntime_nativeLoadRootfs(
     JNIEnv* env, jclass clazz,
     jbyteArray tarBytes, jstring entryPath, jobject callback) {
+    boottrace::start();
 
     // Store callback
     {
@@ -324,8 +473,9 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeLoadRootfs(
         }
         g_callback_obj = env->NewGlobalRef(callback);
         jclass cls = env->GetObjectClass(callback);
-        g_on_output_method = env->GetMethodID(cls, "onOutput", "(Ljava/lang/String;)V");
+        g_on_output_method = env->GetMethodID(cls, "onOutput", "(Ljava/nio/ByteBuffer;I)V");
     }
+    start_output_thread();
 
     // Get tar bytes
     jsize tar_len = env->GetArrayLength(tarBytes);
@@ -343,192 +493,38 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeLoadRootfs(
     env->ReleaseStringUTFChars(entryPath, entry_cstr);
 
     try {
-        // Reset state
+        // Reset state. A background snapshot may still be reading the old
+        // arena, and a mapped-chunk check may still stop the old machine.
+        snapshot::wait_background();
+        snapshot::cancel_mapped_check();
+        g_snapshot_corrupt.store(false);
         android_io::reset();
+        reset_ready();
 
-        // Load tar into VFS
-        g_vfs = std::make_unique<vfs::VirtualFS>();
-        g_vfs->load_tar(reinterpret_cast<const uint8_t*>(tar_data), tar_len);
+        // Load tar into VFS with the virtual /proc, /dev, /etc files
+        const auto* tar = reinterpret_cast<const uint8_t*>(tar_data);
+        g_vfs = session::load_image(tar, tar_len, entry_path, g_rootfs_digest);
         env->ReleaseByteArrayElements(tarBytes, tar_data, JNI_ABORT);
 
-        // Setup virtual /proc, /dev, /etc files (synced from standalone)
-        setup_virtual_files(*g_vfs);
-        g_vfs->add_virtual_file("/proc/self/exe", entry_path);
-
         LOGI("VFS loaded, resolving entry: %s", entry_path.c_str());
 
-        // Resolve the entry path (may be a symlink, e.g. /bin/sh -> /bin/busybox)
-        std::string resolved_entry = resolve_vfs_path(*g_vfs, entry_path);
-        if (resolved_entry.empty()) {
-            LOGE("Entry not found in VFS: %s", entry_path.c_str());
-            std::string msg = "[friscy] Entry not found: " + entry_path + "\n";
+        session::BootInfo info;
+        std::string error;
+        g_machine = session::boot(*g_vfs, entry_path, info, error);
+        if (!g_machine) {
+            LOGE("%s", error.c_str());
+            std::string msg = "[friscy] " + error + "\n";
             send_to_java(msg.c_str(), msg.size());
             return JNI_FALSE;
         }
-
-        // Read the entry binary from VFS
-        auto binary = read_vfs_file(*g_vfs, resolved_entry);
-        if (binary.empty()) {
-            LOGE("Failed to read entry binary: %s", resolved_entry.c_str());
-            return JNI_FALSE;
-        }
-        LOGI("Entry binary: %s (%zu bytes)", resolved_entry.c_str(), binary.size());
-
-        // Parse ELF to check for dynamic linking
-        auto exec_info = elf::parse_elf(binary);
-        bool use_dynamic_linker = exec_info.is_dynamic &&
-                                  !exec_info.interpreter.empty();
-
-        std::vector<uint8_t> interp_binary;
-        elf::ElfInfo interp_info{};
-        uint64_t interp_base = 0;
-
-        if (use_dynamic_linker) {
-            LOGI("Dynamic binary, interpreter: %s", exec_info.interpreter.c_str());
-
-            // Read interpreter from VFS
-            std::string interp_resolved = resolve_vfs_path(*g_vfs, exec_info.interpreter);
-            if (interp_resolved.empty()) {
-                LOGE("Interpreter not found: %s", exec_info.interpreter.c_str());
-                return JNI_FALSE;
-            }
-            interp_binary = read_vfs_file(*g_vfs, interp_resolved);
-            if (interp_binary.empty()) {
-                LOGE("Failed to read interpreter: %s", interp_resolved.c_str());
-                return JNI_FALSE;
-            }
-            interp_info = elf::parse_elf(interp_binary);
-            LOGI("Interpreter: %zu bytes", interp_binary.size());
-        } else {
-            LOGI("Static binary, no dynamic linker needed");
-        }
-
-        // Create the RISC-V machine (512MB arena for container workloads)
-        riscv::MachineOptions<riscv::RISCV64> options{
-            .memory_max = 512ull << 20,  // 512MB
-        };
-        g_machine = std::make_unique<Machine>(binary, options);
-
-        // If dynamic, load interpreter and set up auxiliary vector
-        if (use_dynamic_linker) {
-            // Load interpreter within the 512MB arena (at 384MB mark)
-            interp_base = 0x18000000;
-            LOGI("Loading interpreter at 0x%lx", (unsigned long)interp_base);
-
-            dynlink::load_elf_segments(*g_machine, interp_binary, interp_base);
-
-            // Calculate interpreter entry point
-            uint64_t interp_entry = interp_info.entry_point;
-            if (interp_info.type == elf::ET_DYN) {
-                auto [lo, hi] = elf::get_load_range(interp_binary);
-                interp_entry = interp_info.entry_point - lo + interp_base;
-            }
-
-            // Adjust exec_info for PIE main binary
-            if (exec_info.type == elf::ET_DYN) {
-                uint64_t actual_entry = g_machine->memory.start_address();
-                uint64_t exec_base = actual_entry - exec_info.entry_point;
-                exec_info.phdr_addr += exec_base;
-                exec_info.entry_point = actual_entry;
-                LOGI("PIE base: 0x%lx", (unsigned long)exec_base);
-
-                auto [lo, hi] = elf::get_load_range(binary);
-                syscalls::g_exec_ctx.exec_base = exec_base + lo;
-                auto [rw_lo, rw_hi] = elf::get_writable_range(binary);
-                syscalls::g_exec_ctx.exec_rw_start = exec_base + rw_lo;
-                syscalls::g_exec_ctx.exec_rw_end = exec_base + rw_hi;
-            }
-
-            // Advance mmap past interpreter to prevent overlap (from standalone)
-            auto [interp_lo, interp_hi] = elf::get_load_range(interp_binary);
-            uint64_t interp_end_page = (interp_base + interp_hi + 0xFFF) & ~0xFFFULL;
-            if (g_machine->memory.mmap_address() < interp_end_page) {
-                LOGI("Advancing mmap past interpreter: 0x%lx -> 0x%lx",
-                     (unsigned long)g_machine->memory.mmap_address(),
-                     (unsigned long)interp_end_page);
-                g_machine->memory.mmap_address() = interp_end_page;
-            }
-
-            // Jump to interpreter instead of main binary
-            g_machine->cpu.jump(interp_entry);
-            LOGI("Interpreter entry: 0x%lx", (unsigned long)interp_entry);
-        }
-
-        // Save execution context for execve support
-        syscalls::g_exec_ctx.exec_binary = binary;
-        syscalls::g_exec_ctx.exec_info = exec_info;
-        if (use_dynamic_linker) {
-            syscalls::g_exec_ctx.interp_binary = interp_binary;
-            syscalls::g_exec_ctx.interp_base = interp_base;
-            syscalls::g_exec_ctx.interp_entry = g_machine->cpu.pc();
-            syscalls::g_exec_ctx.dynamic = true;
-            auto [irw_lo, irw_hi] = elf::get_writable_range(interp_binary);
-            syscalls::g_exec_ctx.interp_rw_start = interp_base + irw_lo;
-            syscalls::g_exec_ctx.interp_rw_end = interp_base + irw_hi;
-        }
-
-        // Install Linux syscall emulation (defaults from libriscv)
-        g_machine->setup_linux_syscalls();
-
-        // Set up heap and mmap area (64MB)
-        const auto heap_area = g_machine->memory.mmap_allocate(64ULL << 20);
-        g_machine->setup_native_heap(HEAP_SYSCALLS_BASE, heap_area, 64ULL << 20);
-        syscalls::g_exec_ctx.heap_start = heap_area;
-        syscalls::g_exec_ctx.heap_size = 64ULL << 20;
-        LOGI("Heap area: 0x%lx (64MB)", (unsigned long)heap_area);
-
-        Machine::setup_native_memory(MEMORY_SYSCALLS_BASE);
-
-        // Install our custom VFS-backed syscall handlers (overrides libriscv defaults)
-        syscalls::install_syscalls(*g_machine, *g_vfs);
-
-        // Install network syscall handlers (real POSIX sockets via Android)
-        net::install_network_syscalls(*g_machine);
-
-        // Wire up network bridge function pointers for syscalls.hpp
-        // (syscalls.hpp uses these to delegate socket I/O without including network.hpp)
-        syscalls::net_is_socket_fd = [](int fd) -> bool {
-            return net::get_network_ctx().is_socket_fd(fd);
-        };
-        syscalls::net_get_native_fd = [](int fd) -> int {
-            return net::get_network_ctx().get_native_fd(fd);
-        };
-
-        // Initialize cooperative thread scheduler (for CLONE_THREAD support)
-        syscalls::g_sched = {};
-        syscalls::g_fork = {};
-        syscalls::g_next_pid = 100;
-
-        // Environment variables (synced from standalone)
-        std::vector<std::string> guest_env = {
-            "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin",
-            "HOME=/root",
-            "USER=root",
-            "TERM=xterm-256color",
-            "LANG=C.UTF-8",
-            "HOSTNAME=friscy",
-            "TZ=UTC",
-            "NODE_OPTIONS=--jitless --max-old-space-size=256",
-            "NODE_COMPILE_CACHE=/tmp/node-compile-cache",
-        };
-        syscalls::g_exec_ctx.env = guest_env;
-
-        // Arguments
-        std::vector<std::string> guest_args = {entry_path};
-
-        // Set up program stack
-        if (use_dynamic_linker) {
-            uint64_t stack_top = g_machine->cpu.reg(riscv::REG_SP);
-            syscalls::g_exec_ctx.original_stack_top = stack_top;
-
-            uint64_t sp = dynlink::setup_dynamic_stack(
-                *g_machine, exec_info, interp_base,
-                guest_args, guest_env, stack_top);
-            g_machine->cpu.reg(riscv::REG_SP) = sp;
-            LOGI("Dynamic stack: SP=0x%lx", (unsigned long)sp);
+        if (info.interpreter.empty()) {
+            LOGI("Static binary: %s (%zu bytes)", info.resolved_entry.c_str(), info.binary_size);
         } else {
-            g_machine->setup_argv(guest_args, guest_env);
+            LOGI("Dynamic binary: %s, interpreter %s, PIE base 0x%lx",
+                 info.resolved_entry.c_str(), info.interpreter.c_str(),
+                 (unsigned long)info.pie_base);
         }
+        LOGI("Load phases (ms): %s", session::load_stats_json().c_str());
 
         // Route stdout/stderr to Java callback
         g_machine->set_printer(friscy_printer);
@@ -578,7 +574,7 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeLoadRootfs(
 
         LOGI("Machine ready, entry: %s", entry_path.c_str());
         std::string msg = "[friscy] Loaded " + entry_path + " (" +
-                          std::to_string(binary.size()) + " bytes)\r\n";
+                          std::to_string(info.binary_size) + " bytes)\r\n";
         send_to_java(msg.c_str(), msg.size());
 
         return JNI_TRUE;
@@ -615,6 +611,7 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeStart(JNIEnv* env, jclass clazz) {
         g_exec_thread.join();
     }
 
+    guestwait::clear();
     g_exec_thread = std::thread(execution_loop);
     LOGI("Execution thread spawned");
 
@@ -622,21 +619,20 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeStart(JNIEnv* env, jclass clazz) {
 }
 
 /**
- * Send input text to the guest's stdin.
+ * Send `length` raw bytes from the start of `buffer`, a direct ByteBuffer,
+ * to the guest's stdin. Bytes are passed through as-is (NULs included).
  */
 JNIEXPORT void JNICALL
 Java_com_example_c2wdemo_FriscyRuntime_nativeSendInput(
-    JNIEnv* env, jclass clazz, jstring text) {
+    JNIEnv* env, jclass clazz, jobject buffer, jint length) {
 
-    const char* chars = env->GetStringUTFChars(text, nullptr);
-    if (!chars) return;
+    auto* bytes = static_cast<const uint8_t*>(env->GetDirectBufferAddress(buffer));
+    if (!bytes || length <= 0) return;
+    size_t len = std::min(static_cast<size_t>(length),
+                          static_cast<size_t>(env->GetDirectBufferCapacity(buffer)));
 
-    size_t len = strlen(chars);
-    if (len > 0) {
-        android_io::push_stdin(
-            reinterpret_cast<const uint8_t*>(chars), len);
-    }
-    env->ReleaseStringUTFChars(text, chars);
+    abandon_ready_point();
+    android_io::push_stdin(bytes, len);
 }
 
 /**
@@ -648,6 +644,8 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeStop(JNIEnv* env, jclass clazz) {
 
     LOGI("Stopping execution...");
     android_io::running.store(false);
+    g_pause_cv.notify_all();  // Release a parked thread
+    guestwait::interrupt();   // ... or one blocked in a guest call
 
     // Stop the machine (if it's running simulate())
     if (g_machine) {
@@ -673,6 +671,15 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeDestroy(JNIEnv* env, jclass clazz)
     // Stop first
     Java_com_example_c2wdemo_FriscyRuntime_nativeStop(env, clazz);
 
+    stop_output_thread();
+
+    // Tear down host listeners before the guest sockets they target
+    net::get_port_forwarder().remove_all();
+    net::get_listener_registry().clear();
+    net::get_traffic_shaper().shutdown_all();
+
+    snapshot::wait_background();
+    snapshot::cancel_mapped_check();
     g_machine.reset();
     g_vfs.reset();
 
@@ -687,6 +694,9 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeDestroy(JNIEnv* env, jclass clazz)
     syscalls::libriscv_brk_handler = nullptr;
     syscalls::net_is_socket_fd = nullptr;
     syscalls::net_get_native_fd = nullptr;
+    syscalls::net_close_socket = nullptr;
+    syscalls::net_is_nonblocking = nullptr;
+    syscalls::net_set_nonblocking = nullptr;
 
     // Clear callback
     {
@@ -715,69 +725,303 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeGetVersion(JNIEnv* env, jclass claz
 }
 
 // --- Snapshot save/restore ---
-// Custom format for flat arena mode (libriscv's built-in serialize
-// doesn't work with RISCV_FLAT_RW_ARENA).
-//
-// Format:
-//   [magic: 8]  [version: 4]  [regs_size: 4]
-//   [arena_size: 8]  [instruction_counter: 8]
-//   [registers: regs_size bytes]
-//   [arena: arena_size bytes]
+// Format and codec live in friscy/snapshot.hpp. Saves always write v2
+// (sparse, chunked, LZ4); restore also accepts legacy v1 files and walks
+// incremental chains. Each save also stores the runtime state outside the
+// arena (VFS delta, fds, threads, exec context, sockets), and the
+// execution thread is parked for the duration of a save or restore.
+
+static std::vector<uint8_t> capture_runtime_state() {
+    return session::capture_state(g_rootfs_digest, *g_vfs, *g_machine);
+}
 
-static constexpr uint64_t SNAPSHOT_MAGIC = 0x4653524953435946ULL;  // "FYSCRISF"
-static constexpr uint32_t SNAPSHOT_VERSION = 1;
+static bool runtime_state_compatible(const std::vector<uint8_t>& state) {
+    std::string error;
+    if (!session::state_compatible(state, g_rootfs_digest, error)) {
+        LOGE("%s", error.c_str());
+        return false;
+    }
+    return true;
+}
 
-JNIEXPORT jboolean JNICALL
-Java_com_example_c2wdemo_FriscyRuntime_nativeSaveSnapshot(
-    JNIEnv* env, jclass clazz, jstring jpath) {
+static bool apply_runtime_state(const std::vector<uint8_t>& state) {
+    return session::apply_state(state, *g_vfs, *g_machine);
+}
+
+static std::string jstring_to_std(JNIEnv* env, jstring js) {
+    const char* chars = env->GetStringUTFChars(js, nullptr);
+    std::string s = chars;
+    env->ReleaseStringUTFChars(js, chars);
+    return s;
+}
+
+// Mappable layout: raw, aligned chunks that restore lazily via mmap
+static std::atomic<bool> g_snapshot_mappable{false};
+// Stored layout: chunks deduplicated into the directory's chunk store
+static std::atomic<bool> g_snapshot_dedup{false};
+
+static jboolean save_snapshot(JNIEnv* env, jstring jpath, snapshot::SaveMode mode,
+                              bool background = false) {
     if (!g_machine) {
         LOGE("Cannot save snapshot: no machine");
         return JNI_FALSE;
     }
+    if (background && snapshot::background_pending()) {
+        LOGI("Background snapshot still running, skipping");
+        return JNI_FALSE;
+    }
 
-    const char* path = env->GetStringUTFChars(jpath, nullptr);
-    LOGI("Saving snapshot to: %s", path);
+    std::string path = jstring_to_std(env, jpath);
+    LOGI("Saving snapshot to: %s", path.c_str());
 
-    FILE* fp = fopen(path, "wb");
-    env->ReleaseStringUTFChars(jpath, path);
-    if (!fp) {
-        LOGE("Cannot open snapshot file for writing");
+    auto layout = g_snapshot_mappable.load() ? snapshot::Layout::Mappable
+                : g_snapshot_dedup.load()    ? snapshot::Layout::Stored
+                                             : snapshot::Layout::Compressed;
+    auto t0 = std::chrono::steady_clock::now();
+    if (!pause_execution()) {
+        LOGE("Snapshot save failed: guest did not pause");
+        return JNI_FALSE;
+    }
+    auto state = capture_runtime_state();
+    bool ok = background
+        ? snapshot::save_background(*g_machine, path, mode, layout, &state, t0)
+        : snapshot::save(*g_machine, path, mode, layout, &state);
+    resume_execution();
+    if (!ok) {
+        LOGE("Snapshot save failed");
         return JNI_FALSE;
     }
+    if (background) {
+        // Stats land in getRuntimeStats() once the writer finishes
+        LOGI("Snapshot started in background, guest paused %.2f ms",
+             std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - t0).count());
+        return JNI_TRUE;
+    }
 
-    auto& cpu = g_machine->cpu;
-    auto& mem = g_machine->memory;
-
-    // Header
-    uint64_t magic = SNAPSHOT_MAGIC;
-    uint32_t version = SNAPSHOT_VERSION;
-    uint32_t regs_size = static_cast<uint32_t>(sizeof(cpu.registers()));
-    uint64_t arena_size = mem.memory_arena_size();
-    uint64_t counter = g_machine->instruction_counter();
-
-    fwrite(&magic, 8, 1, fp);
-    fwrite(&version, 4, 1, fp);
-    fwrite(&regs_size, 4, 1, fp);
-    fwrite(&arena_size, 8, 1, fp);
-    fwrite(&counter, 8, 1, fp);
-
-    // CPU registers (POD struct)
-    fwrite(&cpu.registers(), regs_size, 1, fp);
-
-    // Flat arena memory
-    const void* arena = mem.memory_arena_ptr();
-    if (arena && arena_size > 0) {
-        size_t written = fwrite(arena, 1, arena_size, fp);
-        if (written != arena_size) {
-            LOGE("Short write: %zu / %zu", written, (size_t)arena_size);
-            fclose(fp);
-            return JNI_FALSE;
+    const auto& st = snapshot::g_last_save;
+    LOGI("Snapshot saved: %s depth=%u arena=%llu file=%llu (v1 %llu) state=%llu chunks=%u "
+         "zero=%u lz4=%u raw=%u unchanged=%u deduped=%u (+%llu store) %.1f ms, %.0f MB/s, "
+         "%u threads",
+         st.incremental ? "incremental" : "full", st.chain_depth,
+         (unsigned long long)st.arena_bytes, (unsigned long long)st.file_bytes,
+         (unsigned long long)st.v1_bytes, (unsigned long long)st.state_bytes,
+         st.chunks_total, st.chunks_zero,
+         st.chunks_lz4, st.chunks_raw, st.chunks_unchanged, st.chunks_deduped,
+         (unsigned long long)st.store_bytes, st.seconds * 1000.0,
+         st.arena_mb_per_sec(), st.threads);
+    return JNI_TRUE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSaveSnapshot(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    return save_snapshot(env, jpath, snapshot::SaveMode::Full);
+}
+
+/**
+ * Save only the chunks changed since the last snapshot saved or restored,
+ * with that snapshot as parent. Falls back to a full save when there is no
+ * usable parent or the chain is at its depth limit.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSaveIncrementalSnapshot(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    return save_snapshot(env, jpath, snapshot::SaveMode::Incremental);
+}
+
+/**
+ * Save with the guest paused only while the arena is write-protected; the
+ * file is written by a background thread, copying chunks aside as the guest
+ * writes to them. Returns false if the previous background save is still
+ * running. Completion shows up in getRuntimeStats().
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSaveSnapshotBackground(
+    JNIEnv* env, jclass clazz, jstring jpath, jboolean incremental) {
+    return save_snapshot(env, jpath,
+                         incremental ? snapshot::SaveMode::Incremental : snapshot::SaveMode::Full,
+                         true);
+}
+
+/**
+ * Rewrite an incremental snapshot in place as a standalone one, so its
+ * ancestors can be deleted.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeConsolidateSnapshot(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    std::string path = jstring_to_std(env, jpath);
+    if (!snapshot::consolidate(path)) {
+        LOGE("Snapshot consolidate failed: %s", path.c_str());
+        return JNI_FALSE;
+    }
+    return JNI_TRUE;
+}
+
+/**
+ * Choose the layout for subsequent saves. Mappable snapshots are larger
+ * (chunks stored raw) but restore without decoding: once the chunks pass
+ * their checksums, the arena is mmap'd from the file and paged in on first
+ * touch.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetSnapshotMappable(
+    JNIEnv* env, jclass clazz, jboolean enabled) {
+    g_snapshot_mappable.store(enabled == JNI_TRUE);
+}
+
+/**
+ * Deduplicate subsequent saves into the chunk store next to the snapshot
+ * (Layout::Stored). Ignored while the mappable layout is selected.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetSnapshotDedup(
+    JNIEnv* env, jclass clazz, jboolean enabled) {
+    g_snapshot_dedup.store(enabled == JNI_TRUE);
+}
+
+/**
+ * Delete a snapshot, releasing its chunks in the store. Children must have
+ * been consolidated first.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeDeleteSnapshot(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    return snapshot::remove(jstring_to_std(env, jpath)) ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * Check a snapshot and the files it depends on against their checksums,
+ * including chunks a restore would only map. Does not touch the machine.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeVerifySnapshot(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    std::string path = jstring_to_std(env, jpath);
+    bool ok = snapshot::verify(path);
+    if (!ok) LOGE("Snapshot %s failed verification", path.c_str());
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * Recount the chunk store of a snapshot directory and delete unreferenced
+ * chunks. Returns the number of files deleted, or -1 on error.
+ */
+JNIEXPORT jint JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeCollectSnapshotGarbage(
+    JNIEnv* env, jclass clazz, jstring jdir) {
+    std::string dir = jstring_to_std(env, jdir);
+    int removed = snapshot::collect_garbage(dir);
+    LOGI("Chunk store GC in %s: %d files removed", dir.c_str(), removed);
+    return removed;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetSnapshotStoreStats(
+    JNIEnv* env, jclass clazz, jstring jdir) {
+    std::string json = snapshot::store_stats_json(jstring_to_std(env, jdir));
+    return env->NewStringUTF(json.c_str());
+}
+
+// --- Chunk sync (see "Chunk sync" in friscy/snapshot.hpp) ---
+// Keys cross JNI as newline-separated 32-digit hex strings.
+
+static std::string keys_to_text(const std::vector<chunkstore::Key>& keys) {
+    std::string text;
+    text.reserve(keys.size() * 33);
+    for (const auto& k : keys) {
+        text += chunkstore::key_hex(k);
+        text += '\n';
+    }
+    return text;
+}
+
+static bool text_to_keys(const std::string& text, std::vector<chunkstore::Key>& keys) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        if (end > pos) {
+            chunkstore::Key k;
+            if (!chunkstore::parse_key(text.substr(pos, end - pos), k)) return false;
+            keys.push_back(k);
         }
+        pos = end + 1;
     }
+    return true;
+}
 
-    fclose(fp);
-    LOGI("Snapshot saved: regs=%u arena=%zu", regs_size, (size_t)arena_size);
-    return JNI_TRUE;
+/**
+ * Chunk keys a stored snapshot references (all, or only those missing from
+ * the local chunk store). Null if the file is not a stored snapshot.
+ */
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetSnapshotChunkKeys(
+    JNIEnv* env, jclass clazz, jstring jpath, jboolean missingOnly) {
+    std::vector<chunkstore::Key> keys;
+    if (!snapshot::chunk_keys(jstring_to_std(env, jpath), missingOnly == JNI_TRUE, keys)) {
+        return nullptr;
+    }
+    return env->NewStringUTF(keys_to_text(keys).c_str());
+}
+
+/**
+ * Pack chunks from the store of `dir` for transfer. The pack is capped in
+ * size, so it may hold only a prefix of `keys`; the caller sends the rest
+ * in further packs. Null if a key is unknown.
+ */
+JNIEXPORT jbyteArray JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativePackSnapshotChunks(
+    JNIEnv* env, jclass clazz, jstring jdir, jstring jkeys) {
+    std::vector<chunkstore::Key> keys;
+    if (!text_to_keys(jstring_to_std(env, jkeys), keys)) return nullptr;
+    std::vector<uint8_t> pack;
+    size_t packed = 0;
+    if (!snapshot::pack_chunks(jstring_to_std(env, jdir), keys, pack, packed)) return nullptr;
+    jbyteArray out = env->NewByteArray(static_cast<jsize>(pack.size()));
+    if (out) {
+        env->SetByteArrayRegion(out, 0, static_cast<jsize>(pack.size()),
+                                reinterpret_cast<const jbyte*>(pack.data()));
+    }
+    return out;
+}
+
+/**
+ * Verify and add the chunks of a received pack to the store of `dir`.
+ * Returns the number of new chunks, or -1 if the pack is corrupt.
+ */
+JNIEXPORT jint JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeUnpackSnapshotChunks(
+    JNIEnv* env, jclass clazz, jstring jdir, jbyteArray jpack) {
+    std::string dir = jstring_to_std(env, jdir);
+    jsize len = env->GetArrayLength(jpack);
+    jbyte* data = env->GetByteArrayElements(jpack, nullptr);
+    if (!data) return -1;
+    int added = snapshot::unpack_chunks(dir, reinterpret_cast<const uint8_t*>(data), len);
+    env->ReleaseByteArrayElements(jpack, data, JNI_ABORT);
+    if (added < 0) LOGE("Rejected corrupt chunk pack (%d bytes)", len);
+    return added;
+}
+
+/**
+ * Move a received manifest into place once all its chunks are present.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeImportSnapshotManifest(
+    JNIEnv* env, jclass clazz, jstring jsrc, jstring jdest) {
+    return snapshot::import_manifest(jstring_to_std(env, jsrc), jstring_to_std(env, jdest))
+        ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * Parent snapshot path of an incremental snapshot, or null.
+ */
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetSnapshotParent(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    std::string parent = snapshot::parent_of(jstring_to_std(env, jpath));
+    return parent.empty() ? nullptr : env->NewStringUTF(parent.c_str());
 }
 
 JNIEXPORT jboolean JNICALL
@@ -788,85 +1032,339 @@ Java_com_example_c2wdemo_FriscyRuntime_nativeRestoreSnapshot(
         return JNI_FALSE;
     }
 
-    const char* path = env->GetStringUTFChars(jpath, nullptr);
-    LOGI("Restoring snapshot from: %s", path);
+    std::string path = jstring_to_std(env, jpath);
+    LOGI("Restoring snapshot from: %s", path.c_str());
+
+    // Snapshots without state (v1, or saved before runtime state existed)
+    // restore memory and registers only, as they always did
+    std::vector<uint8_t> state;
+    bool has_state = snapshot::read_state(path, state);
+    if (has_state && !runtime_state_compatible(state)) return JNI_FALSE;
 
-    FILE* fp = fopen(path, "rb");
-    env->ReleaseStringUTFChars(jpath, path);
-    if (!fp) {
-        LOGE("Cannot open snapshot file for reading");
+    if (!pause_execution()) {
+        LOGE("Snapshot restore failed: guest did not pause");
+        return JNI_FALSE;
+    }
+    // The previous restore's mapped-chunk check no longer applies; this
+    // restore starts its own
+    snapshot::cancel_mapped_check();
+    g_snapshot_corrupt.store(false);
+    bool ok = snapshot::restore(*g_machine, path);
+    if (ok) {
+        // The arena was replaced: no library text is resident, nothing aliased
+        prelink::reset();
+        pagecache::reset();
+    }
+    if (ok && has_state && !apply_runtime_state(state)) {
+        // The arena is already replaced; the session is not resumable
+        LOGE("Snapshot runtime state is corrupt");
+        ok = false;
+    }
+    resume_execution();
+    if (!ok) {
+        LOGE("Snapshot restore failed");
         return JNI_FALSE;
     }
+    if (!has_state) LOGI("Snapshot has no runtime state; restored memory only");
+
+    const auto& st = snapshot::g_last_restore;
+    LOGI("Snapshot restored: v%u depth=%u arena=%llu file=%llu mapped=%llu/%u chunks=%u zero=%u "
+         "%.1f ms, %.0f MB/s, %u threads",
+         st.version, st.chain_depth, (unsigned long long)st.arena_bytes,
+         (unsigned long long)st.file_bytes, (unsigned long long)st.mapped_bytes,
+         st.mapped_regions, st.chunks_total, st.chunks_zero,
+         st.seconds * 1000.0, st.arena_mb_per_sec(), st.threads);
+    return JNI_TRUE;
+}
 
-    // Read and validate header
-    uint64_t magic = 0;
-    uint32_t version = 0, regs_size = 0;
-    uint64_t arena_size = 0, counter = 0;
+// --- VM templates ---
 
-    fread(&magic, 8, 1, fp);
-    fread(&version, 4, 1, fp);
-    fread(&regs_size, 4, 1, fp);
-    fread(&arena_size, 8, 1, fp);
-    fread(&counter, 8, 1, fp);
+/**
+ * Declare the ready point for templates: the first stdin wait after
+ * `marker` appears in guest output, or the first stdin wait if null/empty.
+ * Takes effect from the next loadRootfs.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetReadyMarker(
+    JNIEnv* env, jclass clazz, jstring marker) {
+    std::lock_guard<std::mutex> lock(g_ready_mutex);
+    g_ready_marker = marker ? jstring_to_std(env, marker) : std::string();
+}
+
+/**
+ * Block until the guest reaches the ready point. Returns false on timeout,
+ * or if the guest exits or receives input first.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeWaitReady(
+    JNIEnv* env, jclass clazz, jlong timeoutMs) {
+    std::unique_lock<std::mutex> lock(g_ready_mutex);
+    g_ready_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [] {
+        return g_ready || g_ready_abandoned || !android_io::running.load();
+    });
+    return g_ready ? JNI_TRUE : JNI_FALSE;
+}
 
-    if (magic != SNAPSHOT_MAGIC) {
-        LOGE("Invalid snapshot magic");
-        fclose(fp);
+/**
+ * Save a template of the running session: a full snapshot in the mappable
+ * layout, so every session cloned from it restores with a few mmap calls
+ * and shares the template's pages until it writes to them.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSaveTemplate(
+    JNIEnv* env, jclass clazz, jstring jpath) {
+    if (!g_machine) {
+        LOGE("Cannot save template: no machine");
+        return JNI_FALSE;
+    }
+    std::string path = jstring_to_std(env, jpath);
+    if (!pause_execution()) {
+        LOGE("Template save failed: guest did not pause");
         return JNI_FALSE;
     }
-    if (version != SNAPSHOT_VERSION) {
-        LOGE("Unsupported snapshot version: %u", version);
-        fclose(fp);
+    auto state = capture_runtime_state();
+    bool ok = snapshot::save(*g_machine, path, snapshot::SaveMode::Full,
+                             snapshot::Layout::Mappable, &state);
+    resume_execution();
+    if (!ok) {
+        LOGE("Template save failed: %s", path.c_str());
         return JNI_FALSE;
     }
+    const auto& st = snapshot::g_last_save;
+    LOGI("Template saved: %s file=%llu chunks=%u zero=%u %.1f ms", path.c_str(),
+         (unsigned long long)st.file_bytes, st.chunks_total, st.chunks_zero,
+         st.seconds * 1000.0);
+    return JNI_TRUE;
+}
 
-    auto& cpu = g_machine->cpu;
-    auto& mem = g_machine->memory;
+/**
+ * Digest of the loaded rootfs and entry path as 16 hex digits. Snapshots
+ * only restore onto the image with the same digest; templates are keyed
+ * by it.
+ */
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetImageDigest(JNIEnv* env, jclass clazz) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)g_rootfs_digest);
+    return env->NewStringUTF(hex);
+}
 
-    uint32_t expected_regs = static_cast<uint32_t>(sizeof(cpu.registers()));
-    uint64_t expected_arena = mem.memory_arena_size();
+JNIEXPORT void JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetTerminalSize(
+    JNIEnv* env, jclass clazz, jint cols, jint rows) {
+    android_io::term_cols.store(cols, std::memory_order_relaxed);
+    android_io::term_rows.store(rows, std::memory_order_relaxed);
+    LOGI("Terminal size: %dx%d", cols, rows);
+}
 
-    if (regs_size != expected_regs) {
-        LOGE("Register size mismatch: file=%u expected=%u", regs_size, expected_regs);
-        fclose(fp);
-        return JNI_FALSE;
+/**
+ * Runtime counters as JSON:
+ * {"iobuf":{...},"port_forward":{...},"shaper":{...},"snapshot":{...},
+ *  "exec_lookup":{...},"prelink":{...},"load":{...},"page_cache":{...},
+ *  "signals":{...},"output":{...}}.
+ * "load" holds the phase timings of the last nativeLoadRootfs().
+ */
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetRuntimeStats(JNIEnv* env, jclass clazz) {
+    std::string json = "{\"iobuf\":" + iobuf::stats_json() +
+                       ",\"port_forward\":" + net::get_port_forwarder().stats_json() +
+                       ",\"shaper\":" + net::get_traffic_shaper().stats_json() +
+                       ",\"snapshot\":" + snapshot::stats_json() +
+                       ",\"exec_lookup\":" + execlookup::stats_json() +
+                       ",\"prelink\":" + prelink::stats_json() +
+                       ",\"load\":" + session::load_stats_json() +
+                       ",\"page_cache\":" + pagecache::stats_json() +
+                       ",\"signals\":" + signals::stats_json() +
+                       ",\"output\":" + g_output_ring.stats_json() + "}";
+    return env->NewStringUTF(json.c_str());
+}
+
+/**
+ * Startup critical path of the last nativeLoadRootfs() as JSON:
+ * {"complete":bool,"phases":[{"phase":"tar_ingest","at_ms":..,"ms":..},...],
+ *  "syscalls":[{"nr":..,"at_ms":..},...]}. Phases are listed in
+ * friscy/boot_trace.hpp; "complete" once the guest first read stdin.
+ */
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetBootTrace(JNIEnv* env, jclass clazz) {
+    return env->NewStringUTF(boottrace::report_json().c_str());
+}
+
+/**
+ * Output path throughput: push `totalBytes` of `sample`, repeated, through
+ * the output ring and delivery thread into `sink` (in place of the terminal
+ * callback), as the execution thread would. Returns
+ * {"bytes":..,"ms":..,"mb_per_s":..,"batches":..}, or null while a guest
+ * runs, since the ring takes one producer at a time.
+ */
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeBenchmarkOutput(
+    JNIEnv* env, jclass clazz, jbyteArray sample, jlong totalBytes, jobject sink) {
+    if (android_io::running.load() || totalBytes <= 0) return nullptr;
+    jsize sample_len = env->GetArrayLength(sample);
+    if (sample_len <= 0) return nullptr;
+    std::vector<uint8_t> chunk(sample_len);
+    env->GetByteArrayRegion(sample, 0, sample_len, reinterpret_cast<jbyte*>(chunk.data()));
+
+    // Let the terminal have what it is still owed, then swap the sink in
+    bool was_running = g_output_running.load();
+    while (was_running && g_output_delivered.load() < g_output_ring.stats().bytes_in.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    if (arena_size != expected_arena) {
-        LOGE("Arena size mismatch: file=%zu expected=%zu",
-             (size_t)arena_size, (size_t)expected_arena);
-        fclose(fp);
-        return JNI_FALSE;
+    jobject saved_obj;
+    jmethodID saved_method;
+    {
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        saved_obj = g_callback_obj;
+        saved_method = g_on_output_method;
+        g_callback_obj = env->NewGlobalRef(sink);
+        jclass cls = env->GetObjectClass(sink);
+        g_on_output_method = env->GetMethodID(cls, "onOutput", "(Ljava/nio/ByteBuffer;I)V");
+    }
+    start_output_thread();
+
+    uint64_t total = static_cast<uint64_t>(totalBytes);
+    uint64_t target = g_output_delivered.load() + total;
+    uint64_t batches = g_output_ring.stats().batches.load();
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t left = total; left > 0;) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(left, chunk.size()));
+        g_output_ring.write(chunk.data(), n);
+        left -= n;
     }
+    while (g_output_delivered.load() < target) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t0).count();
+    batches = g_output_ring.stats().batches.load() - batches;
 
-    // Restore CPU registers
-    fread(&cpu.registers(), regs_size, 1, fp);
+    if (!was_running) stop_output_thread();
+    {
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        env->DeleteGlobalRef(g_callback_obj);
+        g_callback_obj = saved_obj;
+        g_on_output_method = saved_method;
+    }
 
-    // Restore arena memory
-    void* arena = mem.memory_arena_ptr();
-    if (arena && arena_size > 0) {
-        size_t read_bytes = fread(arena, 1, arena_size, fp);
-        if (read_bytes != arena_size) {
-            LOGE("Short read: %zu / %zu", read_bytes, (size_t)arena_size);
-            fclose(fp);
-            return JNI_FALSE;
+    char json[160];
+    snprintf(json, sizeof(json), "{\"bytes\":%llu,\"ms\":%.2f,\"mb_per_s\":%.1f,\"batches\":%llu}",
+             (unsigned long long)total, ms, ms > 0 ? total / ms / 1e3 : 0.0,
+             (unsigned long long)batches);
+    LOGI("Output benchmark: %s", json);
+    return env->NewStringUTF(json);
+}
+
+// --- Port forwarding ---
+
+/**
+ * Forward 127.0.0.1:hostPort to a guest listening socket.
+ *
+ * @param guestPort Guest TCP port (ignored when guestUnixPath is set)
+ * @param guestUnixPath Guest AF_UNIX path, or null for TCP
+ * @param maxConnections Concurrent connection limit (<= 0 for default)
+ * @return forward id (> 0) or negative errno
+ */
+JNIEXPORT jint JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeAddPortForward(
+    JNIEnv* env, jclass clazz, jint hostPort, jint guestPort,
+    jstring guestUnixPath, jint maxConnections) {
+    std::string unix_path;
+    if (guestUnixPath) {
+        const char* chars = env->GetStringUTFChars(guestUnixPath, nullptr);
+        if (chars) {
+            unix_path = chars;
+            env->ReleaseStringUTFChars(guestUnixPath, chars);
         }
     }
+    int id = net::get_port_forwarder().add(
+        static_cast<uint16_t>(hostPort), static_cast<uint16_t>(guestPort),
+        unix_path, maxConnections);
+    if (id < 0) {
+        LOGE("Port forward %d failed: %s", hostPort, strerror(-id));
+    } else {
+        LOGI("Port forward #%d: 127.0.0.1:%d -> guest %s", id, hostPort,
+             unix_path.empty() ? std::to_string(guestPort).c_str() : unix_path.c_str());
+    }
+    return id;
+}
 
-    // Restore instruction counter
-    g_machine->reset_instruction_counter();
-    // Note: we don't restore the exact counter, just reset it
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeRemovePortForward(
+    JNIEnv* env, jclass clazz, jint id) {
+    return net::get_port_forwarder().remove(id) ? JNI_TRUE : JNI_FALSE;
+}
 
-    fclose(fp);
-    LOGI("Snapshot restored: regs=%u arena=%zu", regs_size, (size_t)arena_size);
+JNIEXPORT jstring JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeGetPortForwardStats(JNIEnv* env, jclass clazz) {
+    return env->NewStringUTF(net::get_port_forwarder().stats_json().c_str());
+}
+
+/**
+ * Restrict guest wildcard binds to loopback so guest servers are reachable
+ * only through explicit port forwards.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetGuestLoopbackOnly(
+    JNIEnv* env, jclass clazz, jboolean enabled) {
+    net::get_network_ctx().set_loopback_only(enabled == JNI_TRUE);
+}
+
+// --- Traffic shaping ---
+
+/**
+ * Shape guest traffic to a destination, or VM-wide when dest is null.
+ *
+ * @param dest "1.2.3.4", "10.0.0.0/8", "host:port", "[v6]:port", "*:53"
+ * @param downBps / upBps bytes per second (0 = unlimited)
+ * @param loss probability 0..1 per chunk (TCP stall) or datagram (UDP drop)
+ * @return false if dest could not be parsed
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetTrafficShaping(
+    JNIEnv* env, jclass clazz, jstring dest, jlong downBps, jlong upBps,
+    jint latencyMs, jint jitterMs, jfloat loss) {
+    net::ShapingProfile profile;
+    profile.down_bps = static_cast<uint64_t>(std::max<jlong>(0, downBps));
+    profile.up_bps = static_cast<uint64_t>(std::max<jlong>(0, upBps));
+    profile.latency_ms = static_cast<uint32_t>(std::max<jint>(0, latencyMs));
+    profile.jitter_ms = static_cast<uint32_t>(std::max<jint>(0, jitterMs));
+    profile.loss = std::clamp<double>(loss, 0.0, 1.0);
+
+    auto& shaper = net::get_traffic_shaper();
+    if (!dest) {
+        shaper.set_default(profile);
+        LOGI("Traffic shaping (default): down=%lld up=%lld lat=%dms jitter=%dms loss=%.3f",
+             (long long)downBps, (long long)upBps, latencyMs, jitterMs, profile.loss);
+        return JNI_TRUE;
+    }
+
+    const char* chars = env->GetStringUTFChars(dest, nullptr);
+    std::string dest_str = chars ? chars : "";
+    if (chars) env->ReleaseStringUTFChars(dest, chars);
+    if (!shaper.add_rule(dest_str, profile)) {
+        LOGE("Invalid shaping destination: %s", dest_str.c_str());
+        return JNI_FALSE;
+    }
+    LOGI("Traffic shaping (%s): down=%lld up=%lld lat=%dms jitter=%dms loss=%.3f",
+         dest_str.c_str(), (long long)downBps, (long long)upBps,
+         latencyMs, jitterMs, profile.loss);
     return JNI_TRUE;
 }
 
 JNIEXPORT void JNICALL
-Java_com_example_c2wdemo_FriscyRuntime_nativeSetTerminalSize(
-    JNIEnv* env, jclass clazz, jint cols, jint rows) {
-    android_io::term_cols.store(cols, std::memory_order_relaxed);
-    android_io::term_rows.store(rows, std::memory_order_relaxed);
-    LOGI("Terminal size: %dx%d", cols, rows);
+Java_com_example_c2wdemo_FriscyRuntime_nativeClearTrafficShaping(JNIEnv* env, jclass clazz) {
+    net::get_traffic_shaper().clear();
+}
+
+/**
+ * Seed jitter/loss decisions (0 = random). Applies to connections made
+ * after the call, so set it before starting a benchmark run.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_c2wdemo_FriscyRuntime_nativeSetTrafficShapingSeed(
+    JNIEnv* env, jclass clazz, jlong seed) {
+    net::get_traffic_shaper().set_seed(static_cast<uint64_t>(seed));
 }
 
 } // extern "C"
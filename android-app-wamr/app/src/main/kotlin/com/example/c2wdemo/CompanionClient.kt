@@ -21,6 +21,8 @@ import kotlin.coroutines.resume
  *   - GET  /snapshots/{name}       -> snapshot binary
  *   - PUT  /snapshots/{name}       -> upload snapshot binary
  *   - DELETE /snapshots/{name}     -> delete snapshot
+ *   - /sync/...                    -> delta sync of deduplicated snapshots,
+ *                                     see [SnapshotSync]
  */
 class CompanionClient(private val context: Context) {
 
@@ -145,6 +147,34 @@ class CompanionClient(private val context: Context) {
         }
     }
 
+    /**
+     * Push a deduplicated snapshot, sending only the chunks the companion
+     * does not have yet. Resumes where an interrupted push stopped.
+     */
+    suspend fun pushSnapshot(snapshotFile: File): Boolean = withContext(Dispatchers.IO) {
+        val base = companionUrl ?: return@withContext false
+        val sync = SnapshotSync(base, NativeChunkStore(snapshotFile.absoluteFile.parentFile!!))
+        sync.push(snapshotFile, snapshotFile.nameWithoutExtension).also { ok ->
+            sync.lastResult?.takeIf { ok }?.let {
+                Log.i(TAG, "Pushed ${snapshotFile.name}: ${it.chunksSent}/${it.chunksTotal} chunks, ${it.bytesSent} bytes")
+            }
+        }
+    }
+
+    /**
+     * Pull a deduplicated snapshot into [destFile] (inside the snapshots
+     * directory), fetching only chunks missing locally.
+     */
+    suspend fun pullSnapshot(name: String, destFile: File): Boolean = withContext(Dispatchers.IO) {
+        val base = companionUrl ?: return@withContext false
+        val sync = SnapshotSync(base, NativeChunkStore(destFile.absoluteFile.parentFile!!))
+        sync.pull(name, destFile).also { ok ->
+            sync.lastResult?.takeIf { ok }?.let {
+                Log.i(TAG, "Pulled $name: ${it.chunksSent}/${it.chunksTotal} chunks, ${it.bytesSent} bytes")
+            }
+        }
+    }
+
     /** List snapshots available on the companion. */
     suspend fun listRemoteSnapshots(): List<String> = withContext(Dispatchers.IO) {
         val base = companionUrl ?: return@withContext emptyList()
@@ -1,5 +1,7 @@
 package com.example.c2wdemo
 
+import java.nio.ByteBuffer
+
 /**
  * JNI wrapper for friscy — libriscv RISC-V 64 emulator.
  *
@@ -11,8 +13,33 @@ object FriscyRuntime {
         System.loadLibrary("friscy_android")
     }
 
+    /**
+     * Receives guest terminal output on the runtime's output thread, batched
+     * to at most one call per frame. The first [length] bytes of [buffer]
+     * are the raw output, not necessarily valid UTF-8; the buffer is reused
+     * once the call returns, so copy them out before posting to the UI thread.
+     */
     interface OutputCallback {
-        fun onOutput(text: String)
+        fun onOutput(buffer: ByteBuffer, length: Int)
+    }
+
+    /**
+     * Emulated network conditions for guest traffic. Rates are bytes/sec
+     * (0 = unlimited); latency and jitter apply to each direction.
+     */
+    data class NetworkConditions(
+        val downBytesPerSec: Long = 0,
+        val upBytesPerSec: Long = 0,
+        val latencyMs: Int = 0,
+        val jitterMs: Int = 0,
+        val lossRate: Float = 0f,
+    ) {
+        companion object {
+            val UNSHAPED = NetworkConditions()
+            val SLOW_3G = NetworkConditions(50_000, 50_000, 200, 50, 0.01f)
+            val FAST_3G = NetworkConditions(200_000, 90_000, 75, 20, 0.005f)
+            val LTE = NetworkConditions(1_500_000, 500_000, 35, 10, 0.001f)
+        }
     }
 
     // --- Native methods ---
@@ -20,7 +47,7 @@ object FriscyRuntime {
     external fun nativeInit(): Boolean
     external fun nativeLoadRootfs(tarBytes: ByteArray, entryPath: String, callback: OutputCallback): Boolean
     external fun nativeStart(): Boolean
-    external fun nativeSendInput(text: String)
+    external fun nativeSendInput(buffer: ByteBuffer, length: Int)
     external fun nativeStop()
     external fun nativeDestroy()
     external fun nativeIsRunning(): Boolean
@@ -28,32 +55,181 @@ object FriscyRuntime {
     external fun nativeSetTerminalSize(cols: Int, rows: Int)
     external fun nativeSaveSnapshot(path: String): Boolean
     external fun nativeRestoreSnapshot(path: String): Boolean
+    external fun nativeSaveIncrementalSnapshot(path: String): Boolean
+    external fun nativeSaveSnapshotBackground(path: String, incremental: Boolean): Boolean
+    external fun nativeConsolidateSnapshot(path: String): Boolean
+    external fun nativeGetSnapshotParent(path: String): String?
+    external fun nativeSetSnapshotMappable(enabled: Boolean)
+    external fun nativeSetSnapshotDedup(enabled: Boolean)
+    external fun nativeDeleteSnapshot(path: String): Boolean
+    external fun nativeVerifySnapshot(path: String): Boolean
+    external fun nativeCollectSnapshotGarbage(dir: String): Int
+    external fun nativeGetSnapshotStoreStats(dir: String): String
+    external fun nativeGetSnapshotChunkKeys(path: String, missingOnly: Boolean): String?
+    external fun nativePackSnapshotChunks(dir: String, keys: String): ByteArray?
+    external fun nativeUnpackSnapshotChunks(dir: String, pack: ByteArray): Int
+    external fun nativeImportSnapshotManifest(src: String, dest: String): Boolean
+    external fun nativeSetReadyMarker(marker: String?)
+    external fun nativeWaitReady(timeoutMs: Long): Boolean
+    external fun nativeSaveTemplate(path: String): Boolean
+    external fun nativeGetImageDigest(): String
+    external fun nativeGetRuntimeStats(): String
+    external fun nativeGetBootTrace(): String
+    external fun nativeBenchmarkOutput(sample: ByteArray, totalBytes: Long, sink: OutputCallback): String?
+    external fun nativeAddPortForward(hostPort: Int, guestPort: Int, guestUnixPath: String?, maxConnections: Int): Int
+    external fun nativeRemovePortForward(id: Int): Boolean
+    external fun nativeGetPortForwardStats(): String
+    external fun nativeSetGuestLoopbackOnly(enabled: Boolean)
+    external fun nativeSetTrafficShaping(
+        dest: String?, downBps: Long, upBps: Long, latencyMs: Int, jitterMs: Int, loss: Float,
+    ): Boolean
+    external fun nativeClearTrafficShaping()
+    external fun nativeSetTrafficShapingSeed(seed: Long)
 
     // --- Kotlin API ---
 
     fun initialize(): Boolean = nativeInit()
 
-    fun loadRootfs(tarBytes: ByteArray, entryPath: String = "/bin/sh", onOutput: (String) -> Unit): Boolean {
+    fun loadRootfs(tarBytes: ByteArray, entryPath: String = "/bin/sh", onOutput: (ByteArray) -> Unit): Boolean {
         return nativeLoadRootfs(tarBytes, entryPath, object : OutputCallback {
-            override fun onOutput(text: String) {
-                onOutput(text)
+            override fun onOutput(buffer: ByteBuffer, length: Int) {
+                onOutput(copyOut(buffer, length))
             }
         })
     }
 
     fun start(): Boolean = nativeStart()
 
-    fun sendInput(input: String) {
-        if (isRunning) {
-            nativeSendInput(input)
+    /** Direct buffer shared with the native side for stdin bytes. */
+    private val inputBuffer: ByteBuffer = ByteBuffer.allocateDirect(INPUT_BUFFER_SIZE)
+
+    /** Send raw bytes to the guest's stdin. */
+    fun sendInput(data: ByteArray, offset: Int = 0, count: Int = data.size) {
+        if (!isRunning) return
+        synchronized(inputBuffer) {
+            var done = 0
+            while (done < count) {
+                val n = minOf(count - done, INPUT_BUFFER_SIZE)
+                inputBuffer.clear()
+                inputBuffer.put(data, offset + done, n)
+                nativeSendInput(inputBuffer, n)
+                done += n
+            }
         }
     }
 
+    private fun copyOut(buffer: ByteBuffer, length: Int): ByteArray {
+        val bytes = ByteArray(length)
+        buffer.clear()
+        buffer.get(bytes)
+        return bytes
+    }
+
     fun stop() = nativeStop()
 
+    /**
+     * Forward 127.0.0.1:[hostPort] to a guest listener, either TCP [guestPort]
+     * or the AF_UNIX socket at [guestUnixPath]. Guest listeners bind real
+     * host ports on the same loopback, so a TCP forward needs a [hostPort]
+     * other than [guestPort] (-EINVAL otherwise). Returns a forward id, or a
+     * negative errno on failure.
+     */
+    fun addPortForward(
+        hostPort: Int,
+        guestPort: Int,
+        guestUnixPath: String? = null,
+        maxConnections: Int = 0,
+    ): Int = nativeAddPortForward(hostPort, guestPort, guestUnixPath, maxConnections)
+
+    fun removePortForward(id: Int): Boolean = nativeRemovePortForward(id)
+
+    /** Per-forward connection and byte counters as JSON. */
+    val portForwardStats: String get() = nativeGetPortForwardStats()
+
+    /**
+     * Shape guest traffic to [destination] ("10.0.0.0/8", "host:443", ...),
+     * or all guest traffic when null. Returns false for an unparsable destination.
+     */
+    fun setNetworkConditions(conditions: NetworkConditions, destination: String? = null): Boolean =
+        nativeSetTrafficShaping(
+            destination,
+            conditions.downBytesPerSec,
+            conditions.upBytesPerSec,
+            conditions.latencyMs,
+            conditions.jitterMs,
+            conditions.lossRate,
+        )
+
+    fun clearNetworkConditions() = nativeClearTrafficShaping()
+
+    /** Make jitter/loss decisions repeatable across runs (0 = random). */
+    fun setNetworkSeed(seed: Long) = nativeSetTrafficShapingSeed(seed)
+
+    /** Keep guest wildcard binds on loopback so only port forwards reach them. */
+    fun setGuestLoopbackOnly(enabled: Boolean) = nativeSetGuestLoopbackOnly(enabled)
+
+    /**
+     * Save snapshots uncompressed and page-aligned so restore maps them
+     * instead of reading them: larger files, near-instant resume.
+     */
+    fun setSnapshotMappable(enabled: Boolean) = nativeSetSnapshotMappable(enabled)
+
+    /**
+     * Store snapshot chunks once in a content-addressed store shared by all
+     * snapshots in the same directory; the snapshot file becomes a manifest.
+     */
+    fun setSnapshotDedup(enabled: Boolean) = nativeSetSnapshotDedup(enabled)
+
+    /**
+     * Ready point for templates: the guest's first wait on an empty stdin
+     * after [marker] appears in its output (any stdin wait when null).
+     * Set before [loadRootfs].
+     */
+    fun setReadyMarker(marker: String?) = nativeSetReadyMarker(marker)
+
+    /** Wait for the ready point; false on timeout or if the guest exited. */
+    fun waitReady(timeoutMs: Long): Boolean = nativeWaitReady(timeoutMs)
+
+    /** Digest of the loaded rootfs and entry point (16 hex digits). */
+    val imageDigest: String get() = nativeGetImageDigest()
+
     fun destroy() = nativeDestroy()
 
     val isRunning: Boolean get() = nativeIsRunning()
 
     val version: String get() = nativeGetVersion()
+
+    /** Native runtime counters (I/O buffer pool, port forwards, snapshots, exec lookups, prelinked libraries, load phase timings, mmap page sharing, guest signals, terminal output ring) as JSON. */
+    val runtimeStats: String get() = nativeGetRuntimeStats()
+
+    /** Startup phases and first syscalls of the last [loadRootfs], up to the first stdin read, as JSON. */
+    val bootTrace: String get() = nativeGetBootTrace()
+
+    /**
+     * Push [totalBytes] of UTF-8-heavy terminal output (CJK, emoji, box
+     * drawing, SGR colours) through the native output ring and delivery
+     * thread into a callback that copies each batch out, as [loadRootfs]'s
+     * does. Returns {"bytes","ms","mb_per_s","batches"} as JSON, or null
+     * while a guest is running.
+     */
+    fun benchmarkOutput(totalBytes: Long = BENCHMARK_BYTES): String? =
+        nativeBenchmarkOutput(benchmarkSample, totalBytes, object : OutputCallback {
+            override fun onOutput(buffer: ByteBuffer, length: Int) {
+                copyOut(buffer, length)
+            }
+        })
+
+    private val benchmarkSample: ByteArray by lazy {
+        buildString {
+            repeat(8) { i ->
+                append("\u001B[1;3${i % 8}m\u2714\u001B[0m ")
+                append("\u6D4B\u8BD5\u8F93\u51FA \u30ED\u30B0 \uCD9C\uB825 ")
+                append("\u256D\u2500\u2500\u256E \u2502\u00E4\u00F6\u00FC\u00DF\u2502 ")
+                append("\uD83D\uDE80\uD83C\uDF89\uD83D\uDC4D \u2026 line $i\r\n")
+            }
+        }.toByteArray(Charsets.UTF_8)
+    }
+
+    private const val INPUT_BUFFER_SIZE = 4096
+    private const val BENCHMARK_BYTES = 16L shl 20
 }
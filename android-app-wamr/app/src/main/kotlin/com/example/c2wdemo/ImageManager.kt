@@ -24,6 +24,8 @@ data class ContainerImage(
     val downloadUrl: String?,
     val entryPoint: String,
     val sizeBytes: Long,
+    /** Output that precedes the template ready point; null = first stdin wait. */
+    val readyMarker: String? = null,
 )
 
 /** Download progress update. */
@@ -139,6 +141,7 @@ class ImageManager(private val context: Context) {
                     downloadUrl = obj.optString("downloadUrl").ifEmpty { null },
                     entryPoint = obj.getString("entryPoint"),
                     sizeBytes = obj.optLong("sizeBytes", 0),
+                    readyMarker = obj.optString("readyMarker").ifEmpty { null },
                 )
             }
         }
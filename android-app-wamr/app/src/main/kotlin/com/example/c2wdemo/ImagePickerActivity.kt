@@ -305,6 +305,7 @@ class ImagePickerActivity : ComponentActivity() {
         val intent = Intent(this, MainActivity::class.java).apply {
             putExtra(EXTRA_IMAGE_ID, image.id)
             putExtra(EXTRA_ENTRY_POINT, image.entryPoint)
+            putExtra(EXTRA_READY_MARKER, image.readyMarker)
             if (image.bundledAsset != null) {
                 putExtra(EXTRA_IMAGE_SOURCE, SOURCE_ASSET)
                 putExtra(EXTRA_ASSET_NAME, image.bundledAsset)
@@ -322,6 +323,7 @@ class ImagePickerActivity : ComponentActivity() {
         const val EXTRA_IMAGE_SOURCE = "image_source"
         const val EXTRA_ASSET_NAME = "asset_name"
         const val EXTRA_FILE_PATH = "file_path"
+        const val EXTRA_READY_MARKER = "ready_marker"
         const val SOURCE_ASSET = "asset"
         const val SOURCE_FILE = "file"
 
@@ -71,9 +71,9 @@ class MainActivity : AppCompatActivity() {
             }
 
             // Register for live output
-            localBinder.service.setOutputCallback { text ->
+            localBinder.service.setOutputCallback { bytes ->
                 runOnUiThread {
-                    feedOutput(text)
+                    feedOutput(bytes)
                 }
             }
         }
@@ -136,6 +136,10 @@ class MainActivity : AppCompatActivity() {
                 intent.getStringExtra(ImagePickerActivity.EXTRA_FILE_PATH))
             putExtra(ImagePickerActivity.EXTRA_ENTRY_POINT,
                 intent.getStringExtra(ImagePickerActivity.EXTRA_ENTRY_POINT) ?: "/bin/sh")
+            putExtra(ImagePickerActivity.EXTRA_IMAGE_ID,
+                intent.getStringExtra(ImagePickerActivity.EXTRA_IMAGE_ID))
+            putExtra(ImagePickerActivity.EXTRA_READY_MARKER,
+                intent.getStringExtra(ImagePickerActivity.EXTRA_READY_MARKER))
         }
         startService(serviceIntent)
         bindService(serviceIntent, serviceConnection, Context.BIND_AUTO_CREATE)
@@ -146,8 +150,8 @@ class MainActivity : AppCompatActivity() {
         if (::statsProvider.isInitialized) {
             statsProvider.resume(lifecycleScope)
         }
-        vmService?.setOutputCallback { text ->
-            runOnUiThread { feedOutput(text) }
+        vmService?.setOutputCallback { bytes ->
+            runOnUiThread { feedOutput(bytes) }
         }
     }
 
@@ -163,11 +167,11 @@ class MainActivity : AppCompatActivity() {
      * Feed output from the friscy runtime into the terminal emulator.
      * The TerminalEmulator handles all ANSI escape sequence parsing.
      */
-    private fun feedOutput(text: String) {
+    private fun feedOutput(bytes: ByteArray) {
         if (::statsProvider.isInitialized) {
             statsProvider.onOutputEvent()
         }
-        bridge.feedOutput(text)
+        bridge.feedOutput(bytes)
     }
 
     private fun setupImeAnimation() {
@@ -243,7 +247,7 @@ class MainActivity : AppCompatActivity() {
         // SNAP: tap to save, long-press to restore
         btnSnap.setOnClickListener {
             lifecycleScope.launch {
-                val ok = snapshotManager.save()
+                val ok = snapshotManager.save(incremental = true, background = true)
                 runOnUiThread {
                     Toast.makeText(
                         this@MainActivity,
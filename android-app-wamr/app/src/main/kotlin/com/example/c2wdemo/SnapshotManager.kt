@@ -21,13 +21,29 @@ data class SnapshotInfo(
 /**
  * Manages local snapshot files in `filesDir/snapshots/`.
  *
- * Snapshots are binary files containing CPU registers + flat arena memory,
- * allowing instant restore of a running container's state.
+ * Snapshots are binary files containing CPU registers + flat arena memory
+ * plus the runtime state around it (filesystem changes, open files, threads,
+ * sockets), allowing instant restore of a running container's session.
+ * A snapshot only restores onto the same rootfs image it was taken from.
+ *
+ * Snapshots are deduplicated: each `.snap` is a manifest of content-hashed
+ * chunks kept once in `snapshots/chunks/`, so snapshots of the same image
+ * share their common memory. Chunks are reference counted and deleted with
+ * the last snapshot that uses them.
+ *
+ * Incremental snapshots (from older saves) store only what changed since
+ * the previous snapshot and depend on it as their parent. Deleting a
+ * snapshot first consolidates any children, so the remaining snapshots
+ * stay restorable.
  */
 class SnapshotManager(context: Context) {
 
     private val snapshotsDir = File(context.filesDir, "snapshots").also { it.mkdirs() }
 
+    init {
+        FriscyRuntime.setSnapshotDedup(true)
+    }
+
     /** List all saved snapshots, sorted by creation time (newest first). */
     fun list(): List<SnapshotInfo> {
         return snapshotsDir.listFiles()
@@ -44,10 +60,27 @@ class SnapshotManager(context: Context) {
             ?: emptyList()
     }
 
-    /** Save the current machine state to a named snapshot. */
-    suspend fun save(name: String = generateName()): Boolean = withContext(Dispatchers.IO) {
+    /**
+     * Save the current machine state to a named snapshot. Only chunks not
+     * already in the chunk store are written; [incremental] only matters
+     * when deduplication is off. With [background], the guest is paused only
+     * for a few milliseconds and the file appears once a native thread has
+     * written it; returns false if the previous background save has not
+     * finished.
+     */
+    suspend fun save(
+        name: String = generateName(),
+        incremental: Boolean = false,
+        background: Boolean = false,
+    ): Boolean = withContext(Dispatchers.IO) {
         val file = File(snapshotsDir, "$name.snap")
-        FriscyRuntime.nativeSaveSnapshot(file.absolutePath)
+        if (background) {
+            FriscyRuntime.nativeSaveSnapshotBackground(file.absolutePath, incremental)
+        } else if (incremental) {
+            FriscyRuntime.nativeSaveIncrementalSnapshot(file.absolutePath)
+        } else {
+            FriscyRuntime.nativeSaveSnapshot(file.absolutePath)
+        }
     }
 
     /** Restore machine state from a named snapshot. Machine must be loaded first. */
@@ -57,11 +90,44 @@ class SnapshotManager(context: Context) {
         FriscyRuntime.nativeRestoreSnapshot(file.absolutePath)
     }
 
-    /** Delete a snapshot by name. */
+    /**
+     * Check a snapshot against its checksums without restoring it. Restore
+     * verifies what it reads on its own; this also covers chunks a restore
+     * maps lazily, so run it before trusting a mappable snapshot long-term.
+     */
+    suspend fun verify(name: String): Boolean = withContext(Dispatchers.IO) {
+        val file = File(snapshotsDir, "$name.snap")
+        file.exists() && FriscyRuntime.nativeVerifySnapshot(file.absolutePath)
+    }
+
+    /**
+     * Delete a snapshot by name, consolidating snapshots that depend on it.
+     * Chunks no other snapshot references are freed.
+     */
     fun delete(name: String): Boolean {
-        return File(snapshotsDir, "$name.snap").delete()
+        val file = File(snapshotsDir, "$name.snap")
+        for (child in list()) {
+            if (FriscyRuntime.nativeGetSnapshotParent(child.file.absolutePath) == file.absolutePath &&
+                !FriscyRuntime.nativeConsolidateSnapshot(child.file.absolutePath)
+            ) {
+                return false
+            }
+        }
+        return FriscyRuntime.nativeDeleteSnapshot(file.absolutePath)
     }
 
+    /**
+     * Recount chunk references from the snapshots on disk and delete chunks
+     * none of them uses (e.g. left by a save that was interrupted).
+     * Returns the number of files removed, or -1 on error.
+     */
+    suspend fun collectGarbage(): Int = withContext(Dispatchers.IO) {
+        FriscyRuntime.nativeCollectSnapshotGarbage(snapshotsDir.absolutePath)
+    }
+
+    /** Chunk store usage as JSON: chunks, bytes, references, unreferenced. */
+    fun storeStats(): String = FriscyRuntime.nativeGetSnapshotStoreStats(snapshotsDir.absolutePath)
+
     /** Check if a snapshot exists. */
     fun exists(name: String): Boolean {
         return File(snapshotsDir, "$name.snap").exists()
@@ -0,0 +1,157 @@
+package com.example.c2wdemo
+
+import android.util.Log
+import java.io.File
+import java.io.IOException
+import java.net.HttpURLConnection
+import java.net.URL
+
+/**
+ * Chunk store operations the sync protocol needs from the native runtime.
+ * Keys are 32-digit hex strings; packs are opaque byte blobs.
+ */
+interface ChunkStoreAccess {
+    /** Chunk keys [manifest] references, or only those missing locally. Null if not a stored snapshot. */
+    fun chunkKeys(manifest: File, missingOnly: Boolean): List<String>?
+
+    /** Pack some prefix of [keys] (at least one); the caller sends the rest in later packs. */
+    fun pack(keys: List<String>): ByteArray?
+
+    /** Verify and store a received pack. Number of new chunks, or -1 if corrupt. */
+    fun unpack(pack: ByteArray): Int
+
+    /** Move a received manifest into place once all its chunks are present. */
+    fun importManifest(received: File, dest: File): Boolean
+}
+
+/** [ChunkStoreAccess] backed by the chunk store of a snapshot directory. */
+class NativeChunkStore(private val snapshotsDir: File) : ChunkStoreAccess {
+    override fun chunkKeys(manifest: File, missingOnly: Boolean): List<String>? =
+        FriscyRuntime.nativeGetSnapshotChunkKeys(manifest.absolutePath, missingOnly)?.let(::splitKeys)
+
+    override fun pack(keys: List<String>): ByteArray? =
+        FriscyRuntime.nativePackSnapshotChunks(snapshotsDir.absolutePath, joinKeys(keys))
+
+    override fun unpack(pack: ByteArray): Int =
+        FriscyRuntime.nativeUnpackSnapshotChunks(snapshotsDir.absolutePath, pack)
+
+    override fun importManifest(received: File, dest: File): Boolean =
+        FriscyRuntime.nativeImportSnapshotManifest(received.absolutePath, dest.absolutePath)
+}
+
+internal fun splitKeys(text: String): List<String> = text.lines().filter { it.isNotEmpty() }
+
+internal fun joinKeys(keys: List<String>): String = keys.joinToString("\n", postfix = "\n")
+
+/**
+ * Delta sync of deduplicated snapshots with the companion.
+ *
+ * A snapshot is a small manifest plus content-addressed chunks (see
+ * [SnapshotManager]); only chunks the other side lacks are transferred.
+ *   - POST /sync/missing           keys -> the subset the companion lacks
+ *   - POST /sync/chunks            upload a chunk pack
+ *   - POST /sync/chunks/fetch      keys -> chunk pack
+ *   - PUT  /sync/manifests/{name}  upload a manifest (last, commits the push)
+ *   - GET  /sync/manifests/{name}  download a manifest
+ *
+ * Chunks travel LZ4-compressed as stored, in packs of a few MB. Transfers
+ * are resumable: both directions start by asking which chunks are still
+ * missing, so a retry after an interruption only moves the rest, and a
+ * manifest becomes visible only after all of its chunks have arrived.
+ */
+class SnapshotSync(
+    private val baseUrl: String,
+    private val store: ChunkStoreAccess,
+    private val maxAttempts: Int = MAX_ATTEMPTS,
+) {
+
+    /** Chunk and byte counts of the last push or pull. */
+    data class Result(val chunksTotal: Int, val chunksSent: Int, val bytesSent: Long)
+
+    var lastResult: Result? = null
+        private set
+
+    /** Upload [manifest] as [name], sending only chunks the companion lacks. */
+    fun push(manifest: File, name: String): Boolean = retrying("push $name") {
+        val keys = store.chunkKeys(manifest, missingOnly = false) ?: return@retrying false
+        var remaining = splitKeys(String(post("/sync/missing", joinKeys(keys).toByteArray())))
+        val missing = remaining.size
+        var bytes = 0L
+        while (remaining.isNotEmpty()) {
+            val pack = store.pack(remaining) ?: return@retrying false
+            post("/sync/chunks", pack)
+            bytes += pack.size
+            // Ask again rather than trusting the pack count: the companion
+            // may have dropped chunks it could not verify
+            val next = splitKeys(String(post("/sync/missing", joinKeys(remaining).toByteArray())))
+            if (next.size >= remaining.size) throw IOException("Companion did not accept chunks")
+            remaining = next
+        }
+        request("PUT", "/sync/manifests/$name", manifest.readBytes())
+        lastResult = Result(keys.size, missing, bytes)
+        true
+    }
+
+    /** Download [name] into [dest], fetching only chunks missing locally. */
+    fun pull(name: String, dest: File): Boolean = retrying("pull $name") {
+        val partial = File(dest.parentFile, "${dest.name}$PARTIAL_SUFFIX")
+        partial.writeBytes(request("GET", "/sync/manifests/$name", null))
+        val total = store.chunkKeys(partial, missingOnly = false)?.size ?: return@retrying false
+        var remaining = store.chunkKeys(partial, missingOnly = true) ?: return@retrying false
+        val missing = remaining.size
+        var bytes = 0L
+        while (remaining.isNotEmpty()) {
+            val pack = post("/sync/chunks/fetch", joinKeys(remaining).toByteArray())
+            if (store.unpack(pack) < 0) throw IOException("Corrupt chunk pack")
+            bytes += pack.size
+            val next = store.chunkKeys(partial, missingOnly = true) ?: return@retrying false
+            if (next.size >= remaining.size) throw IOException("Companion sent no usable chunks")
+            remaining = next
+        }
+        if (!store.importManifest(partial, dest)) return@retrying false
+        lastResult = Result(total, missing, bytes)
+        true
+    }
+
+    // Retry transport failures; each attempt resumes from what is missing
+    private fun retrying(what: String, attempt: () -> Boolean): Boolean {
+        repeat(maxAttempts) { n ->
+            try {
+                return attempt()
+            } catch (e: IOException) {
+                Log.w(TAG, "Sync $what attempt ${n + 1} failed: ${e.message}")
+            }
+        }
+        return false
+    }
+
+    private fun post(path: String, body: ByteArray): ByteArray = request("POST", path, body)
+
+    private fun request(method: String, path: String, body: ByteArray?): ByteArray {
+        val conn = URL(baseUrl + path).openConnection() as HttpURLConnection
+        try {
+            conn.requestMethod = method
+            conn.connectTimeout = CONNECT_TIMEOUT
+            conn.readTimeout = READ_TIMEOUT
+            if (body != null) {
+                conn.doOutput = true
+                conn.setRequestProperty("Content-Type", "application/octet-stream")
+                conn.setFixedLengthStreamingMode(body.size)
+                conn.outputStream.use { it.write(body) }
+            }
+            val code = conn.responseCode
+            if (code !in 200..299) throw IOException("$method $path: HTTP $code")
+            return conn.inputStream.use { it.readBytes() }
+        } finally {
+            conn.disconnect()
+        }
+    }
+
+    companion object {
+        private const val TAG = "SnapshotSync"
+        private const val CONNECT_TIMEOUT = 5_000
+        private const val READ_TIMEOUT = 30_000
+        private const val MAX_ATTEMPTS = 3
+        const val PARTIAL_SUFFIX = ".partial"
+    }
+}
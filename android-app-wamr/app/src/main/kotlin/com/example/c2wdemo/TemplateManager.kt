@@ -0,0 +1,125 @@
+package com.example.c2wdemo
+
+import android.content.Context
+import java.io.File
+
+/**
+ * Pre-warmed VM templates, one per image, in `filesDir/images/` next to the
+ * image cache.
+ *
+ * The first session of an image boots cold to its ready point (see
+ * [FriscyRuntime.setReadyMarker]) and is captured as `<id>.<digest>.template`
+ * together with the output it printed on the way. Later sessions of the
+ * same image load the rootfs, restore the template instead of booting, and
+ * replay that output. The file name carries the image digest, so a changed
+ * image or entry point never matches an old template; stale ones are
+ * deleted when the new template is captured.
+ *
+ * Images can also ship a template built at build time
+ * (scripts/build_boot_snapshot.sh) as `assets/templates/<id>.<digest>.snap`;
+ * it is installed the first time that image and digest are loaded, so even
+ * the first session skips the cold boot.
+ */
+class TemplateManager(context: Context) {
+
+    private val assets = context.assets
+    private val imagesDir = File(context.filesDir, "images").also { it.mkdirs() }
+
+    /**
+     * Restore the template for [imageId] into the loaded (not yet started)
+     * machine. Returns the boot output to replay, or null if there is no
+     * usable template and the session must boot cold.
+     */
+    fun clone(imageId: String): ByteArray? {
+        val digest = FriscyRuntime.imageDigest
+        val file = templateFile(imageId, digest)
+        if (!file.exists() && !installBundled(imageId, digest)) return null
+        if (!FriscyRuntime.nativeRestoreSnapshot(file.absolutePath)) {
+            // Unreadable or rejected; the next cold boot recaptures it
+            invalidate(imageId)
+            return null
+        }
+        return transcriptFile(imageId, digest).takeIf { it.exists() }?.readBytes() ?: ByteArray(0)
+    }
+
+    /**
+     * Capture the running session as the template for [imageId] once it
+     * reaches the ready point. [transcript] is the guest output so far.
+     * Blocking; call off the main thread after [FriscyRuntime.start].
+     */
+    fun capture(imageId: String, transcript: () -> ByteArray, timeoutMs: Long = READY_TIMEOUT_MS): Boolean {
+        if (!FriscyRuntime.waitReady(timeoutMs)) return false
+        val digest = FriscyRuntime.imageDigest
+        val file = templateFile(imageId, digest)
+        if (!FriscyRuntime.nativeSaveTemplate(file.absolutePath)) return false
+        transcriptFile(imageId, digest).writeBytes(transcript())
+        removeStale(imageId, digest)
+        return true
+    }
+
+    /**
+     * Copy the build-time template for [imageId] and [digest] out of the
+     * APK, if there is one. Returns true when the template is installed.
+     */
+    private fun installBundled(imageId: String, digest: String): Boolean {
+        val name = "$imageId.$digest$BUNDLED_SUFFIX"
+        if (assets.list(BUNDLED_DIR)?.contains(name) != true) return false
+        val file = templateFile(imageId, digest)
+        val tmp = File(imagesDir, "${file.name}.tmp")
+        assets.open("$BUNDLED_DIR/$name").use { input ->
+            tmp.outputStream().use { input.copyTo(it) }
+        }
+        if (!tmp.renameTo(file)) {
+            tmp.delete()
+            return false
+        }
+        runCatching {
+            assets.open("$BUNDLED_DIR/$name.out").use { input ->
+                transcriptFile(imageId, digest).outputStream().use { input.copyTo(it) }
+            }
+        }
+        removeStale(imageId, digest)
+        return true
+    }
+
+    /** Delete every template of [imageId]. */
+    fun invalidate(imageId: String) = removeStale(imageId, keepDigest = null)
+
+    private fun removeStale(imageId: String, keepDigest: String?) {
+        imagesDir.listFiles()?.forEach { file ->
+            val (id, digest) = parseTemplateName(file.name) ?: return@forEach
+            if (id == imageId && digest != keepDigest) file.delete()
+        }
+    }
+
+    private fun templateFile(imageId: String, digest: String) =
+        File(imagesDir, "$imageId.$digest$TEMPLATE_SUFFIX")
+
+    private fun transcriptFile(imageId: String, digest: String) =
+        File(imagesDir, "$imageId.$digest$TRANSCRIPT_SUFFIX")
+
+    companion object {
+        /**
+         * Split a template or transcript file name into its image id and
+         * digest, or null if it is neither. Image ids may contain dots
+         * (`alpine.3.19`); the digest is hex and never does, so it is
+         * whatever follows the last one.
+         */
+        internal fun parseTemplateName(name: String): Pair<String, String>? {
+            val stem = when {
+                name.endsWith(TRANSCRIPT_SUFFIX) -> name.removeSuffix(TRANSCRIPT_SUFFIX)
+                name.endsWith(TEMPLATE_SUFFIX) -> name.removeSuffix(TEMPLATE_SUFFIX)
+                else -> return null
+            }
+            val dot = stem.lastIndexOf('.')
+            if (dot <= 0 || dot == stem.length - 1) return null
+            return stem.substring(0, dot) to stem.substring(dot + 1)
+        }
+
+        private const val TEMPLATE_SUFFIX = ".template"
+        private const val TRANSCRIPT_SUFFIX = ".template.out"
+        private const val BUNDLED_DIR = "templates"
+        private const val BUNDLED_SUFFIX = ".snap"
+        private const val READY_TIMEOUT_MS = 120_000L
+    }
+}
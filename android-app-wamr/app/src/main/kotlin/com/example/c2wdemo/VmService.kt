@@ -11,6 +11,7 @@ import android.os.Binder
 import android.os.Build
 import android.os.IBinder
 import android.os.PowerManager
+import java.io.ByteArrayOutputStream
 import java.io.File
 import androidx.core.app.NotificationCompat
 import kotlinx.coroutines.CoroutineScope
@@ -29,7 +30,7 @@ class VmService : Service() {
     private val serviceScope = CoroutineScope(SupervisorJob() + Dispatchers.Main)
 
     private var wakeLock: PowerManager.WakeLock? = null
-    private var outputCallback: ((String) -> Unit)? = null
+    private var outputCallback: ((ByteArray) -> Unit)? = null
 
     /** Image source: "asset" or "file". */
     private var imageSource: String = ImagePickerActivity.SOURCE_ASSET
@@ -39,9 +40,15 @@ class VmService : Service() {
     private var filePath: String? = null
     /** Entry point binary inside the rootfs. */
     private var entryPoint: String = "/bin/sh"
+    /** Registry id; keys the image's template. */
+    private var imageId: String = DEFAULT_IMAGE_ID
+    /** Template ready point marker (see [FriscyRuntime.setReadyMarker]). */
+    private var readyMarker: String? = null
 
-    /** Ring buffer of recent output so reconnecting UI can replay missed text. */
-    private val outputBuffer = StringBuilder(OUTPUT_BUFFER_CAPACITY)
+    private lateinit var templates: TemplateManager
+
+    /** Recent output bytes so reconnecting UI can replay what it missed. */
+    private val outputBuffer = ByteArrayOutputStream(OUTPUT_BUFFER_CAPACITY)
 
     /** Whether the VM has been started by this service instance. */
     var vmStarted = false
@@ -49,6 +56,7 @@ class VmService : Service() {
 
     override fun onCreate() {
         super.onCreate()
+        templates = TemplateManager(this)
         createNotificationChannel()
     }
 
@@ -60,6 +68,8 @@ class VmService : Service() {
             assetName = it.getStringExtra(ImagePickerActivity.EXTRA_ASSET_NAME) ?: "rootfs.tar"
             filePath = it.getStringExtra(ImagePickerActivity.EXTRA_FILE_PATH)
             entryPoint = it.getStringExtra(ImagePickerActivity.EXTRA_ENTRY_POINT) ?: "/bin/sh"
+            imageId = it.getStringExtra(ImagePickerActivity.EXTRA_IMAGE_ID) ?: DEFAULT_IMAGE_ID
+            readyMarker = it.getStringExtra(ImagePickerActivity.EXTRA_READY_MARKER)
         }
 
         startForeground(NOTIFICATION_ID, buildNotification())
@@ -88,7 +98,7 @@ class VmService : Service() {
 
     // --- Output callback management ---
 
-    fun setOutputCallback(cb: (String) -> Unit) {
+    fun setOutputCallback(cb: (ByteArray) -> Unit) {
         outputCallback = cb
     }
 
@@ -97,9 +107,9 @@ class VmService : Service() {
     }
 
     /** Returns buffered output for UI replay on reconnect. */
-    fun getBufferedOutput(): String {
+    fun getBufferedOutput(): ByteArray {
         synchronized(outputBuffer) {
-            return outputBuffer.toString()
+            return outputBuffer.toByteArray()
         }
     }
 
@@ -130,14 +140,24 @@ class VmService : Service() {
             }
             deliverOutput("rootfs: ${tarBytes.size} bytes\r\n")
 
-            val loaded = FriscyRuntime.loadRootfs(tarBytes, entryPoint) { text ->
-                deliverOutput(text)
+            // Guest output up to the ready point, replayed by template clones
+            val bootOutput = ByteArrayOutputStream()
+            FriscyRuntime.setReadyMarker(readyMarker)
+            val loaded = FriscyRuntime.loadRootfs(tarBytes, entryPoint) { bytes ->
+                synchronized(bootOutput) { bootOutput.write(bytes) }
+                deliverOutput(bytes)
             }
             if (!loaded) {
                 deliverOutput("ERROR: Failed to load rootfs\r\n")
                 return
             }
 
+            val replay = templates.clone(imageId)
+            if (replay != null) {
+                deliverOutput("[friscy] Session cloned from template\r\n")
+                deliverOutput(replay)
+            }
+
             vmStarted = true
 
             if (!FriscyRuntime.start()) {
@@ -146,22 +166,32 @@ class VmService : Service() {
                 return
             }
 
-            deliverOutput("[friscy] Shell started\r\n")
+            if (replay == null) {
+                deliverOutput("[friscy] Shell started\r\n")
+                // First session of this image: capture a template at the ready point
+                templates.capture(imageId, { synchronized(bootOutput) { bootOutput.toByteArray() } })
+            }
         } catch (e: Exception) {
             deliverOutput("ERROR: ${e.message}\r\n")
             vmStarted = false
         }
     }
 
-    private fun deliverOutput(text: String) {
+    private fun deliverOutput(text: String) = deliverOutput(text.toByteArray(Charsets.UTF_8))
+
+    private fun deliverOutput(bytes: ByteArray) {
         synchronized(outputBuffer) {
-            outputBuffer.append(text)
-            if (outputBuffer.length > OUTPUT_BUFFER_CAPACITY) {
-                val excess = outputBuffer.length - OUTPUT_BUFFER_TRIM_TARGET
-                outputBuffer.delete(0, excess)
+            outputBuffer.write(bytes)
+            if (outputBuffer.size() > OUTPUT_BUFFER_CAPACITY) {
+                val all = outputBuffer.toByteArray()
+                // Keep the tail, starting on a UTF-8 lead byte
+                var from = all.size - OUTPUT_BUFFER_TRIM_TARGET
+                while (from < all.size && (all[from].toInt() and 0xC0) == 0x80) from++
+                outputBuffer.reset()
+                outputBuffer.write(all, from, all.size - from)
             }
         }
-        outputCallback?.invoke(text)
+        outputCallback?.invoke(bytes)
     }
 
     // --- Notification ---
@@ -214,6 +244,7 @@ class VmService : Service() {
     companion object {
         private const val CHANNEL_ID = "vm_service"
         private const val NOTIFICATION_ID = 1
+        private const val DEFAULT_IMAGE_ID = "default"
         private const val OUTPUT_BUFFER_CAPACITY = 8192
         private const val OUTPUT_BUFFER_TRIM_TARGET = 6144
     }
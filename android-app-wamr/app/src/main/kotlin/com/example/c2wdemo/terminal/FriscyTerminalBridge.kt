@@ -65,8 +65,7 @@ class FriscyTerminalBridge(
      */
     override fun write(data: ByteArray, offset: Int, count: Int) {
         if (count <= 0) return
-        val text = String(data, offset, count, Charsets.UTF_8)
-        FriscyRuntime.sendInput(text)
+        FriscyRuntime.sendInput(data, offset, count)
     }
 
     override fun titleChanged(oldTitle: String?, newTitle: String?) {
@@ -101,14 +100,6 @@ class FriscyTerminalBridge(
         listener.onScreenUpdated()
     }
 
-    /**
-     * Feed a string of output (convenience wrapper).
-     */
-    fun feedOutput(text: String) {
-        val bytes = text.toByteArray(Charsets.UTF_8)
-        feedOutput(bytes, bytes.size)
-    }
-
     // --- Session client for TerminalEmulator callbacks ---
 
     /**
@@ -0,0 +1,169 @@
+package com.example.c2wdemo
+
+import com.sun.net.httpserver.HttpExchange
+import com.sun.net.httpserver.HttpServer
+import org.junit.After
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertTrue
+import org.junit.Before
+import org.junit.Rule
+import org.junit.Test
+import org.junit.rules.TemporaryFolder
+import org.junit.runner.RunWith
+import org.robolectric.RobolectricTestRunner
+import java.io.File
+import java.net.InetSocketAddress
+import java.util.concurrent.ConcurrentHashMap
+
+@RunWith(RobolectricTestRunner::class)
+class SnapshotSyncTest {
+
+    @get:Rule
+    val tmp = TemporaryFolder()
+
+    /** In-memory stand-in for the companion's /sync endpoints. */
+    private class FakeCompanion {
+        val chunks: MutableSet<String> = ConcurrentHashMap.newKeySet()
+        val manifests = ConcurrentHashMap<String, ByteArray>()
+        var chunksReceived = 0
+        var failUploadsAfter = Int.MAX_VALUE
+
+        val server: HttpServer = HttpServer.create(InetSocketAddress("127.0.0.1", 0), 0).apply {
+            createContext("/sync/missing") { ex ->
+                reply(ex, joinKeys(splitKeys(body(ex)).filter { it !in chunks }))
+            }
+            createContext("/sync/chunks/fetch") { ex ->
+                reply(ex, FakeStore.packOf(splitKeys(body(ex)).filter { it in chunks }))
+            }
+            createContext("/sync/chunks") { ex ->
+                if (failUploadsAfter-- <= 0) {
+                    ex.sendResponseHeaders(503, -1)
+                    ex.close()
+                    return@createContext
+                }
+                val keys = splitKeys(body(ex))
+                chunksReceived += keys.size
+                chunks += keys
+                reply(ex, "")
+            }
+            createContext("/sync/manifests/") { ex ->
+                val name = ex.requestURI.path.substringAfterLast('/')
+                if (ex.requestMethod == "PUT") {
+                    manifests[name] = ex.requestBody.readBytes()
+                    reply(ex, "")
+                } else {
+                    val m = manifests[name]
+                    if (m == null) {
+                        ex.sendResponseHeaders(404, -1)
+                        ex.close()
+                    } else {
+                        reply(ex, String(m))
+                    }
+                }
+            }
+            start()
+        }
+
+        val url get() = "http://127.0.0.1:${server.address.port}"
+
+        private fun body(ex: HttpExchange) = String(ex.requestBody.readBytes())
+
+        private fun reply(ex: HttpExchange, text: String) {
+            val bytes = text.toByteArray()
+            ex.sendResponseHeaders(200, if (bytes.isEmpty()) -1 else bytes.size.toLong())
+            if (bytes.isNotEmpty()) ex.responseBody.use { it.write(bytes) }
+            ex.close()
+        }
+    }
+
+    /** Manifests are key lists and packs hold at most two keys, so transfers take several rounds. */
+    private class FakeStore(val chunks: MutableSet<String> = mutableSetOf()) : ChunkStoreAccess {
+        override fun chunkKeys(manifest: File, missingOnly: Boolean): List<String> =
+            splitKeys(manifest.readText()).filter { !missingOnly || it !in chunks }
+
+        override fun pack(keys: List<String>): ByteArray = packOf(keys.take(2)).toByteArray()
+
+        override fun unpack(pack: ByteArray): Int {
+            val keys = splitKeys(String(pack))
+            return keys.count { chunks.add(it) }
+        }
+
+        override fun importManifest(received: File, dest: File): Boolean =
+            chunkKeys(received, missingOnly = true).isEmpty() && received.renameTo(dest)
+
+        companion object {
+            fun packOf(keys: List<String>) = if (keys.isEmpty()) "" else joinKeys(keys)
+        }
+    }
+
+    private lateinit var remote: FakeCompanion
+
+    @Before
+    fun setUp() {
+        remote = FakeCompanion()
+    }
+
+    @After
+    fun tearDown() {
+        remote.server.stop(0)
+    }
+
+    private fun key(i: Int) = "%032x".format(i)
+
+    private fun manifest(name: String, keys: List<String>): File =
+        tmp.newFile(name).apply { writeText(joinKeys(keys)) }
+
+    @Test
+    fun `push sends only chunks the companion lacks`() {
+        remote.chunks += listOf(key(1), key(2))
+        val keys = (1..5).map(::key)
+        val sync = SnapshotSync(remote.url, FakeStore(keys.toMutableSet()))
+
+        assertTrue(sync.push(manifest("a.snap", keys), "a"))
+        assertEquals(3, remote.chunksReceived)
+        assertEquals(5, sync.lastResult!!.chunksTotal)
+        assertEquals(3, sync.lastResult!!.chunksSent)
+        assertTrue(remote.manifests.containsKey("a"))
+
+        // A second snapshot sharing most chunks only sends the new one
+        assertTrue(sync.push(manifest("b.snap", keys + key(6)), "b"))
+        assertEquals(4, remote.chunksReceived)
+    }
+
+    @Test
+    fun `interrupted push resumes with the remaining chunks`() {
+        val keys = (1..6).map(::key)
+        val store = FakeStore(keys.toMutableSet())
+        remote.failUploadsAfter = 1
+
+        assertFalse(SnapshotSync(remote.url, store, maxAttempts = 1).push(manifest("a.snap", keys), "a"))
+        assertFalse("No manifest before all chunks arrived", remote.manifests.containsKey("a"))
+        assertEquals(2, remote.chunksReceived)
+
+        remote.failUploadsAfter = Int.MAX_VALUE
+        assertTrue(SnapshotSync(remote.url, store).push(manifest("a2.snap", keys), "a"))
+        assertEquals("Each chunk crosses the wire once", 6, remote.chunksReceived)
+    }
+
+    @Test
+    fun `pull fetches only missing chunks and imports the manifest`() {
+        val keys = (1..5).map(::key)
+        remote.chunks += keys
+        remote.manifests["a"] = joinKeys(keys).toByteArray()
+        val store = FakeStore(mutableSetOf(key(1), key(4)))
+        val dest = File(tmp.root, "a.snap")
+
+        val sync = SnapshotSync(remote.url, store)
+        assertTrue(sync.pull("a", dest))
+        assertTrue(dest.exists())
+        assertEquals(keys.toSet(), store.chunks)
+        assertEquals(3, sync.lastResult!!.chunksSent)
+    }
+
+    @Test
+    fun `pull of an unknown snapshot fails`() {
+        val sync = SnapshotSync(remote.url, FakeStore(), maxAttempts = 1)
+        assertFalse(sync.pull("missing", File(tmp.root, "missing.snap")))
+    }
+}
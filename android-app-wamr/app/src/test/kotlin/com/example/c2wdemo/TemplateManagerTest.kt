@@ -0,0 +1,65 @@
+package com.example.c2wdemo
+
+import android.app.Application
+import androidx.test.core.app.ApplicationProvider
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertFalse
+import org.junit.Assert.assertNull
+import org.junit.Assert.assertTrue
+import org.junit.Before
+import org.junit.Test
+import org.junit.runner.RunWith
+import org.robolectric.RobolectricTestRunner
+import java.io.File
+
+@RunWith(RobolectricTestRunner::class)
+class TemplateManagerTest {
+
+    private lateinit var imagesDir: File
+    private lateinit var manager: TemplateManager
+
+    @Before
+    fun setUp() {
+        val context = ApplicationProvider.getApplicationContext<Application>()
+        manager = TemplateManager(context)
+        imagesDir = File(context.filesDir, "images")
+        imagesDir.listFiles()?.forEach { it.delete() }
+    }
+
+    private fun templateFiles(imageId: String, digest: String): List<File> =
+        listOf("template", "template.out").map {
+            File(imagesDir, "$imageId.$digest.$it").apply { writeText("x") }
+        }
+
+    @Test
+    fun parseTemplateName_splitsOnTheLastDot() {
+        assertEquals(
+            "alpine.3.19" to "00112233aabbccdd",
+            TemplateManager.parseTemplateName("alpine.3.19.00112233aabbccdd.template"),
+        )
+        assertEquals(
+            "alpine" to "00112233aabbccdd",
+            TemplateManager.parseTemplateName("alpine.00112233aabbccdd.template.out"),
+        )
+        assertNull(TemplateManager.parseTemplateName("alpine.tar"))
+        assertNull(TemplateManager.parseTemplateName("alpine.template"))
+    }
+
+    @Test
+    fun invalidate_leavesImagesSharingTheIdAsPrefix() {
+        val alpine = templateFiles("alpine", "1111111111111111")
+        val alpine319 = templateFiles("alpine.3.19", "2222222222222222")
+        val image = File(imagesDir, "alpine.3.19.tar").apply { writeText("rootfs") }
+
+        manager.invalidate("alpine")
+        alpine.forEach { assertFalse(it.name, it.exists()) }
+        alpine319.forEach { assertTrue(it.name, it.exists()) }
+        assertTrue(image.exists())
+
+        templateFiles("alpine", "1111111111111111")
+        manager.invalidate("alpine.3.19")
+        alpine319.forEach { assertFalse(it.name, it.exists()) }
+        alpine.forEach { assertTrue(it.name, it.exists()) }
+        assertTrue(image.exists())
+    }
+}
@@ -0,0 +1,148 @@
+// boot_snapshot.cpp - Build-time boot-to-prompt snapshot for the APK
+//
+// Runs the friscy runtime headers headlessly on a Linux host: loads a
+// rootfs tar, boots the entry binary through session::boot() exactly as
+// nativeLoadRootfs() does, simulates until the guest first waits on stdin
+// (after printing the ready marker, if one is given), and saves that
+// point as a compressed snapshot with its runtime state. The app installs
+// it as the image's template on first launch (see TemplateManager), so
+// the very first session restores instead of booting cold.
+//
+// Usage: boot_snapshot <rootfs.tar> <entry> <out-dir> <image-id> [ready-marker]
+//
+// Writes <out-dir>/<image-id>.<digest>.snap and the boot output as
+// <out-dir>/<image-id>.<digest>.snap.out. The digest in the name is the
+// one FriscyRuntime.imageDigest reports for the same tar and entry. The
+// boot trace (friscy/boot_trace.hpp) of the run is printed at the end, the
+// same report FriscyRuntime.bootTrace gives on a device.
+
+#include "friscy/session.hpp"
+#include "friscy/android_io.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+
+static constexpr uint64_t MAX_INSTRUCTIONS = 512'000'000'000ULL;
+
+// simulate() rounds before giving up on reaching the prompt
+static constexpr int MAX_ROUNDS = 64;
+
+static std::string g_transcript;
+
+static void host_printer(const Machine&, const char* data, size_t size) {
+    boottrace::first_output();
+    g_transcript.append(data, size);
+    fwrite(data, 1, size, stderr);
+}
+
+// Same loop as execution_loop() in friscy_runtime.cpp, minus the stdin
+// wait: returns true once the guest blocks on stdin, false on exit.
+static bool run_until_stdin(Machine& machine) {
+    for (int retries = 0; retries < 8; retries++) {
+        try {
+            machine.simulate(MAX_INSTRUCTIONS);
+            if (syscalls::g_execve_restart) {
+                syscalls::g_execve_restart = false;
+                retries = -1;
+                continue;
+            }
+            break;
+        } catch (const riscv::MachineException& e) {
+            uint64_t fault_addr = e.data();
+            if (fault_addr != 0 && retries < 7) {
+                riscv::PageAttributes attr;
+                attr.read = true;
+                attr.write = true;
+                attr.exec = true;
+                pageattr::set(machine.memory, fault_addr & ~0xFFFULL, 4096, attr);
+                continue;
+            }
+            throw;
+        }
+    }
+    bool waiting = android_io::waiting_for_stdin.load();
+    android_io::waiting_for_stdin.store(false);
+    return waiting;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s <rootfs.tar> <entry> <out-dir> <image-id> [ready-marker]\n",
+                argv[0]);
+        return 2;
+    }
+    const std::string tar_path = argv[1];
+    const std::string entry_path = argv[2];
+    const std::string out_dir = argv[3];
+    const std::string image_id = argv[4];
+    const std::string marker = argc > 5 ? argv[5] : "";
+
+    boottrace::start();
+    std::ifstream in(tar_path, std::ios::binary);
+    std::vector<uint8_t> tar((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+    if (tar.empty()) {
+        fprintf(stderr, "[boot_snapshot] Cannot read %s\n", tar_path.c_str());
+        return 1;
+    }
+
+    try {
+        android_io::reset();
+        android_io::running.store(true);
+
+        uint64_t digest = 0;
+        auto fs = session::load_image(tar.data(), tar.size(), entry_path, digest);
+
+        session::BootInfo info;
+        std::string error;
+        auto machine = session::boot(*fs, entry_path, info, error);
+        if (!machine) {
+            fprintf(stderr, "[boot_snapshot] %s\n", error.c_str());
+            return 1;
+        }
+        machine->set_printer(host_printer);
+
+        // The app's ready point: the first stdin wait after the marker
+        // (or the first stdin wait at all when there is no marker)
+        bool ready = false;
+        for (int round = 0; round < MAX_ROUNDS && !ready; round++) {
+            if (!run_until_stdin(*machine)) {
+                fprintf(stderr, "\n[boot_snapshot] Guest exited before its prompt\n");
+                return 1;
+            }
+            ready = marker.empty() || g_transcript.find(marker) != std::string::npos;
+        }
+        if (!ready) {
+            fprintf(stderr, "\n[boot_snapshot] Ready marker \"%s\" never printed\n",
+                    marker.c_str());
+            return 1;
+        }
+
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)digest);
+        std::string path = out_dir + "/" + image_id + "." + hex + ".snap";
+
+        auto state = session::capture_state(digest, *fs, *machine);
+        if (!snapshot::save(*machine, path, snapshot::SaveMode::Full,
+                            snapshot::Layout::Compressed, &state)) {
+            fprintf(stderr, "[boot_snapshot] Failed to write %s\n", path.c_str());
+            return 1;
+        }
+        std::ofstream(path + ".out", std::ios::binary) << g_transcript;
+
+        const auto& st = snapshot::g_last_save;
+        fprintf(stderr, "\n[boot_snapshot] %s: %llu bytes, %u/%u chunks non-zero\n",
+                path.c_str(), (unsigned long long)st.file_bytes,
+                st.chunks_total - st.chunks_zero, st.chunks_total);
+        fprintf(stderr, "[boot_snapshot] boot trace: %s\n", boottrace::report_json().c_str());
+        return 0;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "\n[boot_snapshot] %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,165 @@
+// prelink.cpp - Build-time load bases for a rootfs's shared libraries
+//
+// Walks a rootfs tar for RISC-V shared objects (ET_DYN without PT_INTERP,
+// other than the dynamic linker itself), gives each one its own 64KB
+// aligned base in prelink::WINDOW_LO..WINDOW_HI, and appends the manifest
+// to the tar at prelink::MANIFEST_PATH. The runtime then maps each library
+// at its base (friscy/prelink.hpp), so its code stays in place across
+// processes instead of being copied in by every exec.
+//
+// Relocations are not applied here: ld-musl relocates every library from
+// its RELA addends on each load whatever the file holds, so pre-applied
+// values would be overwritten anyway. Only the writable segments it
+// relocates are per process; the read-only part must sit at the same file
+// offset and address (prelink::measure(), which the runtime repeats).
+//
+// Usage: prelink <rootfs.tar> <out.tar>
+//
+// The input tar is copied unchanged, with the manifest appended as its
+// last entry (a later entry replaces an earlier one, so re-running on a
+// prelinked tar is fine). Files not listed simply load at the mmap
+// frontier as before.
+
+#include "friscy/vfs.hpp"
+#include "friscy/elf_loader.hpp"
+#include "friscy/prelink.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+struct Candidate {
+    std::string path;
+    std::shared_ptr<vfs::Entry> entry;
+};
+
+static void collect(const std::shared_ptr<vfs::Entry>& dir, const std::string& prefix,
+                    std::vector<Candidate>& out) {
+    for (const auto& [name, child] : dir->children) {
+        std::string path = prefix + "/" + name;
+        if (child->is_dir()) {
+            collect(child, path, out);
+        } else if (child->is_file() && child->content.size() >= sizeof(elf::Elf64_Ehdr) &&
+                   memcmp(child->content.data(), "\x7f" "ELF", 4) == 0) {
+            out.push_back({path, child});
+        }
+    }
+}
+
+// Append `name` with `content` to a tar, replacing its end-of-archive
+static void append_file(std::vector<uint8_t>& tar, const std::string& name,
+                        const std::string& content) {
+    // Find where the archive's entries end
+    size_t offset = 0;
+    while (offset + 512 <= tar.size()) {
+        const uint8_t* h = tar.data() + offset;
+        if (std::all_of(h, h + 512, [](uint8_t b) { return b == 0; })) break;
+        uint64_t size = 0;
+        for (int i = 124; i < 136 && h[i] >= '0' && h[i] <= '7'; i++) size = size * 8 + (h[i] - '0');
+        offset += 512 + (size + 511) / 512 * 512;
+    }
+    tar.resize(std::min(offset, tar.size()));
+
+    uint8_t h[512] = {};
+    auto octal = [&](size_t at, size_t len, uint64_t v) {
+        snprintf(reinterpret_cast<char*>(h + at), len, "%0*llo", int(len - 1), (unsigned long long)v);
+    };
+    memcpy(h, name.data(), std::min<size_t>(name.size(), 100));
+    octal(100, 8, 0444);
+    octal(108, 8, 0);
+    octal(116, 8, 0);
+    octal(124, 12, content.size());
+    octal(136, 12, 0);
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memset(h + 148, ' ', 8);
+    uint32_t sum = 0;
+    for (uint8_t b : h) sum += b;
+    snprintf(reinterpret_cast<char*>(h + 148), 8, "%06o", sum);
+
+    tar.insert(tar.end(), h, h + 512);
+    tar.insert(tar.end(), content.begin(), content.end());
+    tar.resize(tar.size() + (512 - content.size() % 512) % 512 + 1024, 0);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <rootfs.tar> <out.tar>\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    std::vector<uint8_t> tar((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+    if (tar.empty()) {
+        fprintf(stderr, "[prelink] Cannot read %s\n", argv[1]);
+        return 1;
+    }
+    vfs::VirtualFS fs;
+    fs.load_tar(tar.data(), tar.size());
+
+    std::vector<Candidate> elfs;
+    collect(fs.resolve("/"), "", elfs);
+    std::sort(elfs.begin(), elfs.end(),
+              [](const Candidate& a, const Candidate& b) { return a.path < b.path; });
+
+    // The dynamic linker is loaded by the runtime itself, never mmap'd
+    std::set<const vfs::Entry*> interpreters;
+    std::vector<std::pair<Candidate, elf::Layout>> shared;
+    for (const auto& c : elfs) {
+        try {
+            auto layout = elf::parse_layout(c.entry->content, false);
+            if (layout.info.is_dynamic) {
+                if (auto e = fs.resolve(layout.info.interpreter)) interpreters.insert(e.get());
+            } else if (layout.info.type == elf::ET_DYN) {
+                shared.emplace_back(c, std::move(layout));
+            }
+        } catch (const std::exception&) {
+            // Not a RISC-V executable or library
+        }
+    }
+
+    std::string manifest = "# friscy prelink v1: base span text path\n";
+    uint64_t cursor = prelink::WINDOW_LO;
+    size_t placed = 0, skipped = 0;
+    for (const auto& [c, layout] : shared) {
+        if (interpreters.count(c.entry.get())) continue;
+        prelink::Lib lib;
+        lib.path = c.path;
+        if (!prelink::measure(layout, c.entry->content.size(), lib.span, lib.text)) {
+            fprintf(stderr, "[prelink] %s: text not at its file offsets, skipped\n", c.path.c_str());
+            skipped++;
+            continue;
+        }
+        lib.base = (cursor + prelink::ALIGN - 1) & ~(prelink::ALIGN - 1);
+        if (lib.base + lib.span > prelink::WINDOW_HI) {
+            fprintf(stderr, "[prelink] %s: window full, skipped\n", c.path.c_str());
+            skipped++;
+            continue;
+        }
+        cursor = lib.base + lib.span;
+        manifest += prelink::format_line(lib);
+        placed++;
+        fprintf(stderr, "[prelink] 0x%08llx %s (%llu KB text)\n", (unsigned long long)lib.base,
+                c.path.c_str(), (unsigned long long)(lib.text >> 10));
+    }
+
+    std::string name = prelink::MANIFEST_PATH;
+    append_file(tar, name.substr(1), manifest);
+
+    std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(tar.data()), tar.size());
+    if (!out) {
+        fprintf(stderr, "[prelink] Failed to write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(stderr, "[prelink] %zu libraries placed, %zu skipped, window used to 0x%llx\n",
+            placed, skipped, (unsigned long long)cursor);
+    return 0;
+}
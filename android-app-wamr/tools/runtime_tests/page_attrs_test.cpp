@@ -0,0 +1,118 @@
+// page_attrs_test.cpp - Page permissions carried through the runtime state
+//
+//   - set() records non-overlapping ranges: a range set over others splits
+//     them, and neighbours of the same protection merge.
+//   - The record survives save()/read(), and apply() on another machine
+//     first returns every page that machine's boot set to the default,
+//     then sets the saved ranges, leaving the same record behind.
+//
+// Exits non-zero on the first failed check.
+
+#include "friscy/page_attrs.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <tuple>
+#include <vector>
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+// Stands in for Machine::memory: the calls apply() makes, in order
+struct Memory {
+    std::vector<std::tuple<uint64_t, uint64_t, int>> calls;
+    void set_page_attr(uint64_t addr, uint64_t len, riscv::PageAttributes attr) {
+        calls.emplace_back(addr, len, pageattr::prot_of(attr));
+    }
+};
+
+static bool same(const std::vector<pageattr::Range>& got,
+                 const std::vector<pageattr::Range>& want) {
+    if (got.size() != want.size()) return false;
+    for (size_t i = 0; i < got.size(); i++) {
+        if (got[i].addr != want[i].addr || got[i].len != want[i].len ||
+            got[i].prot != want[i].prot) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    constexpr int R = 1, RW = 3, RX = 5, RWX = 7;
+    const uint64_t P = 0x1000;
+
+    // A session: text, data, a RELRO page made read-only inside the data,
+    // then an mmap next to the data with the same protection
+    Memory session;
+    pageattr::reset();
+    pageattr::set(session, 0x10000, 4 * P, pageattr::attr_of(RX));
+    pageattr::set(session, 0x14000, 4 * P, pageattr::attr_of(RW));
+    pageattr::set(session, 0x15000, P, pageattr::attr_of(R));
+    pageattr::set(session, 0x18000, 2 * P, pageattr::attr_of(RW));
+    const std::vector<pageattr::Range> expected = {
+        {0x10000, 4 * P, RX},
+        {0x14000, P, RW},
+        {0x15000, P, R},
+        {0x16000, 4 * P, RW},
+    };
+    CHECK(same(pageattr::ranges(), expected));
+    CHECK(session.calls.size() == 4);
+
+    // Overwriting the middle of one range and part of two others
+    pageattr::set(session, 0x11000, P, pageattr::attr_of(RWX));
+    pageattr::set(session, 0x13000, 3 * P, pageattr::attr_of(RW));
+    CHECK(same(pageattr::ranges(), {
+        {0x10000, P, RX},
+        {0x11000, P, RWX},
+        {0x12000, P, RX},
+        {0x13000, 7 * P, RW},
+    }));
+    pageattr::set(session, 0x15000, P, pageattr::attr_of(R));   // Back to the RELRO layout
+    pageattr::set(session, 0x13000, 2 * P, pageattr::attr_of(RX));
+    pageattr::set(session, 0x14000, P, pageattr::attr_of(RW));
+    pageattr::set(session, 0x11000, P, pageattr::attr_of(RX));
+    CHECK(same(pageattr::ranges(), expected));
+
+    serial::Writer w;
+    pageattr::save(w);
+    std::vector<uint8_t> blob = w.data();
+
+    // A freshly booted machine with permissions of its own
+    Memory booted;
+    pageattr::reset();
+    pageattr::set(booted, 0x10000, 8 * P, pageattr::attr_of(RX));
+    pageattr::set(booted, 0x40000, P, pageattr::attr_of(RWX));
+    booted.calls.clear();
+
+    serial::Reader r(blob.data(), blob.size());
+    std::vector<pageattr::Range> saved;
+    pageattr::read(r, saved);
+    CHECK(r.ok());
+    CHECK(same(saved, expected));
+    pageattr::apply(booted, saved);
+
+    const int def = pageattr::prot_of(riscv::PageAttributes{});
+    std::vector<std::tuple<uint64_t, uint64_t, int>> want = {
+        {0x10000, 8 * P, def},
+        {0x40000, P, def},
+    };
+    for (const auto& s : expected) want.emplace_back(s.addr, s.len, s.prot);
+    CHECK(booted.calls == want);
+    CHECK(same(pageattr::ranges(), expected));
+
+    // A truncated record fails the reader instead of applying half of it
+    serial::Reader cut(blob.data(), blob.size() - 3);
+    std::vector<pageattr::Range> partial;
+    pageattr::read(cut, partial);
+    CHECK(!cut.ok());
+
+    printf("page_attrs_test: ok\n");
+    return 0;
+}
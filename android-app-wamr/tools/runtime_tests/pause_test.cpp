@@ -0,0 +1,120 @@
+// pause_test.cpp - Guest pause of a background (copy-on-write) snapshot
+//
+// Times what the runtime holds the guest for around save_background(): the
+// runtime state capture (with a VFS delta) plus planning and
+// write-protecting a fully populated 512MB arena, and checks it against
+// snapshot::PAUSE_BUDGET_MS. The "guest" then rewrites every chunk while
+// the writer runs, so chunks are captured both by the writer and by the
+// fault handler, and the restored file must still hold the arena as it was
+// at the pause.
+//
+// Exits non-zero on the first failed check.
+
+#include "friscy/session.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint64_t ARENA_SIZE = 512ULL << 20;
+static constexpr size_t DELTA_FILES = 16;
+static constexpr size_t DELTA_FILE_SIZE = 64 * 1024;   // 1MB of VFS delta
+static constexpr size_t PAGE = 4096;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+static double ms_since(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+static uint8_t pattern(uint64_t chunk, uint8_t round) {
+    return static_cast<uint8_t>(chunk * 31 + round * 7 + 1);
+}
+
+// Touch every page of every chunk, so the arena is resident throughout.
+// Backwards, the guest meets the writer (which goes forwards) half way.
+static void fill(Machine& m, uint8_t round, bool backwards = false) {
+    const uint64_t chunks = ARENA_SIZE / snapshot::CHUNK_SIZE;
+    for (uint64_t i = 0; i < chunks; i++) {
+        uint64_t c = backwards ? chunks - 1 - i : i;
+        uint8_t v = pattern(c, round);
+        for (uint64_t off = 0; off < snapshot::CHUNK_SIZE; off += PAGE) {
+            m.memory.write<uint8_t>(c * snapshot::CHUNK_SIZE + off, v);
+        }
+    }
+}
+
+int main() {
+    char dir_template[] = "/tmp/pause_test.XXXXXX";
+    CHECK(::mkdtemp(dir_template) != nullptr);
+    const std::string path = std::string(dir_template) + "/bg.snap";
+
+    const std::vector<uint8_t> empty;
+    riscv::MachineOptions<riscv::RISCV64> options;
+    options.memory_max = ARENA_SIZE;
+    Machine m{empty, options};
+    CHECK(m.memory.memory_arena_size() == ARENA_SIZE);
+    fill(m, 0);
+
+    vfs::VirtualFS fs;
+    CHECK(fs.mkdir("/data", 0755) == 0);
+    fs.mark_base();
+    std::vector<uint8_t> content(DELTA_FILE_SIZE, 0x42);
+    for (size_t i = 0; i < DELTA_FILES; i++) {
+        int fd = fs.open("/data/file" + std::to_string(i), 0101);   // O_WRONLY | O_CREAT
+        CHECK(fd >= 0);
+        CHECK(fs.write(fd, content.data(), content.size()) == (ssize_t)content.size());
+        fs.close(fd);
+    }
+
+    // What save_snapshot() does between pause_execution() and resume
+    auto paused_at = Clock::now();
+    auto state = session::capture_state(0, fs, m);
+    double capture_ms = ms_since(paused_at);
+    CHECK(snapshot::save_background(m, path, snapshot::SaveMode::Full,
+                                    snapshot::Layout::Compressed, &state, paused_at));
+    double pause_ms = ms_since(paused_at);
+    printf("pause_test: paused %.2f ms (state capture %.2f ms) for a %llu MB arena\n",
+           pause_ms, capture_ms, (unsigned long long)(ARENA_SIZE >> 20));
+    CHECK(pause_ms <= snapshot::PAUSE_BUDGET_MS);
+
+    // The guest writes everywhere while the chunks are being written out
+    fill(m, 1, true);
+    snapshot::wait_background();
+    CHECK(snapshot::g_background_failures.load() == 0);
+    const auto& st = snapshot::g_last_save;
+    CHECK(st.background);
+    CHECK(st.pause_seconds * 1000.0 <= pause_ms);
+    printf("pause_test: %u chunks copied by the fault handler, written in %.1f ms\n",
+           st.cow_chunks, st.seconds * 1000.0);
+
+    // Every chunk is writable again, and the file is the arena at the pause
+    fill(m, 2);
+    Machine restored{empty, options};
+    CHECK(snapshot::restore(restored, path));
+    for (uint64_t c = 0; c < ARENA_SIZE / snapshot::CHUNK_SIZE; c++) {
+        for (uint64_t off = 0; off < snapshot::CHUNK_SIZE; off += PAGE) {
+            CHECK(restored.memory.read<uint8_t>(c * snapshot::CHUNK_SIZE + off) == pattern(c, 0));
+        }
+    }
+    std::vector<uint8_t> saved_state;
+    CHECK(snapshot::read_state(path, saved_state));
+    CHECK(saved_state.size() > DELTA_FILES * DELTA_FILE_SIZE);
+
+    snapshot::remove(path);
+    ::rmdir(dir_template);
+    printf("pause_test: ok\n");
+    return 0;
+}
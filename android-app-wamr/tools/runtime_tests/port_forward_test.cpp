@@ -0,0 +1,284 @@
+// port_forward_test.cpp - Host -> guest port forwarding over loopback
+//
+// Guest listeners are made through the network syscall handlers (as in
+// shaper_test), host clients are plain sockets on 127.0.0.1:
+//
+//   - A TCP forward reaches a guest TCP listener; data round-trips both
+//     ways through splice and the stats count it.
+//   - An AF_UNIX forward reaches a guest AF_UNIX listener; with splice
+//     refused (EINVAL) the relay falls back to recv/send and the stats
+//     count the bytes as copied.
+//   - Connections over max_connections are closed and counted as rejected,
+//     a forward with no guest listener as a connect failure.
+//   - A TCP forward whose guest port is the host port is refused (-EINVAL).
+//
+// Exits non-zero on the first failed check.
+
+#include "friscy/port_forward.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint64_t SCRATCH = 0x100000;      // Guest buffer
+static constexpr size_t PAYLOAD = 256 * 1024;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+static int64_t call(Machine& m, void (*handler)(Machine&),
+                    std::vector<uint64_t> args) {
+    for (size_t i = 0; i < args.size(); i++) m.cpu.reg(riscv::REG_ARG0 + i) = args[i];
+    handler(m);
+    return m.return_value<int64_t>();
+}
+
+static bool wait_readable(int fd, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, timeout_ms) == 1;
+}
+
+// A loopback port nothing listens on right now
+static uint16_t free_port() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct ::sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    CHECK(::getsockname(fd, (struct sockaddr*)&addr, &len) == 0);
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static int host_connect(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0);
+    struct ::sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+// Guest TCP listener on 127.0.0.1:<ephemeral>
+static int guest_tcp_listener(Machine& m, uint16_t& port) {
+    int fd = (int)call(m, net::sys_socket, {AF_INET, SOCK_STREAM, 0});
+    CHECK(fd >= net::NetworkContext::SOCKET_FD_BASE);
+    struct ::sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    m.memory.memcpy(SCRATCH, &addr, sizeof(addr));
+    CHECK(call(m, net::sys_bind, {(uint64_t)fd, SCRATCH, sizeof(addr)}) == 0);
+    CHECK(call(m, net::sys_listen, {(uint64_t)fd, 8}) == 0);
+
+    uint32_t len = sizeof(addr);
+    m.memory.memcpy(SCRATCH + 64, &len, sizeof(len));
+    CHECK(call(m, net::sys_getsockname, {(uint64_t)fd, SCRATCH, SCRATCH + 64}) == 0);
+    m.memory.memcpy_out(&addr, SCRATCH, sizeof(addr));
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int guest_unix_listener(Machine& m, const std::string& path) {
+    int fd = (int)call(m, net::sys_socket, {AF_UNIX, SOCK_STREAM, 0});
+    CHECK(fd >= net::NetworkContext::SOCKET_FD_BASE);
+    struct ::sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    m.memory.memcpy(SCRATCH, &addr, sizeof(addr));
+    CHECK(call(m, net::sys_bind, {(uint64_t)fd, SCRATCH, sizeof(addr)}) == 0);
+    CHECK(call(m, net::sys_listen, {(uint64_t)fd, 8}) == 0);
+    return fd;
+}
+
+// Accept the forwarded connection on the guest side; its native fd
+static int guest_accept(Machine& m, int listener, int& guest_fd) {
+    auto* lsock = net::get_network_ctx().get_socket(listener);
+    CHECK(wait_readable(lsock->native_fd, 2000));
+    guest_fd = (int)call(m, net::sys_accept4, {(uint64_t)listener, 0, 0, 0});
+    CHECK(guest_fd >= net::NetworkContext::SOCKET_FD_BASE);
+    return net::io_native_fd(guest_fd);
+}
+
+static void send_all(int fd, const std::vector<uint8_t>& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t w = ::send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        CHECK(w > 0);
+        off += w;
+    }
+}
+
+static std::vector<uint8_t> recv_n(int fd, size_t n) {
+    std::vector<uint8_t> out(n);
+    size_t got = 0;
+    while (got < n) {
+        CHECK(wait_readable(fd, 5000));
+        ssize_t r = ::recv(fd, out.data() + got, n - got, 0);
+        CHECK(r > 0);
+        got += r;
+    }
+    return out;
+}
+
+// `PAYLOAD` bytes each way between a host client and the guest end,
+// sent from a second thread so neither side's buffers have to hold it all
+static void round_trip(int client, int guest) {
+    std::vector<uint8_t> up(PAYLOAD), down(PAYLOAD);
+    for (size_t i = 0; i < PAYLOAD; i++) {
+        up[i] = static_cast<uint8_t>(i * 7 + 1);
+        down[i] = static_cast<uint8_t>(i * 13 + 5);
+    }
+    std::thread sender([&] {
+        send_all(client, up);
+        send_all(guest, down);
+    });
+    CHECK(recv_n(guest, PAYLOAD) == up);
+    CHECK(recv_n(client, PAYLOAD) == down);
+    sender.join();
+}
+
+// Counter `key` of the only forward in stats_json()
+static uint64_t stat(const char* key) {
+    std::string json = net::get_port_forwarder().stats_json();
+    std::string needle = std::string("\"") + key + "\":";
+    size_t at = json.find(needle);
+    CHECK(at != std::string::npos);
+    return strtoull(json.c_str() + at + needle.size(), nullptr, 10);
+}
+
+// The forwarder closes a connection it cannot relay: the client sees EOF
+static bool closed_by_forwarder(int client) {
+    if (!wait_readable(client, 2000)) return false;
+    char c;
+    return ::recv(client, &c, 1, 0) == 0;
+}
+
+static void wait_stat(const char* key, uint64_t want) {
+    auto start = Clock::now();
+    while (stat(key) != want) {
+        CHECK(Clock::now() - start < std::chrono::seconds(5));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+static void test_tcp_forward(Machine& m) {
+    auto& fwd = net::get_port_forwarder();
+    uint16_t guest_port = 0;
+    int listener = guest_tcp_listener(m, guest_port);
+
+    // The guest's own port would collide with the guest listener
+    CHECK(fwd.add(guest_port, guest_port, "", 2) == -EINVAL);
+
+    uint16_t host_port = free_port();
+    int id = fwd.add(host_port, guest_port, "", 2);
+    CHECK(id > 0);
+
+    int client = host_connect(host_port);
+    int guest_fd = -1;
+    int guest = guest_accept(m, listener, guest_fd);
+    round_trip(client, guest);
+    wait_stat("bytes_to_guest", PAYLOAD);
+    wait_stat("bytes_to_host", PAYLOAD);
+    wait_stat("splice_bytes", 2 * PAYLOAD);
+    wait_stat("copy_bytes", 0);
+
+    // Two connections are the limit: the third is accepted and closed
+    int second = host_connect(host_port);
+    int second_guest_fd = -1;
+    guest_accept(m, listener, second_guest_fd);
+    wait_stat("active", 2);
+    int third = host_connect(host_port);
+    CHECK(closed_by_forwarder(third));
+    CHECK(stat("rejected") == 1);
+    CHECK(stat("accepted") == 2);
+
+    // Closing one end frees the slot
+    ::close(client);
+    CHECK(net::get_network_ctx().close_socket(guest_fd) == 0);
+    wait_stat("active", 1);
+    int fourth = host_connect(host_port);
+    int fourth_guest_fd = -1;
+    guest_accept(m, listener, fourth_guest_fd);
+    wait_stat("accepted", 3);
+
+    for (int fd : {second, third, fourth}) ::close(fd);
+    for (int fd : {second_guest_fd, fourth_guest_fd, listener}) {
+        CHECK(net::get_network_ctx().close_socket(fd) == 0);
+    }
+
+    wait_stat("active", 0);
+
+    // No guest listener any more: a connect failure, not a hang
+    int orphan = host_connect(host_port);
+    CHECK(closed_by_forwarder(orphan));
+    CHECK(stat("connect_failures") == 1);
+    ::close(orphan);
+    CHECK(fwd.remove(id));
+}
+
+static ssize_t refuse_splice(int, loff_t*, int, loff_t*, size_t, unsigned int) {
+    errno = EINVAL;
+    return -1;
+}
+
+static void test_unix_forward_without_splice(Machine& m) {
+    auto& fwd = net::get_port_forwarder();
+    const std::string path = "/tmp/port_forward_test.sock";
+    int listener = guest_unix_listener(m, path);
+
+    net::PortForwarder::splice_fn = refuse_splice;
+    uint16_t host_port = free_port();
+    // The guest port does not matter for AF_UNIX targets
+    int id = fwd.add(host_port, host_port, path, 0);
+    CHECK(id > 0);
+
+    int client = host_connect(host_port);
+    int guest_fd = -1;
+    int guest = guest_accept(m, listener, guest_fd);
+    round_trip(client, guest);
+    wait_stat("bytes_to_guest", PAYLOAD);
+    wait_stat("bytes_to_host", PAYLOAD);
+    wait_stat("copy_bytes", 2 * PAYLOAD);
+    wait_stat("splice_bytes", 0);
+
+    // EOF carries through the fallback too
+    ::shutdown(client, SHUT_WR);
+    CHECK(wait_readable(guest, 2000));
+    char c;
+    CHECK(::recv(guest, &c, 1, 0) == 0);
+
+    ::close(client);
+    CHECK(net::get_network_ctx().close_socket(guest_fd) == 0);
+    CHECK(net::get_network_ctx().close_socket(listener) == 0);
+    CHECK(fwd.remove(id));
+    net::PortForwarder::splice_fn = ::splice;
+}
+
+int main() {
+    const std::vector<uint8_t> empty;
+    riscv::MachineOptions<riscv::RISCV64> options;
+    options.memory_max = 16ULL << 20;
+    Machine m{empty, options};
+
+    test_tcp_forward(m);
+    test_unix_forward_without_splice(m);
+
+    net::get_port_forwarder().remove_all();
+    printf("port_forward_test: ok\n");
+    return 0;
+}
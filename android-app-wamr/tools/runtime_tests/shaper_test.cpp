@@ -0,0 +1,327 @@
+// shaper_test.cpp - Traffic shaper behind the guest socket syscalls
+//
+// Drives the network syscall handlers directly (arguments in a0-a5 of an
+// empty machine, addresses in its arena) against real loopback sockets:
+//
+//   - accept4(SOCK_NONBLOCK) on a shaped connection returns a non-blocking
+//     guest socket: recv reports EAGAIN at once, data shows up after the
+//     configured latency.
+//   - The relay survives a non-blocking real socket whose send buffer
+//     fills up (it waits for POLLOUT instead of dropping the connection).
+//   - A non-blocking connect is shaped once it completes, and
+//     getpeername reports the real peer rather than the relay.
+//   - The same seeded transfer, run twice with the data split into
+//     different recv()/send() sizes, gets the same delay and stall for
+//     every segment in both directions.
+//
+// Exits non-zero on the first failed check.
+
+#include "friscy/network.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint64_t SCRATCH = 0x100000;      // Guest buffer
+static constexpr uint32_t LATENCY_MS = 150;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+static int64_t call(Machine& m, void (*handler)(Machine&),
+                    std::vector<uint64_t> args) {
+    for (size_t i = 0; i < args.size(); i++) m.cpu.reg(riscv::REG_ARG0 + i) = args[i];
+    handler(m);
+    return m.return_value<int64_t>();
+}
+
+static int64_t elapsed_ms(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - since).count();
+}
+
+// Guest socket listening on 127.0.0.1:<ephemeral>; returns its fd and port
+static int guest_listener(Machine& m, uint16_t& port) {
+    int fd = (int)call(m, net::sys_socket, {AF_INET, SOCK_STREAM, 0});
+    CHECK(fd >= net::NetworkContext::SOCKET_FD_BASE);
+
+    struct ::sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    m.memory.memcpy(SCRATCH, &addr, sizeof(addr));
+    CHECK(call(m, net::sys_bind, {(uint64_t)fd, SCRATCH, sizeof(addr)}) == 0);
+    CHECK(call(m, net::sys_listen, {(uint64_t)fd, 4}) == 0);
+
+    uint32_t len = sizeof(addr);
+    m.memory.memcpy(SCRATCH + 64, &len, sizeof(len));
+    CHECK(call(m, net::sys_getsockname, {(uint64_t)fd, SCRATCH, SCRATCH + 64}) == 0);
+    m.memory.memcpy_out(&addr, SCRATCH, sizeof(addr));
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Small receive buffer, so a non-reading client backs the sender up quickly
+static int host_connect(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0);
+    int rcvbuf = 64 * 1024;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct ::sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static bool wait_readable(int fd, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, timeout_ms) == 1;
+}
+
+static void test_nonblocking_accept(Machine& m) {
+    uint16_t port = 0;
+    int listener = guest_listener(m, port);
+    int client = host_connect(port);
+
+    // Wait for the connection to be queued, then accept it non-blocking
+    auto* lsock = net::get_network_ctx().get_socket(listener);
+    CHECK(wait_readable(lsock->native_fd, 1000));
+    int fd = (int)call(m, net::sys_accept4, {(uint64_t)listener, 0, 0, SOCK_NONBLOCK});
+    CHECK(fd >= net::NetworkContext::SOCKET_FD_BASE);
+
+    auto* sock = net::get_network_ctx().get_socket(fd);
+    CHECK(sock && sock->nonblocking);
+    CHECK(sock->shaped_fd >= 0);                                 // Behind the relay
+    CHECK(::fcntl(sock->native_fd, F_GETFL, 0) & O_NONBLOCK);    // Guest end too
+
+    // Nothing sent yet: EAGAIN, immediately
+    auto start = Clock::now();
+    CHECK(call(m, net::sys_recvfrom, {(uint64_t)fd, SCRATCH, 64, 0, 0, 0}) == -EAGAIN);
+    CHECK(elapsed_ms(start) < 50);
+
+    // Sent but still in flight: EAGAIN again, then the data after the latency
+    CHECK(::send(client, "ping", 4, 0) == 4);
+    start = Clock::now();
+    CHECK(call(m, net::sys_recvfrom, {(uint64_t)fd, SCRATCH, 64, 0, 0, 0}) == -EAGAIN);
+    CHECK(wait_readable(net::io_native_fd(fd), 2000));
+    CHECK(elapsed_ms(start) >= LATENCY_MS - 20);
+    CHECK(call(m, net::sys_recvfrom, {(uint64_t)fd, SCRATCH, 64, 0, 0, 0}) == 4);
+    char buf[4];
+    m.memory.memcpy_out(buf, SCRATCH, 4);
+    CHECK(std::string(buf, 4) == "ping");
+
+    // Fill every buffer on the way while the client is not reading; the
+    // relay must hold what it has and deliver all of it once it drains
+    const size_t total = 32 * net::TrafficShaper::MAX_QUEUED;
+    std::vector<uint8_t> chunk(64 * 1024, 0x5a);
+    m.memory.memcpy(SCRATCH, chunk.data(), chunk.size());
+    size_t sent = 0;
+    int64_t n;
+    auto send_some = [&] {
+        size_t len = std::min(chunk.size(), total - sent);
+        return call(m, net::sys_sendto, {(uint64_t)fd, SCRATCH, len, 0, 0, 0});
+    };
+    while (sent < total && (n = send_some()) > 0) sent += n;
+    CHECK(sent < total && n == -EAGAIN);
+
+    size_t received = 0;
+    std::thread reader([&] {
+        std::vector<uint8_t> in(64 * 1024);
+        while (received < total) {
+            ssize_t r = ::recv(client, in.data(), in.size(), 0);
+            if (r <= 0) break;
+            received += r;
+        }
+    });
+    start = Clock::now();
+    while (sent < total && elapsed_ms(start) < 20000) {
+        n = send_some();
+        if (n > 0) {
+            sent += n;
+        } else {
+            CHECK(n == -EAGAIN);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+    reader.join();
+    CHECK(sent == total);
+    CHECK(received == total);
+
+    ::close(client);
+    CHECK(net::get_network_ctx().close_socket(fd) == 0);
+    CHECK(net::get_network_ctx().close_socket(listener) == 0);
+}
+
+static void test_nonblocking_connect(Machine& m) {
+    int server = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct ::sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(::bind(server, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    CHECK(::listen(server, 4) == 0);
+    socklen_t alen = sizeof(addr);
+    CHECK(::getsockname(server, (struct sockaddr*)&addr, &alen) == 0);
+
+    int fd = (int)call(m, net::sys_socket, {AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0});
+    CHECK(fd >= net::NetworkContext::SOCKET_FD_BASE);
+    m.memory.memcpy(SCRATCH, &addr, sizeof(addr));
+    int64_t r = call(m, net::sys_connect, {(uint64_t)fd, SCRATCH, sizeof(addr)});
+    CHECK(r == 0 || r == -EINPROGRESS);
+
+    // Poll the guest's view until writable, as an event loop would
+    auto start = Clock::now();
+    for (;;) {
+        struct pollfd pfd = {net::io_native_fd(fd), POLLOUT, 0};
+        if (::poll(&pfd, 1, 10) == 1) break;
+        CHECK(elapsed_ms(start) < 2000);
+    }
+    auto* sock = net::get_network_ctx().get_socket(fd);
+    CHECK(sock->connected && !sock->shape_pending);
+    CHECK(sock->shaped_fd >= 0);
+
+    // SO_ERROR and the peer come from the real socket
+    uint32_t len = 4;
+    m.memory.memcpy(SCRATCH + 64, &len, sizeof(len));
+    CHECK(call(m, net::sys_getsockopt, {(uint64_t)fd, SOL_SOCKET, SO_ERROR, SCRATCH, SCRATCH + 64}) == 0);
+    int32_t error = -1;
+    m.memory.memcpy_out(&error, SCRATCH, sizeof(error));
+    CHECK(error == 0);
+
+    len = sizeof(struct ::sockaddr_in);
+    m.memory.memcpy(SCRATCH + 64, &len, sizeof(len));
+    CHECK(call(m, net::sys_getpeername, {(uint64_t)fd, SCRATCH, SCRATCH + 64}) == 0);
+    struct ::sockaddr_in peer{};
+    m.memory.memcpy_out(&peer, SCRATCH, sizeof(peer));
+    CHECK(peer.sin_port == addr.sin_port);
+
+    CHECK(net::get_network_ctx().close_socket(fd) == 0);
+    ::close(server);
+}
+
+using Decision = std::tuple<bool, uint64_t, int64_t, bool>;   // up, segment, delay, lost
+
+static std::mutex g_decisions_mutex;
+static std::vector<Decision> g_decisions;
+
+static void record_decision(const net::SegmentDecision& d) {
+    std::lock_guard<std::mutex> lock(g_decisions_mutex);
+    g_decisions.emplace_back(d.up, d.segment, d.delay_ms, d.lost);
+}
+
+// Move `total` bytes each way through one shaped connection, in writes of
+// `piece` bytes, and return the draws sorted by direction and segment
+static std::vector<Decision> seeded_transfer(Machine& m, uint64_t seed, size_t total,
+                                             size_t piece) {
+    {
+        std::lock_guard<std::mutex> lock(g_decisions_mutex);
+        g_decisions.clear();
+    }
+    net::get_traffic_shaper().set_seed(seed);
+
+    uint16_t port = 0;
+    int listener = guest_listener(m, port);
+    int client = host_connect(port);
+    auto* lsock = net::get_network_ctx().get_socket(listener);
+    CHECK(wait_readable(lsock->native_fd, 1000));
+    int fd = (int)call(m, net::sys_accept4, {(uint64_t)listener, 0, 0, 0});
+    CHECK(fd >= net::NetworkContext::SOCKET_FD_BASE);
+    CHECK(net::get_network_ctx().get_socket(fd)->shaped_fd >= 0);
+    int guest = net::io_native_fd(fd);
+
+    // Both directions at once, so the lanes' draws interleave
+    auto pump = [total, piece](int from, int to) {
+        std::vector<uint8_t> out(piece, 0x33), in(64 * 1024);
+        size_t sent = 0, received = 0;
+        while (received < total) {
+            if (sent < total) {
+                ssize_t w = ::send(from, out.data(), std::min(piece, total - sent),
+                                   MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (w > 0) sent += w;
+            }
+            if (!wait_readable(to, 5)) continue;
+            ssize_t r = ::recv(to, in.data(), in.size(), MSG_DONTWAIT);
+            if (r > 0) received += r;
+        }
+    };
+    std::thread down([&] { pump(client, guest); });
+    pump(guest, client);
+    down.join();
+
+    ::close(client);
+    CHECK(net::get_network_ctx().close_socket(fd) == 0);
+    CHECK(net::get_network_ctx().close_socket(listener) == 0);
+
+    std::lock_guard<std::mutex> lock(g_decisions_mutex);
+    std::vector<Decision> out = g_decisions;
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static void test_seeded_determinism(Machine& m) {
+    auto& shaper = net::get_traffic_shaper();
+    shaper.clear();
+    net::ShapingProfile profile;
+    profile.latency_ms = 2;
+    profile.jitter_ms = 2;
+    profile.loss = 0.2;
+    CHECK(shaper.add_rule("127.0.0.1", profile));
+    shaper.set_segment_hook(record_decision);
+
+    const size_t segments = 12;
+    const size_t total = segments * net::TrafficShaper::CHUNK;
+    auto first = seeded_transfer(m, 42, total, 1000);
+    auto second = seeded_transfer(m, 42, total, 7000);
+    auto other = seeded_transfer(m, 43, total, 7000);
+    shaper.set_segment_hook(nullptr);
+
+    CHECK(first.size() == 2 * segments);
+    CHECK(first == second);
+    CHECK(first != other);
+    size_t lost = 0;
+    int64_t lo = INT64_MAX, hi = 0;
+    for (const auto& [up, segment, delay, stalled] : first) {
+        lost += stalled;
+        if (!stalled) {
+            lo = std::min(lo, delay);
+            hi = std::max(hi, delay);
+        }
+    }
+    printf("shaper_test: seed 42 stalled %zu of %zu segments, delays %lld..%lld ms\n",
+           lost, first.size(), (long long)lo, (long long)hi);
+    CHECK(lost > 0 && lost < first.size());
+    CHECK(lo < hi);
+}
+
+int main() {
+    const std::vector<uint8_t> empty;
+    riscv::MachineOptions<riscv::RISCV64> options;
+    options.memory_max = 16ULL << 20;
+    Machine m{empty, options};
+
+    net::ShapingProfile profile;
+    profile.latency_ms = LATENCY_MS;
+    CHECK(net::get_traffic_shaper().add_rule("127.0.0.1", profile));
+
+    test_nonblocking_accept(m);
+    test_nonblocking_connect(m);
+    test_seeded_determinism(m);
+
+    net::get_traffic_shaper().shutdown_all();
+    printf("shaper_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,131 @@
+// snapshot_check_test.cpp - Snapshot integrity checks around a lazy restore
+//
+//   - A Mappable restore does not read the mapped chunks: it returns before
+//     any of them is checked, and the background check then reports a
+//     corrupt one through g_on_mapped_corrupt.
+//   - A clean file restores without the hook firing.
+//   - A v2 file whose FLAG_CHECKSUMS bit was cleared is refused outright.
+//
+// Prints restore times of the lazy restore next to the time a full
+// checksum pass over the same file takes, which is what restore cost when
+// it checked mapped chunks inline. Exits non-zero on the first failed
+// check.
+
+#include "friscy/session.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Machine = riscv::Machine<riscv::RISCV64>;
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint64_t ARENA_SIZE = 256ULL << 20;
+static constexpr size_t PAGE = 4096;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+static double ms_since(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+static std::atomic<int> g_corrupt_reports{0};
+
+static void on_corrupt(const std::string&) {
+    g_corrupt_reports.fetch_add(1);
+}
+
+static void wait_check() {
+    auto start = Clock::now();
+    while (snapshot::mapped_check_pending()) {
+        CHECK(ms_since(start) < 20000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+static void flip_byte(const std::string& path, uint64_t offset) {
+    int fd = ::open(path.c_str(), O_RDWR);
+    CHECK(fd >= 0);
+    uint8_t b = 0;
+    CHECK(::pread(fd, &b, 1, offset) == 1);
+    b ^= 0xff;
+    CHECK(::pwrite(fd, &b, 1, offset) == 1);
+    ::close(fd);
+}
+
+int main() {
+    char dir_template[] = "/tmp/snapshot_check_test.XXXXXX";
+    CHECK(::mkdtemp(dir_template) != nullptr);
+    const std::string path = std::string(dir_template) + "/lazy.snap";
+    snapshot::g_on_mapped_corrupt = on_corrupt;
+
+    const std::vector<uint8_t> empty;
+    riscv::MachineOptions<riscv::RISCV64> options;
+    options.memory_max = ARENA_SIZE;
+    {
+        Machine m{empty, options};
+        for (uint64_t a = 0; a < ARENA_SIZE; a += PAGE) m.memory.write<uint64_t>(a, a * 31 + 1);
+        CHECK(snapshot::save(m, path, snapshot::SaveMode::Full, snapshot::Layout::Mappable));
+    }
+
+    // Clean file: restored by mapping, checked afterwards, nothing reported
+    Machine clean{empty, options};
+    auto start = Clock::now();
+    CHECK(snapshot::restore(clean, path));
+    double lazy_ms = ms_since(start);
+    const auto& st = snapshot::g_last_restore;
+    CHECK(st.chunks_mapped == ARENA_SIZE / snapshot::CHUNK_SIZE);
+    CHECK(st.chunks_verified == 0);
+    CHECK(clean.memory.read<uint64_t>(PAGE * 100) == PAGE * 100 * 31 + 1);
+    start = Clock::now();
+    wait_check();
+    double check_ms = ms_since(start);
+    CHECK(g_corrupt_reports.load() == 0);
+
+    start = Clock::now();
+    CHECK(snapshot::verify(path));
+    double inline_ms = ms_since(start);
+    printf("snapshot_check_test: %llu MB lazy restore %.2f ms, background check %.1f ms "
+           "more, full checksum pass %.1f ms\n",
+           (unsigned long long)(ARENA_SIZE >> 20), lazy_ms, check_ms, inline_ms);
+
+    // A corrupt mapped chunk: restore still maps, the check reports it
+    snapshot::SnapshotFile f;
+    CHECK(snapshot::open_v2(path, f));
+    flip_byte(path, f.index[f.index.size() / 2].file_offset + 100);
+    Machine corrupt{empty, options};
+    CHECK(snapshot::restore(corrupt, path));
+    wait_check();
+    CHECK(g_corrupt_reports.load() == 1);
+    CHECK(snapshot::g_mapped_failures.load() == 1);
+    CHECK(!snapshot::verify(path));
+
+    // A cleared FLAG_CHECKSUMS must not switch the checks off
+    flip_byte(path, f.index[f.index.size() / 2].file_offset + 100);   // Repair
+    uint32_t flags = 0;
+    CHECK(::pread(f.fd, &flags, sizeof(flags), offsetof(snapshot::FileHeader, flags)) == 4);
+    int fd = ::open(path.c_str(), O_RDWR);
+    flags &= ~snapshot::FLAG_CHECKSUMS;
+    CHECK(::pwrite(fd, &flags, sizeof(flags), offsetof(snapshot::FileHeader, flags)) == 4);
+    ::close(fd);
+    Machine unchecked{empty, options};
+    CHECK(!snapshot::restore(unchecked, path));
+    CHECK(!snapshot::verify(path));
+
+    snapshot::cancel_mapped_check();
+    snapshot::g_on_mapped_corrupt = nullptr;
+    ::unlink(path.c_str());
+    ::rmdir(dir_template);
+    printf("snapshot_check_test: ok\n");
+    return 0;
+}
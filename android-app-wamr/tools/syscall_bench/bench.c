@@ -0,0 +1,87 @@
+// bench.c - Guest syscall overhead, C side (see bench.go for the Go side)
+//
+// Built statically for riscv64 and booted by tools/boot_snapshot through
+// scripts/run_syscall_bench.sh. Both programs time the same loops and
+// print one line per loop in the same format, then wait on stdin, which
+// is where boot_snapshot stops:
+//
+//   getpid        raw syscall round trip
+//   clock_gettime what a timer read costs without a vDSO
+//   sched_yield   the scheduler path with a single runnable thread
+//   write         1 byte to /dev/null through the VFS
+//   getpid/spin   getpid while a second thread spins without syscalls, so
+//                 every switch to it costs a TIME_SLICE
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char* name, uint64_t ns, int ops) {
+    printf("syscall_bench: c %-13s %8.0f ns/op (%d ops)\n", name, (double)ns / ops, ops);
+    fflush(stdout);
+}
+
+static atomic_int g_stop;
+
+static void* spin(void* arg) {
+    (void)arg;
+    volatile uint64_t n = 0;
+    while (!atomic_load_explicit(&g_stop, memory_order_relaxed)) n++;
+    return NULL;
+}
+
+int main(void) {
+    const int ops = 200000;
+    uint64_t t0;
+
+    t0 = now_ns();
+    for (int i = 0; i < ops; i++) syscall(SYS_getpid);
+    report("getpid", now_ns() - t0, ops);
+
+    struct timespec ts;
+    t0 = now_ns();
+    for (int i = 0; i < ops; i++) syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+    report("clock_gettime", now_ns() - t0, ops);
+
+    t0 = now_ns();
+    for (int i = 0; i < ops; i++) sched_yield();
+    report("sched_yield", now_ns() - t0, ops);
+
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        char c = 'x';
+        t0 = now_ns();
+        for (int i = 0; i < ops; i++) write(fd, &c, 1);
+        report("write", now_ns() - t0, ops);
+        close(fd);
+    }
+
+    pthread_t spinner;
+    if (pthread_create(&spinner, NULL, spin, NULL) == 0) {
+        const int spin_ops = ops / 10;
+        t0 = now_ns();
+        for (int i = 0; i < spin_ops; i++) syscall(SYS_getpid);
+        report("getpid/spin", now_ns() - t0, spin_ops);
+        atomic_store(&g_stop, 1);
+        pthread_join(spinner, NULL);
+    }
+
+    printf("syscall_bench: done\n");
+    fflush(stdout);
+    char line[64];
+    read(0, line, sizeof(line));
+    return 0;
+}
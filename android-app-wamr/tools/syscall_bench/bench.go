@@ -0,0 +1,90 @@
+// bench.go - Guest syscall overhead, Go side (see bench.c)
+//
+// Same loops and output as bench.c. Go adds its own cost around every
+// syscall.Syscall (entersyscall/exitsyscall) and, unlike C, sizes its
+// scheduler from the CPU count the guest reports (GUEST_CPUS), so the
+// first lines show what the runtime sees. "getpid/raw" skips the
+// scheduler hooks (RawSyscall), which isolates the emulator's share.
+//
+// Build: CGO_ENABLED=0 GOOS=linux GOARCH=riscv64 go build -o bench-go bench.go
+package main
+
+import (
+	"fmt"
+	"os"
+	"runtime"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+func report(name string, d time.Duration, ops int) {
+	fmt.Printf("syscall_bench: go %-13s %8.0f ns/op (%d ops)\n", name,
+		float64(d.Nanoseconds())/float64(ops), ops)
+}
+
+func main() {
+	const ops = 200000
+	fmt.Printf("syscall_bench: go NumCPU %d GOMAXPROCS %d\n", runtime.NumCPU(), runtime.GOMAXPROCS(0))
+
+	t0 := time.Now()
+	for i := 0; i < ops; i++ {
+		syscall.Syscall(syscall.SYS_GETPID, 0, 0, 0)
+	}
+	report("getpid", time.Since(t0), ops)
+
+	t0 = time.Now()
+	for i := 0; i < ops; i++ {
+		syscall.RawSyscall(syscall.SYS_GETPID, 0, 0, 0)
+	}
+	report("getpid/raw", time.Since(t0), ops)
+
+	var ts syscall.Timespec
+	t0 = time.Now()
+	for i := 0; i < ops; i++ {
+		syscall.Syscall(syscall.SYS_CLOCK_GETTIME, 1, uintptr(unsafe.Pointer(&ts)), 0)
+	}
+	report("clock_gettime", time.Since(t0), ops)
+
+	t0 = time.Now()
+	for i := 0; i < ops; i++ {
+		syscall.Syscall(syscall.SYS_SCHED_YIELD, 0, 0, 0)
+	}
+	report("sched_yield", time.Since(t0), ops)
+
+	if f, err := os.OpenFile("/dev/null", os.O_WRONLY, 0); err == nil {
+		b := []byte{'x'}
+		fd := int(f.Fd())
+		t0 = time.Now()
+		for i := 0; i < ops; i++ {
+			syscall.Write(fd, b)
+		}
+		report("write", time.Since(t0), ops)
+		f.Close()
+	}
+
+	// A goroutine that never makes a syscall: with GOMAXPROCS=1 it only
+	// gets off the P through sysmon's preemption signal
+	var stop atomic.Bool
+	done := make(chan struct{})
+	go func() {
+		n := 0
+		for !stop.Load() {
+			n++
+		}
+		close(done)
+	}()
+	const spinOps = ops / 10
+	t0 = time.Now()
+	for i := 0; i < spinOps; i++ {
+		syscall.Syscall(syscall.SYS_GETPID, 0, 0, 0)
+	}
+	report("getpid/spin", time.Since(t0), spinOps)
+	stop.Store(true)
+	<-done
+
+	fmt.Println("syscall_bench: done")
+	line := make([]byte, 64)
+	os.Stdin.Read(line)
+}
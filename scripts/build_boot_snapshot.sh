@@ -0,0 +1,29 @@
+#!/bin/bash
+# Build the boot-to-prompt snapshot shipped in the APK.
+#
+# Boots the bundled rootfs.tar headlessly on this (Linux) host with the
+# same runtime headers as the app, stops at the first shell prompt, and
+# writes app/src/main/assets/templates/<image>.<digest>.snap(.out). The
+# app installs it as the image's template on first launch; a snapshot
+# whose digest does not match the bundled tar is simply never used.
+#
+# Usage: scripts/build_boot_snapshot.sh [image-id] [entry] [ready-marker]
+set -e
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+APP="$ROOT/android-app-wamr"
+IMAGE_ID="${1:-alpine-base}"
+ENTRY="${2:-/bin/sh}"
+MARKER="${3:-}"
+ROOTFS="$APP/app/src/main/assets/rootfs.tar"
+OUT_DIR="$APP/app/src/main/assets/templates"
+BUILD_DIR="$ROOT/build/boot_snapshot"
+
+cmake -S "$APP/tools/boot_snapshot" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$BUILD_DIR" -j"$(nproc)"
+
+mkdir -p "$OUT_DIR"
+# Replace earlier snapshots of this image (their digest may be stale)
+rm -f "$OUT_DIR/$IMAGE_ID".*.snap "$OUT_DIR/$IMAGE_ID".*.snap.out
+
+"$BUILD_DIR/boot_snapshot" "$ROOTFS" "$ENTRY" "$OUT_DIR" "$IMAGE_ID" "$MARKER"
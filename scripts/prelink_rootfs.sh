@@ -0,0 +1,22 @@
+#!/bin/bash
+# Prelink the bundled rootfs: give each shared library its own load base.
+#
+# Runs tools/prelink on app/src/main/assets/rootfs.tar (in place, or on
+# the tar given) and appends the manifest at /etc/friscy/prelink.map. The
+# runtime then keeps library code in place across execs instead of
+# copying it in again for every process. Run it before
+# build_boot_snapshot.sh: the snapshot is tied to the tar's digest.
+#
+# Usage: scripts/prelink_rootfs.sh [rootfs.tar]
+set -e
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+APP="$ROOT/android-app-wamr"
+ROOTFS="${1:-$APP/app/src/main/assets/rootfs.tar}"
+BUILD_DIR="$ROOT/build/prelink"
+
+cmake -S "$APP/tools/prelink" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$BUILD_DIR" -j"$(nproc)"
+
+"$BUILD_DIR/prelink" "$ROOTFS" "$ROOTFS.prelinked"
+mv "$ROOTFS.prelinked" "$ROOTFS"
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Compare guest syscall overhead of a static Go and a static C program.
+#
+# Builds tools/syscall_bench/bench.{c,go} as static riscv64 binaries,
+# packs them into a throwaway rootfs tar, and boots each one headlessly
+# with tools/boot_snapshot (the same runtime headers and libriscv
+# configuration as the app). Each program prints one ns/op line per loop
+# and then waits on stdin, which is where boot_snapshot stops; the lines
+# are collected from its output. Useful before changing TIME_SLICE or
+# GUEST_CPUS (friscy/syscalls.hpp).
+#
+# Needs Go and a static-capable riscv64 C compiler (musl or glibc):
+#   CC=riscv64-linux-musl-gcc scripts/run_syscall_bench.sh
+#
+# Usage: scripts/run_syscall_bench.sh
+set -e
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+APP="$ROOT/android-app-wamr"
+SRC="$APP/tools/syscall_bench"
+BUILD_DIR="$ROOT/build/boot_snapshot"
+CC="${CC:-riscv64-linux-gnu-gcc}"
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+mkdir -p "$WORK/rootfs/bin" "$WORK/out"
+
+"$CC" -static -O2 -pthread -o "$WORK/rootfs/bin/bench-c" "$SRC/bench.c"
+(cd "$SRC" && CGO_ENABLED=0 GOOS=linux GOARCH=riscv64 \
+    go build -trimpath -o "$WORK/rootfs/bin/bench-go" bench.go)
+tar -C "$WORK/rootfs" -cf "$WORK/bench.tar" bin
+
+cmake -S "$APP/tools/boot_snapshot" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$BUILD_DIR" -j"$(nproc)"
+
+for prog in bench-c bench-go; do
+    "$BUILD_DIR/boot_snapshot" "$WORK/bench.tar" "/bin/$prog" "$WORK/out" "$prog" \
+        "syscall_bench: done" 2>&1 | grep '^syscall_bench: [a-z]' | grep -v ': done$'
+done